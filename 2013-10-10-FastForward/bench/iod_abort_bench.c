@@ -0,0 +1,255 @@
+/*
+ * iod_abort_bench: cost of finishing a TID by the number of objects it
+ * touched.
+ *
+ * -n blob objects are created and kept open. For each object count, from
+ * 16 up to -n by fours, -r TIDs write -s bytes to that many objects with
+ * iod_blob_write_list, and are then finished, alternately aborted and
+ * committed. Only the finish is timed. A third TID also creates as many
+ * objects as it writes before it is aborted, as rolling a creation back
+ * removes the object too.
+ *
+ * usage: iod_abort_bench [-n objects] [-r reps] [-s size] [-b bb_root]
+ *                        [-c central_root]
+ */
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "iod_api.h"
+
+#define BENCH_CONT	"/iod_abort_bench"
+
+static iod_handle_t	coh;
+static iod_handle_t	*oh;
+static iod_obj_id_t	*oid;
+static unsigned long	nobj = 262144;
+static int		reps = 4;
+static size_t		size = 64;
+
+static double
+now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * one TID writing the first n objects, and creating n more with create; the
+ * time its finish took, or a negative value
+ */
+static double
+run_tid(unsigned long n, int create, int abort, char *buf)
+{
+	iod_obj_create_t	*oc = NULL;
+	iod_obj_id_t		*noid = NULL;
+	iod_blob_iodesc_t	*io;
+	iod_mem_desc_t		*md;
+	iod_blob_io_t		*bw;
+	iod_trans_id_t		tid = IOD_TID_UNKNOWN;
+	unsigned long		i;
+	double			t = -1;
+	double			t0;
+	int			rc;
+
+	bw = calloc(n, sizeof(*bw));
+	md = malloc(sizeof(*md) + sizeof(md->frag[0]));
+	io = malloc(n * (sizeof(*io) + sizeof(io->frag[0])));
+	if (create) {
+		oc = calloc(n, sizeof(*oc));
+		noid = calloc(n, sizeof(*noid));
+	}
+	if (bw == NULL || md == NULL || io == NULL ||
+	    (create && (oc == NULL || noid == NULL)))
+		goto out;
+	md->nfrag = 1;
+	md->frag[0].addr = buf;
+	md->frag[0].len = size;
+	for (i = 0; i < n; i++) {
+		bw[i].oh = oh[i];
+		bw[i].mem_desc = md;
+		bw[i].io_desc = (iod_blob_iodesc_t *)((char *)io + i *
+				(sizeof(*io) + sizeof(io->frag[0])));
+		bw[i].io_desc->nfrag = 1;
+		bw[i].io_desc->frag[0].offset = 0;
+		bw[i].io_desc->frag[0].len = size;
+	}
+	for (i = 0; create && i < n; i++) {
+		oc[i].type = IOD_OBJ_BLOB;
+		oc[i].oid = &noid[i];
+	}
+
+	rc = iod_trans_start(coh, &tid, NULL, 0, IOD_TRANS_WR, NULL);
+	if (rc == 0)
+		rc = iod_blob_write_list(coh, tid, n, bw, NULL);
+	if (rc == 0 && create)
+		rc = iod_obj_create_list(coh, tid, n, oc, NULL);
+	t0 = now();
+	if (rc == 0)
+		rc = iod_trans_finish(coh, tid, NULL, abort ?
+				      IOD_TRANS_ABORT_SINGLE : 0, NULL);
+	if (rc == 0)
+		t = now() - t0;
+out:
+	free(noid);
+	free(oc);
+	free(io);
+	free(md);
+	free(bw);
+	return t;
+}
+
+static int
+setup(void)
+{
+	iod_obj_create_t	*oc;
+	iod_obj_open_t		*op;
+	iod_trans_id_t		tid = IOD_TID_UNKNOWN;
+	unsigned long		i;
+	int			rc = -1;
+
+	oc = calloc(nobj, sizeof(*oc));
+	op = calloc(nobj, sizeof(*op));
+	oh = calloc(nobj, sizeof(*oh));
+	oid = calloc(nobj, sizeof(*oid));
+	if (oc == NULL || op == NULL || oh == NULL || oid == NULL)
+		goto out;
+	for (i = 0; i < nobj; i++) {
+		oc[i].type = IOD_OBJ_BLOB;
+		oc[i].oid = &oid[i];
+		op[i].oh = &oh[i];
+	}
+	rc = iod_trans_start(coh, &tid, NULL, 0, IOD_TRANS_WR, NULL);
+	if (rc == 0)
+		rc = iod_obj_create_list(coh, tid, nobj, oc, NULL);
+	for (i = 0; i < nobj; i++)
+		op[i].oid = oid[i];
+	if (rc == 0)
+		rc = iod_obj_open_write_list(coh, nobj, op, NULL);
+	if (rc == 0)
+		rc = iod_trans_finish(coh, tid, NULL, 0, NULL);
+out:
+	free(op);
+	free(oc);
+	return rc;
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-n objects] [-r reps] [-s size] "
+		"[-b bb_root] [-c central_root]\n", prog);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	iod_hint_list_t	*hints;
+	const char	*bb_root = NULL;
+	const char	*central_root = NULL;
+	unsigned long	n;
+	double		ta;
+	double		tc;
+	double		tx;
+	double		t;
+	char		*buf;
+	int		nhint = 0;
+	int		opt;
+	int		rc;
+	int		i;
+
+	while ((opt = getopt(argc, argv, "n:r:s:b:c:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			nobj = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			reps = atoi(optarg);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			bb_root = optarg;
+			break;
+		case 'c':
+			central_root = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nobj < 16 || reps <= 0 || size == 0)
+		usage(argv[0]);
+
+	hints = calloc(1, sizeof(*hints) + 2 * sizeof(hints->hint[0]));
+	buf = malloc(size);
+	if (hints == NULL || buf == NULL)
+		return 1;
+	memset(buf, 'a', size);
+	if (bb_root != NULL) {
+		hints->hint[nhint].key = "iod.bb_root";
+		hints->hint[nhint++].value = bb_root;
+	}
+	if (central_root != NULL) {
+		hints->hint[nhint].key = "iod.central_root";
+		hints->hint[nhint++].value = central_root;
+	}
+	hints->num_hint = nhint;
+
+	rc = iod_initialize(MPI_COMM_WORLD, hints, 1, 1, NULL);
+	if (rc == 0)
+		rc = iod_container_open(BENCH_CONT, NULL,
+					IOD_CONT_RW | IOD_CONT_CREATE, &coh,
+					NULL);
+	if (rc == 0)
+		rc = setup();
+	if (rc != 0) {
+		fprintf(stderr, "setup failed: %d\n", rc);
+		return 1;
+	}
+
+	printf("%-9s  %12s  %12s  %12s\n", "objects", "abort us",
+	       "commit us", "abort+new us");
+	for (n = 16; n <= nobj && rc == 0; n *= 4) {
+		ta = tc = tx = 0;
+		for (i = 0; i < reps && rc == 0; i++) {
+			t = run_tid(n, 0, 1, buf);
+			ta += t;
+			if (t < 0)
+				rc = -1;
+			t = run_tid(n, 0, 0, buf);
+			tc += t;
+			if (t < 0)
+				rc = -1;
+			t = run_tid(n, 1, 1, buf);
+			tx += t;
+			if (t < 0)
+				rc = -1;
+		}
+		if (rc == 0)
+			printf("%-9lu  %12.1f  %12.1f  %12.1f\n", n,
+			       ta / reps * 1e6, tc / reps * 1e6,
+			       tx / reps * 1e6);
+	}
+	if (rc != 0)
+		fprintf(stderr, "abort run failed\n");
+
+	for (n = 0; n < nobj; n++)
+		iod_obj_close(oh[n], NULL, NULL);
+	iod_container_close(coh, NULL, NULL);
+	iod_container_unlink(BENCH_CONT, 1, NULL);
+	iod_finalize(NULL, NULL);
+	free(oid);
+	free(oh);
+	free(buf);
+	free(hints);
+	return rc == 0 ? 0 : 1;
+}
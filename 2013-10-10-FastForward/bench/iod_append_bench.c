@@ -0,0 +1,280 @@
+/*
+ * iod_append_bench: concurrent appends to the first dimension of one array.
+ *
+ * A 2-D array of ints, -w wide, with an unlimited first dimension is created
+ * empty. -t threads then each append -r rows in one TID, -k rows at a time,
+ * with iod_array_reserve to claim the rows and iod_array_write to fill them.
+ * The run is timed with one thread and again with -t, over separate arrays;
+ * the rows are read back and checked after each run.
+ *
+ * usage: iod_append_bench [-t threads] [-r rows] [-k rows_per_append]
+ *                         [-w width] [-b bb_root] [-c central_root]
+ */
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "iod_api.h"
+
+#define BENCH_CONT	"/iod_append_bench"
+
+static iod_handle_t	coh;
+static iod_handle_t	oh;
+static iod_trans_id_t	tid;
+static unsigned long	nthread = 8;
+static unsigned long	nrow = 20000;
+static unsigned long	per_app = 4;
+static unsigned long	width = 64;
+
+static double
+now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* every cell holds its row number */
+static void
+fill(int *buf, iod_size_t start, unsigned long rows)
+{
+	unsigned long	i;
+
+	for (i = 0; i < rows * width; i++)
+		buf[i] = (int)(start + i / width);
+}
+
+static void *
+appender(void *arg)
+{
+	iod_mem_desc_t	*md;
+	iod_hyperslab_t	hs;
+	iod_size_t	st[2];
+	iod_size_t	cnt[2];
+	iod_size_t	start;
+	unsigned long	done;
+	unsigned long	n;
+	long		rc = 0;
+	int		*buf;
+
+	(void)arg;
+	buf = malloc(per_app * width * sizeof(*buf));
+	md = malloc(sizeof(*md) + sizeof(md->frag[0]));
+	if (buf == NULL || md == NULL) {
+		rc = -1;
+		goto out;
+	}
+	hs.start = st;
+	hs.count = cnt;
+	hs.stride = NULL;
+	hs.block = NULL;
+	md->nfrag = 1;
+	md->frag[0].addr = buf;
+	for (done = 0; done < nrow && rc == 0; done += n) {
+		n = nrow - done < per_app ? nrow - done : per_app;
+		rc = iod_array_reserve(oh, tid, n, &start, NULL);
+		if (rc != 0)
+			break;
+		fill(buf, start, n);
+		st[0] = start;
+		st[1] = 0;
+		cnt[0] = n;
+		cnt[1] = width;
+		md->frag[0].len = n * width * sizeof(*buf);
+		rc = iod_array_write(oh, tid, NULL, md, &hs, NULL, NULL);
+	}
+out:
+	free(md);
+	free(buf);
+	return (void *)rc;
+}
+
+/* every row of the array is there, once */
+static int
+check(unsigned long rows)
+{
+	iod_array_struct_t	as = { 0 };
+	iod_mem_desc_t		*md;
+	iod_hyperslab_t		hs;
+	iod_size_t		cur[2];
+	iod_size_t		st[2] = { 0, 0 };
+	iod_size_t		cnt[2];
+	unsigned long		i;
+	int			*buf;
+	int			rc;
+
+	as.current_dims = cur;
+	rc = iod_array_get_struct(oh, tid, &as, NULL);
+	if (rc != 0 || cur[0] != rows)
+		return rc != 0 ? rc : -1;
+	buf = malloc(rows * width * sizeof(*buf));
+	md = malloc(sizeof(*md) + sizeof(md->frag[0]));
+	if (buf == NULL || md == NULL) {
+		rc = -1;
+		goto out;
+	}
+	cnt[0] = rows;
+	cnt[1] = width;
+	hs.start = st;
+	hs.count = cnt;
+	hs.stride = NULL;
+	hs.block = NULL;
+	md->nfrag = 1;
+	md->frag[0].addr = buf;
+	md->frag[0].len = rows * width * sizeof(*buf);
+	rc = iod_array_read(oh, tid, NULL, md, &hs, NULL, NULL);
+	for (i = 0; i < rows * width && rc == 0; i++)
+		if (buf[i] != (int)(i / width))
+			rc = -1;
+out:
+	free(md);
+	free(buf);
+	return rc;
+}
+
+static int
+run(unsigned long threads, double *t)
+{
+	iod_array_struct_t	as = { 0 };
+	iod_obj_id_t		oid;
+	pthread_t		*th;
+	iod_size_t		dims[2] = { 0, width };
+	unsigned long		i;
+	void			*ret;
+	double			t0;
+	int			rc;
+
+	th = calloc(threads, sizeof(*th));
+	if (th == NULL)
+		return -1;
+	as.cell_size = sizeof(int);
+	as.num_dims = 2;
+	as.current_dims = dims;
+	as.firstdim_max = IOD_DIMLEN_UNLIMITED;
+	tid = IOD_TID_UNKNOWN;
+	rc = iod_trans_start(coh, &tid, NULL, 0, IOD_TRANS_WR, NULL);
+	if (rc == 0)
+		rc = iod_obj_create(coh, tid, NULL, IOD_OBJ_ARRAY, NULL, &as,
+				    &oid, NULL);
+	if (rc == 0)
+		rc = iod_obj_open_write(coh, oid, NULL, &oh, NULL);
+	if (rc != 0)
+		goto out;
+
+	t0 = now();
+	for (i = 0; i < threads; i++)
+		if (pthread_create(&th[i], NULL, appender, NULL) != 0)
+			break;
+	while (i-- > 0) {
+		pthread_join(th[i], &ret);
+		if (ret != NULL)
+			rc = -1;
+	}
+	*t = now() - t0;
+
+	if (rc == 0)
+		rc = iod_trans_finish(coh, tid, NULL, 0, NULL);
+	if (rc == 0)
+		rc = check(threads * nrow);
+	iod_obj_close(oh, NULL, NULL);
+out:
+	free(th);
+	return rc;
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-t threads] [-r rows] [-k rows_per_append] "
+		"[-w width] [-b bb_root] [-c central_root]\n", prog);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	iod_hint_list_t	*hints;
+	const char	*bb_root = NULL;
+	const char	*central_root = NULL;
+	double		t1 = 0;
+	double		tn = 0;
+	int		nhint = 0;
+	int		opt;
+	int		rc;
+
+	while ((opt = getopt(argc, argv, "t:r:k:w:b:c:h")) != -1) {
+		switch (opt) {
+		case 't':
+			nthread = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			nrow = strtoul(optarg, NULL, 0);
+			break;
+		case 'k':
+			per_app = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			width = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			bb_root = optarg;
+			break;
+		case 'c':
+			central_root = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nthread == 0 || nrow == 0 || per_app == 0 || width == 0)
+		usage(argv[0]);
+
+	hints = calloc(1, sizeof(*hints) + 2 * sizeof(hints->hint[0]));
+	if (hints == NULL)
+		return 1;
+	if (bb_root != NULL) {
+		hints->hint[nhint].key = "iod.bb_root";
+		hints->hint[nhint++].value = bb_root;
+	}
+	if (central_root != NULL) {
+		hints->hint[nhint].key = "iod.central_root";
+		hints->hint[nhint++].value = central_root;
+	}
+	hints->num_hint = nhint;
+
+	rc = iod_initialize(MPI_COMM_WORLD, hints, 1, 1, NULL);
+	if (rc == 0)
+		rc = iod_container_open(BENCH_CONT, NULL,
+					IOD_CONT_RW | IOD_CONT_CREATE, &coh,
+					NULL);
+	if (rc != 0) {
+		fprintf(stderr, "setup failed: %d\n", rc);
+		return 1;
+	}
+
+	rc = run(1, &t1);
+	if (rc == 0)
+		rc = run(nthread, &tn);
+	if (rc == 0) {
+		printf("%-8s  %10s  %12s  %12s\n", "threads", "rows", "ms",
+		       "rows/s");
+		printf("%-8d  %10lu  %12.3f  %12.0f\n", 1, nrow, t1 * 1e3,
+		       nrow / t1);
+		printf("%-8lu  %10lu  %12.3f  %12.0f\n", nthread,
+		       nthread * nrow, tn * 1e3, nthread * nrow / tn);
+	} else {
+		fprintf(stderr, "append run failed: %d\n", rc);
+	}
+
+	iod_container_close(coh, NULL, NULL);
+	iod_container_unlink(BENCH_CONT, 1, NULL);
+	iod_finalize(NULL, NULL);
+	free(hints);
+	return rc == 0 ? 0 : 1;
+}
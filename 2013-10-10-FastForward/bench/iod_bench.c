@@ -0,0 +1,347 @@
+/*
+ * iod_bench: throughput of the IOD reference engine.
+ *
+ * Every thread writes its own object inside one shared transaction and the
+ * aggregate bandwidth and operation rate is reported for:
+ *
+ *   blob   iod_blob_write of -s bytes at increasing offsets
+ *   array  iod_array_write of one -s byte row of a 2D array of doubles
+ *   kv     iod_kv_set of -v byte values under distinct keys
+ *
+ * usage: iod_bench [-t threads] [-n ops] [-s size] [-v kv_size]
+ *		    [-b bb_root] [-c central_root] [-w blob,array,kv]
+ */
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "iod_api.h"
+
+#define BENCH_CONT	"/iod_bench"
+
+struct bench_cfg {
+	int		threads;
+	long		ops;
+	size_t		size;
+	size_t		kv_size;
+	const char	*bb_root;
+	const char	*central_root;
+	const char	*workloads;
+};
+
+struct bench_thread {
+	pthread_t		bt_thread;
+	struct bench_cfg	*bt_cfg;
+	iod_handle_t		bt_coh;
+	iod_trans_id_t		bt_tid;
+	iod_obj_id_t		bt_oid;
+	int			bt_idx;
+	int			bt_rc;
+};
+
+static struct bench_cfg cfg = {
+	.threads	= 4,
+	.ops		= 1024,
+	.size		= 1 << 20,
+	.kv_size	= 64,
+};
+
+static double
+now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+fill(char *buf, size_t len, int seed)
+{
+	size_t	i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = (char)(i * 31 + seed);
+}
+
+static void *
+blob_worker(void *arg)
+{
+	struct bench_thread	*bt = arg;
+	struct bench_cfg	*c = bt->bt_cfg;
+	iod_mem_desc_t		*md;
+	iod_blob_iodesc_t	*io;
+	iod_handle_t		oh;
+	long			i;
+	char			*buf;
+
+	md = malloc(sizeof(*md) + sizeof(md->frag[0]));
+	io = malloc(sizeof(*io) + sizeof(io->frag[0]));
+	buf = malloc(c->size);
+	if (md == NULL || io == NULL || buf == NULL) {
+		bt->bt_rc = -1;
+		goto out;
+	}
+	fill(buf, c->size, bt->bt_idx);
+	bt->bt_rc = iod_obj_open_write(bt->bt_coh, bt->bt_oid, NULL, &oh,
+				       NULL);
+	if (bt->bt_rc != 0)
+		goto out;
+	md->nfrag = 1;
+	md->frag[0].addr = buf;
+	md->frag[0].len = c->size;
+	io->nfrag = 1;
+	io->frag[0].len = c->size;
+	for (i = 0; i < c->ops && bt->bt_rc == 0; i++) {
+		io->frag[0].offset = (iod_off_t)i * c->size;
+		bt->bt_rc = iod_blob_write(oh, bt->bt_tid, NULL, md, io, NULL,
+					   NULL);
+	}
+	iod_obj_close(oh, NULL, NULL);
+out:
+	free(buf);
+	free(io);
+	free(md);
+	return NULL;
+}
+
+static void *
+array_worker(void *arg)
+{
+	struct bench_thread	*bt = arg;
+	struct bench_cfg	*c = bt->bt_cfg;
+	iod_size_t		start[2];
+	iod_size_t		count[2];
+	iod_hyperslab_t		slab = { start, count, NULL, NULL };
+	iod_mem_desc_t		*md;
+	iod_handle_t		oh;
+	long			i;
+	char			*buf;
+
+	md = malloc(sizeof(*md) + sizeof(md->frag[0]));
+	buf = malloc(c->size);
+	if (md == NULL || buf == NULL) {
+		bt->bt_rc = -1;
+		goto out;
+	}
+	fill(buf, c->size, bt->bt_idx);
+	bt->bt_rc = iod_obj_open_write(bt->bt_coh, bt->bt_oid, NULL, &oh,
+				       NULL);
+	if (bt->bt_rc != 0)
+		goto out;
+	md->nfrag = 1;
+	md->frag[0].addr = buf;
+	md->frag[0].len = c->size;
+	count[0] = 1;
+	count[1] = c->size / sizeof(double);
+	start[1] = 0;
+	for (i = 0; i < c->ops && bt->bt_rc == 0; i++) {
+		start[0] = i;
+		bt->bt_rc = iod_array_write(oh, bt->bt_tid, NULL, md, &slab,
+					    NULL, NULL);
+	}
+	iod_obj_close(oh, NULL, NULL);
+out:
+	free(buf);
+	free(md);
+	return NULL;
+}
+
+static void *
+kv_worker(void *arg)
+{
+	struct bench_thread	*bt = arg;
+	struct bench_cfg	*c = bt->bt_cfg;
+	iod_handle_t		oh;
+	iod_kv_t		kv;
+	char			key[64];
+	long			i;
+	char			*buf;
+
+	buf = malloc(c->kv_size);
+	if (buf == NULL) {
+		bt->bt_rc = -1;
+		return NULL;
+	}
+	fill(buf, c->kv_size, bt->bt_idx);
+	bt->bt_rc = iod_obj_open_write(bt->bt_coh, bt->bt_oid, NULL, &oh,
+				       NULL);
+	if (bt->bt_rc != 0)
+		goto out;
+	kv.key = key;
+	kv.value = buf;
+	kv.value_len = c->kv_size;
+	for (i = 0; i < c->ops && bt->bt_rc == 0; i++) {
+		snprintf(key, sizeof(key), "key-%08ld", i);
+		bt->bt_rc = iod_kv_set(oh, bt->bt_tid, NULL, &kv, NULL, NULL);
+	}
+	iod_obj_close(oh, NULL, NULL);
+out:
+	free(buf);
+	return NULL;
+}
+
+static int
+run(const char *name, iod_obj_type_t type, void *(*fn)(void *),
+    size_t op_size)
+{
+	struct bench_thread	*bt;
+	iod_array_struct_t	as;
+	iod_size_t		dims[2];
+	iod_handle_t		coh;
+	iod_trans_id_t		tid = IOD_TID_UNKNOWN;
+	double			t0;
+	double			t;
+	double			bytes;
+	int			i;
+	int			rc;
+
+	bt = calloc(cfg.threads, sizeof(*bt));
+	if (bt == NULL)
+		return -1;
+	rc = iod_container_open(BENCH_CONT, NULL, IOD_CONT_RW | IOD_CONT_CREATE,
+				&coh, NULL);
+	if (rc == 0)
+		rc = iod_trans_start(coh, &tid, NULL, 0, IOD_TRANS_WR, NULL);
+	if (rc != 0) {
+		fprintf(stderr, "%s: setup failed: %d\n", name, rc);
+		free(bt);
+		return rc;
+	}
+
+	dims[0] = cfg.ops;
+	dims[1] = cfg.size / sizeof(double);
+	as.cell_size = sizeof(double);
+	as.num_dims = 2;
+	as.current_dims = dims;
+	as.chunk_dims = NULL;
+	as.dims_seq = NULL;
+	as.firstdim_max = 0;
+	for (i = 0; i < cfg.threads && rc == 0; i++) {
+		bt[i].bt_cfg = &cfg;
+		bt[i].bt_coh = coh;
+		bt[i].bt_tid = tid;
+		bt[i].bt_idx = i;
+		rc = iod_obj_create(coh, tid, NULL, type, NULL,
+				    type == IOD_OBJ_ARRAY ? &as : NULL,
+				    &bt[i].bt_oid, NULL);
+	}
+
+	t0 = now();
+	for (i = 0; i < cfg.threads && rc == 0; i++)
+		pthread_create(&bt[i].bt_thread, NULL, fn, &bt[i]);
+	for (i = 0; i < cfg.threads && rc == 0; i++) {
+		pthread_join(bt[i].bt_thread, NULL);
+		if (bt[i].bt_rc != 0)
+			rc = bt[i].bt_rc;
+	}
+	t = now() - t0;
+
+	if (rc == 0) {
+		bytes = (double)cfg.threads * cfg.ops * op_size;
+		printf("%-16s %10.3f GB/s %14.0f ops/s  (%d x %ld x %zu B, "
+		       "%.3f s)\n", name, bytes / t / 1e9,
+		       cfg.threads * cfg.ops / t, cfg.threads, cfg.ops, op_size,
+		       t);
+	} else {
+		fprintf(stderr, "%s: failed: %d\n", name, rc);
+	}
+	iod_trans_finish(coh, tid, NULL, rc == 0 ? 0 : IOD_TRANS_ABORT_SINGLE,
+			 NULL);
+	iod_container_close(coh, NULL, NULL);
+	iod_container_unlink(BENCH_CONT, 1, NULL);
+	free(bt);
+	return rc;
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-t threads] [-n ops] [-s size] [-v kv_size]\n"
+		"          [-b bb_root] [-c central_root] [-w blob,array,kv]\n",
+		prog);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	iod_hint_list_t	*hints;
+	char		threads[16];
+	int		nhint = 0;
+	int		opt;
+	int		rc = 0;
+
+	while ((opt = getopt(argc, argv, "t:n:s:v:b:c:w:h")) != -1) {
+		switch (opt) {
+		case 't':
+			cfg.threads = atoi(optarg);
+			break;
+		case 'n':
+			cfg.ops = atol(optarg);
+			break;
+		case 's':
+			cfg.size = strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			cfg.kv_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			cfg.bb_root = optarg;
+			break;
+		case 'c':
+			cfg.central_root = optarg;
+			break;
+		case 'w':
+			cfg.workloads = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (cfg.threads <= 0 || cfg.ops <= 0 || cfg.size < sizeof(double) ||
+	    cfg.size % sizeof(double) != 0 || cfg.kv_size == 0 ||
+	    cfg.kv_size > IOD_KV_VALUE_MAXLEN)
+		usage(argv[0]);
+	if (cfg.workloads == NULL)
+		cfg.workloads = "blob,array,kv";
+
+	hints = calloc(1, sizeof(*hints) + 3 * sizeof(hints->hint[0]));
+	if (hints == NULL)
+		return 1;
+	snprintf(threads, sizeof(threads), "%d", cfg.threads);
+	hints->hint[nhint].key = "iod.threads";
+	hints->hint[nhint++].value = threads;
+	if (cfg.bb_root != NULL) {
+		hints->hint[nhint].key = "iod.bb_root";
+		hints->hint[nhint++].value = cfg.bb_root;
+	}
+	if (cfg.central_root != NULL) {
+		hints->hint[nhint].key = "iod.central_root";
+		hints->hint[nhint++].value = cfg.central_root;
+	}
+	hints->num_hint = nhint;
+
+	rc = iod_initialize(MPI_COMM_WORLD, hints, 1, 1, NULL);
+	if (rc != 0) {
+		fprintf(stderr, "iod_initialize: %d\n", rc);
+		return 1;
+	}
+	if (rc == 0 && strstr(cfg.workloads, "blob") != NULL)
+		rc = run("iod_blob_write", IOD_OBJ_BLOB, blob_worker,
+			 cfg.size);
+	if (rc == 0 && strstr(cfg.workloads, "array") != NULL)
+		rc = run("iod_array_write", IOD_OBJ_ARRAY, array_worker,
+			 cfg.size);
+	if (rc == 0 && strstr(cfg.workloads, "kv") != NULL)
+		rc = run("iod_kv_set", IOD_OBJ_KV, kv_worker, cfg.kv_size);
+	iod_finalize(NULL, NULL);
+	free(hints);
+	return rc == 0 ? 0 : 1;
+}
@@ -0,0 +1,245 @@
+/*
+ * iod_catalog_bench: full listings against TID diffs, and listings against
+ * concurrent creations.
+ *
+ * -n blob objects are created over TIDs of -t objects each. Another TID then
+ * creates -m / 2 objects and unlinks as many. The latest TID is listed whole,
+ * -p objects per iod_container_list_obj call, and its changes are listed with
+ * one iod_container_diff_obj over that last TID. Last, -t objects more are
+ * created, once on their own and once while another thread keeps listing the
+ * container, to show what the listings cost the writer.
+ *
+ * usage: iod_catalog_bench [-n objects] [-t per_tid] [-m changes]
+ *                          [-p page] [-b bb_root] [-c central_root]
+ */
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "iod_api.h"
+
+#define BENCH_CONT	"/iod_catalog_bench"
+
+static iod_handle_t	coh;
+static unsigned long	nobj = 200000;
+static unsigned long	per_tid = 10000;
+static unsigned long	nchg = 1000;
+static unsigned long	page = 4096;
+static iod_obj_id_t	*oid;
+static int		stop;
+static unsigned long	nlisted;
+
+static double
+now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* create \a n objects, and unlink \a nunlink of the first ones, in one TID */
+static int
+run_tid(unsigned long n, unsigned long nunlink, iod_trans_id_t *tid)
+{
+	iod_obj_id_t	id;
+	unsigned long	i;
+	int		rc;
+
+	*tid = IOD_TID_UNKNOWN;
+	rc = iod_trans_start(coh, tid, NULL, 0, IOD_TRANS_WR, NULL);
+	for (i = 0; i < n && rc == 0; i++)
+		rc = iod_obj_create(coh, *tid, NULL, IOD_OBJ_BLOB, NULL, NULL,
+				    &id, NULL);
+	for (i = 0; i < nunlink && rc == 0; i++)
+		rc = iod_obj_unlink(coh, oid[i], *tid, NULL);
+	if (rc == 0)
+		rc = iod_trans_finish(coh, *tid, NULL, 0, NULL);
+	return rc;
+}
+
+/* the whole container at \a tid, page by page; returns the object count */
+static long
+list_all(iod_trans_id_t tid, iod_obj_id_t *buf)
+{
+	unsigned long	off = 0;
+	int		n;
+
+	do {
+		n = iod_container_list_obj(coh, tid, IOD_OBJ_ANY, off, page,
+					   buf, NULL, NULL, NULL);
+		if (n < 0)
+			return n;
+		off += n;
+	} while ((unsigned long)n == page);
+	return off;
+}
+
+static void *
+lister(void *arg)
+{
+	iod_obj_id_t	*buf = arg;
+
+	while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+		if (list_all(0, buf) < 0)
+			break;
+		__atomic_add_fetch(&nlisted, 1, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-n objects] [-t per_tid] [-m changes] "
+		"[-p page] [-b bb_root] [-c central_root]\n", prog);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	iod_hint_list_t		*hints;
+	iod_obj_change_t	*chg;
+	iod_obj_id_t		*buf;
+	iod_obj_id_t		*lbuf;
+	iod_trans_id_t		tid;
+	iod_trans_id_t		prev;
+	pthread_t		th;
+	const char		*bb_root = NULL;
+	const char		*central_root = NULL;
+	double			t0;
+	double			tlist = 0;
+	double			tdiff = 0;
+	double			tidle = 0;
+	double			tbusy = 0;
+	unsigned long		i;
+	long			nlist = 0;
+	int			ndiff = 0;
+	int			nhint = 0;
+	int			opt;
+	int			rc;
+
+	while ((opt = getopt(argc, argv, "n:t:m:p:b:c:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			nobj = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			per_tid = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			nchg = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			page = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			bb_root = optarg;
+			break;
+		case 'c':
+			central_root = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nobj == 0 || per_tid == 0 || nchg < 2 || nchg / 2 > nobj ||
+	    page == 0)
+		usage(argv[0]);
+
+	hints = calloc(1, sizeof(*hints) + 2 * sizeof(hints->hint[0]));
+	oid = calloc(nobj, sizeof(*oid));
+	buf = calloc(nchg, sizeof(*buf));
+	chg = calloc(nchg, sizeof(*chg));
+	lbuf = calloc(2 * page, sizeof(*lbuf));
+	if (hints == NULL || oid == NULL || buf == NULL || chg == NULL ||
+	    lbuf == NULL)
+		return 1;
+	if (bb_root != NULL) {
+		hints->hint[nhint].key = "iod.bb_root";
+		hints->hint[nhint++].value = bb_root;
+	}
+	if (central_root != NULL) {
+		hints->hint[nhint].key = "iod.central_root";
+		hints->hint[nhint++].value = central_root;
+	}
+	hints->num_hint = nhint;
+
+	rc = iod_initialize(MPI_COMM_WORLD, hints, 1, 1, NULL);
+	if (rc == 0)
+		rc = iod_container_open(BENCH_CONT, NULL,
+					IOD_CONT_RW | IOD_CONT_CREATE, &coh,
+					NULL);
+	if (rc != 0) {
+		fprintf(stderr, "setup failed: %d\n", rc);
+		return 1;
+	}
+
+	for (i = 0; i < nobj && rc == 0; i += per_tid)
+		rc = run_tid(nobj - i < per_tid ? nobj - i : per_tid, 0,
+			     &tid);
+	/* object IDs are handed out in order, from 1 */
+	for (i = 0; i < nobj; i++) {
+		oid[i].oid_hi = IOD_OBJ_BLOB;
+		oid[i].oid_lo = i + 1;
+	}
+	prev = tid;
+	if (rc == 0)
+		rc = run_tid(nchg / 2, nchg / 2, &tid);
+
+	if (rc == 0) {
+		t0 = now();
+		nlist = list_all(tid, lbuf);
+		tlist = now() - t0;
+		t0 = now();
+		ndiff = iod_container_diff_obj(coh, prev, tid, IOD_OBJ_ANY, 0,
+					       nchg, buf, NULL, chg, NULL);
+		tdiff = now() - t0;
+		if (nlist < 0 || ndiff < 0)
+			rc = nlist < 0 ? nlist : ndiff;
+	}
+
+	/* what listings running alongside cost a writer */
+	if (rc == 0) {
+		t0 = now();
+		rc = run_tid(per_tid, 0, &tid);
+		tidle = now() - t0;
+	}
+	if (rc == 0 && pthread_create(&th, NULL, lister, lbuf + page) == 0) {
+		t0 = now();
+		rc = run_tid(per_tid, 0, &tid);
+		tbusy = now() - t0;
+		__atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+		pthread_join(th, NULL);
+	}
+
+	if (rc == 0) {
+		printf("%-24s  %10s  %12s\n", "call", "objects", "ms");
+		printf("%-24s  %10ld  %12.3f\n", "list whole TID", nlist,
+		       tlist * 1e3);
+		printf("%-24s  %10d  %12.3f\n", "diff last TID", ndiff,
+		       tdiff * 1e3);
+		printf("%-24s  %10lu  %12.3f\n", "create, no listing",
+		       per_tid, tidle * 1e3);
+		printf("%-24s  %10lu  %12.3f  (%lu listings)\n",
+		       "create, listing", per_tid, tbusy * 1e3, nlisted);
+	} else {
+		fprintf(stderr, "catalog run failed: %d\n", rc);
+	}
+
+	iod_container_close(coh, NULL, NULL);
+	iod_container_unlink(BENCH_CONT, 1, NULL);
+	iod_finalize(NULL, NULL);
+	free(lbuf);
+	free(chg);
+	free(buf);
+	free(oid);
+	free(hints);
+	return rc == 0 ? 0 : 1;
+}
@@ -0,0 +1,228 @@
+/*
+ * iod_eq_bench: completion rate and poll latency of one event queue.
+ *
+ * 1, 2, 4, ... up to -p producer threads each keep -k events in flight on
+ * one EQ, issuing iod_container_query_tids, which completes inline into the
+ * EQ, -n times. One consumer thread drains the EQ with iod_eq_poll in
+ * batches of up to 64 under IOD_EQ_WAIT and hands each event back to its
+ * producer. Poll latency is the time from issuing an event to the poll that
+ * returns it.
+ *
+ * usage: iod_eq_bench [-p producers] [-n events] [-k depth] [-b bb_root]
+ *                     [-c central_root]
+ */
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "iod_api.h"
+
+#define BENCH_CONT	"/iod_eq_bench"
+#define BATCH		64
+
+/** one event with its bookkeeping; ev comes first, polls return it */
+struct bench_ev {
+	iod_event_t		be_ev;
+	iod_container_tids_t	be_tids;
+	double			be_issued;
+	int			be_busy;
+};
+
+static int		producers = 16;
+static long		nevents = 100000;
+static int		depth = 16;
+static iod_handle_t	coh;
+static iod_handle_t	eqh;
+static struct bench_ev	*evs;
+static double		*lat;
+static long		nlat;
+
+static double
+now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *
+producer(void *arg)
+{
+	struct bench_ev	*mine = &evs[(long)arg * depth];
+	struct bench_ev	*be;
+	long		i;
+
+	for (i = 0; i < nevents; i++) {
+		be = &mine[i % depth];
+		while (__atomic_load_n(&be->be_busy, __ATOMIC_ACQUIRE))
+			sched_yield();
+		be->be_busy = 1;
+		be->be_issued = now();
+		if (iod_container_query_tids(coh, &be->be_tids,
+					     &be->be_ev) != 0)
+			abort();
+	}
+	return NULL;
+}
+
+static void *
+consumer(void *arg)
+{
+	iod_event_t	*out[BATCH];
+	struct bench_ev	*be;
+	long		total = (long)arg;
+	double		t;
+	int		n;
+	int		i;
+
+	while (nlat < total) {
+		n = iod_eq_poll(eqh, 0, IOD_EQ_WAIT, BATCH, out);
+		t = now();
+		for (i = 0; i < n; i++) {
+			be = (struct bench_ev *)out[i];
+			lat[nlat++] = t - be->be_issued;
+			__atomic_store_n(&be->be_busy, 0, __ATOMIC_RELEASE);
+		}
+	}
+	return NULL;
+}
+
+static int
+dbl_cmp(const void *a, const void *b)
+{
+	double	da = *(const double *)a;
+	double	db = *(const double *)b;
+
+	return da < db ? -1 : da > db;
+}
+
+static int
+run(int np)
+{
+	pthread_t	*th;
+	pthread_t	cons;
+	double		t0;
+	double		el;
+	double		sum = 0;
+	long		total = np * nevents;
+	long		i;
+
+	th = calloc(np, sizeof(*th));
+	if (th == NULL)
+		return -1;
+	nlat = 0;
+	t0 = now();
+	pthread_create(&cons, NULL, consumer, (void *)total);
+	for (i = 0; i < np; i++)
+		pthread_create(&th[i], NULL, producer, (void *)i);
+	for (i = 0; i < np; i++)
+		pthread_join(th[i], NULL);
+	pthread_join(cons, NULL);
+	el = now() - t0;
+
+	for (i = 0; i < total; i++)
+		sum += lat[i];
+	qsort(lat, total, sizeof(*lat), dbl_cmp);
+	printf("%3d producers  %10.0f events/s  poll latency mean %8.2f us  "
+	       "p50 %8.2f us  p99 %8.2f us\n", np, total / el,
+	       sum / total * 1e6, lat[total / 2] * 1e6,
+	       lat[total * 99 / 100] * 1e6);
+	free(th);
+	return 0;
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-p producers] [-n events] [-k depth] "
+		"[-b bb_root] [-c central_root]\n", prog);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	iod_hint_list_t	*hints;
+	const char	*bb_root = NULL;
+	const char	*central_root = NULL;
+	long		i;
+	int		nhint = 0;
+	int		np;
+	int		opt;
+	int		rc;
+
+	while ((opt = getopt(argc, argv, "p:n:k:b:c:h")) != -1) {
+		switch (opt) {
+		case 'p':
+			producers = atoi(optarg);
+			break;
+		case 'n':
+			nevents = atol(optarg);
+			break;
+		case 'k':
+			depth = atoi(optarg);
+			break;
+		case 'b':
+			bb_root = optarg;
+			break;
+		case 'c':
+			central_root = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (producers <= 0 || nevents <= 0 || depth <= 0)
+		usage(argv[0]);
+
+	hints = calloc(1, sizeof(*hints) + 2 * sizeof(hints->hint[0]));
+	evs = calloc((size_t)producers * depth, sizeof(*evs));
+	lat = malloc(producers * nevents * sizeof(*lat));
+	if (hints == NULL || evs == NULL || lat == NULL)
+		return 1;
+	if (bb_root != NULL) {
+		hints->hint[nhint].key = "iod.bb_root";
+		hints->hint[nhint++].value = bb_root;
+	}
+	if (central_root != NULL) {
+		hints->hint[nhint].key = "iod.central_root";
+		hints->hint[nhint++].value = central_root;
+	}
+	hints->num_hint = nhint;
+
+	rc = iod_initialize(MPI_COMM_WORLD, hints, 1, 1, NULL);
+	if (rc == 0)
+		rc = iod_container_open(BENCH_CONT, NULL,
+					IOD_CONT_RW | IOD_CONT_CREATE, &coh,
+					NULL);
+	if (rc == 0)
+		rc = iod_eq_create(&eqh);
+	for (i = 0; i < (long)producers * depth && rc == 0; i++)
+		rc = iod_event_init(&evs[i].be_ev, eqh);
+	if (rc != 0) {
+		fprintf(stderr, "setup failed: %d\n", rc);
+		return 1;
+	}
+	for (np = 1; np <= producers && rc == 0; np *= 2) {
+		rc = run(np);
+		if (np < producers && np * 2 > producers)
+			np = producers / 2;
+	}
+	for (i = 0; i < (long)producers * depth; i++)
+		iod_event_fini(&evs[i].be_ev);
+	iod_eq_destroy(eqh, NULL);
+	iod_container_close(coh, NULL, NULL);
+	iod_container_unlink(BENCH_CONT, 1, NULL);
+	iod_finalize(NULL, NULL);
+	free(lat);
+	free(evs);
+	free(hints);
+	return rc == 0 ? 0 : 1;
+}
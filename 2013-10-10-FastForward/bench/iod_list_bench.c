@@ -0,0 +1,263 @@
+/*
+ * iod_list_bench: the *_list calls against the same calls made one by one.
+ *
+ * -n blob objects are created in one TID with iod_obj_create called once per
+ * object, then as many again with one iod_obj_create_list. -o of each set
+ * are opened for writing, one by one and as one iod_obj_open_write_list,
+ * and -n writes of -s bytes are spread over them round robin, at offsets
+ * that follow on, with iod_blob_write and then with one
+ * iod_blob_write_list. With "iod.pack_max" 0 each written object keeps a
+ * data log open, and -o is bounded by the limit on open files. Times are per
+ * entry.
+ *
+ * usage: iod_list_bench [-n entries] [-o objects] [-s size]
+ *                       [-b bb_root] [-c central_root]
+ */
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "iod_api.h"
+
+#define BENCH_CONT	"/iod_list_bench"
+
+static iod_handle_t	coh;
+static unsigned long	nent = 100000;
+static unsigned long	nobj = 4000;
+static size_t		size = 64;
+
+static double
+now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+run_create(iod_trans_id_t tid, iod_obj_id_t *oid, int list, double *t)
+{
+	iod_obj_create_t	*oc;
+	unsigned long		i;
+	double			t0;
+	int			rc = 0;
+
+	oc = calloc(nent, sizeof(*oc));
+	if (oc == NULL)
+		return -1;
+	for (i = 0; i < nent; i++) {
+		oc[i].type = IOD_OBJ_BLOB;
+		oc[i].oid = &oid[i];
+	}
+	t0 = now();
+	if (list)
+		rc = iod_obj_create_list(coh, tid, nent, oc, NULL);
+	for (i = 0; !list && i < nent && rc == 0; i++)
+		rc = iod_obj_create(coh, tid, NULL, IOD_OBJ_BLOB, NULL, NULL,
+				    &oid[i], NULL);
+	*t = now() - t0;
+	free(oc);
+	return rc;
+}
+
+static int
+run_open(iod_obj_id_t *oid, iod_handle_t *oh, int list, double *t)
+{
+	iod_obj_open_t	*op;
+	unsigned long	i;
+	double		t0;
+	int		rc = 0;
+
+	op = calloc(nobj, sizeof(*op));
+	if (op == NULL)
+		return -1;
+	for (i = 0; i < nobj; i++) {
+		op[i].oid = oid[i];
+		op[i].oh = &oh[i];
+	}
+	t0 = now();
+	if (list)
+		rc = iod_obj_open_write_list(coh, nobj, op, NULL);
+	for (i = 0; !list && i < nobj && rc == 0; i++)
+		rc = iod_obj_open_write(coh, oid[i], NULL, &oh[i], NULL);
+	*t = now() - t0;
+	free(op);
+	return rc;
+}
+
+static int
+run_write(iod_trans_id_t tid, iod_handle_t *oh, char *buf, int list,
+	  double *t)
+{
+	iod_blob_iodesc_t	*io;
+	iod_mem_desc_t		*md;
+	iod_blob_io_t		*bw;
+	unsigned long		i;
+	double			t0;
+	int			rc = 0;
+
+	bw = calloc(nent, sizeof(*bw));
+	md = malloc(nent * (sizeof(*md) + sizeof(md->frag[0])));
+	io = malloc(nent * (sizeof(*io) + sizeof(io->frag[0])));
+	if (bw == NULL || md == NULL || io == NULL) {
+		rc = -1;
+		goto out;
+	}
+	for (i = 0; i < nent; i++) {
+		bw[i].oh = oh[i % nobj];
+		bw[i].mem_desc = (iod_mem_desc_t *)((char *)md + i *
+				 (sizeof(*md) + sizeof(md->frag[0])));
+		bw[i].io_desc = (iod_blob_iodesc_t *)((char *)io + i *
+				(sizeof(*io) + sizeof(io->frag[0])));
+		bw[i].mem_desc->nfrag = 1;
+		bw[i].mem_desc->frag[0].addr = buf;
+		bw[i].mem_desc->frag[0].len = size;
+		bw[i].io_desc->nfrag = 1;
+		bw[i].io_desc->frag[0].offset = i / nobj * size;
+		bw[i].io_desc->frag[0].len = size;
+	}
+	t0 = now();
+	if (list)
+		rc = iod_blob_write_list(coh, tid, nent, bw, NULL);
+	for (i = 0; !list && i < nent && rc == 0; i++)
+		rc = iod_blob_write(bw[i].oh, tid, NULL, bw[i].mem_desc,
+				    bw[i].io_desc, NULL, NULL);
+	*t = now() - t0;
+out:
+	free(bw);
+	free(md);
+	free(io);
+	return rc;
+}
+
+static void
+report(const char *op, unsigned long n, const double *t)
+{
+	printf("%-8s  %8lu  %12.3f  %12.3f  %8.1fx\n", op, n, t[0] / n * 1e6,
+	       t[1] / n * 1e6, t[0] / t[1]);
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-n entries] [-o objects] [-s size] "
+		"[-b bb_root] [-c central_root]\n", prog);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	iod_hint_list_t	*hints;
+	iod_obj_id_t	*oid[2];
+	iod_handle_t	*oh[2];
+	iod_trans_id_t	tid;
+	const char	*bb_root = NULL;
+	const char	*central_root = NULL;
+	double		tc[2];
+	double		to[2];
+	double		tw[2];
+	char		*buf;
+	unsigned long	i;
+	int		nhint = 0;
+	int		opt;
+	int		rc;
+	int		k;
+
+	while ((opt = getopt(argc, argv, "n:o:s:b:c:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			nent = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			nobj = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			bb_root = optarg;
+			break;
+		case 'c':
+			central_root = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nent == 0 || nobj == 0 || nobj > nent || size == 0)
+		usage(argv[0]);
+
+	hints = calloc(1, sizeof(*hints) + 2 * sizeof(hints->hint[0]));
+	buf = malloc(size);
+	for (k = 0; k < 2; k++) {
+		oid[k] = calloc(nent, sizeof(*oid[k]));
+		oh[k] = calloc(nobj, sizeof(*oh[k]));
+		if (oid[k] == NULL || oh[k] == NULL)
+			return 1;
+	}
+	if (hints == NULL || buf == NULL)
+		return 1;
+	memset(buf, 0x5a, size);
+	if (bb_root != NULL) {
+		hints->hint[nhint].key = "iod.bb_root";
+		hints->hint[nhint++].value = bb_root;
+	}
+	if (central_root != NULL) {
+		hints->hint[nhint].key = "iod.central_root";
+		hints->hint[nhint++].value = central_root;
+	}
+	hints->num_hint = nhint;
+
+	rc = iod_initialize(MPI_COMM_WORLD, hints, 1, 1, NULL);
+	if (rc == 0)
+		rc = iod_container_open(BENCH_CONT, NULL,
+					IOD_CONT_RW | IOD_CONT_CREATE, &coh,
+					NULL);
+	if (rc != 0) {
+		fprintf(stderr, "setup failed: %d\n", rc);
+		return 1;
+	}
+
+	/* one by one first, then as lists */
+	for (k = 0; k < 2 && rc == 0; k++) {
+		tid = IOD_TID_UNKNOWN;
+		rc = iod_trans_start(coh, &tid, NULL, 0, IOD_TRANS_WR, NULL);
+		if (rc == 0)
+			rc = run_create(tid, oid[k], k, &tc[k]);
+		if (rc == 0)
+			rc = run_open(oid[k], oh[k], k, &to[k]);
+		if (rc == 0)
+			rc = run_write(tid, oh[k], buf, k, &tw[k]);
+		if (rc == 0)
+			rc = iod_trans_finish(coh, tid, NULL, 0, NULL);
+	}
+	if (rc == 0) {
+		printf("%-8s  %8s  %12s  %12s  %9s\n", "call", "entries",
+		       "loop us", "list us", "speedup");
+		report("create", nent, tc);
+		report("open", nobj, to);
+		report("write", nent, tw);
+	} else {
+		fprintf(stderr, "list run failed: %d\n", rc);
+	}
+
+	for (k = 0; k < 2; k++) {
+		for (i = 0; i < nobj; i++)
+			if (oh[k][i].cookie != 0)
+				iod_obj_close(oh[k][i], NULL, NULL);
+		free(oid[k]);
+		free(oh[k]);
+	}
+	iod_container_close(coh, NULL, NULL);
+	iod_container_unlink(BENCH_CONT, 1, NULL);
+	iod_finalize(NULL, NULL);
+	free(buf);
+	free(hints);
+	return rc == 0 ? 0 : 1;
+}
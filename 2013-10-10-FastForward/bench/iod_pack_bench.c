@@ -0,0 +1,305 @@
+/*
+ * iod_pack_bench: a container of a great many small blobs, packed into
+ * segment files and with a data log file per object.
+ *
+ * -n blob objects are created with iod_obj_create_list, in TIDs of -t
+ * objects, and each gets -s bytes with iod_blob_write_list. Another round of
+ * TIDs then appends -s bytes to three of every four objects, which moves
+ * their logs out of the slots they were packed in and leaves compaction work
+ * behind. The close, timed on its own, waits for the compactions and writes
+ * the checkpoint. The burst buffer directory is then counted: files, and the
+ * bytes they take on disk. The same is done with packing off ("iod.pack_max"
+ * 0) for -u objects, fewer by default, as each keeps a file open.
+ *
+ * usage: iod_pack_bench [-n objects] [-u unpacked_objects] [-t per_tid]
+ *                       [-s size] [-b bb_root] [-c central_root]
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "iod_api.h"
+
+#define BENCH_CONT	"/iod_pack_bench"
+
+struct result {
+	unsigned long	r_nobj;
+	double		r_create;	/* create and first write */
+	double		r_grow;		/* second write */
+	double		r_close;
+	unsigned long	r_files;
+	unsigned long	r_bytes;	/* allocated on disk */
+};
+
+static iod_handle_t	coh;
+static unsigned long	nobj = 1000000;
+static unsigned long	nunpacked = 10000;
+static unsigned long	per_tid = 10000;
+static size_t		size = 64;
+static const char	*bb_root;
+static const char	*central_root;
+
+static double
+now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * one TID over objects [first, first + n): with create, they are created and
+ * all written; without, three in four are written, -s bytes at off
+ */
+static int
+run_tid(iod_obj_id_t *oid, unsigned long first, unsigned long n, int create,
+	iod_off_t off, char *buf)
+{
+	iod_obj_create_t	*oc = NULL;
+	iod_obj_open_t		*op;
+	iod_obj_close_t		*cl;
+	iod_blob_io_t		*bw;
+	iod_blob_iodesc_t	*io;
+	iod_mem_desc_t		*md;
+	iod_handle_t		*oh;
+	iod_trans_id_t		tid = IOD_TID_UNKNOWN;
+	unsigned long		nw = 0;
+	unsigned long		i;
+	int			rc;
+
+	op = calloc(n, sizeof(*op));
+	cl = calloc(n, sizeof(*cl));
+	bw = calloc(n, sizeof(*bw));
+	oh = calloc(n, sizeof(*oh));
+	md = malloc(sizeof(*md) + sizeof(md->frag[0]));
+	io = malloc(n * (sizeof(*io) + sizeof(io->frag[0])));
+	if (create)
+		oc = calloc(n, sizeof(*oc));
+	if (op == NULL || cl == NULL || bw == NULL || oh == NULL ||
+	    md == NULL || io == NULL || (create && oc == NULL)) {
+		rc = -1;
+		goto out;
+	}
+	md->nfrag = 1;
+	md->frag[0].addr = buf;
+	md->frag[0].len = size;
+
+	rc = iod_trans_start(coh, &tid, NULL, 0, IOD_TRANS_WR, NULL);
+	for (i = 0; create && i < n; i++) {
+		oc[i].type = IOD_OBJ_BLOB;
+		oc[i].oid = &oid[first + i];
+	}
+	if (rc == 0 && create)
+		rc = iod_obj_create_list(coh, tid, n, oc, NULL);
+	for (i = 0; i < n; i++) {
+		op[i].oid = oid[first + i];
+		op[i].oh = &oh[i];
+	}
+	if (rc == 0)
+		rc = iod_obj_open_write_list(coh, n, op, NULL);
+	for (i = 0; i < n; i++) {
+		/* the growth round skips one object in four */
+		if (!create && (first + i) % 4 == 0)
+			continue;
+		bw[nw].oh = oh[i];
+		bw[nw].mem_desc = md;
+		bw[nw].io_desc = (iod_blob_iodesc_t *)((char *)io + nw *
+				 (sizeof(*io) + sizeof(io->frag[0])));
+		bw[nw].io_desc->nfrag = 1;
+		bw[nw].io_desc->frag[0].offset = off;
+		bw[nw].io_desc->frag[0].len = size;
+		nw++;
+	}
+	if (rc == 0)
+		rc = iod_blob_write_list(coh, tid, nw, bw, NULL);
+	for (i = 0; i < n; i++)
+		cl[i].oh = oh[i];
+	if (rc == 0)
+		rc = iod_obj_close_list(coh, n, cl, NULL);
+	if (rc == 0)
+		rc = iod_trans_finish(coh, tid, NULL, 0, NULL);
+out:
+	free(oc);
+	free(io);
+	free(md);
+	free(oh);
+	free(bw);
+	free(cl);
+	free(op);
+	return rc;
+}
+
+/* the files in the container's burst buffer directory, and their blocks */
+static void
+count(struct result *res)
+{
+	struct dirent	*de;
+	struct stat	st;
+	char		path[4096];
+	const char	*root = bb_root;
+	DIR		*dir;
+
+	if (root == NULL)
+		root = getenv("IOD_BB_ROOT");
+	if (root == NULL)
+		root = "/tmp/iod_bb";
+	snprintf(path, sizeof(path), "%s/%s", root, BENCH_CONT + 1);
+	dir = opendir(path);
+	if (dir == NULL)
+		return;
+	while ((de = readdir(dir)) != NULL) {
+		if (de->d_name[0] == '.' ||
+		    fstatat(dirfd(dir), de->d_name, &st, 0) != 0)
+			continue;
+		res->r_files++;
+		res->r_bytes += st.st_blocks * 512;
+	}
+	closedir(dir);
+}
+
+static int
+run(const char *pack_max, unsigned long n, struct result *res)
+{
+	iod_hint_list_t	*hints;
+	iod_obj_id_t	*oid;
+	unsigned long	i;
+	unsigned long	k;
+	double		t0;
+	char		*buf;
+	int		nhint = 0;
+	int		rc;
+
+	memset(res, 0, sizeof(*res));
+	res->r_nobj = n;
+	hints = calloc(1, sizeof(*hints) + 3 * sizeof(hints->hint[0]));
+	oid = calloc(n, sizeof(*oid));
+	buf = malloc(size);
+	if (hints == NULL || oid == NULL || buf == NULL) {
+		rc = -1;
+		goto out;
+	}
+	memset(buf, 'p', size);
+	hints->hint[nhint].key = "iod.pack_max";
+	hints->hint[nhint++].value = pack_max;
+	if (bb_root != NULL) {
+		hints->hint[nhint].key = "iod.bb_root";
+		hints->hint[nhint++].value = bb_root;
+	}
+	if (central_root != NULL) {
+		hints->hint[nhint].key = "iod.central_root";
+		hints->hint[nhint++].value = central_root;
+	}
+	hints->num_hint = nhint;
+
+	rc = iod_initialize(MPI_COMM_WORLD, hints, 1, 1, NULL);
+	if (rc != 0)
+		goto out;
+	rc = iod_container_open(BENCH_CONT, NULL,
+				IOD_CONT_RW | IOD_CONT_CREATE, &coh, NULL);
+	if (rc != 0)
+		goto out_fini;
+
+	t0 = now();
+	for (i = 0; i < n && rc == 0; i += k) {
+		k = n - i < per_tid ? n - i : per_tid;
+		rc = run_tid(oid, i, k, 1, 0, buf);
+	}
+	res->r_create = now() - t0;
+	t0 = now();
+	for (i = 0; i < n && rc == 0; i += k) {
+		k = n - i < per_tid ? n - i : per_tid;
+		rc = run_tid(oid, i, k, 0, size, buf);
+	}
+	res->r_grow = now() - t0;
+
+	t0 = now();
+	if (iod_container_close(coh, NULL, NULL) != 0 && rc == 0)
+		rc = -1;
+	res->r_close = now() - t0;
+	if (rc == 0)
+		count(res);
+	iod_container_unlink(BENCH_CONT, 1, NULL);
+out_fini:
+	iod_finalize(NULL, NULL);
+out:
+	free(buf);
+	free(oid);
+	free(hints);
+	return rc;
+}
+
+static void
+report(const char *mode, const struct result *res)
+{
+	printf("%-9s  %9lu  %10.3f  %10.3f  %10.3f  %10.0f  %9lu  %10.1f\n",
+	       mode, res->r_nobj, res->r_create * 1e3, res->r_grow * 1e3,
+	       res->r_close * 1e3, res->r_nobj / res->r_create, res->r_files,
+	       res->r_bytes / 1048576.0);
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-n objects] [-u unpacked_objects] "
+		"[-t per_tid] [-s size] [-b bb_root] [-c central_root]\n",
+		prog);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct result	packed;
+	struct result	unpacked;
+	int		opt;
+	int		rc;
+
+	while ((opt = getopt(argc, argv, "n:u:t:s:b:c:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			nobj = strtoul(optarg, NULL, 0);
+			break;
+		case 'u':
+			nunpacked = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			per_tid = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			bb_root = optarg;
+			break;
+		case 'c':
+			central_root = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nobj == 0 || per_tid == 0 || size == 0)
+		usage(argv[0]);
+
+	rc = run("65536", nobj, &packed);
+	if (rc == 0 && nunpacked > 0)
+		rc = run("0", nunpacked, &unpacked);
+	if (rc != 0) {
+		fprintf(stderr, "pack run failed: %d\n", rc);
+		return 1;
+	}
+	printf("%-9s  %9s  %10s  %10s  %10s  %10s  %9s  %10s\n", "logs",
+	       "objects", "create ms", "grow ms", "close ms", "objs/s",
+	       "files", "MiB on bb");
+	report("packed", &packed);
+	if (nunpacked > 0)
+		report("per-file", &unpacked);
+	return 0;
+}
@@ -0,0 +1,279 @@
+/*
+ * iod_persist_bench: persist throughput and foreground write latency.
+ *
+ * -o blobs of -m MiB each, striped over -s targets, are written whole in
+ * each of -r TIDs, as an iterative code rewriting its arrays would. The
+ * last of them is then persisted in the background, the older versions
+ * being flattened away, while the main thread keeps writing 4 KiB blocks
+ * into the next TID. The latency of those writes is reported once with the
+ * engine idle and once while the persist streams; -B sets the persist byte
+ * budget.
+ *
+ * usage: iod_persist_bench [-o objects] [-m MiB] [-s stripes] [-r rewrites]
+ *                          [-B budget] [-b bb_root] [-c central_root]
+ */
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "iod_api.h"
+
+#define BENCH_CONT	"/iod_persist_bench"
+#define BLOCK		4096
+#define IDLE_WRITES	2000
+
+static int		nobjs = 16;
+static long		mib = 64;
+static int		stripes = 4;
+static int		rewrites = 1;
+static iod_trans_id_t	fg_tid;
+static iod_handle_t	coh;
+static iod_handle_t	fgh;
+static iod_mem_desc_t	*md;
+static iod_blob_iodesc_t *io;
+static double		*lat;
+static long		nlat;
+static long		max_lat;
+
+static double
+now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+dbl_cmp(const void *a, const void *b)
+{
+	double	da = *(const double *)a;
+	double	db = *(const double *)b;
+
+	return da < db ? -1 : da > db;
+}
+
+static int
+write_one(iod_handle_t oh, iod_trans_id_t tid, char *buf, iod_size_t len,
+	  iod_off_t off)
+{
+	md->nfrag = 1;
+	md->frag[0].addr = buf;
+	md->frag[0].len = len;
+	io->nfrag = 1;
+	io->frag[0].offset = off;
+	io->frag[0].len = len;
+	return iod_blob_write(oh, tid, NULL, md, io, NULL, NULL);
+}
+
+/** one timed foreground write */
+static int
+fg_write(char *buf)
+{
+	double	t0 = now();
+	int	rc;
+
+	rc = write_one(fgh, fg_tid, buf, BLOCK, (iod_off_t)nlat * BLOCK);
+	if (nlat < max_lat)
+		lat[nlat++] = now() - t0;
+	return rc;
+}
+
+static void
+report(const char *what)
+{
+	qsort(lat, nlat, sizeof(*lat), dbl_cmp);
+	printf("%-16s %8ld writes  p50 %8.2f us  p99 %8.2f us  max %8.2f us\n",
+	       what, nlat, lat[nlat / 2] * 1e6, lat[nlat * 99 / 100] * 1e6,
+	       lat[nlat - 1] * 1e6);
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-o objects] [-m MiB] [-s stripes] "
+		"[-r rewrites] [-B budget] [-b bb_root] [-c central_root]\n",
+		prog);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	iod_hint_list_t	*hints;
+	iod_handle_t	*oh;
+	iod_obj_id_t	oid;
+	iod_trans_id_t	tid;
+	iod_layout_t	layout = { IOD_LOC_CENTRAL, 0, 1 << 20, NULL,
+				   IOD_PLACE_ROUND_ROBIN, NULL };
+	iod_container_stats_t stats;
+	iod_handle_t	eqh;
+	iod_event_t	ev;
+	iod_event_t	*done;
+	const char	*bb_root = NULL;
+	const char	*central_root = NULL;
+	const char	*budget = NULL;
+	double		t0;
+	double		el;
+	char		*buf;
+	long		off;
+	int		nhint = 0;
+	int		opt;
+	int		n = 0;
+	int		rc;
+	int		i;
+	int		r;
+
+	while ((opt = getopt(argc, argv, "o:m:s:r:B:b:c:h")) != -1) {
+		switch (opt) {
+		case 'o':
+			nobjs = atoi(optarg);
+			break;
+		case 'm':
+			mib = atol(optarg);
+			break;
+		case 's':
+			stripes = atoi(optarg);
+			break;
+		case 'r':
+			rewrites = atoi(optarg);
+			break;
+		case 'B':
+			budget = optarg;
+			break;
+		case 'b':
+			bb_root = optarg;
+			break;
+		case 'c':
+			central_root = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nobjs <= 0 || mib <= 0 || stripes <= 0 || rewrites <= 0)
+		usage(argv[0]);
+
+	hints = calloc(1, sizeof(*hints) + 3 * sizeof(hints->hint[0]));
+	oh = calloc(nobjs, sizeof(*oh));
+	md = malloc(sizeof(*md) + sizeof(md->frag[0]));
+	io = malloc(sizeof(*io) + sizeof(io->frag[0]));
+	buf = malloc(1 << 20);
+	max_lat = 1 << 22;
+	lat = malloc(max_lat * sizeof(*lat));
+	if (hints == NULL || oh == NULL || md == NULL || io == NULL ||
+	    buf == NULL || lat == NULL)
+		return 1;
+	memset(buf, 'p', 1 << 20);
+	if (bb_root != NULL) {
+		hints->hint[nhint].key = "iod.bb_root";
+		hints->hint[nhint++].value = bb_root;
+	}
+	if (central_root != NULL) {
+		hints->hint[nhint].key = "iod.central_root";
+		hints->hint[nhint++].value = central_root;
+	}
+	if (budget != NULL) {
+		hints->hint[nhint].key = "iod.persist_budget";
+		hints->hint[nhint++].value = budget;
+	}
+	hints->num_hint = nhint;
+
+	rc = iod_initialize(MPI_COMM_WORLD, hints, 1, 1, NULL);
+	if (rc == 0)
+		rc = iod_container_open(BENCH_CONT, NULL,
+					IOD_CONT_RW | IOD_CONT_CREATE, &coh,
+					NULL);
+	tid = 1;
+	if (rc == 0)
+		rc = iod_trans_start(coh, &tid, NULL, 0, IOD_TRANS_WR, NULL);
+	layout.target_num = stripes;
+	for (i = 0; i < nobjs && rc == 0; i++) {
+		rc = iod_obj_create(coh, 1, NULL, IOD_OBJ_BLOB, NULL, NULL,
+				    &oid, NULL);
+		if (rc == 0)
+			rc = iod_obj_open_write(coh, oid, NULL, &oh[i], NULL);
+		if (rc == 0)
+			rc = iod_obj_set_layout(oh[i], 1, NULL, &layout, NULL);
+	}
+	if (rc == 0)
+		rc = iod_obj_create(coh, 1, NULL, IOD_OBJ_BLOB, NULL, NULL,
+				    &oid, NULL);
+	if (rc == 0)
+		rc = iod_obj_open_write(coh, oid, NULL, &fgh, NULL);
+	for (r = 1; r <= rewrites && rc == 0; r++) {
+		tid = r;
+		if (r > 1)
+			rc = iod_trans_start(coh, &tid, NULL, 0, IOD_TRANS_WR,
+					     NULL);
+		for (i = 0; i < nobjs && rc == 0; i++)
+			for (off = 0; off < mib && rc == 0; off++)
+				rc = write_one(oh[i], r, buf, 1 << 20,
+					       off << 20);
+		if (rc == 0)
+			rc = iod_trans_finish(coh, r, NULL, 0, NULL);
+	}
+	fg_tid = tid = rewrites + 1;
+	if (rc == 0)
+		rc = iod_trans_start(coh, &tid, NULL, 0, IOD_TRANS_WR, NULL);
+	if (rc == 0)
+		rc = iod_eq_create(&eqh);
+	if (rc == 0)
+		rc = iod_event_init(&ev, eqh);
+	if (rc != 0) {
+		fprintf(stderr, "setup failed: %d\n", rc);
+		return 1;
+	}
+
+	for (i = 0; i < IDLE_WRITES && rc == 0; i++)
+		rc = fg_write(buf);
+	if (rc == 0)
+		report("idle");
+
+	nlat = 0;
+	t0 = now();
+	if (rc == 0)
+		rc = iod_trans_persist(coh, rewrites, NULL, &ev);
+	while (rc == 0 && (n = iod_eq_poll(eqh, 0, IOD_EQ_NOWAIT, 1,
+					    &done)) == 0)
+		rc = fg_write(buf);
+	if (rc == 0 && n == 0)
+		iod_eq_poll(eqh, 1, IOD_EQ_WAIT, 1, &done);
+	el = now() - t0;
+	if (rc == 0)
+		rc = ev.rc;
+	if (rc == 0)
+		rc = iod_container_query_stats(coh, &stats, NULL);
+	if (rc == 0) {
+		report("during persist");
+		printf("persisted %d versions of %ld MiB over %d stripes in "
+		       "%.2f s: %.1f MiB/s\n", rewrites, nobjs * mib, stripes,
+		       el, nobjs * mib * rewrites / el);
+		printf("shipped %.1f MiB, skipped %.1f MiB overwritten\n",
+		       stats.persist_bytes / 1048576.0,
+		       stats.persist_skipped / 1048576.0);
+	} else {
+		fprintf(stderr, "persist failed: %d\n", rc);
+	}
+
+	iod_trans_finish(coh, fg_tid, NULL, 0, NULL);
+	iod_event_fini(&ev);
+	iod_eq_destroy(eqh, NULL);
+	for (i = 0; i < nobjs; i++)
+		iod_obj_close(oh[i], NULL, NULL);
+	iod_obj_close(fgh, NULL, NULL);
+	iod_container_close(coh, NULL, NULL);
+	iod_container_unlink(BENCH_CONT, 1, NULL);
+	iod_finalize(NULL, NULL);
+	free(lat);
+	free(buf);
+	free(io);
+	free(md);
+	free(oh);
+	free(hints);
+	return rc == 0 ? 0 : 1;
+}
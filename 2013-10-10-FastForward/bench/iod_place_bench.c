@@ -0,0 +1,291 @@
+/*
+ * iod_place_bench: balance and resharding cost of the placement policies.
+ *
+ * For each policy -o blobs of -m MiB are written and persisted over -n
+ * central targets in stripes of -S KiB, the straw draw once with equal
+ * weights and once with weights 1, 2, 3, 4, 1, 2, ... Balance is the
+ * fullest target against its fair share of the bytes, from the space the
+ * shard files take. The layout then gains one target of weight 1 and the
+ * bytes moved by the reshard are reported against what the new target
+ * should hold, which is all any placement needs to move.
+ *
+ * usage: iod_place_bench [-n targets] [-o objects] [-m MiB] [-S stripe_KiB]
+ *                        [-b bb_root] [-c central_root]
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "iod_api.h"
+
+#define BENCH_CONT	"/iod_place_bench"
+#define DEFAULT_CENTRAL	"/tmp/iod_place_bench"
+
+static uint32_t		ntgt = 8;
+static int		nobjs = 8;
+static long		mib = 32;
+static long		stripe_kib = 16;
+static const char	*central_root;
+static iod_mem_desc_t	*md;
+static iod_blob_iodesc_t *io;
+static char		*buf;
+
+static const struct {
+	const char	*name;
+	iod_placement_t	placement;
+	int		weighted;
+} policies[] = {
+	{ "round-robin",	IOD_PLACE_ROUND_ROBIN,	0 },
+	{ "jump",		IOD_PLACE_JUMP,		0 },
+	{ "straw",		IOD_PLACE_STRAW,	0 },
+	{ "straw weighted",	IOD_PLACE_STRAW,	1 },
+};
+
+static double
+now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+blob_io(iod_handle_t oh, iod_trans_id_t tid, long off, int write)
+{
+	md->nfrag = 1;
+	md->frag[0].addr = buf;
+	md->frag[0].len = 1 << 20;
+	io->nfrag = 1;
+	io->frag[0].offset = (iod_off_t)off << 20;
+	io->frag[0].len = 1 << 20;
+	return write ? iod_blob_write(oh, tid, NULL, md, io, NULL, NULL) :
+		       iod_blob_read(oh, tid, NULL, md, io, NULL, NULL);
+}
+
+/** bytes the shard files of target \a t take on disk */
+static double
+target_bytes(uint32_t t)
+{
+	struct dirent	*de;
+	struct stat	sb;
+	char		path[PATH_MAX];
+	double		sum = 0;
+	DIR		*dir;
+
+	snprintf(path, sizeof(path), "%s%s/t%u", central_root, BENCH_CONT, t);
+	dir = opendir(path);
+	if (dir == NULL)
+		return 0;
+	while ((de = readdir(dir)) != NULL) {
+		if (de->d_name[0] == '.' || strstr(de->d_name, ".cks") != NULL)
+			continue;
+		snprintf(path, sizeof(path), "%s%s/t%u/%s", central_root,
+			 BENCH_CONT, t, de->d_name);
+		if (stat(path, &sb) == 0)
+			sum += sb.st_blocks * 512.0;
+	}
+	closedir(dir);
+	return sum;
+}
+
+/** one policy: write, persist, measure balance, add a target, verify */
+static int
+run_policy(int p, uint32_t *weights)
+{
+	iod_layout_t	layout = { IOD_LOC_CENTRAL, ntgt, 0, NULL,
+				   policies[p].placement, NULL };
+	iod_container_stats_t stats;
+	iod_trans_id_t	tid;
+	iod_handle_t	coh;
+	iod_handle_t	*oh;
+	iod_obj_id_t	oid;
+	double		total = 0;
+	double		wsum = 0;
+	double		worst = 0;
+	double		load;
+	double		t0;
+	double		el;
+	uint32_t	t;
+	long		off;
+	int		rc;
+	int		i;
+
+	oh = calloc(nobjs, sizeof(*oh));
+	if (oh == NULL)
+		return -1;
+	for (t = 0; t <= ntgt; t++)
+		weights[t] = policies[p].weighted && t < ntgt ? t % 4 + 1 : 1;
+	layout.stripe_size = stripe_kib << 10;
+	layout.target_weights = weights;
+
+	rc = iod_container_open(BENCH_CONT, NULL,
+				IOD_CONT_RW | IOD_CONT_CREATE, &coh, NULL);
+	if (rc != 0) {
+		free(oh);
+		return rc;
+	}
+	tid = 1;
+	rc = iod_trans_start(coh, &tid, NULL, 0, IOD_TRANS_WR, NULL);
+	for (i = 0; i < nobjs && rc == 0; i++) {
+		rc = iod_obj_create(coh, 1, NULL, IOD_OBJ_BLOB, NULL, NULL,
+				    &oid, NULL);
+		if (rc == 0)
+			rc = iod_obj_open_write(coh, oid, NULL, &oh[i], NULL);
+		if (rc == 0)
+			rc = iod_obj_set_layout(oh[i], 1, NULL, &layout, NULL);
+		for (off = 0; off < mib && rc == 0; off++) {
+			memset(buf, (int)(i * 31 + off), 1 << 20);
+			rc = blob_io(oh[i], 1, off, 1);
+		}
+	}
+	if (rc == 0)
+		rc = iod_trans_finish(coh, 1, NULL, 0, NULL);
+	if (rc == 0)
+		rc = iod_trans_persist(coh, 1, NULL, NULL);
+	if (rc != 0)
+		goto out;
+
+	for (t = 0; t < ntgt; t++) {
+		total += target_bytes(t);
+		wsum += weights[t];
+	}
+	for (t = 0; t < ntgt; t++) {
+		load = target_bytes(t) / (total * weights[t] / wsum);
+		if (load > worst)
+			worst = load;
+	}
+
+	/* one more target, of weight 1 */
+	layout.target_num = ntgt + 1;
+	t0 = now();
+	for (i = 0; i < nobjs && rc == 0; i++)
+		rc = iod_obj_set_layout(oh[i], 1, NULL, &layout, NULL);
+	el = now() - t0;
+	if (rc == 0)
+		rc = iod_container_query_stats(coh, &stats, NULL);
+
+	/* read it all back from central storage */
+	for (i = 0; i < nobjs && rc == 0; i++) {
+		rc = iod_obj_purge(oh[i], 1, NULL, NULL);
+		for (off = 0; off < mib && rc == 0; off++) {
+			rc = blob_io(oh[i], 1, off, 0);
+			if (rc == 0 && (buf[0] != (char)(i * 31 + off) ||
+					memcmp(buf, buf + 1, (1 << 20) - 1)))
+				rc = -1;
+		}
+	}
+	if (rc == 0)
+		printf("%-16s %10.3f  %10.1f  %8.2f%%  %8.2f%%  %8.3f\n",
+		       policies[p].name, worst,
+		       stats.reshard_bytes / 1048576.0,
+		       100.0 * stats.reshard_bytes / total,
+		       100.0 / (wsum + 1), el);
+out:
+	for (i = 0; i < nobjs; i++)
+		if (oh[i].cookie != 0)
+			iod_obj_close(oh[i], NULL, NULL);
+	iod_container_close(coh, NULL, NULL);
+	iod_container_unlink(BENCH_CONT, 1, NULL);
+	free(oh);
+	return rc;
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-n targets] [-o objects] [-m MiB] "
+		"[-S stripe_KiB] [-b bb_root] [-c central_root]\n", prog);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	iod_hint_list_t	*hints;
+	const char	*bb_root = NULL;
+	uint32_t	*weights;
+	int		nhint = 0;
+	int		opt;
+	int		rc;
+	int		p;
+
+	while ((opt = getopt(argc, argv, "n:o:m:S:b:c:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			ntgt = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			nobjs = atoi(optarg);
+			break;
+		case 'm':
+			mib = atol(optarg);
+			break;
+		case 'S':
+			stripe_kib = atol(optarg);
+			break;
+		case 'b':
+			bb_root = optarg;
+			break;
+		case 'c':
+			central_root = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (ntgt < 2 || nobjs <= 0 || mib <= 0 || stripe_kib <= 0)
+		usage(argv[0]);
+	/* the shards are looked at directly, so the root must be known */
+	if (central_root == NULL)
+		central_root = getenv("IOD_CENTRAL_ROOT");
+	if (central_root == NULL)
+		central_root = DEFAULT_CENTRAL;
+
+	hints = calloc(1, sizeof(*hints) + 2 * sizeof(hints->hint[0]));
+	weights = calloc(ntgt + 1, sizeof(*weights));
+	md = malloc(sizeof(*md) + sizeof(md->frag[0]));
+	io = malloc(sizeof(*io) + sizeof(io->frag[0]));
+	buf = malloc(1 << 20);
+	if (hints == NULL || weights == NULL || md == NULL || io == NULL ||
+	    buf == NULL)
+		return 1;
+	if (bb_root != NULL) {
+		hints->hint[nhint].key = "iod.bb_root";
+		hints->hint[nhint++].value = bb_root;
+	}
+	hints->hint[nhint].key = "iod.central_root";
+	hints->hint[nhint++].value = central_root;
+	hints->num_hint = nhint;
+
+	rc = iod_initialize(MPI_COMM_WORLD, hints, 1, 1, NULL);
+	if (rc != 0) {
+		fprintf(stderr, "setup failed: %d\n", rc);
+		return 1;
+	}
+
+	printf("%d x %ld MiB over %u targets in %ld KiB stripes, then %u\n",
+	       nobjs, mib, ntgt, stripe_kib, ntgt + 1);
+	printf("%-16s %10s  %10s  %9s  %9s  %8s\n", "placement",
+	       "max/share", "moved MiB", "moved", "minimum", "time s");
+	for (p = 0; p < (int)(sizeof(policies) / sizeof(policies[0])) &&
+		    rc == 0; p++)
+		rc = run_policy(p, weights);
+	if (rc != 0)
+		fprintf(stderr, "%s failed: %d\n", policies[p - 1].name, rc);
+
+	iod_finalize(NULL, NULL);
+	free(buf);
+	free(io);
+	free(md);
+	free(weights);
+	free(hints);
+	return rc == 0 ? 0 : 1;
+}
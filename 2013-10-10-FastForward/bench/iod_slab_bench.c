@@ -0,0 +1,293 @@
+/*
+ * iod_slab_bench: hyperslab read/write rate of iod_array_read/write.
+ *
+ * A cubic 3D array of -n cells per dimension, and a 4D array of -n/4, is
+ * written whole once; then every pattern is read -r times from that TID and
+ * written -r times into a new one, for cell sizes of 4, 8 and 16 bytes:
+ *
+ *   stencil    the interior of the cube, one cell in from every face
+ *   subsample  every other cell in all three dimensions
+ *   pencil     one cell of every plane along the slowest dimension
+ *   4d-plane   one 3D plane of the 4D array, every other cell in the last
+ *
+ * Rates count selected bytes only.
+ *
+ * usage: iod_slab_bench [-n edge] [-r reps] [-b bb_root] [-c central_root]
+ */
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "iod_api.h"
+
+#define BENCH_CONT	"/iod_slab_bench"
+
+struct slab_pat {
+	const char	*sp_name;
+	int		sp_ndims;
+	/* fill start/count/stride/block for an array of edge n */
+	void		(*sp_fill)(iod_size_t n, iod_size_t *start,
+				   iod_size_t *count, iod_size_t *stride,
+				   iod_size_t *block);
+};
+
+static iod_size_t	edge = 128;
+static int		reps = 10;
+
+static double
+now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+pat_stencil(iod_size_t n, iod_size_t *start, iod_size_t *count,
+	    iod_size_t *stride, iod_size_t *block)
+{
+	int	d;
+
+	for (d = 0; d < 3; d++) {
+		start[d] = 1;
+		count[d] = n - 2;
+		stride[d] = 1;
+		block[d] = 1;
+	}
+}
+
+static void
+pat_subsample(iod_size_t n, iod_size_t *start, iod_size_t *count,
+	      iod_size_t *stride, iod_size_t *block)
+{
+	int	d;
+
+	for (d = 0; d < 3; d++) {
+		start[d] = 0;
+		count[d] = n / 2;
+		stride[d] = 2;
+		block[d] = 1;
+	}
+}
+
+static void
+pat_pencil(iod_size_t n, iod_size_t *start, iod_size_t *count,
+	   iod_size_t *stride, iod_size_t *block)
+{
+	int	d;
+
+	for (d = 0; d < 3; d++) {
+		start[d] = d == 0 ? 0 : n / 2;
+		count[d] = d == 0 ? n : 1;
+		stride[d] = 1;
+		block[d] = 1;
+	}
+}
+
+static void
+pat_4d_plane(iod_size_t n, iod_size_t *start, iod_size_t *count,
+	     iod_size_t *stride, iod_size_t *block)
+{
+	int	d;
+
+	for (d = 0; d < 4; d++) {
+		start[d] = d == 0 ? n / 2 : 0;
+		count[d] = d == 0 ? 1 : d == 3 ? n / 2 : n;
+		stride[d] = d == 3 ? 2 : 1;
+		block[d] = 1;
+	}
+}
+
+static const struct slab_pat pats[] = {
+	{ "stencil",	3, pat_stencil },
+	{ "subsample",	3, pat_subsample },
+	{ "pencil",	3, pat_pencil },
+	{ "4d-plane",	4, pat_4d_plane },
+};
+
+static int
+run(iod_handle_t coh, const struct slab_pat *pat, uint32_t cell)
+{
+	iod_array_struct_t	as;
+	iod_hyperslab_t		slab;
+	iod_mem_desc_t		*md;
+	iod_obj_id_t		oid;
+	iod_trans_id_t		tid = IOD_TID_UNKNOWN;
+	iod_trans_id_t		wtid = IOD_TID_UNKNOWN;
+	iod_handle_t		oh;
+	iod_size_t		n = pat->sp_ndims == 4 ? edge / 4 : edge;
+	iod_size_t		dims[4];
+	iod_size_t		start[4];
+	iod_size_t		count[4];
+	iod_size_t		stride[4];
+	iod_size_t		block[4];
+	iod_size_t		full[4];
+	iod_size_t		cells = 1;
+	iod_size_t		sel = 1;
+	double			t0;
+	double			rt;
+	double			wt;
+	char			*buf;
+	int			d;
+	int			i;
+	int			rc;
+
+	for (d = 0; d < pat->sp_ndims; d++) {
+		dims[d] = n;
+		full[d] = n;
+		cells *= n;
+	}
+	pat->sp_fill(n, start, count, stride, block);
+	for (d = 0; d < pat->sp_ndims; d++)
+		sel *= count[d] * block[d];
+
+	as.cell_size = cell;
+	as.num_dims = pat->sp_ndims;
+	as.current_dims = dims;
+	as.chunk_dims = NULL;
+	as.dims_seq = NULL;
+	as.firstdim_max = 0;
+
+	buf = malloc(cells * cell);
+	md = malloc(sizeof(*md) + sizeof(md->frag[0]));
+	if (buf == NULL || md == NULL) {
+		rc = -1;
+		goto out;
+	}
+	memset(buf, 0x5a, cells * cell);
+	md->nfrag = 1;
+	md->frag[0].addr = buf;
+
+	rc = iod_trans_start(coh, &tid, NULL, 0, IOD_TRANS_WR, NULL);
+	if (rc == 0)
+		rc = iod_obj_create(coh, tid, NULL, IOD_OBJ_ARRAY, NULL, &as,
+				    &oid, NULL);
+	if (rc == 0)
+		rc = iod_obj_open_write(coh, oid, NULL, &oh, NULL);
+	if (rc != 0)
+		goto out;
+	slab.start = start;
+	slab.count = full;
+	slab.stride = NULL;
+	slab.block = NULL;
+	memset(start, 0, sizeof(start));
+	md->frag[0].len = cells * cell;
+	rc = iod_array_write(oh, tid, NULL, md, &slab, NULL, NULL);
+	if (rc == 0)
+		rc = iod_trans_finish(coh, tid, NULL, 0, NULL);
+
+	pat->sp_fill(n, start, count, stride, block);
+	slab.count = count;
+	slab.stride = stride;
+	slab.block = block;
+	md->frag[0].len = sel * cell;
+
+	t0 = now();
+	for (i = 0; i < reps && rc == 0; i++)
+		rc = iod_array_read(oh, tid, NULL, md, &slab, NULL, NULL);
+	rt = now() - t0;
+
+	if (rc == 0)
+		rc = iod_trans_start(coh, &wtid, NULL, 0, IOD_TRANS_WR, NULL);
+	t0 = now();
+	for (i = 0; i < reps && rc == 0; i++)
+		rc = iod_array_write(oh, wtid, NULL, md, &slab, NULL, NULL);
+	wt = now() - t0;
+	if (wtid != IOD_TID_UNKNOWN)
+		iod_trans_finish(coh, wtid, NULL, 0, NULL);
+	iod_obj_close(oh, NULL, NULL);
+
+	if (rc == 0)
+		printf("%-10s %2u B  read %8.3f GB/s %9.1f us  "
+		       "write %8.3f GB/s %9.1f us  (%llu cells)\n",
+		       pat->sp_name, cell,
+		       (double)sel * cell * reps / rt / 1e9, rt / reps * 1e6,
+		       (double)sel * cell * reps / wt / 1e9, wt / reps * 1e6,
+		       (unsigned long long)sel);
+out:
+	if (rc != 0)
+		fprintf(stderr, "%s/%u: failed: %d\n", pat->sp_name, cell, rc);
+	free(md);
+	free(buf);
+	return rc;
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-n edge] [-r reps] [-b bb_root] "
+		"[-c central_root]\n", prog);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const uint32_t	cell[] = { 4, 8, 16 };
+	iod_hint_list_t		*hints;
+	iod_handle_t		coh;
+	const char		*bb_root = NULL;
+	const char		*central_root = NULL;
+	unsigned int		p;
+	unsigned int		c;
+	int			nhint = 0;
+	int			opt;
+	int			rc;
+
+	while ((opt = getopt(argc, argv, "n:r:b:c:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			edge = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			reps = atoi(optarg);
+			break;
+		case 'b':
+			bb_root = optarg;
+			break;
+		case 'c':
+			central_root = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (edge < 8 || reps <= 0)
+		usage(argv[0]);
+
+	hints = calloc(1, sizeof(*hints) + 2 * sizeof(hints->hint[0]));
+	if (hints == NULL)
+		return 1;
+	if (bb_root != NULL) {
+		hints->hint[nhint].key = "iod.bb_root";
+		hints->hint[nhint++].value = bb_root;
+	}
+	if (central_root != NULL) {
+		hints->hint[nhint].key = "iod.central_root";
+		hints->hint[nhint++].value = central_root;
+	}
+	hints->num_hint = nhint;
+
+	rc = iod_initialize(MPI_COMM_WORLD, hints, 1, 1, NULL);
+	if (rc == 0)
+		rc = iod_container_open(BENCH_CONT, NULL,
+					IOD_CONT_RW | IOD_CONT_CREATE, &coh,
+					NULL);
+	if (rc != 0) {
+		fprintf(stderr, "setup failed: %d\n", rc);
+		return 1;
+	}
+	for (p = 0; p < sizeof(pats) / sizeof(pats[0]) && rc == 0; p++)
+		for (c = 0; c < sizeof(cell) / sizeof(cell[0]) && rc == 0; c++)
+			rc = run(coh, &pats[p], cell[c]);
+	iod_container_close(coh, NULL, NULL);
+	iod_container_unlink(BENCH_CONT, 1, NULL);
+	iod_finalize(NULL, NULL);
+	free(hints);
+	return rc == 0 ? 0 : 1;
+}
@@ -0,0 +1,237 @@
+/*
+ * iod_trans_bench: overhead of multi-leader transactions without MPI.
+ *
+ * -t threads stand in for 256 up to -n ranks, each thread driving every
+ * -t'th rank, the leader being the last one. The leader starts a write TID
+ * with num_ranks set, then all other ranks join it, and then all of them
+ * finish it, passing their rank as a hint; -r TIDs are run per rank
+ * count. Finishes are counted once flat at one place (fan-out 0) and once
+ * through sub-coordinators of -f ranks each. Times are per TID, from the
+ * first start to the TID turning readable.
+ *
+ * usage: iod_trans_bench [-n max_ranks] [-t threads] [-f fanout] [-r reps]
+ *                        [-b bb_root] [-c central_root]
+ */
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "iod_api.h"
+
+#define BENCH_CONT	"/iod_trans_bench"
+
+static unsigned int	max_ranks = 65536;
+static int		nthreads = 8;
+static int		reps = 5;
+static iod_handle_t	coh;
+static pthread_barrier_t bar;
+static unsigned int	num_ranks;
+static iod_trans_id_t	tid;
+static double		t_start;	/* every rank started */
+static int		failed;
+
+static double
+now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *
+rank_thread(void *arg)
+{
+	iod_hint_list_t	*hints;
+	iod_trans_id_t	t;
+	char		buf[16];
+	unsigned int	r;
+
+	hints = calloc(1, sizeof(*hints) + sizeof(hints->hint[0]));
+	if (hints == NULL)
+		abort();
+	hints->num_hint = 1;
+	hints->hint[0].key = "rank";
+	hints->hint[0].value = buf;
+
+	for (r = (long)arg; r < num_ranks - 1; r += nthreads) {
+		t = tid;
+		if (iod_trans_start(coh, &t, NULL, num_ranks, IOD_TRANS_WR,
+				    NULL) != 0)
+			__atomic_store_n(&failed, 1, __ATOMIC_RELAXED);
+	}
+	if (pthread_barrier_wait(&bar) == PTHREAD_BARRIER_SERIAL_THREAD)
+		t_start = now();
+	pthread_barrier_wait(&bar);
+	for (r = (long)arg; r < num_ranks - 1; r += nthreads) {
+		snprintf(buf, sizeof(buf), "%u", r);
+		if (iod_trans_finish(coh, tid, hints, 0, NULL) != 0)
+			__atomic_store_n(&failed, 1, __ATOMIC_RELAXED);
+	}
+	free(hints);
+	return NULL;
+}
+
+/** run one TID over \a n ranks, return start and finish times */
+static int
+run_tid(unsigned int n, const char *fanout, double *start, double *finish)
+{
+	iod_hint_list_t		*hints;
+	iod_container_tids_t	tids;
+	iod_trans_status_t	st;
+	pthread_t		*th;
+	char			buf[16];
+	double			t0;
+	long			i;
+	int			rc;
+
+	hints = calloc(1, sizeof(*hints) + sizeof(hints->hint[0]));
+	th = calloc(nthreads, sizeof(*th));
+	if (hints == NULL || th == NULL)
+		return -1;
+	hints->num_hint = 1;
+	hints->hint[0].key = "fanout";
+	hints->hint[0].value = fanout;
+
+	rc = iod_container_query_tids(coh, &tids, NULL);
+	if (rc != 0)
+		goto out;
+	num_ranks = n;
+	tid = tids.latest_wrting + 1;
+	t0 = now();
+	/* the first start picks the fan-out, the threads join it */
+	rc = iod_trans_start(coh, &tid, hints, n, IOD_TRANS_WR, NULL);
+	if (rc != 0)
+		goto out;
+	pthread_barrier_init(&bar, NULL, nthreads);
+	for (i = 0; i < nthreads; i++)
+		pthread_create(&th[i], NULL, rank_thread, (void *)i);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(th[i], NULL);
+	pthread_barrier_destroy(&bar);
+	/* the leader's own finish, as rank n - 1 */
+	snprintf(buf, sizeof(buf), "%u", n - 1);
+	hints->hint[0].key = "rank";
+	hints->hint[0].value = buf;
+	rc = iod_trans_finish(coh, tid, hints, 0, NULL);
+	*finish = now() - t_start;
+	*start = t_start - t0;
+	if (rc == 0)
+		rc = iod_trans_query(coh, tid, &st, NULL);
+	if (rc == 0 && (failed || st != IOD_TRANS_READABLE))
+		rc = -1;
+out:
+	free(th);
+	free(hints);
+	return rc;
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-n max_ranks] [-t threads] [-f fanout] "
+		"[-r reps] [-b bb_root] [-c central_root]\n", prog);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	iod_hint_list_t	*hints;
+	const char	*bb_root = NULL;
+	const char	*central_root = NULL;
+	const char	*fanout = "32";
+	double		start[2];
+	double		finish[2];
+	double		s = 0;
+	double		f = 0;
+	unsigned int	n;
+	int		nhint = 0;
+	int		opt;
+	int		rc;
+	int		i;
+	int		k;
+
+	while ((opt = getopt(argc, argv, "n:t:f:r:b:c:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			max_ranks = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		case 'f':
+			fanout = optarg;
+			break;
+		case 'r':
+			reps = atoi(optarg);
+			break;
+		case 'b':
+			bb_root = optarg;
+			break;
+		case 'c':
+			central_root = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (max_ranks < 256 || nthreads <= 0 || reps <= 0)
+		usage(argv[0]);
+
+	hints = calloc(1, sizeof(*hints) + 2 * sizeof(hints->hint[0]));
+	if (hints == NULL)
+		return 1;
+	if (bb_root != NULL) {
+		hints->hint[nhint].key = "iod.bb_root";
+		hints->hint[nhint++].value = bb_root;
+	}
+	if (central_root != NULL) {
+		hints->hint[nhint].key = "iod.central_root";
+		hints->hint[nhint++].value = central_root;
+	}
+	hints->num_hint = nhint;
+
+	rc = iod_initialize(MPI_COMM_WORLD, hints, 1, 1, NULL);
+	if (rc == 0)
+		rc = iod_container_open(BENCH_CONT, NULL,
+					IOD_CONT_RW | IOD_CONT_CREATE, &coh,
+					NULL);
+	if (rc != 0) {
+		fprintf(stderr, "setup failed: %d\n", rc);
+		return 1;
+	}
+
+	printf("%8s  %12s  %14s  %14s  %8s\n", "ranks", "start ms",
+	       "finish flat ms", "finish tree ms", "speedup");
+	for (n = 256; n <= max_ranks && rc == 0; n *= 4) {
+		for (k = 0; k < 2; k++) {
+			start[k] = 0;
+			finish[k] = 0;
+			for (i = 0; i < reps && rc == 0; i++) {
+				rc = run_tid(n, k == 0 ? "0" : fanout, &s, &f);
+				start[k] += s;
+				finish[k] += f;
+			}
+		}
+		if (rc != 0)
+			break;
+		printf("%8u  %12.3f  %14.3f  %14.3f  %7.2fx\n", n,
+		       (start[0] + start[1]) / (2 * reps) * 1e3,
+		       finish[0] / reps * 1e3, finish[1] / reps * 1e3,
+		       finish[0] / finish[1]);
+	}
+	if (rc != 0)
+		fprintf(stderr, "transaction failed: %d\n", rc);
+
+	iod_container_close(coh, NULL, NULL);
+	iod_container_unlink(BENCH_CONT, 1, NULL);
+	iod_finalize(NULL, NULL);
+	free(hints);
+	return rc == 0 ? 0 : 1;
+}
@@ -0,0 +1,336 @@
+/*
+ * iod_xfer_bench: blob writes handed to IOD in place, against the same
+ * writes staged in one buffer first.
+ *
+ * IOD runs in the client's address space, so iod_blob_write_list reads the
+ * fragments of each iod_mem_desc_t where they are: into the data log by
+ * pwritev, and into the write-ahead log record of a small write. Each of
+ * -n requests makes -k writes of -s bytes, in -f fragments each. The staged
+ * path first copies the fragments of every write into a buffer of its own
+ * and writes that as one fragment, the copy the write-ahead log path used
+ * to make. The requests are timed both ways, each way in a TID of its own,
+ * and read back. "-w 0" runs without the write-ahead log.
+ *
+ * usage: iod_xfer_bench [-n requests] [-k writes] [-s size] [-f frags]
+ *                       [-w wal] [-b bb_root] [-c central_root]
+ */
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "iod_api.h"
+
+#define BENCH_CONT	"/iod_xfer_bench"
+
+/* the iod_blob_write_list arguments of one request */
+struct xfer_list {
+	iod_blob_io_t	*xl_bw;
+	char		*xl_md;		/* -k descriptors of -f fragments */
+	char		*xl_io;		/* -k descriptors of one fragment */
+};
+
+static iod_handle_t	coh;
+static iod_handle_t	oh;
+static iod_trans_id_t	tid;
+static unsigned long	nreq = 2000;
+static unsigned long	per_req = 16;
+static size_t		size = 4096;
+static unsigned long	nfrag = 4;
+
+static double
+now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t
+md_size(void)
+{
+	return sizeof(iod_mem_desc_t) + nfrag * sizeof(iod_mem_frag_t);
+}
+
+static size_t
+io_size(void)
+{
+	return sizeof(iod_blob_iodesc_t) + sizeof(iod_blob_iofrag_t);
+}
+
+static int
+list_init(struct xfer_list *xl)
+{
+	xl->xl_bw = calloc(per_req, sizeof(*xl->xl_bw));
+	xl->xl_md = malloc(per_req * md_size());
+	xl->xl_io = malloc(per_req * io_size());
+	return xl->xl_bw == NULL || xl->xl_md == NULL || xl->xl_io == NULL ?
+	       -1 : 0;
+}
+
+static void
+list_fini(struct xfer_list *xl)
+{
+	free(xl->xl_io);
+	free(xl->xl_md);
+	free(xl->xl_bw);
+}
+
+/*
+ * write \a nr writes from \a buf, the first of them write \a first of the
+ * run that starts at object offset \a base. With \a stage set the fragments
+ * of each write are first copied into \a stage.
+ */
+static int
+list_write(struct xfer_list *xl, char *buf, char *stage, iod_off_t base,
+	   unsigned long first, unsigned long nr)
+{
+	iod_blob_iodesc_t	*io;
+	iod_mem_desc_t		*md;
+	size_t			flen = size / nfrag;
+	size_t			len;
+	unsigned long		i;
+	unsigned long		j;
+
+	for (i = 0; i < nr; i++) {
+		md = (iod_mem_desc_t *)(xl->xl_md + i * md_size());
+		io = (iod_blob_iodesc_t *)(xl->xl_io + i * io_size());
+		md->nfrag = stage != NULL ? 1 : nfrag;
+		for (j = 0; j < nfrag; j++) {
+			len = j + 1 < nfrag ? flen : size - j * flen;
+			if (stage != NULL)
+				memcpy(stage + i * size + j * flen,
+				       buf + i * size + j * flen, len);
+			else
+				md->frag[j].addr = buf + i * size + j * flen;
+			md->frag[j].len = len;
+		}
+		if (stage != NULL) {
+			md->frag[0].addr = stage + i * size;
+			md->frag[0].len = size;
+		}
+		io->nfrag = 1;
+		io->frag[0].offset = base + (first + i) * size;
+		io->frag[0].len = size;
+		xl->xl_bw[i].oh = oh;
+		xl->xl_bw[i].mem_desc = md;
+		xl->xl_bw[i].io_desc = io;
+	}
+	return iod_blob_write_list(coh, tid, nr, xl->xl_bw, NULL);
+}
+
+/* every byte of write w is (w + i) & 0xff, i the byte index */
+static void
+fill(char *buf, unsigned long first, unsigned long nr)
+{
+	unsigned long	i;
+	size_t		j;
+
+	for (i = 0; i < nr; i++)
+		for (j = 0; j < size; j++)
+			buf[i * size + j] = (char)(first + i + j);
+}
+
+/* the run at \a base reads back as written */
+static int
+check(iod_off_t base)
+{
+	iod_mem_desc_t		*md;
+	iod_blob_iodesc_t	*io;
+	unsigned long		i;
+	char			*exp;
+	char			*buf;
+	int			rc = -1;
+
+	buf = malloc(per_req * size);
+	exp = malloc(per_req * size);
+	md = malloc(sizeof(*md) + sizeof(md->frag[0]));
+	io = malloc(sizeof(*io) + sizeof(io->frag[0]));
+	if (buf == NULL || exp == NULL || md == NULL || io == NULL)
+		goto out;
+	md->nfrag = 1;
+	md->frag[0].addr = buf;
+	md->frag[0].len = per_req * size;
+	io->nfrag = 1;
+	io->frag[0].len = per_req * size;
+	for (i = 0, rc = 0; i < nreq && rc == 0; i++) {
+		io->frag[0].offset = base + i * per_req * size;
+		rc = iod_blob_read(oh, tid, NULL, md, io, NULL, NULL);
+		fill(exp, i * per_req, per_req);
+		if (rc == 0 && memcmp(buf, exp, per_req * size) != 0)
+			rc = -1;
+	}
+out:
+	free(io);
+	free(md);
+	free(exp);
+	free(buf);
+	return rc;
+}
+
+static int
+run(int staged, iod_off_t base, double *t)
+{
+	struct xfer_list	xl = { 0 };
+	unsigned long		i;
+	double			t0;
+	char			*stage = NULL;
+	char			*buf;
+	int			rc;
+
+	buf = malloc(per_req * size);
+	if (staged)
+		stage = malloc(per_req * size);
+	if (buf == NULL || (staged && stage == NULL) ||
+	    list_init(&xl) != 0) {
+		rc = -1;
+		goto out;
+	}
+	tid = IOD_TID_UNKNOWN;
+	rc = iod_trans_start(coh, &tid, NULL, 0, IOD_TRANS_WR, NULL);
+	if (rc != 0)
+		goto out;
+
+	*t = 0;
+	for (i = 0; i < nreq && rc == 0; i++) {
+		/* the client makes its data, outside the timing */
+		fill(buf, i * per_req, per_req);
+		t0 = now();
+		rc = list_write(&xl, buf, stage, base, i * per_req, per_req);
+		*t += now() - t0;
+	}
+
+	if (rc == 0)
+		rc = iod_trans_finish(coh, tid, NULL, 0, NULL);
+	if (rc == 0)
+		rc = check(base);
+out:
+	list_fini(&xl);
+	free(stage);
+	free(buf);
+	return rc;
+}
+
+static void
+report(const char *path, double t)
+{
+	printf("%-10s  %10.3f  %12.0f  %10.2f  %10.1f\n", path, t * 1e3,
+	       nreq / t, t / (nreq * per_req) * 1e6,
+	       nreq * per_req * size / t / 1048576);
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-n requests] [-k writes] [-s size] "
+		"[-f frags] [-w wal] [-b bb_root] [-c central_root]\n", prog);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	iod_hint_list_t	*hints;
+	iod_obj_id_t	oid;
+	const char	*bb_root = NULL;
+	const char	*central_root = NULL;
+	const char	*wal = NULL;
+	iod_off_t	span;
+	double		tmem = 0;
+	double		tstage = 0;
+	int		nhint = 0;
+	int		opt;
+	int		rc;
+
+	while ((opt = getopt(argc, argv, "n:k:s:f:w:b:c:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			nreq = strtoul(optarg, NULL, 0);
+			break;
+		case 'k':
+			per_req = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			nfrag = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			wal = optarg;
+			break;
+		case 'b':
+			bb_root = optarg;
+			break;
+		case 'c':
+			central_root = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nreq == 0 || per_req == 0 || nfrag == 0 || size < nfrag ||
+	    per_req * nfrag >= 1024)
+		usage(argv[0]);
+
+	hints = calloc(1, sizeof(*hints) + 3 * sizeof(hints->hint[0]));
+	if (hints == NULL)
+		return 1;
+	if (wal != NULL) {
+		hints->hint[nhint].key = "iod.wal";
+		hints->hint[nhint++].value = wal;
+	}
+	if (bb_root != NULL) {
+		hints->hint[nhint].key = "iod.bb_root";
+		hints->hint[nhint++].value = bb_root;
+	}
+	if (central_root != NULL) {
+		hints->hint[nhint].key = "iod.central_root";
+		hints->hint[nhint++].value = central_root;
+	}
+	hints->num_hint = nhint;
+
+	tid = IOD_TID_UNKNOWN;
+	rc = iod_initialize(MPI_COMM_WORLD, hints, 1, 1, NULL);
+	if (rc == 0)
+		rc = iod_container_open(BENCH_CONT, NULL,
+					IOD_CONT_RW | IOD_CONT_CREATE, &coh,
+					NULL);
+	if (rc == 0)
+		rc = iod_trans_start(coh, &tid, NULL, 0, IOD_TRANS_WR, NULL);
+	if (rc == 0)
+		rc = iod_obj_create(coh, tid, NULL, IOD_OBJ_BLOB, NULL, NULL,
+				    &oid, NULL);
+	if (rc == 0)
+		rc = iod_trans_finish(coh, tid, NULL, 0, NULL);
+	if (rc == 0)
+		rc = iod_obj_open_write(coh, oid, NULL, &oh, NULL);
+	if (rc != 0) {
+		fprintf(stderr, "setup failed: %d\n", rc);
+		return 1;
+	}
+
+	span = nreq * per_req * size;
+	rc = run(0, 0, &tmem);
+	if (rc == 0)
+		rc = run(1, span, &tstage);
+	if (rc == 0) {
+		printf("%-10s  %10s  %12s  %10s  %10s\n", "path", "ms",
+		       "requests/s", "us/write", "MiB/s");
+		report("in place", tmem);
+		report("staged", tstage);
+	} else {
+		fprintf(stderr, "xfer run failed: %d\n", rc);
+	}
+
+	iod_obj_close(oh, NULL, NULL);
+	iod_container_close(coh, NULL, NULL);
+	iod_container_unlink(BENCH_CONT, 1, NULL);
+	iod_finalize(NULL, NULL);
+	free(hints);
+	return rc == 0 ? 0 : 1;
+}
@@ -116,9 +116,9 @@ iod_container_unlink(const char *path, int force, iod_event_t *event);
 /**
  * Get list of objects within an IOD container at a particular TID.
  *
- * It can be called by any processes, commonly should be called by single
- * process as multiple processes' concurrent calling possibly will lead to
- * performance downgrade.
+ * It can be called by any processes. The listing is a snapshot read of a
+ * multi-version catalog: it takes no lock, so concurrent callers neither wait
+ * for each other nor hold up object creations, unlinks or commits.
  *
  * The \a tid can be gotten from iod_container_query_tids, or set as zero which
  * means to list this container's latest readable tid.
@@ -148,6 +148,41 @@ iod_container_list_obj(iod_handle_t coh, iod_trans_id_t tid,
 		       iod_obj_id_t *oid, iod_obj_type_t *type, char *name,
 		       iod_event_t *event);
 
+/**
+ * Get list of objects created, modified or unlinked between two TIDs of an
+ * IOD container, for incremental backup and the like.
+ *
+ * An object is listed once, by what it became from \a from_tid to \a to_tid:
+ * IOD_OBJ_CREATED if it did not exist at \a from_tid, IOD_OBJ_UNLINKED if it
+ * does not exist at \a to_tid, IOD_OBJ_MODIFIED otherwise. Objects both
+ * created and unlinked in between are not listed. Objects are found from the
+ * TIDs the object catalog keeps for each of them, skipping whole parts of the
+ * catalog nothing changed in after \a from_tid, so the cost follows where the
+ * changes are rather than the number of objects in the container.
+ *
+ * \param coh [IN]	container handle
+ * \param from_tid [IN]	TID the changes are counted from, zero for since
+ *			the container was created
+ * \param to_tid [IN]	readable TID the changes are counted up to, zero for
+ *			the latest readable TID
+ * \param filter [IN]	object type filter, as for iod_container_list_obj
+ * \param offset [IN]	offset in the list, ordered by object ID from lower to
+ *			higher
+ * \param num [IN]	how many objects to list
+ * \param oid [IN/OUT]	returned object ID list, user provides the memory.
+ * \param type [IN/OUT]	returned object type list, can be NULL.
+ * \param change [IN/OUT] returned change list, can be NULL.
+ * \param event [IN]	pointer to completion event
+ * \return		number of objects stored on success, negative value if
+ *			error
+ */
+iod_ret_t
+iod_container_diff_obj(iod_handle_t coh, iod_trans_id_t from_tid,
+		       iod_trans_id_t to_tid, iod_obj_type_t filter,
+		       iod_off_t offset, iod_size_t num, iod_obj_id_t *oid,
+		       iod_obj_type_t *type, iod_obj_change_t *change,
+		       iod_event_t *event);
+
 
 /* SECTION 2 ***** OBJECT FUNCTIONS ********************/
 
@@ -180,7 +215,8 @@ iod_obj_create(iod_handle_t coh, iod_trans_id_t tid, iod_hint_list_t *hints,
 
 /**
  * Create a set of IOD objects within one transaction.
- * It is a wrapper inside which looply calls iod_obj_create.
+ * The whole list is created under one container lock, and the creations
+ * go to the write-ahead log as one record.
  *
  * \param coh [IN]		container handle
  * \param tid [IN]		transaction ID
@@ -217,7 +253,7 @@ iod_obj_open_write(iod_handle_t coh, iod_obj_id_t oid, iod_hint_list_t *hints,
 
 /**
  * Open a set of IOD objects for writing.
- * It is a wrapper inside which looply calls iod_obj_open_write.
+ * The objects are looked up under one container lock.
  *
  * \param coh [IN]		container handle
  * \param num [IN]		number of objects to open
@@ -250,7 +286,8 @@ iod_array_write(iod_handle_t oh, iod_trans_id_t tid, iod_hint_list_t *hints,
 
 /**
  * Write to a set of IOD array objects within one transaction.
- * It is a wrapper inside which looply calls iod_obj_write_struct.
+ * The entries are checked against their transaction under one container
+ * lock, then written one by one.
  *
  * \param coh [IN]		container handle
  * \param tid [IN]		transaction ID
@@ -285,6 +322,10 @@ iod_blob_write(iod_handle_t oh, iod_trans_id_t tid,
 
 /**
  * write to a set of IOD blob objects within one transaction.
+ * The entries are checked against the transaction under one container lock,
+ * the entries for one object are appended to its data log together, and the
+ * list goes to the write-ahead log as one record, so that it completes with
+ * one sync.
  *
  * \param coh [IN]		container handle
  * \param tid [IN]		transaction ID
@@ -318,7 +359,7 @@ iod_obj_open_read(iod_handle_t coh, iod_obj_id_t oid, iod_hint_list_t *hints,
 
 /**
  * Open a set of IOD objects for read.
- * It is a wrapper inside which looply calls iod_obj_open_read.
+ * The objects are looked up under one container lock.
  *
  * \param coh [IN]		container handle
  * \param num [IN]		how many object to read
@@ -352,7 +393,8 @@ iod_array_read(iod_handle_t oh, iod_trans_id_t tid,
 
 /**
  * Read from a set of IOD array objects within one transaction.
- * It is a wrapper inside which looply calls iod_obj_read_struct.
+ * The entries are checked against their transaction under one container
+ * lock, then read one by one.
  *
  * \param coh [IN]		container handle
  * \param tid [IN]		transaction ID
@@ -421,7 +463,7 @@ iod_obj_close(iod_handle_t oh, iod_hint_list_t *hints, iod_event_t *event);
 
 /**
  * Close a set of IOD objects within one container.
- * It is a wrapper inside which looply calls iod_obj_close.
+ * The handles of the container are released under one container lock.
  *
  * \param coh [IN]		container handle
  * \param num [IN]		how many objects to close
@@ -474,10 +516,13 @@ iod_array_get_struct_list(iod_handle_t coh, iod_trans_id_t tid,
  * It will fail for fixed dimensional array, or \a firstdim_len >
  * firstdim_max.
  *
- * Only single rank should call it to extend array object. Caller should aware
- * the possible race here: when one rank extends array, previous gotten array
- * structure (by calling iod_array_get_struct) by other ranks will be invalid.
- * TODO: needs to support shink?
+ * Extending only records the new length in the transaction, existing data is
+ * never moved or rewritten. Any number of ranks can extend the same array in
+ * one transaction: the array gets the largest length asked for, and shorter
+ * ones are not an error. It fails with -EINVAL if \a firstdim_len is shorter
+ * than the length before this transaction, arrays do not shrink. An array
+ * structure gotten earlier by iod_array_get_struct may be shorter than the
+ * array is after an extend.
  *
  * \param oh [IN]		object handle
  * \param tid [IN]		transaction ID
@@ -507,18 +552,49 @@ iod_ret_t
 iod_array_extend_list(iod_handle_t coh, iod_trans_id_t tid, iod_size_t num,
 		      iod_obj_extend_t *obj_extend, iod_event_t *event);
 
+/**
+ * Reserve \a count entries of the first dimension of one IOD ARRAY object for
+ * appending, and extend the array in \a tid to cover them.
+ *
+ * Reservations come after every entry any transaction extended the array to
+ * or reserved before, and concurrent ranks always get disjoint ranges, so
+ * each rank can then write its own hyperslab, as with time steps appended by
+ * many ranks. Neither the reservation nor the writes of a transaction to an
+ * array it already changed go through a container-wide lock. An array created
+ * with firstdim_max IOD_DIMLEN_UNLIMITED grows until its byte size no longer
+ * fits an iod_off_t. It fails with -EINVAL past firstdim_max.
+ *
+ * \param oh [IN]		object handle, opened for writing
+ * \param tid [IN]		transaction ID
+ * \param count [IN]		how many first dimension entries to reserve
+ * \param start [OUT]		first reserved entry
+ * \param event [IN]		completion event pointer
+ *
+ * \return			zero on success, negative value if error
+ */
+iod_ret_t
+iod_array_reserve(iod_handle_t oh, iod_trans_id_t tid, iod_size_t count,
+		  iod_size_t *start, iod_event_t *event);
+
 /**
  * Set one IOD object's layout on storage system.
  *
  * This routine is only for setting object's layout on BB or central storage.
- * It will not start/trigger data movement. Only single rank should call it.
+ * It will not start/trigger migration. Only single rank should call it.
  *
  * Common usage is user can first set the layout, when iod_trans_persist IOD
  * will based on this setted layout to determine data placement when migrating
  * this object to DAOS. At that time IOD will migrate object's data with the
- * dimension sequence of \a layout.dims_seq, all split shards will be
- * round-robin placed on \a layout.target_num's targets with stripe size of
- * \a layout.stripe_size.
+ * dimension sequence of \a layout.dims_seq, all split shards will be placed
+ * on \a layout.target_num's targets by \a layout.placement with stripe size
+ * of \a layout.stripe_size.
+ *
+ * Shards the object already has on central storage are moved to the targets
+ * the new layout gives them before this returns. With IOD_PLACE_JUMP or
+ * IOD_PLACE_STRAW on both sides only the shards whose target changes move,
+ * which for one target added to N is about 1/(N+1) of them.
+ * \a layout.target_weights is only read for IOD_PLACE_STRAW, and an unknown
+ * \a layout.placement fails with -EINVAL.
  *
  * \param oh [IN]		object handle
  * \param tid [IN]		transaction ID
@@ -537,6 +613,10 @@ iod_obj_set_layout(iod_handle_t oh, iod_trans_id_t tid, iod_hint_list_t *hints,
  *
  * Any rank can call it, commonly single rank calls it to query.
  *
+ * \a layout.dims_seq, if not NULL, is filled in too, and so is
+ * \a layout.target_weights if the object is placed by IOD_PLACE_STRAW; the
+ * weights need room for target_num entries. Zero-initialize \a layout.
+ *
  * \param oh [IN]		object handle
  * \param tid [IN]		transaction ID, must be readable
  * \param layout [IN/OUT]	returned object layout
@@ -679,12 +759,26 @@ iod_ret_t
 iod_container_query_tids(iod_handle_t coh, iod_container_tids_t *tids,
 			 iod_event_t *event);
 
+/**
+ * Query the engine counters of an IOD container.
+ *
+ * \param coh [IN]		container handle
+ * \param stats [IN/OUT]	pointer to container counters
+ * \param event [IN]		pointer to completion event
+ *
+ * \return			zero on success, negative value if error
+ */
+iod_ret_t
+iod_container_query_stats(iod_handle_t coh, iod_container_stats_t *stats,
+			  iod_event_t *event);
+
 /**
  * Query one TID's status.
  *
  * Caller should be aware that there could be race condition here - when this
  * call returns, the underneath TID status possibly being changed as other work
- * is ongoing.
+ * is ongoing. A TID below lowest_durable that no reader holds is forgotten
+ * once it is durable or rolled back, and is then IOD_TRANS_INVALID.
  *
  * \param coh [IN]		container handle
  * \param tid [IN]		TID to query
@@ -716,6 +810,14 @@ iod_trans_query(iod_handle_t coh, iod_trans_id_t tid,
  * If two independent groups need to start new transaction for writing, then
  * commonly they should pass in IOD_TID_UNKNOWN to avoid TID confliction.
  *
+ * A write TID normally becomes readable only after every earlier TID became
+ * readable or was aborted. Started with IOD_TRANS_WR | IOD_TRANS_INDEPENDENT
+ * it becomes readable once its own writers finished it, whatever state the
+ * earlier TIDs are in; it still is a dependency of later non-independent
+ * TIDs. Reading an independent TID shows the updates of the earlier TIDs that
+ * are readable at the time of the read, so earlier TIDs that become readable
+ * later show up in it too. All callers of a TID must pass the same mode.
+ *
  * For reading, user should pass in an appropriate TID, for the same TID all
  * callers must call it with same \a num_ranks. User can get the appropriate
  * TID by either:
@@ -753,13 +855,18 @@ iod_trans_query(iod_handle_t coh, iod_trans_id_t tid,
  *    User should pass in \a num_ranks as the number of CN ranks that will
  *    participate in this transaction for this method. IOD_TID_UNKNOWN cannot be
  *    used for this method.
+ *    IOD counts the finishes of such a TID in a tree of sub-coordinators, each
+ *    waiting for at most "iod.trans_fanout" ranks or sub-coordinators.
+ *    Hints: key "fanout" value N on the call that starts the TID overrides
+ *           that fan-out for it, "0" counts all finishes at one place.
  * Commonly application should use method 1) to participate transaction.
  *
  * \param coh [IN]		container handle
  * \param tid [IN/OUT]		pointer to transaction ID
  * \param hints[IN]		pointer to hints and can be NULL when no hint
  * \param num_ranks[IN]		count of participators(CN ranks)
- * \param mode[IN]		either IOD_TRANS_RD or IOD_TRANS_WR,
+ * \param mode[IN]		either IOD_TRANS_RD or IOD_TRANS_WR, the
+ *				latter possibly with IOD_TRANS_INDEPENDENT,
  *				will return -EINVAL if passes in other value.
  * \param event [IN]		pointer to completion event
  *
@@ -821,6 +928,10 @@ iod_trans_slip(iod_handle_t coh, iod_trans_id_t *tid, iod_hint_list_t *hints,
  * For reading, this routine is only for releasing the ref-count taken by
  * iod_trans_start(or _slip).
  *
+ * Hints: key "rank" value the caller's rank in [0, num_ranks) of a TID
+ *        started with \a num_ranks, which picks its sub-coordinator. Either
+ *        every rank of the TID passes it or none does.
+ *
  * \param coh [IN]	container handle
  * \param tid [IN]	transaction ID
  * \param abort [IN]	abort the transaction, only meaningful for writing.
@@ -849,7 +960,20 @@ iod_trans_finish(iod_handle_t coh, iod_trans_id_t tid, iod_hint_list_t *hints,
  * user want to set/change some objects' layout on central storage, it should
  * call iod_obj_set_layout before calling iod_trans_persist. After persist's
  * completion this \a tid become durable on central storage. The previous
- * readable TID is still on BB, IOD will not automatically purge it.
+ * readable TID is still on BB; IOD purges it automatically only when the
+ * "iod.bb_capacity" setting bounds the BB space of the container (see
+ * iod_obj_purge).
+ *
+ * TIDs reach central storage in TID order. If an earlier TID is still in
+ * writing, as it can be below an independent \a tid, the TIDs below it are
+ * persisted and -EAGAIN is returned.
+ *
+ * Bytes that several TIDs in the range wrote are shipped once, as the newest
+ * of them wrote them; iod_container_query_stats counts the bytes skipped.
+ *
+ * With an \a event the migration runs in the background, streaming from the
+ * burst buffer to central storage with at most the "iod.persist_budget"
+ * setting of bytes in flight, while I/O to the container carries on.
  *
  * \param coh [IN]	container handle
  * \param tid [IN]	transaction ID
@@ -867,9 +991,19 @@ iod_trans_persist(iod_handle_t coh, iod_trans_id_t tid, iod_hint_list_t *hints,
  *
  * Only single rank can call this routine to purge one object from BB.
  * This is commonly used after migrating done and that object of \a tid is
- * un-needed to be kept on BB. IOD won't do auto-purging, user should explicitly
- * call the purge at appropriate time to free BB's storage space. Purging is at
- * object level, IOD will purge all lower TIDs and this TID \a tid.
+ * un-needed to be kept on BB. Unless the "iod.bb_capacity" setting is given,
+ * IOD won't do auto-purging, user should explicitly call the purge at
+ * appropriate time to free BB's storage space. Purging is at object level, IOD
+ * will purge all lower TIDs and this TID \a tid.
+ *
+ * With a capacity set IOD purges blob and array objects itself, up to the
+ * latest durable TID, once the container's data logs pass the high watermark
+ * of "iod.bb_watermarks", least recently used and least reused objects first,
+ * until they are back under the low one. Nothing is evicted while a reader
+ * holds a durable TID. A write that would pass the capacity
+ * waits for a running persist and fails with -ENOSPC if no room can be made;
+ * writers racing each other may overshoot it by what they write at once. KV
+ * values count against the capacity but are never evicted.
  *
  * User can only call purge with the \a tid that ever passed in by
  * iod_trans_persist. If it is called before the completion of iod_trans_persist
@@ -891,13 +1025,19 @@ iod_obj_purge(iod_handle_t oh, iod_trans_id_t tid, iod_hint_list_t *hints,
  * Fetch/pre-stage one object from central storage to BB.
  *
  * Only single rank can call this routine to fetch one object from central
- * storage to BB.
+ * storage to BB. Only the purged bytes the \a slab selects of an array are
+ * staged, whole chunks of a chunked one; a blob, or an array without a
+ * slab, is staged whole. Array reads that step through an object at a
+ * fixed stride fetch the next hyperslabs ahead of themselves in the same
+ * way, see the "iod.readahead" setting of iod_initialize.
  *
  * \param oh [IN]		object handle
  * \param tid [IN]		transaction ID
  * \param hints[IN]		pointer to hints and can be NULL when no hint
- * \param slab [IN]		the hyperslab within this object
- *				will be ignored for KV object.
+ * \param slab [IN]		the hyperslab within this object, NULL for
+ *				all of it. Will be ignored for KV and blob
+ *				objects, must stay valid until \a event
+ *				completes.
  * \param layout [IN]		passed in layout placement on BB,
  *				can be NULL if does not change layout on BB.
  * \param new_tid[IN/OUT]	returned new TID, will be same as passed in
@@ -942,7 +1082,8 @@ iod_obj_replica(iod_handle_t oh, iod_trans_id_t tid, iod_hint_list_t *hints,
  *
  * Only single rank can call this routine to create a container snapshot.
  * IOD will migrate latest readable TID to DAOS and create DAOS container
- * snapshot by calling daos_container_snapshot.
+ * snapshot by calling daos_container_snapshot. Independent TIDs above an
+ * earlier TID still in writing are not in the snapshot.
  *
  * \param coh [IN]		container handle
  * \param snapshot [IN]		name of snapshot
@@ -1183,6 +1324,57 @@ iod_event_init(iod_event_t *ev, iod_handle_t eqh);
 void
 iod_event_fini(iod_event_t *ev);
 
-/* TODO: details of kinds of hints */
+/* SECTION 6 ********** HINTS *************************/
+
+/*
+ * Hints a call understands, all optional; others are ignored:
+ *
+ *   "access"		"sequential": strided array reads are read ahead
+ *			from the first step; "random": never read ahead;
+ *			"normal" (default): once a step repeats
+ *   "prefetch"		hyperslabs read ahead of array reads, 0 for none,
+ *			at most 64; "iod.readahead" if not given
+ *   "write_once"	"true": data written is not read back through this
+ *			IOD, so its objects are evicted from the burst
+ *			buffer first and never count as reused
+ *   "skip_bb"		"true": writes leave the burst buffer as soon as a
+ *			persist makes them durable, and reads neither read
+ *			ahead nor count as burst buffer use
+ *   "persist_priority"	objects written with a higher value are shipped
+ *			to central storage first by a persist, default 0
+ *   "rank"		iod_trans_finish: rank finishing a multi-leader TID
+ *   "fanout"		iod_trans_start: sub-coordinator fan-out
+ *   "lowest_readable"	iod_trans_start: "true" to read at the lowest
+ *			readable TID
+ *   "adjacent_readable" iod_trans_slip: "true" to move to the next readable
+ *			TID rather than the latest
+ *
+ * Boolean hints take "true"/"1" or "false"/"0". A malformed value fails the
+ * call with -EINVAL. Hints given to iod_obj_open_read/write apply to every
+ * call through the handle, and each call's own hints override them.
+ */
+
+/**
+ * Compile a hint list into a policy once, for the calls that pass it.
+ *
+ * The policy is itself a hint list, holding a copy of \a hints, that every
+ * call takes in their place without parsing them again. It must stay valid
+ * until the calls given it complete.
+ *
+ * \param hints [IN]	hints to compile, can be NULL
+ * \param policy [OUT]	the compiled list, freed by iod_hint_free
+ *
+ * \return		zero on success, -EINVAL for a malformed hint
+ */
+iod_ret_t
+iod_hint_compile(iod_hint_list_t *hints, iod_hint_list_t **policy);
+
+/**
+ * Free a policy made by iod_hint_compile.
+ *
+ * \param policy [IN]	compiled hint list, can be NULL
+ */
+void
+iod_hint_free(iod_hint_list_t *policy);
 
 #endif
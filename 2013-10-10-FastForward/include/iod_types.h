@@ -54,6 +54,13 @@ typedef enum {
 	IOD_OBJ_KV,
 } iod_obj_type_t;
 
+/** how an object changed between two TIDs, see iod_container_diff_obj */
+typedef enum {
+	IOD_OBJ_CREATED,
+	IOD_OBJ_MODIFIED,
+	IOD_OBJ_UNLINKED,
+} iod_obj_change_t;
+
 /**
  * IOD array object's dimensions sequence, it determines the layout mapping
  * between logical dimensions and physical layout. The dedault dimensions
@@ -124,6 +131,16 @@ typedef enum {
 	IOD_LOC_CENTRAL,	/** object on central storage */
 } iod_location_t;
 
+/** How the stripes of an object are placed on its targets */
+typedef enum {
+	/** stripe i on target i % target_num, packed densely */
+	IOD_PLACE_ROUND_ROBIN = 0,
+	/** jump consistent hash of the stripe, equal weights */
+	IOD_PLACE_JUMP,
+	/** weighted straw draw per stripe, as CRUSH straw2 buckets do */
+	IOD_PLACE_STRAW,
+} iod_placement_t;
+
 /**
  * IOD object layout, descripes layout on BB or central storage.
  * loc         -- target location, either IOD_LOC_CENTRAL or IOD_LOC_BB.
@@ -135,14 +152,27 @@ typedef enum {
  * stripe_size -- resharding granularity. The count of dataset items for
  *		  contiguous layout array, or the count of chunks for chunked
  *		  layout array. For blob object, the unit is byte.
- *		  All split shards will be round-robin placed on targets.
+ *		  All split shards will be placed on targets by placement.
  *		  It will be ignored for KV object.
+ * placement   -- how the shards are placed. Round-robin moves nearly every
+ *		  shard when target_num changes; the hash placements move
+ *		  about the share of the targets added or removed.
+ * target_weights -- relative capacity of each of the target_num targets,
+ *		  for IOD_PLACE_STRAW; NULL for equal weights. A target of
+ *		  weight 0 gets no shard. Only read for IOD_PLACE_STRAW and
+ *		  ignored for the other placements.
+ *
+ * Zero-initialize a layout before filling it in, e.g. with "= { 0 }":
+ * fields a caller does not know about then keep their zero value, which is
+ * round-robin placement with equal weights, the layout of older releases.
  */
 typedef struct {
 	iod_location_t		loc;
 	uint32_t		target_num;
 	iod_size_t		stripe_size;
 	iod_dims_seq_t		dims_seq;
+	iod_placement_t		placement;
+	uint32_t		*target_weights;
 } iod_layout_t;
 
 /** Key-Value pair */
@@ -211,6 +241,11 @@ typedef iod_hyperslab_t		iod_array_iodesc_t;
 #define	IOD_TRANS_RD			(1)
 /** write-only */
 #define IOD_TRANS_WR			(1 << 1)
+/**
+ * or-ed into IOD_TRANS_WR: the TID does not depend on earlier ones and
+ * becomes readable as soon as all of its writers finished it
+ */
+#define IOD_TRANS_INDEPENDENT		(1 << 2)
 
 /**
  * The statuses of IOD transaction.
@@ -220,7 +255,7 @@ typedef iod_hyperslab_t		iod_array_iodesc_t;
  * Finished - all writers have called finish but earlier transactions are not
  *	      finished,
  * Readable - all writers have called finish and all earlier transactions are
- *	      also finished,
+ *	      also finished, or just the former for an independent transaction,
  * Durable  - readable and the migration to central is finished,
  */
 typedef enum {
@@ -235,7 +270,8 @@ typedef enum {
 /**
  * The TIDs' status of one IOD container.
  * For read, IOD can provide a consistent view between lowest_durable and
- * latest_rdable, with possible un-used TIDs between them.
+ * latest_rdable, with possible un-used TIDs between them. Independent TIDs
+ * can make latest_rdable pass earlier TIDs still in writing.
  * For write, upper layer should provide a tid greater than latest_wrting.
  */
 typedef struct {
@@ -247,6 +283,43 @@ typedef struct {
 	iod_trans_id_t		latest_wrting;
 } iod_container_tids_t;
 
+/**
+ * Engine counters of one IOD container since it was opened.
+ */
+typedef struct {
+	/** blob and array bytes persist shipped to central storage */
+	iod_size_t		persist_bytes;
+	/**
+	 * blob and array bytes persist did not ship, as a later TID of the
+	 * same persist overwrote them
+	 */
+	iod_size_t		persist_skipped;
+	/** central bytes moved to other targets by layout changes */
+	iod_size_t		reshard_bytes;
+	/** data log bytes the container holds on the burst buffer now */
+	iod_size_t		bb_bytes;
+	/** blob and array bytes read from the burst buffer */
+	iod_size_t		cache_hit_bytes;
+	/** blob and array bytes read from central storage, once purged */
+	iod_size_t		cache_miss_bytes;
+	/** objects evicted from the burst buffer to make room */
+	uint64_t		evict_count;
+	/** data log bytes those evictions gave back */
+	iod_size_t		evict_bytes;
+	/** nanoseconds spent evicting */
+	uint64_t		evict_nsec;
+	/** hyperslabs fetched ahead of strided array reads */
+	uint64_t		readahead_count;
+	/** bytes those fetches staged from central storage */
+	iod_size_t		readahead_bytes;
+	/** data log bytes read back to check their checksums */
+	iod_size_t		cksum_verify_bytes;
+	/** checksum records of the data logs that did not match */
+	uint64_t		cksum_errors;
+	/** write TIDs aborted as their lease ran out, see "iod.trans_lease" */
+	uint64_t		trans_expired;
+} iod_container_stats_t;
+
 #define IOD_TID_UNKNOWN		((iod_trans_id_t)(-1))
 #define IOD_TRANS_ABORT_ALL	(1)
 #define IOD_TRANS_ABORT_SINGLE	(2)
@@ -303,6 +376,8 @@ typedef enum {
 	IOD_EV_KV_GET_VALUE,
 	IOD_EV_KV_UNLINK_KEY,
 	IOD_EV_EQ_DESTROY,
+	IOD_EV_CONT_QUERY_STATS,
+	IOD_EV_CONT_DIFF_OBJ,
 } iod_ev_type_t;
 
 /** wait for completion event forever */
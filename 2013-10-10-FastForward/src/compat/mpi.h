@@ -0,0 +1,18 @@
+/*
+ * Stand-in for mpi.h used when the IOD engine is built without MPI.
+ *
+ * iod_types.h only needs MPI_Comm for iod_comm_t. The single-node engine never
+ * talks to other IOD processes, so an opaque integer communicator is enough.
+ * Build with MPI=1 (and an MPI compiler wrapper) to use the real header.
+ */
+
+#ifndef _IOD_COMPAT_MPI_H_
+#define _IOD_COMPAT_MPI_H_
+
+typedef int	MPI_Comm;
+
+#define MPI_COMM_NULL	((MPI_Comm)0)
+#define MPI_COMM_WORLD	((MPI_Comm)0x44000000)
+#define MPI_COMM_SELF	((MPI_Comm)0x44000001)
+
+#endif /* _IOD_COMPAT_MPI_H_ */
@@ -0,0 +1,341 @@
+/*
+ * IOD array objects: hyperslab I/O.
+ *
+ * An array is stored as the row-major byte image of its logical dataspace,
+ * the first dimension slowest, so growing the first dimension never moves
+ * existing cells. The memory buffer of a hyperslab access holds the selected
+ * cells packed in the same order; iod_slab.c turns the selection into runs of
+ * that image. A chunked array is stored chunk by chunk instead, see
+ * iod_chunk.c.
+ */
+
+#include "iod_internal.h"
+
+/** check \a slab against \a dims, the dataspace of \a obj */
+static int
+iod_slab_valid(struct iod_obj *obj, iod_hyperslab_t *slab,
+	       const iod_size_t *dims, iod_size_t *nbytes)
+{
+	iod_size_t	cells = 1;
+	iod_size_t	stride;
+	iod_size_t	block;
+	uint32_t	d;
+
+	for (d = 0; d < obj->io_ndims; d++) {
+		stride = slab->stride != NULL ? slab->stride[d] : 1;
+		block = slab->block != NULL ? slab->block[d] : 1;
+		if (block == 0 || (slab->count[d] > 1 && stride < block))
+			return -EINVAL;
+		if (slab->count[d] == 0)
+			cells = 0;
+		else if (slab->start[d] + (slab->count[d] - 1) * stride +
+			 block > dims[d])
+			return -ERANGE;
+		cells *= slab->count[d] * block;
+	}
+	*nbytes = cells * obj->io_cell_size;
+	return 0;
+}
+
+/** check \a slab against the dataspace of \a obj at \a tid */
+static int
+iod_slab_check(struct iod_obj *obj, iod_trans_id_t tid, iod_hyperslab_t *slab,
+	       iod_size_t *dims, iod_size_t *nbytes)
+{
+	uint32_t	d;
+
+	if (slab == NULL || slab->start == NULL || slab->count == NULL)
+		return -EINVAL;
+	pthread_rwlock_rdlock(&obj->io_lock);
+	dims[0] = iod_array_dim0(obj, tid);
+	pthread_rwlock_unlock(&obj->io_lock);
+	for (d = 1; d < obj->io_ndims; d++)
+		dims[d] = obj->io_dims[d];
+	return iod_slab_valid(obj, slab, dims, nbytes);
+}
+
+/**
+ * Call \a cb with every byte range of \a obj that \a slab reads at \a tid,
+ * adjacent runs merged: whole chunk slots of a chunked array. Caller holds
+ * io_lock.
+ */
+int
+iod_array_ranges(struct iod_obj *obj, iod_trans_id_t tid,
+		 iod_hyperslab_t *slab, iod_seg_cb_t cb, void *arg)
+{
+	struct iod_slab_plan	sp;
+	struct iod_seg		seg = { 0 };
+	iod_size_t		dims[IOD_MAX_DIMS];
+	iod_size_t		nbytes;
+	iod_size_t		r;
+	iod_size_t		i;
+	iod_off_t		off;
+	uint32_t		d;
+	int			rc;
+
+	if (slab == NULL || slab->start == NULL || slab->count == NULL)
+		return -EINVAL;
+	dims[0] = iod_array_dim0(obj, tid);
+	for (d = 1; d < obj->io_ndims; d++)
+		dims[d] = obj->io_dims[d];
+	rc = iod_slab_valid(obj, slab, dims, &nbytes);
+	if (rc != 0 || nbytes == 0)
+		return rc;
+	if (obj->io_chunked)
+		return iod_chunk_ranges(obj, dims, slab, cb, arg);
+	rc = iod_slab_compile(obj, dims, slab, &sp);
+	if (rc != 0)
+		return rc;
+
+	for (r = 0; r < sp.sp_nrows && rc == 0; r++) {
+		for (i = 0; i < sp.sp_runs && rc == 0; i++) {
+			off = sp.sp_row[r] + i * sp.sp_stride;
+			if (seg.is_len > 0 && seg.is_off + seg.is_len == off) {
+				seg.is_len += sp.sp_run_len;
+				continue;
+			}
+			if (seg.is_len > 0)
+				rc = cb(&seg, arg);
+			seg.is_off = off;
+			seg.is_len = sp.sp_run_len;
+		}
+	}
+	if (rc == 0 && seg.is_len > 0)
+		rc = cb(&seg, arg);
+	iod_slab_plan_free(&sp);
+	return rc;
+}
+
+/** write through \a h, prepared for \a tid already */
+static int
+iod_array_write_prepped(struct iod_objh *h, iod_trans_id_t tid,
+			iod_mem_desc_t *mem_desc, iod_hyperslab_t *slab)
+{
+	struct iod_slab_plan	sp;
+	struct iod_memcur	mc;
+	iod_size_t		dims[IOD_MAX_DIMS];
+	iod_size_t		nbytes;
+	int			rc;
+
+	if (mem_desc == NULL)
+		return -EINVAL;
+	rc = iod_slab_check(h->oh_obj, tid, slab, dims, &nbytes);
+	if (rc != 0)
+		return rc;
+	if (nbytes != iod_mem_len(mem_desc))
+		return -EINVAL;
+	if (h->oh_obj->io_chunked)
+		return iod_chunk_write(h->oh_obj, tid, dims, slab, mem_desc);
+	rc = iod_slab_compile(h->oh_obj, dims, slab, &sp);
+	if (rc != 0)
+		return rc;
+
+	iod_memcur_init(&mc, mem_desc);
+	rc = iod_slab_write(h->oh_obj, tid, &sp, &mc);
+	iod_slab_plan_free(&sp);
+	return rc;
+}
+
+static int
+iod_array_write_exec(iod_handle_t oh, iod_trans_id_t tid,
+		     iod_hint_list_t *hints, iod_mem_desc_t *mem_desc,
+		     iod_hyperslab_t *slab)
+{
+	struct iod_objh		*h = iod_objh_lookup(oh);
+	const struct iod_policy	*pol;
+	struct iod_policy	buf;
+	int			rc;
+
+	if (h == NULL || mem_desc == NULL)
+		return -EINVAL;
+	rc = iod_policy_resolve(&h->oh_pol, hints, &buf, &pol);
+	if (rc == 0)
+		rc = iod_obj_write_prep(h, IOD_OBJ_ARRAY, tid, pol);
+	if (rc == 0)
+		rc = iod_array_write_prepped(h, tid, mem_desc, slab);
+	return rc;
+}
+
+/** read through \a h, prepared for \a tid under \a pol already */
+static int
+iod_array_read_prepped(struct iod_objh *h, iod_trans_id_t tid,
+		       const struct iod_policy *pol, iod_mem_desc_t *mem_desc,
+		       iod_hyperslab_t *slab, iod_checksum_t *cs)
+{
+	struct iod_slab_plan	sp;
+	struct iod_memcur	mc;
+	iod_size_t		dims[IOD_MAX_DIMS];
+	iod_size_t		nbytes;
+	int			rc;
+
+	if (mem_desc == NULL)
+		return -EINVAL;
+	rc = iod_slab_check(h->oh_obj, tid, slab, dims, &nbytes);
+	if (rc != 0)
+		return rc;
+	if (nbytes != iod_mem_len(mem_desc))
+		return -EINVAL;
+	if (h->oh_obj->io_chunked) {
+		pthread_rwlock_rdlock(&h->oh_obj->io_lock);
+		rc = iod_chunk_read(h->oh_obj, tid, dims, slab, mem_desc);
+		pthread_rwlock_unlock(&h->oh_obj->io_lock);
+		goto out;
+	}
+	rc = iod_slab_compile(h->oh_obj, dims, slab, &sp);
+	if (rc != 0)
+		return rc;
+
+	iod_memcur_init(&mc, mem_desc);
+	pthread_rwlock_rdlock(&h->oh_obj->io_lock);
+	rc = iod_slab_read(h->oh_obj, tid, &sp, &mc);
+	pthread_rwlock_unlock(&h->oh_obj->io_lock);
+	iod_slab_plan_free(&sp);
+out:
+	if (rc == 0 && cs != NULL)
+		iod_mem_cksum(mem_desc, cs);
+	if (rc == 0)
+		iod_readahead(h->oh_obj, tid, slab, dims, pol);
+	return rc;
+}
+
+static int
+iod_array_read_exec(iod_handle_t oh, iod_trans_id_t tid,
+		    iod_hint_list_t *hints, iod_mem_desc_t *mem_desc,
+		    iod_hyperslab_t *slab, iod_checksum_t *cs)
+{
+	struct iod_objh		*h = iod_objh_lookup(oh);
+	const struct iod_policy	*pol;
+	struct iod_policy	buf;
+	int			rc;
+
+	if (h == NULL || mem_desc == NULL)
+		return -EINVAL;
+	rc = iod_policy_resolve(&h->oh_pol, hints, &buf, &pol);
+	if (rc == 0)
+		rc = iod_obj_read_prep(h, IOD_OBJ_ARRAY, tid, pol);
+	if (rc == 0)
+		rc = iod_array_read_prepped(h, tid, pol, mem_desc, slab, cs);
+	return rc;
+}
+
+static int
+iod_array_write_op(struct iod_op *op)
+{
+	iod_array_io_t	*io = &op->op_u.array;
+
+	return iod_array_write_exec(io->oh, op->op_tid, io->hints,
+				    io->mem_desc, io->io_desc);
+}
+
+static int
+iod_array_read_op(struct iod_op *op)
+{
+	iod_array_io_t	*io = &op->op_u.array;
+
+	return iod_array_read_exec(io->oh, op->op_tid, io->hints,
+				   io->mem_desc, io->io_desc, io->cs);
+}
+
+static iod_ret_t
+iod_array_submit(iod_handle_t oh, iod_trans_id_t tid, iod_hint_list_t *hints,
+		 iod_mem_desc_t *mem_desc, iod_array_iodesc_t *io_desc,
+		 iod_checksum_t *cs, iod_event_t *event, int write)
+{
+	iod_ev_type_t	type = write ? IOD_EV_ARR_WR : IOD_EV_ARR_RD;
+	struct iod_op	*op;
+
+	op = iod_op_alloc(event, type, write ? iod_array_write_op :
+					       iod_array_read_op, tid);
+	if (op == NULL)
+		return -ENOMEM;
+	op->op_u.array.oh = oh;
+	op->op_u.array.hints = hints;
+	op->op_u.array.mem_desc = mem_desc;
+	op->op_u.array.io_desc = io_desc;
+	op->op_u.array.cs = cs;
+	return iod_sched_submit(op);
+}
+
+iod_ret_t
+iod_array_write(iod_handle_t oh, iod_trans_id_t tid, iod_hint_list_t *hints,
+		iod_mem_desc_t *mem_desc, iod_array_iodesc_t *io_desc,
+		iod_checksum_t *cs, iod_event_t *event)
+{
+	if (event != NULL)
+		return iod_array_submit(oh, tid, hints, mem_desc, io_desc, cs,
+					event, 1);
+	return iod_array_write_exec(oh, tid, hints, mem_desc, io_desc);
+}
+
+iod_ret_t
+iod_array_read(iod_handle_t oh, iod_trans_id_t tid,
+	       iod_hint_list_t *hints, iod_mem_desc_t *mem_desc,
+	       iod_array_iodesc_t *io_desc, iod_checksum_t *cs,
+	       iod_event_t *event)
+{
+	if (event != NULL)
+		return iod_array_submit(oh, tid, hints, mem_desc, io_desc, cs,
+					event, 0);
+	return iod_array_read_exec(oh, tid, hints, mem_desc, io_desc, cs);
+}
+
+/**
+ * Run the \a num entries of \a list, a write list if \a write, prepared
+ * under one hold of ic_lock.
+ */
+static iod_ret_t
+iod_array_list(iod_handle_t coh, iod_trans_id_t tid, iod_size_t num,
+	       iod_array_io_t *list, iod_event_t *event, int write)
+{
+	struct iod_cont	*cont = iod_cont_lookup(coh);
+	iod_ev_type_t	type = write ? IOD_EV_ARR_WR : IOD_EV_ARR_RD;
+	struct iod_xfer	*xf;
+	iod_array_io_t	*io;
+	iod_size_t	i;
+	int		rc = 0;
+	int		rc2;
+
+	if (cont == NULL || (num > 0 && list == NULL))
+		return iod_ev_return(event, type, -EINVAL);
+	xf = calloc(iod_max(num, (iod_size_t)1), sizeof(*xf));
+	if (xf == NULL)
+		return iod_ev_return(event, type, -ENOMEM);
+	for (i = 0; i < num; i++) {
+		xf[i].xf_h = iod_objh_lookup(list[i].oh);
+		xf[i].xf_hints = list[i].hints;
+	}
+	iod_xfer_prep(cont, IOD_OBJ_ARRAY, tid, write, xf, num);
+	for (i = 0; i < num; i++) {
+		io = &list[i];
+		rc2 = xf[i].xf_rc;
+		if (rc2 == 0 && write)
+			rc2 = iod_array_write_prepped(xf[i].xf_h, tid,
+						      io->mem_desc,
+						      io->io_desc);
+		else if (rc2 == 0)
+			rc2 = iod_array_read_prepped(xf[i].xf_h, tid,
+						     xf[i].xf_pol,
+						     io->mem_desc, io->io_desc,
+						     io->cs);
+		if (io->ret != NULL)
+			*io->ret = rc2;
+		if (rc == 0)
+			rc = rc2;
+	}
+	free(xf);
+	return iod_ev_return(event, type, rc);
+}
+
+iod_ret_t
+iod_array_write_list(iod_handle_t coh, iod_trans_id_t tid, iod_size_t num,
+		     iod_array_io_t *array_write, iod_event_t *event)
+{
+	return iod_array_list(coh, tid, num, array_write, event, 1);
+}
+
+iod_ret_t
+iod_array_read_list(iod_handle_t coh, iod_trans_id_t tid, iod_size_t num,
+		    iod_array_io_t *array_read, iod_event_t *event)
+{
+	return iod_array_list(coh, tid, num, array_read, event, 0);
+}
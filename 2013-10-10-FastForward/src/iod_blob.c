@@ -0,0 +1,453 @@
+/*
+ * IOD blob objects: offset I/O described by iod_blob_iodesc_t.
+ */
+
+#include <unistd.h>
+
+#include "iod_internal.h"
+
+static int
+iod_blob_check(iod_mem_desc_t *mem_desc, iod_blob_iodesc_t *io_desc)
+{
+	iod_size_t	len = 0;
+	unsigned long	i;
+
+	if (mem_desc == NULL || io_desc == NULL)
+		return -EINVAL;
+	for (i = 0; i < io_desc->nfrag; i++)
+		len += io_desc->frag[i].len;
+	return len == iod_mem_len(mem_desc) ? 0 : -EINVAL;
+}
+
+/** add the fragments of \a io_desc to the \a n ranges at \a ext */
+static void
+iod_blob_extents_add(struct iod_extent *ext, unsigned long *n,
+		     iod_blob_iodesc_t *io_desc)
+{
+	iod_blob_iofrag_t	*frag;
+	unsigned long		i;
+
+	for (i = 0; i < io_desc->nfrag; i++) {
+		frag = &io_desc->frag[i];
+		if (frag->len == 0)
+			continue;
+		if (*n > 0 && ext[*n - 1].ie_off + ext[*n - 1].ie_len ==
+			      frag->offset) {
+			ext[*n - 1].ie_len += frag->len;
+			continue;
+		}
+		ext[*n].ie_off = frag->offset;
+		ext[*n].ie_len = frag->len;
+		ext[*n].ie_addr = 0;
+		(*n)++;
+	}
+}
+
+/**
+ * The file fragments of \a io_desc with neighbours that are adjacent in the
+ * object merged, so each merged range is resolved and transferred once.
+ */
+static struct iod_extent *
+iod_blob_extents(iod_blob_iodesc_t *io_desc, unsigned long *nr)
+{
+	struct iod_extent	*ext;
+
+	ext = malloc(iod_max(io_desc->nfrag, 1) * sizeof(*ext));
+	if (ext == NULL)
+		return NULL;
+	*nr = 0;
+	iod_blob_extents_add(ext, nr, io_desc);
+	return ext;
+}
+
+/**
+ * Log the write of \a tid that put the ranges \a ext at \a addr of the data
+ * log of \a obj. A small write carries its bytes, a larger one syncs the data
+ * log first. The record goes to \a wt unless that is NULL, otherwise
+ * returns the WAL group to wait for in \a group.
+ */
+static int
+iod_blob_write_log(struct iod_obj *obj, iod_trans_id_t tid,
+		   const struct iod_extent *ext, unsigned long nr,
+		   uint64_t addr, iod_mem_desc_t *mem_desc,
+		   struct iod_wal_batch *wt, uint64_t *group)
+{
+	struct iod_wal_rec	rec = { 0 };
+	int			rc = 0;
+
+	rec.wr_type = IOD_WAL_BLOB;
+	rec.wr_oid = obj->io_oid;
+	rec.wr_tid = tid;
+	rec.wr_addr = addr;
+	rec.wr_arg = nr;
+	if (iod_mem_len(mem_desc) <= IOD_WAL_INLINE_MAX) {
+		rec.wr_flags = IOD_WAL_INLINE;
+	} else {
+		rc = fdatasync(obj->io_fd) == 0 ? 0 : -errno;
+		mem_desc = NULL;
+	}
+	/* the bytes go into the record from the caller's fragments */
+	if (rc == 0 && wt != NULL)
+		rc = iod_wal_batch_add_mem(wt, &rec, ext, nr * sizeof(*ext),
+					   mem_desc);
+	else if (rc == 0)
+		rc = iod_wal_log_mem(obj->io_cont->ic_wal, &rec, ext,
+				     nr * sizeof(*ext), mem_desc, group);
+	if (rc != 0) {
+		/* the TID can no longer be replayed whole */
+		pthread_mutex_lock(&obj->io_cont->ic_lock);
+		iod_trans_dirty(obj->io_cont, tid, obj);
+		pthread_mutex_unlock(&obj->io_cont->ic_lock);
+	}
+	return rc;
+}
+
+static int
+iod_blob_write_exec(iod_handle_t oh, iod_trans_id_t tid,
+		    iod_hint_list_t *hints, iod_mem_desc_t *mem_desc,
+		    iod_blob_iodesc_t *io_desc, uint64_t *group)
+{
+	struct iod_objh		*h = iod_objh_lookup(oh);
+	const struct iod_policy	*pol;
+	struct iod_policy	buf;
+	struct iod_extent	*ext;
+	struct iod_memcur	mc;
+	unsigned long		nr;
+	uint64_t		addr;
+	int			rc;
+
+	*group = 0;
+	if (h == NULL)
+		return -EINVAL;
+	rc = iod_policy_resolve(&h->oh_pol, hints, &buf, &pol);
+	if (rc == 0)
+		rc = iod_blob_check(mem_desc, io_desc);
+	if (rc == 0)
+		rc = iod_obj_write_prep(h, IOD_OBJ_BLOB, tid, pol);
+	if (rc != 0)
+		return rc;
+	ext = iod_blob_extents(io_desc, &nr);
+	if (ext == NULL)
+		return -ENOMEM;
+
+	/* the whole request is one log append */
+	iod_memcur_init(&mc, mem_desc);
+	rc = iod_obj_write_vec(h->oh_obj, tid, ext, nr, &mc, &addr);
+	if (rc == 0 && nr > 0 && h->oh_obj->io_cont->ic_wal != NULL)
+		rc = iod_blob_write_log(h->oh_obj, tid, ext, nr, addr,
+					mem_desc, NULL, group);
+	free(ext);
+	return rc;
+}
+
+/** the WAL of the container \a oh is in, for waiting on a write */
+static struct iod_wal *
+iod_blob_wal(iod_handle_t oh)
+{
+	struct iod_objh	*h = iod_objh_lookup(oh);
+
+	return h != NULL ? h->oh_obj->io_cont->ic_wal : NULL;
+}
+
+/** read through \a h, prepared for \a tid already */
+static int
+iod_blob_read_prepped(struct iod_objh *h, iod_trans_id_t tid,
+		      iod_mem_desc_t *mem_desc, iod_blob_iodesc_t *io_desc,
+		      iod_checksum_t *cs)
+{
+	struct iod_obj		*obj = h->oh_obj;
+	struct iod_extent	*ext;
+	struct iod_memcur	mc;
+	unsigned long		nr;
+	unsigned long		i;
+	int			rc;
+
+	rc = iod_blob_check(mem_desc, io_desc);
+	if (rc != 0)
+		return rc;
+	ext = iod_blob_extents(io_desc, &nr);
+	if (ext == NULL)
+		return -ENOMEM;
+
+	iod_memcur_init(&mc, mem_desc);
+	pthread_rwlock_rdlock(&obj->io_lock);
+	for (i = 0; i < nr && rc == 0; i++)
+		rc = iod_obj_read_range(obj, tid, ext[i].ie_off, ext[i].ie_len,
+					&mc);
+	pthread_rwlock_unlock(&obj->io_lock);
+	free(ext);
+	if (rc == 0 && cs != NULL)
+		iod_mem_cksum(mem_desc, cs);
+	return rc;
+}
+
+static int
+iod_blob_read_exec(iod_handle_t oh, iod_trans_id_t tid,
+		   iod_hint_list_t *hints, iod_mem_desc_t *mem_desc,
+		   iod_blob_iodesc_t *io_desc, iod_checksum_t *cs)
+{
+	struct iod_objh		*h = iod_objh_lookup(oh);
+	const struct iod_policy	*pol;
+	struct iod_policy	buf;
+	int			rc;
+
+	if (h == NULL)
+		return -EINVAL;
+	rc = iod_policy_resolve(&h->oh_pol, hints, &buf, &pol);
+	if (rc == 0)
+		rc = iod_obj_read_prep(h, IOD_OBJ_BLOB, tid, pol);
+	if (rc == 0)
+		rc = iod_blob_read_prepped(h, tid, mem_desc, io_desc, cs);
+	return rc;
+}
+
+static int
+iod_blob_write_op(struct iod_op *op)
+{
+	iod_blob_io_t	*io = &op->op_u.blob;
+	uint64_t	group;
+	int		rc;
+
+	rc = iod_blob_write_exec(io->oh, op->op_tid, io->hints, io->mem_desc,
+				 io->io_desc, &group);
+	if (rc == 0)
+		rc = iod_wal_wait(iod_blob_wal(io->oh), group);
+	return rc;
+}
+
+static int
+iod_blob_read_op(struct iod_op *op)
+{
+	iod_blob_io_t	*io = &op->op_u.blob;
+
+	return iod_blob_read_exec(io->oh, op->op_tid, io->hints, io->mem_desc,
+				  io->io_desc, io->cs);
+}
+
+static iod_ret_t
+iod_blob_submit(iod_handle_t oh, iod_trans_id_t tid, iod_hint_list_t *hints,
+		iod_mem_desc_t *mem_desc, iod_blob_iodesc_t *io_desc,
+		iod_checksum_t *cs, iod_event_t *event, int write)
+{
+	iod_ev_type_t	type = write ? IOD_EV_BLOB_WR : IOD_EV_BLOB_RD;
+	struct iod_op	*op;
+
+	op = iod_op_alloc(event, type, write ? iod_blob_write_op :
+					       iod_blob_read_op, tid);
+	if (op == NULL)
+		return -ENOMEM;
+	op->op_u.blob.oh = oh;
+	op->op_u.blob.hints = hints;
+	op->op_u.blob.mem_desc = mem_desc;
+	op->op_u.blob.io_desc = io_desc;
+	op->op_u.blob.cs = cs;
+	return iod_sched_submit(op);
+}
+
+iod_ret_t
+iod_blob_write(iod_handle_t oh, iod_trans_id_t tid,
+	       iod_hint_list_t *hints, iod_mem_desc_t *mem_desc,
+	       iod_blob_iodesc_t *io_desc, iod_checksum_t *cs,
+	       iod_event_t *event)
+{
+	uint64_t	group;
+	int		rc;
+
+	if (event != NULL)
+		return iod_blob_submit(oh, tid, hints, mem_desc, io_desc, cs,
+				       event, 1);
+	rc = iod_blob_write_exec(oh, tid, hints, mem_desc, io_desc, &group);
+	if (rc == 0)
+		rc = iod_wal_wait(iod_blob_wal(oh), group);
+	return rc;
+}
+
+iod_ret_t
+iod_blob_read(iod_handle_t oh, iod_trans_id_t tid,
+	      iod_hint_list_t *hints, iod_mem_desc_t *mem_desc,
+	      iod_blob_iodesc_t *io_desc, iod_checksum_t *cs,
+	      iod_event_t *event)
+{
+	if (event != NULL)
+		return iod_blob_submit(oh, tid, hints, mem_desc, io_desc, cs,
+				       event, 0);
+	return iod_blob_read_exec(oh, tid, hints, mem_desc, io_desc, cs);
+}
+
+/** order the entries of a list by object, then by their place in the list */
+static int
+iod_xfer_obj_cmp(const void *a, const void *b)
+{
+	const struct iod_xfer	*xa = *(const struct iod_xfer * const *)a;
+	const struct iod_xfer	*xb = *(const struct iod_xfer * const *)b;
+	uintptr_t		oa = (uintptr_t)xa->xf_h->oh_obj;
+	uintptr_t		ob = (uintptr_t)xb->xf_h->oh_obj;
+
+	if (oa != ob)
+		return oa < ob ? -1 : 1;
+	return xa < xb ? -1 : xa > xb;
+}
+
+/**
+ * Write the \a nr entries \a run of \a list, all to one object and in list
+ * order, as one append to its data log, and add their log record to \a wt.
+ * \a xf is the iod_xfer array \a run points into.
+ */
+static int
+iod_blob_write_run(iod_trans_id_t tid, iod_blob_io_t *list,
+		   struct iod_xfer *xf, struct iod_xfer **run,
+		   unsigned long nr, struct iod_wal_batch *wt)
+{
+	struct iod_obj		*obj = run[0]->xf_h->oh_obj;
+	struct iod_extent	*ext;
+	struct iod_memcur	mc;
+	iod_mem_desc_t		*md;
+	iod_blob_io_t		*io;
+	unsigned long		nfrag = 0;
+	unsigned long		nmem = 0;
+	unsigned long		next = 0;
+	unsigned long		i;
+	uint64_t		addr;
+	int			rc;
+
+	for (i = 0; i < nr; i++) {
+		io = &list[run[i] - xf];
+		nfrag += io->io_desc->nfrag;
+		nmem += io->mem_desc->nfrag;
+	}
+	ext = malloc(iod_max(nfrag, 1UL) * sizeof(*ext));
+	md = malloc(sizeof(*md) + nmem * sizeof(md->frag[0]));
+	if (ext == NULL || md == NULL) {
+		free(ext);
+		free(md);
+		return -ENOMEM;
+	}
+	md->nfrag = 0;
+	for (i = 0; i < nr; i++) {
+		io = &list[run[i] - xf];
+		iod_blob_extents_add(ext, &next, io->io_desc);
+		memcpy(&md->frag[md->nfrag], io->mem_desc->frag,
+		       io->mem_desc->nfrag * sizeof(md->frag[0]));
+		md->nfrag += io->mem_desc->nfrag;
+	}
+
+	iod_memcur_init(&mc, md);
+	rc = iod_obj_write_vec(obj, tid, ext, next, &mc, &addr);
+	if (rc == 0 && next > 0 && obj->io_cont->ic_wal != NULL)
+		rc = iod_blob_write_log(obj, tid, ext, next, addr, md, wt,
+					NULL);
+	free(ext);
+	free(md);
+	return rc;
+}
+
+/**
+ * The entries of the list are prepared under one hold of ic_lock, those of
+ * each object go to its data log as one append, and the log records of the
+ * whole list as one record, so the list shares one sync.
+ */
+iod_ret_t
+iod_blob_write_list(iod_handle_t coh, iod_trans_id_t tid, iod_size_t num,
+		    iod_blob_io_t *blob_write, iod_event_t *event)
+{
+	struct iod_cont		*cont = iod_cont_lookup(coh);
+	struct iod_wal_batch	wt = { 0 };
+	struct iod_xfer		*xf;
+	struct iod_xfer		**run;
+	iod_size_t		nrun = 0;
+	iod_size_t		i;
+	iod_size_t		j;
+	iod_size_t		k;
+	uint64_t		group;
+	int			rc = 0;
+	int			rc2;
+
+	if (cont == NULL || (num > 0 && blob_write == NULL))
+		return iod_ev_return(event, IOD_EV_BLOB_WR, -EINVAL);
+	xf = calloc(iod_max(num, (iod_size_t)1), sizeof(*xf));
+	run = malloc(iod_max(num, (iod_size_t)1) * sizeof(*run));
+	if (xf == NULL || run == NULL) {
+		free(xf);
+		free(run);
+		return iod_ev_return(event, IOD_EV_BLOB_WR, -ENOMEM);
+	}
+	for (i = 0; i < num; i++) {
+		xf[i].xf_h = iod_objh_lookup(blob_write[i].oh);
+		xf[i].xf_hints = blob_write[i].hints;
+	}
+	iod_xfer_prep(cont, IOD_OBJ_BLOB, tid, 1, xf, num);
+	for (i = 0; i < num; i++) {
+		if (xf[i].xf_rc == 0)
+			xf[i].xf_rc = iod_blob_check(blob_write[i].mem_desc,
+						     blob_write[i].io_desc);
+		if (xf[i].xf_rc == 0)
+			run[nrun++] = &xf[i];
+	}
+
+	qsort(run, nrun, sizeof(*run), iod_xfer_obj_cmp);
+	for (i = 0; i < nrun; i = j) {
+		for (j = i + 1; j < nrun && run[j]->xf_h->oh_obj ==
+					    run[i]->xf_h->oh_obj; j++)
+			;
+		rc2 = iod_blob_write_run(tid, blob_write, xf, &run[i], j - i,
+					 &wt);
+		for (k = i; k < j; k++)
+			run[k]->xf_rc = rc2;
+	}
+	rc2 = iod_wal_batch_log(cont->ic_wal, &wt, tid, &group);
+	if (rc2 != 0) {
+		pthread_mutex_lock(&cont->ic_lock);
+		iod_trans_unlogged(cont, tid);
+		pthread_mutex_unlock(&cont->ic_lock);
+	}
+
+	for (i = 0; i < num; i++) {
+		if (blob_write[i].ret != NULL)
+			*blob_write[i].ret = xf[i].xf_rc;
+		if (rc == 0)
+			rc = xf[i].xf_rc;
+	}
+	free(xf);
+	free(run);
+	/* the whole list shares the sync of its one record */
+	return iod_wal_return(cont->ic_wal, group, event, IOD_EV_BLOB_WR,
+			      rc != 0 ? rc : rc2);
+}
+
+/** prepared under one hold of ic_lock, then read one by one */
+iod_ret_t
+iod_blob_read_list(iod_handle_t coh, iod_trans_id_t tid, iod_size_t num,
+		   iod_blob_io_t *blob_read, iod_event_t *event)
+{
+	struct iod_cont	*cont = iod_cont_lookup(coh);
+	struct iod_xfer	*xf;
+	iod_blob_io_t	*io;
+	iod_size_t	i;
+	int		rc = 0;
+	int		rc2;
+
+	if (cont == NULL || (num > 0 && blob_read == NULL))
+		return iod_ev_return(event, IOD_EV_BLOB_RD, -EINVAL);
+	xf = calloc(iod_max(num, (iod_size_t)1), sizeof(*xf));
+	if (xf == NULL)
+		return iod_ev_return(event, IOD_EV_BLOB_RD, -ENOMEM);
+	for (i = 0; i < num; i++) {
+		xf[i].xf_h = iod_objh_lookup(blob_read[i].oh);
+		xf[i].xf_hints = blob_read[i].hints;
+	}
+	iod_xfer_prep(cont, IOD_OBJ_BLOB, tid, 0, xf, num);
+	for (i = 0; i < num; i++) {
+		io = &blob_read[i];
+		rc2 = xf[i].xf_rc;
+		if (rc2 == 0)
+			rc2 = iod_blob_read_prepped(xf[i].xf_h, tid,
+						    io->mem_desc, io->io_desc,
+						    io->cs);
+		if (io->ret != NULL)
+			*io->ret = rc2;
+		if (rc == 0)
+			rc = rc2;
+	}
+	free(xf);
+	return iod_ev_return(event, IOD_EV_BLOB_RD, rc);
+}
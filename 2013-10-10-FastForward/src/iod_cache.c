@@ -0,0 +1,348 @@
+/*
+ * The burst buffer as a managed cache of central storage.
+ *
+ * Every container counts the data log bytes its objects keep on the burst
+ * buffer. With the "iod.bb_capacity" setting at zero that is all; otherwise
+ * a write that would take the count past the high watermark first evicts
+ * objects until it is back under the low one, and a write that would pass
+ * the capacity itself waits for a persist in progress to make room and
+ * fails with -ENOSPC if there still is none. A persist evicts too once it
+ * has made more data durable.
+ *
+ * Evicting an object purges it up to the newest persisted TID, exactly as
+ * iod_obj_purge does: the central copy holds every byte of that version, so
+ * readable TIDs above it lose nothing. Central storage keeps no older
+ * version, and the next persist of the object replaces that one, so nothing
+ * is evicted while a reader holds a durable TID.
+ *
+ * Victims are picked as ARC does, at object granularity. An object used in
+ * one TID only sits on list 1, one used again in a later TID on list 2, each
+ * in LRU order. List 1 is evicted while it holds more than the target p, and
+ * p adapts on ghost hits: a read that goes to central storage for an object
+ * that eviction took from list 1 grows p by the bytes read, one for an
+ * object taken from list 2 shrinks it.
+ *
+ * Hints steer it: an object written "write_once" never moves to list 2 and
+ * goes first from list 1, and one written "skip_bb" leaves the burst buffer
+ * as soon as a persist has made it durable, whatever the watermarks.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <time.h>
+
+#include "iod_internal.h"
+
+/** an object eviction may purge, with its place in the ARC order */
+struct iod_victim {
+	struct iod_obj		*iv_obj;
+	uint64_t		iv_stamp;
+	iod_size_t		iv_bytes;
+	int			iv_list;	/* 1 or 2 */
+};
+
+/**
+ * give back \a len bytes at \a addr of the data log of \a obj. Caller holds
+ * io_lock for write.
+ */
+void
+iod_cache_punch(struct iod_obj *obj, uint64_t addr, iod_size_t len)
+{
+	if (obj->io_fd < 0 || len == 0)
+		return;
+	fallocate(obj->io_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+		  iod_obj_log_pos(obj, addr), len);
+	iod_cache_uncharge(obj, len);
+	iod_cks_drop(obj, addr, len);
+}
+
+/** the data log of \a obj is gone as a whole */
+void
+iod_cache_release(struct iod_obj *obj)
+{
+	iod_cache_uncharge(obj, __atomic_load_n(&obj->io_bb_bytes,
+						__ATOMIC_RELAXED));
+}
+
+/** \a obj is used by \a tid. Caller holds ic_lock. */
+void
+iod_cache_touch(struct iod_obj *obj, iod_trans_id_t tid)
+{
+	/* repeated writes of a TID stamp it without the lock */
+	__atomic_store_n(&obj->io_cache_stamp,
+			 __atomic_add_fetch(&obj->io_cont->ic_cache_clock, 1,
+					    __ATOMIC_RELAXED),
+			 __ATOMIC_RELAXED);
+	if (obj->io_cache_tid == tid ||
+	    (obj->io_pol_flags & IOD_POL_WRITE_ONCE))
+		return;
+	__atomic_store_n(&obj->io_cache_tid, tid, __ATOMIC_RELAXED);
+	if (__atomic_load_n(&obj->io_cache_ref, __ATOMIC_RELAXED) < 2)
+		__atomic_add_fetch(&obj->io_cache_ref, 1, __ATOMIC_RELAXED);
+}
+
+/** a read of \a len bytes of \a obj was served from \a src */
+void
+iod_cache_read(struct iod_obj *obj, int src, iod_size_t len)
+{
+	struct iod_cont	*cont = obj->io_cont;
+	iod_size_t	p;
+	iod_size_t	np;
+	int		ghost;
+
+	if (src == IOD_SEG_BB) {
+		__atomic_add_fetch(&cont->ic_stats.cache_hit_bytes, len,
+				   __ATOMIC_RELAXED);
+		return;
+	}
+	__atomic_add_fetch(&cont->ic_stats.cache_miss_bytes, len,
+			   __ATOMIC_RELAXED);
+	ghost = __atomic_exchange_n(&obj->io_cache_ghost, 0, __ATOMIC_RELAXED);
+	if (ghost == 0)
+		return;
+	/* wanted again after eviction: a frequent one from now on */
+	__atomic_store_n(&obj->io_cache_ref, 2, __ATOMIC_RELAXED);
+	p = __atomic_load_n(&cont->ic_cache_p, __ATOMIC_RELAXED);
+	do {
+		if (ghost == 1)
+			np = iod_min(p + len, iod_env.ie_bb_capacity);
+		else
+			np = p > len ? p - len : 0;
+	} while (!__atomic_compare_exchange_n(&cont->ic_cache_p, &p, np, 0,
+					      __ATOMIC_RELAXED,
+					      __ATOMIC_RELAXED));
+}
+
+static int
+iod_victim_cmp(const void *a, const void *b)
+{
+	const struct iod_victim	*va = a;
+	const struct iod_victim	*vb = b;
+
+	if (va->iv_list != vb->iv_list)
+		return va->iv_list - vb->iv_list;
+	return va->iv_stamp < vb->iv_stamp ? -1 : va->iv_stamp > vb->iv_stamp;
+}
+
+/**
+ * The TID objects can be purged up to: ic_persisted, or 0 if a reader holds
+ * a durable TID. Caller holds ic_lock.
+ */
+static iod_trans_id_t
+iod_cache_floor(struct iod_cont *cont)
+{
+	unsigned long	i;
+
+	for (i = 0; i < cont->ic_ntrans; i++) {
+		if (cont->ic_trans[i]->it_tid > cont->ic_persisted)
+			break;
+		if (cont->ic_trans[i]->it_rdref > 0)
+			return 0;
+	}
+	return cont->ic_persisted;
+}
+
+/**
+ * Every object with data on the burst buffer, list 1 then list 2, least
+ * recently used first, and in \a persisted the TID to purge them up to.
+ * Caller holds ic_lock.
+ */
+static int
+iod_cache_victims(struct iod_cont *cont, struct iod_victim **out,
+		  unsigned long *nr, iod_trans_id_t *persisted)
+{
+	struct iod_victim	*v;
+	struct iod_obj		*obj;
+	unsigned long		i;
+	unsigned long		n = 0;
+
+	*persisted = iod_cache_floor(cont);
+
+	v = malloc(iod_max(cont->ic_nobjs, 1UL) * sizeof(*v));
+	if (v == NULL)
+		return -ENOMEM;
+	for (i = 0; i < cont->ic_hash_size; i++) {
+		for (obj = cont->ic_hash[i]; obj != NULL; obj = obj->io_hnext) {
+			/*
+			 * KV versions are not purged. Only an object whose
+			 * create TID aborts is freed while the container is
+			 * open, so a committed one stays valid unlocked.
+			 */
+			if (obj->io_type == IOD_OBJ_KV ||
+			    !obj->io_create_committed || n == cont->ic_nobjs)
+				continue;
+			v[n].iv_bytes = __atomic_load_n(&obj->io_bb_bytes,
+							__ATOMIC_RELAXED);
+			if (v[n].iv_bytes == 0)
+				continue;
+			v[n].iv_obj = obj;
+			v[n].iv_stamp = 0;
+			if (!(obj->io_pol_flags & IOD_POL_WRITE_ONCE))
+				v[n].iv_stamp = __atomic_load_n(
+					&obj->io_cache_stamp,
+					__ATOMIC_RELAXED);
+			v[n].iv_list = __atomic_load_n(&obj->io_cache_ref,
+						       __ATOMIC_RELAXED) < 2 ?
+				       1 : 2;
+			n++;
+		}
+	}
+	qsort(v, n, sizeof(*v), iod_victim_cmp);
+	*out = v;
+	*nr = n;
+	return 0;
+}
+
+/** purge \a obj up to \a persisted and return the bytes freed */
+static iod_size_t
+iod_cache_evict_obj(struct iod_obj *obj, iod_trans_id_t persisted)
+{
+	struct iod_layer	*layer;
+	struct iod_list		*pos;
+	iod_size_t		freed = 0;
+
+	pthread_rwlock_wrlock(&obj->io_lock);
+	iod_list_for_each(pos, &obj->io_layers) {
+		layer = iod_list_entry(pos, struct iod_layer, il_link);
+		if (layer->il_committed && layer->il_tid <= persisted) {
+			freed = iod_obj_purge_locked(obj, persisted);
+			break;
+		}
+	}
+	pthread_rwlock_unlock(&obj->io_lock);
+	return freed;
+}
+
+/**
+ * Evict until \a len more bytes fit under the low watermark, or nothing
+ * more can go. Caller holds ic_persist_lock, which keeps the persisted TID
+ * and the objects with data below it in place.
+ */
+void
+iod_cache_evict(struct iod_cont *cont, iod_size_t len)
+{
+	struct iod_victim	*v;
+	struct timespec		start;
+	struct timespec		end;
+	iod_trans_id_t		persisted;
+	iod_size_t		bytes[3] = { 0 };
+	iod_size_t		freed;
+	iod_size_t		total = 0;
+	unsigned long		next[3];
+	unsigned long		nr;
+	unsigned long		count = 0;
+	unsigned long		i;
+	int			list;
+	int			one;
+
+	if (iod_cache_used(cont) + len <= iod_env.ie_bb_low)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pthread_mutex_lock(&cont->ic_lock);
+	if (iod_cache_victims(cont, &v, &nr, &persisted) != 0) {
+		pthread_mutex_unlock(&cont->ic_lock);
+		return;
+	}
+	pthread_mutex_unlock(&cont->ic_lock);
+
+	/* list 1 is v[0, next[2]), list 2 the rest */
+	next[1] = 0;
+	next[2] = 0;
+	for (i = 0; i < nr; i++) {
+		bytes[v[i].iv_list] += v[i].iv_bytes;
+		if (v[i].iv_list == 1)
+			next[2] = i + 1;
+	}
+	while (persisted != 0 &&
+	       iod_cache_used(cont) + len > iod_env.ie_bb_low) {
+		/* list 1 while it holds more than its target, else list 2 */
+		one = next[1] < nr && v[next[1]].iv_list == 1;
+		if (one && (next[2] == nr ||
+			    bytes[1] > __atomic_load_n(&cont->ic_cache_p,
+						       __ATOMIC_RELAXED)))
+			list = 1;
+		else if (next[2] < nr)
+			list = 2;
+		else
+			break;
+		i = next[list]++;
+		bytes[list] -= v[i].iv_bytes;
+		freed = iod_cache_evict_obj(v[i].iv_obj, persisted);
+		if (freed == 0)
+			continue;
+		pthread_mutex_lock(&cont->ic_lock);
+		__atomic_store_n(&v[i].iv_obj->io_cache_ref, 0,
+				 __ATOMIC_RELAXED);
+		__atomic_store_n(&v[i].iv_obj->io_cache_tid, 0,
+				 __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&cont->ic_lock);
+		__atomic_store_n(&v[i].iv_obj->io_cache_ghost, list,
+				 __ATOMIC_RELAXED);
+		total += freed;
+		count++;
+	}
+	free(v);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	pthread_mutex_lock(&cont->ic_lock);
+	cont->ic_stats.evict_count += count;
+	cont->ic_stats.evict_bytes += total;
+	cont->ic_stats.evict_nsec += (end.tv_sec - start.tv_sec) *
+				     1000000000ULL + end.tv_nsec -
+				     start.tv_nsec;
+	pthread_mutex_unlock(&cont->ic_lock);
+}
+
+/**
+ * A persist made \a obj durable: purge it now if it was written "skip_bb".
+ * Caller holds ic_persist_lock.
+ */
+void
+iod_cache_shed(struct iod_obj *obj)
+{
+	struct iod_cont	*cont = obj->io_cont;
+	iod_trans_id_t	persisted;
+	iod_size_t	freed;
+
+	pthread_mutex_lock(&cont->ic_lock);
+	persisted = iod_cache_floor(cont);
+	if (!(obj->io_pol_flags & IOD_POL_SKIP_BB) ||
+	    obj->io_type == IOD_OBJ_KV || !obj->io_create_committed)
+		persisted = 0;
+	pthread_mutex_unlock(&cont->ic_lock);
+	if (persisted == 0)
+		return;
+
+	freed = iod_cache_evict_obj(obj, persisted);
+	if (freed == 0)
+		return;
+	pthread_mutex_lock(&cont->ic_lock);
+	cont->ic_stats.evict_count++;
+	cont->ic_stats.evict_bytes += freed;
+	pthread_mutex_unlock(&cont->ic_lock);
+}
+
+/**
+ * Make room for \a len more bytes of \a cont on the burst buffer. Takes no
+ * lock over the high watermark if a persist holds ic_persist_lock, and
+ * waits for it only over the capacity.
+ */
+int
+iod_cache_admit(struct iod_cont *cont, iod_size_t len)
+{
+	iod_size_t	used;
+
+	if (iod_env.ie_bb_capacity == 0)
+		return 0;
+	used = iod_cache_used(cont);
+	if (used + len <= iod_env.ie_bb_high)
+		return 0;
+	if (used + len > iod_env.ie_bb_capacity)
+		pthread_mutex_lock(&cont->ic_persist_lock);
+	else if (pthread_mutex_trylock(&cont->ic_persist_lock) != 0)
+		return 0;
+	iod_cache_evict(cont, len);
+	pthread_mutex_unlock(&cont->ic_persist_lock);
+	return iod_cache_used(cont) + len > iod_env.ie_bb_capacity ?
+	       -ENOSPC : 0;
+}
@@ -0,0 +1,483 @@
+/*
+ * IOD object catalog listings.
+ *
+ * Listings do not walk the object hash. Every object also has an entry in a
+ * multi-version catalog, one per object type, that holds what a listing
+ * needs: the object ID and name, the creating and unlinking TIDs and whether
+ * they committed. Object IDs are handed out in ascending order and a creation
+ * appends its entry, so each catalog stays sorted without ever moving an
+ * entry. Entries live in fixed chunks found through a spine; writers, who
+ * hold ic_lock, fill an entry before they publish the new count, and a grown
+ * spine leaves the old one to readers until the container is freed. A
+ * listing at any TID is then a scan that takes no lock.
+ *
+ * The entry also holds the versions a diff between two TIDs needs: the
+ * creating and unlinking TIDs, and the committed TIDs that modified the
+ * object. Each chunk notes the newest TID committing a change to one of its
+ * entries, so a diff skips the chunks nothing changed in since the TID it
+ * starts from and costs what changed, not the size of the container. The
+ * TIDs that modified an object sit in an array that is only appended to in
+ * place, into a slot reserved when a TID first marks the object dirty, so a
+ * commit cannot run out of memory. When it is full, a larger one replaces it
+ * and the old one is retired until no diff runs.
+ */
+
+#define _GNU_SOURCE
+#include "iod_internal.h"
+
+static struct iod_cat_ent *
+iod_cat_ent(struct iod_cat_spine *sp, unsigned long i)
+{
+	struct iod_cat_chunk	*ck = sp->cs_chunk[i >> IOD_CAT_SHIFT];
+
+	return &ck->ck_ent[i & (IOD_CAT_CHUNK - 1)];
+}
+
+/** the newest TID that committed a change to the chunk of entry \a i */
+static iod_trans_id_t
+iod_cat_latest(struct iod_cat_spine *sp, unsigned long i)
+{
+	return __atomic_load_n(&sp->cs_chunk[i >> IOD_CAT_SHIFT]->ck_latest,
+			       __ATOMIC_ACQUIRE);
+}
+
+/** \a tid committed a change to an entry of \a ck. Caller holds ic_lock. */
+static void
+iod_cat_chunk_raise(struct iod_cat_chunk *ck, iod_trans_id_t tid)
+{
+	if (ck != NULL && tid != IOD_TID_UNKNOWN && tid > ck->ck_latest)
+		__atomic_store_n(&ck->ck_latest, tid, __ATOMIC_RELEASE);
+}
+
+static uint32_t
+iod_cat_flags(struct iod_obj *obj)
+{
+	uint32_t	flags = 0;
+
+	if (obj->io_create_tid == IOD_TID_UNKNOWN)
+		flags |= IOD_CAT_DEAD;
+	if (obj->io_create_committed)
+		flags |= IOD_CAT_CREATED;
+	if (obj->io_unlink_tid != IOD_TID_UNKNOWN && obj->io_unlink_committed)
+		flags |= IOD_CAT_UNLINKED;
+	return flags;
+}
+
+/**
+ * Append \a obj to the catalog of its type. Its ID must not be lower than
+ * any already there. Caller holds ic_lock.
+ */
+int
+iod_cat_add(struct iod_cont *cont, struct iod_obj *obj)
+{
+	struct iod_cat		*ca = &cont->ic_cat[obj->io_type];
+	struct iod_cat_spine	*sp = ca->ca_spine;
+	struct iod_cat_spine	*nsp;
+	struct iod_cat_chunk	*ck;
+	struct iod_cat_ent	*ce;
+	unsigned long		c = ca->ca_nr >> IOD_CAT_SHIFT;
+	unsigned long		max;
+	unsigned long		i;
+
+	if (sp == NULL || c == sp->cs_max) {
+		max = sp != NULL ? sp->cs_max * 2 : 16;
+		nsp = calloc(1, sizeof(*nsp) + max * sizeof(nsp->cs_chunk[0]));
+		if (nsp == NULL)
+			return -ENOMEM;
+		nsp->cs_old = sp;
+		nsp->cs_max = max;
+		if (sp != NULL)
+			memcpy(nsp->cs_chunk, sp->cs_chunk,
+			       sp->cs_max * sizeof(sp->cs_chunk[0]));
+		__atomic_store_n(&ca->ca_spine, nsp, __ATOMIC_RELEASE);
+		sp = nsp;
+	}
+	if (sp->cs_chunk[c] == NULL) {
+		sp->cs_chunk[c] = malloc(sizeof(*ck));
+		if (sp->cs_chunk[c] == NULL)
+			return -ENOMEM;
+		sp->cs_chunk[c]->ck_latest = 0;
+	}
+
+	ck = sp->cs_chunk[c];
+	ce = iod_cat_ent(sp, ca->ca_nr);
+	ce->ce_oid = obj->io_oid;
+	ce->ce_create = obj->io_create_tid;
+	ce->ce_unlink = obj->io_unlink_tid;
+	ce->ce_mods = obj->io_mods;
+	ce->ce_flags = iod_cat_flags(obj);
+	ce->ce_name = NULL;
+	if (obj->io_name != NULL) {
+		/* the object goes away if its creation rolls back */
+		ce->ce_name = strdup(obj->io_name);
+		if (ce->ce_name == NULL)
+			return -ENOMEM;
+	}
+	obj->io_cat = ce;
+	obj->io_cat_chunk = ck;
+	if (obj->io_create_committed)
+		iod_cat_chunk_raise(ck, obj->io_create_tid);
+	if (obj->io_unlink_committed)
+		iod_cat_chunk_raise(ck, obj->io_unlink_tid);
+	for (i = 0; obj->io_mods != NULL && i < obj->io_mods->cm_nr; i++)
+		iod_cat_chunk_raise(ck, obj->io_mods->cm_tid[i]);
+	__atomic_store_n(&ca->ca_nr, ca->ca_nr + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/**
+ * Publish the creation and unlink state of \a obj to listings, after a
+ * change, commit or rollback of it. Caller holds ic_lock.
+ */
+void
+iod_cat_sync(struct iod_obj *obj)
+{
+	struct iod_cat_ent	*ce = obj->io_cat;
+
+	if (ce == NULL)
+		return;
+	__atomic_store_n(&ce->ce_unlink, obj->io_unlink_tid, __ATOMIC_RELAXED);
+	__atomic_store_n(&ce->ce_flags, iod_cat_flags(obj), __ATOMIC_RELEASE);
+	if (obj->io_create_committed)
+		iod_cat_chunk_raise(obj->io_cat_chunk, obj->io_create_tid);
+	if (obj->io_unlink_committed)
+		iod_cat_chunk_raise(obj->io_cat_chunk, obj->io_unlink_tid);
+}
+
+/** free the retired arrays of TIDs unless a diff may still read one */
+static void
+iod_cat_reap(struct iod_cont *cont)
+{
+	struct iod_cat_mods	*cm;
+
+	if (__atomic_load_n(&cont->ic_cat_diffs, __ATOMIC_SEQ_CST) != 0)
+		return;
+	while ((cm = cont->ic_cat_retired) != NULL) {
+		cont->ic_cat_retired = cm->cm_next;
+		free(cm);
+	}
+}
+
+/**
+ * Reserve the slot a TID about to be committed takes in the array of TIDs
+ * that modified \a obj, for each time the TID enters \a obj in its dirty
+ * list. A full array is replaced by one twice the size of what it keeps:
+ * the TIDs from ic_trans_floor up, and the newest one below, which is all a
+ * diff up to a TID still known needs of them. Caller holds ic_lock.
+ */
+int
+iod_cat_reserve(struct iod_cont *cont, struct iod_obj *obj)
+{
+	struct iod_cat_mods	*old = obj->io_mods;
+	struct iod_cat_mods	*cm;
+	iod_trans_id_t		below = IOD_TID_UNKNOWN;
+	iod_trans_id_t		tid;
+	unsigned long		nr = old != NULL ? old->cm_nr : 0;
+	unsigned long		max;
+	unsigned long		i;
+
+	if (old != NULL && nr + obj->io_mods_resv < old->cm_max) {
+		obj->io_mods_resv++;
+		return 0;
+	}
+	max = iod_max(2 * (nr + obj->io_mods_resv + 1), 4UL);
+	cm = malloc(sizeof(*cm) + max * sizeof(cm->cm_tid[0]));
+	if (cm == NULL)
+		return -ENOMEM;
+	cm->cm_next = NULL;
+	cm->cm_nr = 0;
+	cm->cm_max = max;
+	for (i = 0; i < nr; i++) {
+		tid = old->cm_tid[i];
+		if (tid >= cont->ic_trans_floor)
+			cm->cm_tid[cm->cm_nr++] = tid;
+		else if (below == IOD_TID_UNKNOWN || tid > below)
+			below = tid;
+	}
+	if (below != IOD_TID_UNKNOWN)
+		cm->cm_tid[cm->cm_nr++] = below;
+
+	obj->io_mods = cm;
+	obj->io_mods_resv++;
+	if (obj->io_cat != NULL)
+		__atomic_store_n(&obj->io_cat->ce_mods, cm, __ATOMIC_SEQ_CST);
+	if (old != NULL) {
+		old->cm_next = cont->ic_cat_retired;
+		cont->ic_cat_retired = old;
+		iod_cat_reap(cont);
+	}
+	return 0;
+}
+
+/** Give back a slot iod_cat_reserve took. Caller holds ic_lock. */
+void
+iod_cat_unreserve(struct iod_obj *obj)
+{
+	obj->io_mods_resv--;
+}
+
+/**
+ * Record that committed TID \a tid modified \a obj, in the slot reserved
+ * for it. Caller holds ic_lock.
+ */
+void
+iod_cat_mod(struct iod_obj *obj, iod_trans_id_t tid)
+{
+	struct iod_cat_mods	*cm = obj->io_mods;
+
+	if (cm == NULL || cm->cm_nr == cm->cm_max)
+		return;
+	cm->cm_tid[cm->cm_nr] = tid;
+	__atomic_store_n(&cm->cm_nr, cm->cm_nr + 1, __ATOMIC_RELEASE);
+	iod_cat_chunk_raise(obj->io_cat_chunk, tid);
+}
+
+static int
+iod_oid_sort_cmp(const void *a, const void *b)
+{
+	const struct iod_obj	*oa = *(struct iod_obj * const *)a;
+	const struct iod_obj	*ob = *(struct iod_obj * const *)b;
+
+	return iod_oid_cmp(oa->io_oid, ob->io_oid);
+}
+
+/**
+ * Catalog the objects a container was opened with, once its checkpoint is
+ * loaded and its log replayed. Nobody else references \a cont yet.
+ */
+int
+iod_cat_build(struct iod_cont *cont)
+{
+	struct iod_obj	**objs;
+	struct iod_obj	*obj;
+	unsigned long	nr = 0;
+	unsigned long	i;
+	int		rc = 0;
+
+	objs = malloc((cont->ic_nobjs + 1) * sizeof(*objs));
+	if (objs == NULL)
+		return -ENOMEM;
+	for (i = 0; i < cont->ic_hash_size; i++) {
+		for (obj = cont->ic_hash[i]; obj != NULL; obj = obj->io_hnext)
+			objs[nr++] = obj;
+	}
+	qsort(objs, nr, sizeof(*objs), iod_oid_sort_cmp);
+	for (i = 0; i < nr && rc == 0; i++)
+		rc = iod_cat_add(cont, objs[i]);
+	free(objs);
+	return rc;
+}
+
+/** Called on the last close, nobody else references \a cont. */
+void
+iod_cat_free(struct iod_cont *cont)
+{
+	struct iod_cat_spine	*sp;
+	struct iod_cat		*ca;
+	unsigned long		i;
+	int			t;
+
+	for (t = IOD_OBJ_ARRAY; t <= IOD_OBJ_KV; t++) {
+		ca = &cont->ic_cat[t];
+		for (i = 0; i < ca->ca_nr; i++)
+			free(iod_cat_ent(ca->ca_spine, i)->ce_name);
+		for (i = 0; ca->ca_spine != NULL &&
+			    i < ca->ca_spine->cs_max; i++)
+			free(ca->ca_spine->cs_chunk[i]);
+		while ((sp = ca->ca_spine) != NULL) {
+			ca->ca_spine = sp->cs_old;
+			free(sp);
+		}
+		ca->ca_nr = 0;
+	}
+	iod_cat_reap(cont);
+}
+
+static int
+iod_cat_visible(struct iod_cat_ent *ce, iod_trans_id_t tid)
+{
+	uint32_t	flags;
+	iod_trans_id_t	unlink;
+
+	flags = __atomic_load_n(&ce->ce_flags, __ATOMIC_ACQUIRE);
+	unlink = __atomic_load_n(&ce->ce_unlink, __ATOMIC_RELAXED);
+	if ((flags & IOD_CAT_DEAD) ||
+	    !iod_ver_visible(ce->ce_create, flags & IOD_CAT_CREATED, tid))
+		return 0;
+	if (unlink == IOD_TID_UNKNOWN)
+		return 1;
+	return !iod_ver_visible(unlink, flags & IOD_CAT_UNLINKED, tid);
+}
+
+/**
+ * Objects are listed by ascending object ID, which puts ARRAY objects before
+ * BLOB and KV ones. Returns the number of objects stored.
+ */
+iod_ret_t
+iod_container_list_obj(iod_handle_t coh, iod_trans_id_t tid,
+		       iod_obj_type_t filter, iod_off_t offset, iod_size_t num,
+		       iod_obj_id_t *oid, iod_obj_type_t *type, char *name,
+		       iod_event_t *event)
+{
+	struct iod_cont		*cont = iod_cont_lookup(coh);
+	struct iod_cat_spine	*sp;
+	struct iod_cat_ent	*ce;
+	unsigned long		nr;
+	unsigned long		i;
+	iod_off_t		skip = 0;
+	iod_size_t		n = 0;
+	int			t;
+
+	if (cont == NULL || (num > 0 && oid == NULL) || filter > IOD_OBJ_KV)
+		return iod_ev_return(event, IOD_EV_CONT_LS_OBJ, -EINVAL);
+
+	if (tid == 0)
+		tid = __atomic_load_n(&cont->ic_tids.latest_rdable,
+				      __ATOMIC_ACQUIRE);
+	for (t = IOD_OBJ_ARRAY; t <= IOD_OBJ_KV && n < num; t++) {
+		if (filter != IOD_OBJ_ANY && filter != (iod_obj_type_t)t)
+			continue;
+		/* the spine is at least as new as the count */
+		nr = __atomic_load_n(&cont->ic_cat[t].ca_nr, __ATOMIC_ACQUIRE);
+		sp = __atomic_load_n(&cont->ic_cat[t].ca_spine,
+				     __ATOMIC_ACQUIRE);
+		for (i = 0; i < nr && n < num; i++) {
+			ce = iod_cat_ent(sp, i);
+			if (!iod_cat_visible(ce, tid))
+				continue;
+			if (skip++ < offset)
+				continue;
+			oid[n] = ce->ce_oid;
+			if (type != NULL)
+				type[n] = t;
+			if (name != NULL) {
+				char	*buf = name + n * IOD_OBJ_NAME_MAXLEN;
+
+				if (ce->ce_name != NULL)
+					strcpy(buf, ce->ce_name);
+				else
+					buf[0] = '\0';
+			}
+			n++;
+		}
+	}
+	return iod_ev_return(event, IOD_EV_CONT_LS_OBJ, (int)n);
+}
+
+/** whether the object of \a ce exists at \a tid, by what is committed */
+static int
+iod_cat_exists(const struct iod_cat_ent *ce, uint32_t flags,
+	       iod_trans_id_t unlink, iod_trans_id_t tid)
+{
+	if ((flags & IOD_CAT_DEAD) || !(flags & IOD_CAT_CREATED) ||
+	    ce->ce_create > tid)
+		return 0;
+	return !(flags & IOD_CAT_UNLINKED) || unlink > tid;
+}
+
+/**
+ * What the object of \a ce became from \a from to \a to, see
+ * iod_container_diff_obj. Returns 0 if it is not to be listed.
+ */
+static int
+iod_cat_changed(struct iod_cat_ent *ce, iod_trans_id_t from,
+		iod_trans_id_t to, iod_obj_change_t *change)
+{
+	struct iod_cat_mods	*cm;
+	iod_trans_id_t		unlink;
+	iod_trans_id_t		tid;
+	unsigned long		nr;
+	unsigned long		i;
+	uint32_t		flags;
+	int			before;
+	int			after;
+
+	flags = __atomic_load_n(&ce->ce_flags, __ATOMIC_ACQUIRE);
+	unlink = __atomic_load_n(&ce->ce_unlink, __ATOMIC_RELAXED);
+	before = iod_cat_exists(ce, flags, unlink, from);
+	after = iod_cat_exists(ce, flags, unlink, to);
+	if (before != after) {
+		*change = after ? IOD_OBJ_CREATED : IOD_OBJ_UNLINKED;
+		return 1;
+	}
+	if (!after)
+		return 0;
+
+	/* retired arrays stay until ic_cat_diffs drops back to 0 */
+	cm = __atomic_load_n(&ce->ce_mods, __ATOMIC_SEQ_CST);
+	nr = cm != NULL ? __atomic_load_n(&cm->cm_nr, __ATOMIC_ACQUIRE) : 0;
+	for (i = 0; i < nr; i++) {
+		tid = cm->cm_tid[i];
+		if (tid > from && tid <= to) {
+			*change = IOD_OBJ_MODIFIED;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+iod_ret_t
+iod_container_diff_obj(iod_handle_t coh, iod_trans_id_t from_tid,
+		       iod_trans_id_t to_tid, iod_obj_type_t filter,
+		       iod_off_t offset, iod_size_t num, iod_obj_id_t *oid,
+		       iod_obj_type_t *type, iod_obj_change_t *change,
+		       iod_event_t *event)
+{
+	struct iod_cont		*cont = iod_cont_lookup(coh);
+	struct iod_cat_spine	*sp;
+	struct iod_cat_ent	*ce;
+	iod_obj_change_t	c;
+	unsigned long		nr;
+	unsigned long		i;
+	iod_off_t		skip = 0;
+	iod_size_t		n = 0;
+	int			rc;
+	int			t;
+
+	if (cont == NULL || (num > 0 && oid == NULL) || filter > IOD_OBJ_KV)
+		return iod_ev_return(event, IOD_EV_CONT_DIFF_OBJ, -EINVAL);
+
+	/* held like a read, the versions up to \a to_tid are not folded */
+	pthread_mutex_lock(&cont->ic_lock);
+	if (to_tid == 0)
+		to_tid = cont->ic_tids.latest_rdable;
+	rc = from_tid > to_tid ? -EINVAL : iod_trans_get(cont, to_tid);
+	if (rc == 0)
+		__atomic_add_fetch(&cont->ic_cat_diffs, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&cont->ic_lock);
+	if (rc != 0)
+		return iod_ev_return(event, IOD_EV_CONT_DIFF_OBJ, rc);
+
+	for (t = IOD_OBJ_ARRAY; t <= IOD_OBJ_KV && n < num; t++) {
+		if (filter != IOD_OBJ_ANY && filter != (iod_obj_type_t)t)
+			continue;
+		nr = __atomic_load_n(&cont->ic_cat[t].ca_nr, __ATOMIC_ACQUIRE);
+		sp = __atomic_load_n(&cont->ic_cat[t].ca_spine,
+				     __ATOMIC_ACQUIRE);
+		for (i = 0; i < nr && n < num; i++) {
+			/* nothing in the chunk changed since from_tid */
+			if ((i & (IOD_CAT_CHUNK - 1)) == 0 &&
+			    iod_cat_latest(sp, i) <= from_tid) {
+				i += IOD_CAT_CHUNK - 1;
+				continue;
+			}
+			ce = iod_cat_ent(sp, i);
+			if (!iod_cat_changed(ce, from_tid, to_tid, &c) ||
+			    skip++ < offset)
+				continue;
+			oid[n] = ce->ce_oid;
+			if (type != NULL)
+				type[n] = t;
+			if (change != NULL)
+				change[n] = c;
+			n++;
+		}
+	}
+
+	pthread_mutex_lock(&cont->ic_lock);
+	__atomic_sub_fetch(&cont->ic_cat_diffs, 1, __ATOMIC_SEQ_CST);
+	iod_cat_reap(cont);
+	iod_trans_put(cont, to_tid);
+	pthread_mutex_unlock(&cont->ic_lock);
+	return iod_ev_return(event, IOD_EV_CONT_DIFF_OBJ, (int)n);
+}
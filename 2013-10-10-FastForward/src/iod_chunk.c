@@ -0,0 +1,788 @@
+/*
+ * Chunked arrays.
+ *
+ * An array created with chunk_dims is cut into chunks of that shape, a
+ * chunk_dims of 0 standing for 1. Each chunk is stored row-major as one
+ * piece of chunk_bytes in a slot of the object's byte space, and the chunk
+ * index maps chunk numbers to slots with an open-addressing hash, so that
+ * finding a chunk is O(1) however many there are. Slots are handed out in
+ * the order chunks are first written: chunks nobody wrote have no slot, take
+ * no space on the burst buffer or central storage, and read as zeroes, the
+ * fill value of this engine.
+ *
+ * A hyperslab access is split by chunk. Inside a chunk the selected cells
+ * are rows of runs along the last dimension, and a row lands in one piece of
+ * the packed memory buffer. Writes gather a chunk into one log append;
+ * reads stage nearby rows of a chunk together, and the chunks of a read are
+ * fetched by up to iod.threads workers in parallel.
+ */
+
+#include "iod_internal.h"
+
+#define IOD_CHUNK_STAGE		(4UL << 20)	/* staging buffer of a worker */
+#define IOD_CHUNK_GAP		(16UL << 10)	/* hole worth a new window */
+#define IOD_CHUNK_DIRECT	(64UL << 10)	/* runs read in place */
+#define IOD_CHUNK_PAR		(1UL << 20)	/* bytes worth another reader */
+
+/* ------------------------------- index ---------------------------------- */
+
+static inline iod_size_t
+iod_chunk_edge(struct iod_obj *obj, uint32_t d)
+{
+	return obj->io_chunk[d] != 0 ? obj->io_chunk[d] : 1;
+}
+
+/** bytes of one chunk slot */
+iod_size_t
+iod_chunk_bytes(struct iod_obj *obj)
+{
+	iod_size_t	bytes = obj->io_cell_size;
+	uint32_t	d;
+
+	for (d = 0; d < obj->io_ndims; d++)
+		bytes *= iod_chunk_edge(obj, d);
+	return bytes;
+}
+
+static inline uint64_t
+iod_chunk_mix(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	return x ^ (x >> 33);
+}
+
+/** the hash entry of \a chunk, or the free entry where it would go */
+static uint64_t *
+iod_chunk_probe(const struct iod_chunk_index *ci, uint64_t chunk)
+{
+	uint64_t	mask = ci->ci_hash_size - 1;
+	uint64_t	i = iod_chunk_mix(chunk) & mask;
+
+	while (ci->ci_hash[i] != 0 && ci->ci_chunk[ci->ci_hash[i] - 1] != chunk)
+		i = (i + 1) & mask;
+	return &ci->ci_hash[i];
+}
+
+/** slot of \a chunk, IOD_CHUNK_NONE if never written. Caller holds io_lock. */
+uint64_t
+iod_chunk_find(struct iod_obj *obj, uint64_t chunk)
+{
+	struct iod_chunk_index	*ci = &obj->io_chunks;
+	uint64_t		*e;
+
+	if (ci->ci_nslots == 0)
+		return IOD_CHUNK_NONE;
+	e = iod_chunk_probe(ci, chunk);
+	return *e != 0 ? *e - 1 : IOD_CHUNK_NONE;
+}
+
+static int
+iod_chunk_rehash(struct iod_chunk_index *ci, uint64_t size)
+{
+	uint64_t	*old = ci->ci_hash;
+	uint64_t	s;
+
+	ci->ci_hash = calloc(size, sizeof(*ci->ci_hash));
+	if (ci->ci_hash == NULL) {
+		ci->ci_hash = old;
+		return -ENOMEM;
+	}
+	ci->ci_hash_size = size;
+	for (s = 0; s < ci->ci_nslots; s++)
+		*iod_chunk_probe(ci, ci->ci_chunk[s]) = s + 1;
+	free(old);
+	return 0;
+}
+
+/**
+ * Slot of \a chunk, giving it the next free one on first use. Caller holds
+ * io_lock for write.
+ */
+int
+iod_chunk_slot(struct iod_obj *obj, uint64_t chunk, uint64_t *slot)
+{
+	struct iod_chunk_index	*ci = &obj->io_chunks;
+	uint64_t		*chunks;
+	uint64_t		*e;
+	uint64_t		max;
+	int			rc;
+
+	/* keep the load factor under 3/4 */
+	if ((ci->ci_nslots + 1) * 4 > ci->ci_hash_size * 3) {
+		rc = iod_chunk_rehash(ci, iod_max(ci->ci_hash_size * 2, 64UL));
+		if (rc != 0)
+			return rc;
+	}
+	e = iod_chunk_probe(ci, chunk);
+	if (*e != 0) {
+		*slot = *e - 1;
+		return 0;
+	}
+	if (ci->ci_nslots == ci->ci_maxslots) {
+		max = iod_max(ci->ci_maxslots * 2, 64UL);
+		chunks = realloc(ci->ci_chunk, max * sizeof(*chunks));
+		if (chunks == NULL)
+			return -ENOMEM;
+		ci->ci_chunk = chunks;
+		ci->ci_maxslots = max;
+	}
+	ci->ci_chunk[ci->ci_nslots] = chunk;
+	*slot = ci->ci_nslots++;
+	*e = ci->ci_nslots;
+	return 0;
+}
+
+void
+iod_chunk_fini(struct iod_obj *obj)
+{
+	free(obj->io_chunks.ci_chunk);
+	free(obj->io_chunks.ci_hash);
+	memset(&obj->io_chunks, 0, sizeof(obj->io_chunks));
+}
+
+/* ---------------------------- hyperslab I/O ----------------------------- */
+
+/** one chunked hyperslab access, shared by its workers */
+struct iod_chunk_io {
+	struct iod_obj		*cx_obj;
+	iod_trans_id_t		cx_tid;
+	iod_hyperslab_t		*cx_slab;
+	iod_mem_desc_t		*cx_md;
+	iod_size_t		*cx_frag;	/* buffer offset of each frag */
+	uint32_t		cx_nd;
+	uint32_t		cx_cell;
+	iod_size_t		cx_dims[IOD_MAX_DIMS];
+	iod_size_t		cx_edge[IOD_MAX_DIMS];	/* chunk, cells */
+	iod_size_t		cx_gpitch[IOD_MAX_DIMS]; /* chunk numbering */
+	iod_size_t		cx_cpitch[IOD_MAX_DIMS]; /* bytes, in a chunk */
+	iod_size_t		cx_mpitch[IOD_MAX_DIMS]; /* bytes, in memory */
+	iod_size_t		cx_cbytes;
+	iod_size_t		*cx_cidx[IOD_MAX_DIMS];	/* chunks selected */
+	iod_size_t		cx_ncidx[IOD_MAX_DIMS];
+	iod_size_t		cx_total;
+	pthread_mutex_t		cx_lock;
+	iod_size_t		cx_next;	/* next chunk to claim */
+	int			cx_rc;
+};
+
+/** selected cells of one row of a chunk that are adjacent in it */
+struct iod_chunk_run {
+	iod_size_t		cr_off;		/* bytes from the row start */
+	iod_size_t		cr_len;
+};
+
+/** the selection inside one chunk, and the scratch of a worker */
+struct iod_chunk_work {
+	iod_size_t		*cw_loc[IOD_MAX_DIMS];	/* cell in the chunk */
+	iod_size_t		*cw_ord[IOD_MAX_DIMS];	/* cell in the slab */
+	iod_size_t		cw_nsel[IOD_MAX_DIMS];
+	struct iod_chunk_run	*cw_run;
+	iod_size_t		cw_nruns;
+	iod_size_t		cw_span;	/* row start to end of runs */
+	iod_size_t		cw_rowbytes;	/* bytes selected in a row */
+	uint64_t		cw_chunk;
+	iod_off_t		*cw_coff;	/* row offsets in the chunk */
+	iod_size_t		*cw_moff;	/* row offsets in memory */
+	iod_size_t		cw_nrows;
+	iod_size_t		cw_maxrows;
+	char			*cw_buf;
+	iod_size_t		cw_bufsz;
+	iod_mem_desc_t		*cw_md;		/* one fragment, cw_buf */
+	struct iod_extent	*cw_ext;
+	unsigned long		cw_next;
+	unsigned long		cw_maxext;
+};
+
+/**
+ * Selected indices of dimension \a d in [lo, hi): their offset from \a lo
+ * into \a loc and their rank in the selection into \a ord, if not NULL.
+ * Returns how many there are.
+ */
+static iod_size_t
+iod_chunk_sel(const struct iod_chunk_io *cx, uint32_t d, iod_size_t lo,
+	      iod_size_t hi, iod_size_t *loc, iod_size_t *ord)
+{
+	iod_hyperslab_t	*slab = cx->cx_slab;
+	iod_size_t	start = slab->start[d];
+	iod_size_t	count = slab->count[d];
+	iod_size_t	stride = slab->stride != NULL ? slab->stride[d] : 1;
+	iod_size_t	block = slab->block != NULL ? slab->block[d] : 1;
+	iod_size_t	base;
+	iod_size_t	k = 0;
+	iod_size_t	b;
+	iod_size_t	n = 0;
+
+	if (count > 1 && lo > start)
+		k = (lo - start) / stride;
+	for (; k < count; k++) {
+		base = start + k * stride;
+		if (base >= hi)
+			break;
+		for (b = lo > base ? lo - base : 0; b < block && base + b < hi;
+		     b++, n++) {
+			if (loc != NULL) {
+				loc[n] = base + b - lo;
+				ord[n] = k * block + b;
+			}
+		}
+	}
+	return n;
+}
+
+/** set up \a cx for \a slab, already checked against \a dims */
+static int
+iod_chunk_io_init(struct iod_chunk_io *cx, struct iod_obj *obj,
+		  iod_trans_id_t tid, const iod_size_t *dims,
+		  iod_hyperslab_t *slab, iod_mem_desc_t *md)
+{
+	iod_size_t	stride;
+	iod_size_t	block;
+	iod_size_t	first;
+	iod_size_t	last;
+	iod_size_t	c;
+	unsigned long	i;
+	int		d;
+
+	memset(cx, 0, sizeof(*cx));
+	cx->cx_obj = obj;
+	cx->cx_tid = tid;
+	cx->cx_slab = slab;
+	cx->cx_md = md;
+	cx->cx_nd = obj->io_ndims;
+	cx->cx_cell = obj->io_cell_size;
+	cx->cx_cbytes = iod_chunk_bytes(obj);
+	pthread_mutex_init(&cx->cx_lock, NULL);
+	for (d = 0; d < (int)cx->cx_nd; d++)
+		if (slab->count[d] == 0)
+			return 0;
+	cx->cx_total = 1;
+
+	cx->cx_frag = malloc((md->nfrag + 1) * sizeof(*cx->cx_frag));
+	if (cx->cx_frag == NULL)
+		return -ENOMEM;
+	cx->cx_frag[0] = 0;
+	for (i = 0; i < md->nfrag; i++)
+		cx->cx_frag[i + 1] = cx->cx_frag[i] + md->frag[i].len;
+
+	for (d = cx->cx_nd - 1; d >= 0; d--) {
+		cx->cx_dims[d] = dims[d];
+		cx->cx_edge[d] = iod_chunk_edge(obj, d);
+		if (d == (int)cx->cx_nd - 1) {
+			cx->cx_gpitch[d] = 1;
+			cx->cx_cpitch[d] = cx->cx_cell;
+			cx->cx_mpitch[d] = cx->cx_cell;
+			continue;
+		}
+		/* the grid of the first dimension is unbounded */
+		cx->cx_gpitch[d] = cx->cx_gpitch[d + 1] *
+			((dims[d + 1] + cx->cx_edge[d + 1] - 1) /
+			 cx->cx_edge[d + 1]);
+		cx->cx_cpitch[d] = cx->cx_cpitch[d + 1] * cx->cx_edge[d + 1];
+		cx->cx_mpitch[d] = cx->cx_mpitch[d + 1] * slab->count[d + 1] *
+			(slab->block != NULL ? slab->block[d + 1] : 1);
+	}
+
+	/* the chunks of each dimension holding a selected index */
+	for (d = 0; d < (int)cx->cx_nd; d++) {
+		stride = slab->stride != NULL ? slab->stride[d] : 1;
+		block = slab->block != NULL ? slab->block[d] : 1;
+		first = slab->start[d] / cx->cx_edge[d];
+		last = (slab->start[d] + (slab->count[d] - 1) * stride +
+			block - 1) / cx->cx_edge[d];
+		cx->cx_cidx[d] = malloc((last - first + 1) *
+					sizeof(*cx->cx_cidx[d]));
+		if (cx->cx_cidx[d] == NULL)
+			return -ENOMEM;
+		for (c = first; c <= last; c++) {
+			if (iod_chunk_sel(cx, d, c * cx->cx_edge[d],
+					  iod_min((c + 1) * cx->cx_edge[d],
+						  dims[d]), NULL, NULL) > 0)
+				cx->cx_cidx[d][cx->cx_ncidx[d]++] = c;
+		}
+		cx->cx_total *= cx->cx_ncidx[d];
+	}
+	return 0;
+}
+
+static void
+iod_chunk_io_fini(struct iod_chunk_io *cx)
+{
+	uint32_t	d;
+
+	for (d = 0; d < cx->cx_nd; d++)
+		free(cx->cx_cidx[d]);
+	free(cx->cx_frag);
+	pthread_mutex_destroy(&cx->cx_lock);
+}
+
+static int
+iod_chunk_work_init(struct iod_chunk_work *cw, const struct iod_chunk_io *cx)
+{
+	iod_size_t	cap;
+	uint32_t	d;
+
+	memset(cw, 0, sizeof(*cw));
+	for (d = 0; d < cx->cx_nd; d++) {
+		cap = iod_min(cx->cx_edge[d], cx->cx_dims[d]);
+		cw->cw_loc[d] = malloc(2 * cap * sizeof(iod_size_t));
+		if (cw->cw_loc[d] == NULL)
+			return -ENOMEM;
+		cw->cw_ord[d] = cw->cw_loc[d] + cap;
+	}
+	cw->cw_run = malloc(iod_min(cx->cx_edge[cx->cx_nd - 1],
+				    cx->cx_dims[cx->cx_nd - 1]) *
+			    sizeof(*cw->cw_run));
+	cw->cw_md = malloc(sizeof(*cw->cw_md) + sizeof(cw->cw_md->frag[0]));
+	if (cw->cw_run == NULL || cw->cw_md == NULL)
+		return -ENOMEM;
+	cw->cw_md->nfrag = 1;
+	return 0;
+}
+
+static void
+iod_chunk_work_fini(struct iod_chunk_work *cw, const struct iod_chunk_io *cx)
+{
+	uint32_t	d;
+
+	for (d = 0; d < cx->cx_nd; d++)
+		free(cw->cw_loc[d]);
+	free(cw->cw_run);
+	free(cw->cw_coff);
+	free(cw->cw_moff);
+	free(cw->cw_buf);
+	free(cw->cw_md);
+	free(cw->cw_ext);
+}
+
+/** a staging buffer of at least \a len bytes */
+static int
+iod_chunk_buf(struct iod_chunk_work *cw, iod_size_t len)
+{
+	char	*buf;
+
+	if (len <= cw->cw_bufsz)
+		return 0;
+	buf = realloc(cw->cw_buf, len);
+	if (buf == NULL)
+		return -ENOMEM;
+	cw->cw_buf = buf;
+	cw->cw_bufsz = len;
+	return 0;
+}
+
+/** position \a mc at byte \a off of the packed memory buffer */
+static void
+iod_chunk_seek(const struct iod_chunk_io *cx, struct iod_memcur *mc,
+	       iod_size_t off)
+{
+	unsigned long	lo = 0;
+	unsigned long	hi = cx->cx_md->nfrag;
+	unsigned long	mid;
+
+	/* last fragment starting at or before off */
+	while (hi - lo > 1) {
+		mid = (lo + hi) / 2;
+		if (cx->cx_frag[mid] <= off)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	mc->mc_desc = cx->cx_md;
+	mc->mc_idx = lo;
+	mc->mc_off = off - cx->cx_frag[lo];
+}
+
+/**
+ * Work out the selection inside chunk \a t of the access: its chunk number,
+ * the runs of a row and the offset of every row in the chunk and in memory.
+ */
+static int
+iod_chunk_plan(const struct iod_chunk_io *cx, struct iod_chunk_work *cw,
+	       iod_size_t t)
+{
+	iod_size_t	c[IOD_MAX_DIMS];
+	iod_size_t	idx[IOD_MAX_DIMS];
+	iod_size_t	nrows = 1;
+	iod_size_t	lo;
+	iod_size_t	r;
+	iod_size_t	i;
+	iod_off_t	coff;
+	iod_size_t	moff;
+	iod_size_t	*loc;
+	uint32_t	last = cx->cx_nd - 1;
+	void		*p;
+	int		d;
+
+	cw->cw_chunk = 0;
+	for (d = last; d >= 0; d--) {
+		c[d] = cx->cx_cidx[d][t % cx->cx_ncidx[d]];
+		t /= cx->cx_ncidx[d];
+		cw->cw_chunk += c[d] * cx->cx_gpitch[d];
+		lo = c[d] * cx->cx_edge[d];
+		cw->cw_nsel[d] = iod_chunk_sel(cx, d, lo,
+					       iod_min(lo + cx->cx_edge[d],
+						       cx->cx_dims[d]),
+					       cw->cw_loc[d], cw->cw_ord[d]);
+		if (d < (int)last)
+			nrows *= cw->cw_nsel[d];
+		idx[d] = 0;
+	}
+
+	/* adjacent cells of the last dimension are one run */
+	cw->cw_nruns = 0;
+	loc = cw->cw_loc[last];
+	for (i = 0; i < cw->cw_nsel[last]; i++) {
+		if (i > 0 && loc[i] == loc[i - 1] + 1) {
+			cw->cw_run[cw->cw_nruns - 1].cr_len += cx->cx_cell;
+			continue;
+		}
+		cw->cw_run[cw->cw_nruns].cr_off = loc[i] * cx->cx_cell;
+		cw->cw_run[cw->cw_nruns++].cr_len = cx->cx_cell;
+	}
+	cw->cw_span = cw->cw_run[cw->cw_nruns - 1].cr_off +
+		      cw->cw_run[cw->cw_nruns - 1].cr_len;
+	cw->cw_rowbytes = cw->cw_nsel[last] * cx->cx_cell;
+
+	if (nrows > cw->cw_maxrows) {
+		p = realloc(cw->cw_coff, nrows * sizeof(*cw->cw_coff));
+		if (p == NULL)
+			return -ENOMEM;
+		cw->cw_coff = p;
+		p = realloc(cw->cw_moff, nrows * sizeof(*cw->cw_moff));
+		if (p == NULL)
+			return -ENOMEM;
+		cw->cw_moff = p;
+		cw->cw_maxrows = nrows;
+	}
+	for (r = 0; r < nrows; r++) {
+		coff = 0;
+		moff = cw->cw_ord[last][0] * cx->cx_cell;
+		for (d = 0; d < (int)last; d++) {
+			coff += cw->cw_loc[d][idx[d]] * cx->cx_cpitch[d];
+			moff += cw->cw_ord[d][idx[d]] * cx->cx_mpitch[d];
+		}
+		cw->cw_coff[r] = coff;
+		cw->cw_moff[r] = moff;
+		/* odometer over the outer dimensions */
+		for (d = (int)last - 1; d >= 0; d--) {
+			if (++idx[d] < cw->cw_nsel[d])
+				break;
+			idx[d] = 0;
+		}
+	}
+	cw->cw_nrows = nrows;
+	return 0;
+}
+
+/* -------------------------------- write --------------------------------- */
+
+static int
+iod_chunk_ext_add(struct iod_chunk_work *cw, iod_off_t off, iod_size_t len)
+{
+	struct iod_extent	*ext;
+	unsigned long		max;
+
+	if (cw->cw_next > 0 &&
+	    cw->cw_ext[cw->cw_next - 1].ie_off +
+	    (iod_off_t)cw->cw_ext[cw->cw_next - 1].ie_len == off) {
+		cw->cw_ext[cw->cw_next - 1].ie_len += len;
+		return 0;
+	}
+	if (cw->cw_next == cw->cw_maxext) {
+		max = iod_max(cw->cw_maxext * 2, 64UL);
+		ext = realloc(cw->cw_ext, max * sizeof(*ext));
+		if (ext == NULL)
+			return -ENOMEM;
+		cw->cw_ext = ext;
+		cw->cw_maxext = max;
+	}
+	cw->cw_ext[cw->cw_next].ie_off = off;
+	cw->cw_ext[cw->cw_next].ie_len = len;
+	cw->cw_ext[cw->cw_next++].ie_addr = 0;
+	return 0;
+}
+
+/** append the cells gathered in cw_buf to the log as one piece */
+static int
+iod_chunk_flush(const struct iod_chunk_io *cx, struct iod_chunk_work *cw,
+		iod_size_t len)
+{
+	struct iod_memcur	mc;
+	int			rc;
+
+	cw->cw_md->frag[0].addr = cw->cw_buf;
+	cw->cw_md->frag[0].len = len;
+	iod_memcur_init(&mc, cw->cw_md);
+	rc = iod_obj_write_vec(cx->cx_obj, cx->cx_tid, cw->cw_ext, cw->cw_next,
+			       &mc, NULL);
+	cw->cw_next = 0;
+	return rc;
+}
+
+static int
+iod_chunk_write_one(const struct iod_chunk_io *cx, struct iod_chunk_work *cw,
+		    iod_size_t t)
+{
+	struct iod_memcur	mc;
+	iod_size_t		len = 0;
+	iod_size_t		r;
+	iod_size_t		i;
+	iod_off_t		base;
+	uint64_t		slot;
+	int			rc;
+
+	rc = iod_chunk_plan(cx, cw, t);
+	if (rc != 0)
+		return rc;
+	pthread_rwlock_wrlock(&cx->cx_obj->io_lock);
+	rc = iod_chunk_slot(cx->cx_obj, cw->cw_chunk, &slot);
+	pthread_rwlock_unlock(&cx->cx_obj->io_lock);
+	if (rc != 0)
+		return rc;
+	base = slot * cx->cx_cbytes;
+
+	rc = iod_chunk_buf(cw, iod_max(iod_min(IOD_CHUNK_STAGE,
+					       cx->cx_cbytes),
+				       cw->cw_rowbytes));
+	for (r = 0; r < cw->cw_nrows && rc == 0; r++) {
+		if (len + cw->cw_rowbytes > cw->cw_bufsz) {
+			rc = iod_chunk_flush(cx, cw, len);
+			len = 0;
+			if (rc != 0)
+				break;
+		}
+		iod_chunk_seek(cx, &mc, cw->cw_moff[r]);
+		rc = iod_memcur_drain(&mc, cw->cw_buf + len, cw->cw_rowbytes);
+		for (i = 0; i < cw->cw_nruns && rc == 0; i++)
+			rc = iod_chunk_ext_add(cw, base + cw->cw_coff[r] +
+					       cw->cw_run[i].cr_off,
+					       cw->cw_run[i].cr_len);
+		len += cw->cw_rowbytes;
+	}
+	if (rc == 0 && len > 0)
+		rc = iod_chunk_flush(cx, cw, len);
+	cw->cw_next = 0;
+	return rc;
+}
+
+/**
+ * Write the hyperslab \a slab of chunked array \a obj, checked against
+ * \a dims, from \a md in TID \a tid. Every chunk it touches is appended to
+ * the log in one piece.
+ */
+int
+iod_chunk_write(struct iod_obj *obj, iod_trans_id_t tid,
+		const iod_size_t *dims, iod_hyperslab_t *slab,
+		iod_mem_desc_t *md)
+{
+	struct iod_chunk_work	cw;
+	struct iod_chunk_io	cx;
+	iod_size_t		t;
+	int			rc;
+
+	memset(&cw, 0, sizeof(cw));
+	rc = iod_chunk_io_init(&cx, obj, tid, dims, slab, md);
+	if (rc == 0 && cx.cx_total > 0)
+		rc = iod_chunk_work_init(&cw, &cx);
+	for (t = 0; t < cx.cx_total && rc == 0; t++)
+		rc = iod_chunk_write_one(&cx, &cw, t);
+	iod_chunk_work_fini(&cw, &cx);
+	iod_chunk_io_fini(&cx);
+	return rc;
+}
+
+/* -------------------------------- read ---------------------------------- */
+
+/** rows [i, *j) staged together, their bytes are [cw_coff[i], *hi) */
+static void
+iod_chunk_window(const struct iod_chunk_work *cw, iod_size_t i, iod_size_t *j,
+		 iod_off_t *hi)
+{
+	iod_off_t	lo = cw->cw_coff[i];
+
+	*hi = lo + cw->cw_span;
+	for (*j = i + 1; *j < cw->cw_nrows; (*j)++) {
+		if (cw->cw_coff[*j] + cw->cw_span - lo > IOD_CHUNK_STAGE ||
+		    cw->cw_coff[*j] - *hi > (iod_off_t)IOD_CHUNK_GAP)
+			break;
+		*hi = cw->cw_coff[*j] + cw->cw_span;
+	}
+}
+
+static int
+iod_chunk_read_one(const struct iod_chunk_io *cx, struct iod_chunk_work *cw,
+		   iod_size_t t)
+{
+	struct iod_memcur	smc;
+	struct iod_memcur	mc;
+	struct iod_obj		*obj = cx->cx_obj;
+	iod_size_t		r;
+	iod_size_t		i;
+	iod_size_t		j;
+	iod_size_t		k;
+	iod_off_t		base;
+	iod_off_t		hi;
+	uint64_t		slot;
+	char			*src;
+	int			rc;
+
+	rc = iod_chunk_plan(cx, cw, t);
+	if (rc != 0)
+		return rc;
+	slot = iod_chunk_find(obj, cw->cw_chunk);
+	if (slot == IOD_CHUNK_NONE) {
+		for (r = 0; r < cw->cw_nrows && rc == 0; r++) {
+			iod_chunk_seek(cx, &mc, cw->cw_moff[r]);
+			rc = iod_memcur_fill(&mc, NULL, cw->cw_rowbytes);
+		}
+		return rc;
+	}
+	base = slot * cx->cx_cbytes;
+
+	/* long runs, or rows too wide to stage, are read in place */
+	if (cw->cw_run[0].cr_len >= IOD_CHUNK_DIRECT ||
+	    cw->cw_span > IOD_CHUNK_STAGE) {
+		for (r = 0; r < cw->cw_nrows && rc == 0; r++) {
+			iod_chunk_seek(cx, &mc, cw->cw_moff[r]);
+			for (i = 0; i < cw->cw_nruns && rc == 0; i++)
+				rc = iod_obj_read_range(obj, cx->cx_tid,
+						base + cw->cw_coff[r] +
+						cw->cw_run[i].cr_off,
+						cw->cw_run[i].cr_len, &mc);
+		}
+		return rc;
+	}
+
+	for (i = 0; i < cw->cw_nrows && rc == 0; i = j) {
+		iod_chunk_window(cw, i, &j, &hi);
+		rc = iod_chunk_buf(cw, hi - cw->cw_coff[i]);
+		if (rc != 0)
+			break;
+		cw->cw_md->frag[0].addr = cw->cw_buf;
+		cw->cw_md->frag[0].len = hi - cw->cw_coff[i];
+		iod_memcur_init(&smc, cw->cw_md);
+		rc = iod_obj_read_range(obj, cx->cx_tid, base + cw->cw_coff[i],
+					hi - cw->cw_coff[i], &smc);
+		for (r = i; r < j && rc == 0; r++) {
+			src = cw->cw_buf + (cw->cw_coff[r] - cw->cw_coff[i]);
+			iod_chunk_seek(cx, &mc, cw->cw_moff[r]);
+			for (k = 0; k < cw->cw_nruns && rc == 0; k++)
+				rc = iod_memcur_fill(&mc,
+						     src + cw->cw_run[k].cr_off,
+						     cw->cw_run[k].cr_len);
+		}
+	}
+	return rc;
+}
+
+static void *
+iod_chunk_reader(void *arg)
+{
+	struct iod_chunk_io	*cx = arg;
+	struct iod_chunk_work	cw;
+	iod_size_t		t;
+	int			rc;
+
+	rc = iod_chunk_work_init(&cw, cx);
+	while (rc == 0) {
+		pthread_mutex_lock(&cx->cx_lock);
+		if (cx->cx_rc != 0 || cx->cx_next == cx->cx_total) {
+			pthread_mutex_unlock(&cx->cx_lock);
+			break;
+		}
+		t = cx->cx_next++;
+		pthread_mutex_unlock(&cx->cx_lock);
+
+		rc = iod_chunk_read_one(cx, &cw, t);
+	}
+	if (rc != 0) {
+		pthread_mutex_lock(&cx->cx_lock);
+		if (cx->cx_rc == 0)
+			cx->cx_rc = rc;
+		pthread_mutex_unlock(&cx->cx_lock);
+	}
+	iod_chunk_work_fini(&cw, cx);
+	return NULL;
+}
+
+/**
+ * Read the hyperslab \a slab of chunked array \a obj, checked against
+ * \a dims, as seen at \a tid into \a md. The chunks are shared out among up
+ * to iod.threads readers. Caller holds io_lock.
+ */
+int
+iod_chunk_read(struct iod_obj *obj, iod_trans_id_t tid,
+	       const iod_size_t *dims, iod_hyperslab_t *slab,
+	       iod_mem_desc_t *md)
+{
+	struct iod_chunk_io	cx;
+	pthread_t		th[64];
+	iod_size_t		nbytes = iod_mem_len(md);
+	unsigned int		nth;
+	unsigned int		i;
+	int			rc;
+
+	rc = iod_chunk_io_init(&cx, obj, tid, dims, slab, md);
+	if (rc == 0)
+		rc = iod_obj_log_open(obj);
+	if (rc != 0 || cx.cx_total == 0) {
+		iod_chunk_io_fini(&cx);
+		return rc;
+	}
+
+	/* a reader per IOD_CHUNK_PAR bytes, the caller being the first */
+	nth = iod_min(iod_max(iod_env.ie_nthreads, 1U),
+		      sizeof(th) / sizeof(th[0]));
+	nth = iod_min((iod_size_t)nth, cx.cx_total);
+	nth = iod_min((iod_size_t)nth, nbytes / IOD_CHUNK_PAR + 1);
+	for (i = 1; i < nth; i++)
+		if (pthread_create(&th[i], NULL, iod_chunk_reader, &cx) != 0)
+			break;
+	nth = i;
+	iod_chunk_reader(&cx);
+	for (i = 1; i < nth; i++)
+		pthread_join(th[i], NULL);
+	rc = cx.cx_rc;
+	iod_chunk_io_fini(&cx);
+	return rc;
+}
+
+/**
+ * Call \a cb with the slot of every written chunk that \a slab, checked
+ * against \a dims, selects cells of. Caller holds io_lock.
+ */
+int
+iod_chunk_ranges(struct iod_obj *obj, const iod_size_t *dims,
+		 iod_hyperslab_t *slab, iod_seg_cb_t cb, void *arg)
+{
+	struct iod_chunk_io	cx;
+	struct iod_seg		seg = { 0 };
+	iod_mem_desc_t		md = { 0 };
+	iod_size_t		t;
+	iod_size_t		u;
+	uint64_t		chunk;
+	uint64_t		slot;
+	int			d;
+	int			rc;
+
+	rc = iod_chunk_io_init(&cx, obj, 0, dims, slab, &md);
+	for (t = 0; rc == 0 && t < cx.cx_total; t++) {
+		chunk = 0;
+		for (u = t, d = cx.cx_nd - 1; d >= 0; d--) {
+			chunk += cx.cx_cidx[d][u % cx.cx_ncidx[d]] *
+				 cx.cx_gpitch[d];
+			u /= cx.cx_ncidx[d];
+		}
+		slot = iod_chunk_find(obj, chunk);
+		if (slot == IOD_CHUNK_NONE)
+			continue;
+		seg.is_off = slot * cx.cx_cbytes;
+		seg.is_len = cx.cx_cbytes;
+		rc = cb(&seg, arg);
+	}
+	iod_chunk_io_fini(&cx);
+	return rc;
+}
@@ -0,0 +1,316 @@
+/*
+ * Checksums of user data and of the data logs.
+ *
+ * An iod_checksum_t is a Fletcher-style pair of 64-bit sums over a byte
+ * stream: cs_lo adds up the bytes and cs_hi adds up cs_lo after every byte.
+ * The checksum of a concatenation follows from the checksums of its parts
+ * and the length of the second (iod_cksum_combine), so pieces can be summed
+ * on their own and never read twice. The sums are taken a block at a time
+ * with SSE2, or AVX2 where the CPU has it, in lanes that cannot overflow
+ * within a block, and come out as the byte at a time definition would.
+ *
+ * Every piece appended to the data log of a blob or array is summed while
+ * it is submitted, and its checksum recorded against its log address with
+ * the object (io_cks), adjacent pieces of one TID merged up to
+ * IOD_CKS_MERGE. The records are saved with the catalog. Reads from the
+ * burst buffer check them lazily: one read in "iod.cksum_verify" reads back
+ * the records it touches and fails with -EIO if one no longer matches. A
+ * record is dropped once any of its bytes is punched out of the log, as
+ * only whole records can be checked.
+ *
+ * A sampled read costs the whole of every record it touches, and fails on
+ * damage anywhere in them, so records are kept small: merging stops at
+ * 64 KiB, and a sampled 4 KiB read reads back at most about that much for
+ * a record built from small writes. A single larger piece stays one record
+ * and is read back whole.
+ */
+
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__SSE2__)
+#include <immintrin.h>
+#define IOD_CKS_SSE2
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#define IOD_CKS_AVX2
+#endif
+
+#include "iod_internal.h"
+
+#define IOD_CKS_BLOCK		(64UL << 10)	/* summed before folding */
+#define IOD_CKS_MERGE		IOD_CKS_BLOCK	/* longest merged record */
+#define IOD_CKS_STEP		(1UL << 20)	/* read back at a time */
+
+void
+iod_cksum_init(iod_checksum_t *cs)
+{
+	cs->cs_hi = 0;
+	cs->cs_lo = 0;
+}
+
+/** the checksum of the bytes of \a cs followed by \a len bytes of \a next */
+void
+iod_cksum_combine(iod_checksum_t *cs, const iod_checksum_t *next,
+		  iod_size_t len)
+{
+	cs->cs_hi += len * cs->cs_lo + next->cs_hi;
+	cs->cs_lo += next->cs_lo;
+}
+
+#ifdef IOD_CKS_SSE2
+/**
+ * Fold \a n bytes, a multiple of 16 up to IOD_CKS_BLOCK, into \a a and \a b.
+ * Byte i of a block of n counts n - i times towards b: (n - i) / 16 whole
+ * chunk sums, kept as running sums of vs, and a weight of 16 down to 1
+ * within its chunk.
+ */
+static void
+iod_cksum_sse2(uint64_t *a, uint64_t *b, const unsigned char *p, size_t n)
+{
+	const __m128i	zero = _mm_setzero_si128();
+	const __m128i	w_lo = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+	const __m128i	w_hi = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+	__m128i		vs = zero;	/* byte sums, 64-bit lanes */
+	__m128i		vp = zero;	/* vs before every chunk */
+	__m128i		vw = zero;	/* weighted sums, 32-bit lanes */
+	__m128i		v;
+	uint64_t	lane[2];
+	uint32_t	w[4];
+	uint64_t	s;
+	uint64_t	ws;
+	size_t		i;
+
+	for (i = 0; i < n; i += 16) {
+		v = _mm_loadu_si128((const __m128i *)(p + i));
+		vp = _mm_add_epi64(vp, vs);
+		vs = _mm_add_epi64(vs, _mm_sad_epu8(v, zero));
+		vw = _mm_add_epi32(vw, _mm_madd_epi16(
+					_mm_unpacklo_epi8(v, zero), w_lo));
+		vw = _mm_add_epi32(vw, _mm_madd_epi16(
+					_mm_unpackhi_epi8(v, zero), w_hi));
+	}
+	_mm_storeu_si128((__m128i *)lane, vs);
+	s = lane[0] + lane[1];
+	_mm_storeu_si128((__m128i *)lane, vp);
+	_mm_storeu_si128((__m128i *)w, vw);
+	ws = 16 * (lane[0] + lane[1]) + (uint64_t)w[0] + w[1] + w[2] + w[3];
+	*b += n * *a + ws;
+	*a += s;
+}
+#endif
+
+#ifdef IOD_CKS_AVX2
+/** iod_cksum_sse2 on 32-byte chunks, \a n a multiple of 32 */
+__attribute__((target("avx2")))
+static void
+iod_cksum_avx2(uint64_t *a, uint64_t *b, const unsigned char *p, size_t n)
+{
+	const __m256i	zero = _mm256_setzero_si256();
+	const __m256i	ones = _mm256_set1_epi16(1);
+	const __m256i	wt = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25,
+					      24, 23, 22, 21, 20, 19, 18, 17,
+					      16, 15, 14, 13, 12, 11, 10, 9,
+					      8, 7, 6, 5, 4, 3, 2, 1);
+	__m256i		vs = zero;
+	__m256i		vp = zero;
+	__m256i		vw = zero;
+	__m256i		v;
+	uint64_t	lane[4];
+	uint32_t	w[8];
+	uint64_t	s;
+	uint64_t	ws;
+	size_t		i;
+
+	for (i = 0; i < n; i += 32) {
+		v = _mm256_loadu_si256((const __m256i *)(p + i));
+		vp = _mm256_add_epi64(vp, vs);
+		vs = _mm256_add_epi64(vs, _mm256_sad_epu8(v, zero));
+		/* byte times weight, at most 16065 a pair: no saturation */
+		vw = _mm256_add_epi32(vw, _mm256_madd_epi16(
+					_mm256_maddubs_epi16(v, wt), ones));
+	}
+	_mm256_storeu_si256((__m256i *)lane, vs);
+	s = lane[0] + lane[1] + lane[2] + lane[3];
+	_mm256_storeu_si256((__m256i *)lane, vp);
+	_mm256_storeu_si256((__m256i *)w, vw);
+	ws = 32 * (lane[0] + lane[1] + lane[2] + lane[3]);
+	for (i = 0; i < 8; i++)
+		ws += w[i];
+	*b += n * *a + ws;
+	*a += s;
+}
+#endif
+
+void
+iod_cksum_update(iod_checksum_t *cs, const void *buf, size_t len)
+{
+	const unsigned char	*p = buf;
+	uint64_t		a = cs->cs_lo;
+	uint64_t		b = cs->cs_hi;
+	size_t			n;
+	size_t			i;
+
+#ifdef IOD_CKS_SSE2
+	while (len >= 64) {
+		n = iod_min(len, IOD_CKS_BLOCK) & ~(size_t)31;
+#ifdef IOD_CKS_AVX2
+		if (__builtin_cpu_supports("avx2"))
+			iod_cksum_avx2(&a, &b, p, n);
+		else
+#endif
+			iod_cksum_sse2(&a, &b, p, n);
+		p += n;
+		len -= n;
+	}
+#endif
+	for (i = 0; i < len; i++) {
+		a += p[i];
+		b += a;
+	}
+	cs->cs_lo = a;
+	cs->cs_hi = b;
+}
+
+/* --------------------------- log records -------------------------------- */
+
+/** the first record of \a obj that ends after \a addr */
+static unsigned long
+iod_cks_search(struct iod_obj *obj, uint64_t addr)
+{
+	unsigned long	lo = 0;
+	unsigned long	hi = obj->io_ncks;
+	unsigned long	mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (obj->io_cks[mid].lk_addr + obj->io_cks[mid].lk_len <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/**
+ * Forget the records of \a obj with bytes in [addr, addr + len). Caller
+ * holds io_lock for write.
+ */
+void
+iod_cks_drop(struct iod_obj *obj, uint64_t addr, iod_size_t len)
+{
+	unsigned long	first = iod_cks_search(obj, addr);
+	unsigned long	last;
+
+	for (last = first; last < obj->io_ncks &&
+			   obj->io_cks[last].lk_addr < addr + len; last++)
+		;
+	if (last == first)
+		return;
+	memmove(&obj->io_cks[first], &obj->io_cks[last],
+		(obj->io_ncks - last) * sizeof(obj->io_cks[0]));
+	obj->io_ncks -= last - first;
+}
+
+/**
+ * Record \a cs as the checksum of the \a len log bytes of \a obj at \a addr,
+ * written in \a tid. Caller holds io_lock for write.
+ */
+int
+iod_cks_add(struct iod_obj *obj, iod_trans_id_t tid, uint64_t addr,
+	    iod_size_t len, const iod_checksum_t *cs)
+{
+	struct iod_log_cks	*rec;
+	unsigned long		i;
+	unsigned long		max;
+
+	if (len == 0)
+		return 0;
+	/* WAL replay puts back bytes a saved record may already cover */
+	iod_cks_drop(obj, addr, len);
+	i = iod_cks_search(obj, addr);
+	rec = i > 0 ? &obj->io_cks[i - 1] : NULL;
+	/* not across TIDs: an abort would punch the other out with it */
+	if (rec != NULL && rec->lk_addr + rec->lk_len == addr &&
+	    rec->lk_tid == tid && rec->lk_len + len <= IOD_CKS_MERGE) {
+		iod_cksum_combine(&rec->lk_cs, cs, len);
+		rec->lk_len += len;
+		return 0;
+	}
+	if (obj->io_ncks == obj->io_maxcks) {
+		max = iod_max(obj->io_maxcks * 2, 4UL);
+		rec = realloc(obj->io_cks, max * sizeof(*rec));
+		if (rec == NULL)
+			return -ENOMEM;
+		obj->io_cks = rec;
+		obj->io_maxcks = max;
+	}
+	memmove(&obj->io_cks[i + 1], &obj->io_cks[i],
+		(obj->io_ncks - i) * sizeof(obj->io_cks[0]));
+	obj->io_ncks++;
+	rec = &obj->io_cks[i];
+	rec->lk_addr = addr;
+	rec->lk_len = len;
+	rec->lk_tid = tid;
+	rec->lk_cs = *cs;
+	return 0;
+}
+
+/** read one record back from the log and compare */
+static int
+iod_cks_check(struct iod_obj *obj, const struct iod_log_cks *rec, char *buf)
+{
+	iod_checksum_t	cs;
+	iod_size_t	done;
+	iod_size_t	n;
+	int		rc;
+
+	iod_cksum_init(&cs);
+	for (done = 0; done < rec->lk_len; done += n) {
+		n = iod_min(rec->lk_len - done, IOD_CKS_STEP);
+		rc = iod_pread_full(obj->io_fd, buf, n,
+				    iod_obj_log_pos(obj, rec->lk_addr + done));
+		if (rc != 0)
+			return rc;
+		iod_cksum_update(&cs, buf, n);
+	}
+	return cs.cs_lo == rec->lk_cs.cs_lo && cs.cs_hi == rec->lk_cs.cs_hi ?
+	       0 : -EIO;
+}
+
+/**
+ * A read is about to use the \a len log bytes of \a obj at \a addr: check
+ * the records under them, if this is one of the reads sampled. Caller
+ * holds io_lock.
+ */
+int
+iod_cks_verify(struct iod_obj *obj, uint64_t addr, iod_size_t len)
+{
+	struct iod_cont	*cont = obj->io_cont;
+	iod_size_t	bytes = 0;
+	unsigned long	i;
+	char		*buf;
+	int		rc = 0;
+
+	if (iod_env.ie_cks_verify == 0 || obj->io_ncks == 0 ||
+	    __atomic_add_fetch(&cont->ic_cks_tick, 1, __ATOMIC_RELAXED) %
+	    iod_env.ie_cks_verify != 0)
+		return 0;
+	i = iod_cks_search(obj, addr);
+	if (i == obj->io_ncks || obj->io_cks[i].lk_addr >= addr + len)
+		return 0;
+	buf = malloc(IOD_CKS_STEP);
+	if (buf == NULL)
+		return -ENOMEM;
+	for (; i < obj->io_ncks && obj->io_cks[i].lk_addr < addr + len &&
+	       rc == 0; i++) {
+		rc = iod_cks_check(obj, &obj->io_cks[i], buf);
+		bytes += obj->io_cks[i].lk_len;
+	}
+	free(buf);
+	__atomic_add_fetch(&cont->ic_stats.cksum_verify_bytes, bytes,
+			   __ATOMIC_RELAXED);
+	if (rc == -EIO)
+		__atomic_add_fetch(&cont->ic_stats.cksum_errors, 1,
+				   __ATOMIC_RELAXED);
+	return rc;
+}
@@ -0,0 +1,244 @@
+/*
+ * IOD containers.
+ *
+ * All ranks of a process opening the same path share one iod_cont; the last
+ * close checkpoints the catalog to the burst buffer and frees it.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "iod_internal.h"
+
+struct iod_cont *
+iod_cont_lookup(iod_handle_t coh)
+{
+	struct iod_cont	*cont = (struct iod_cont *)(uintptr_t)coh.cookie;
+
+	if (cont == NULL || cont->ic_magic != IOD_MAGIC_CONT)
+		return NULL;
+	return cont;
+}
+
+/** container paths map onto one directory name under each root */
+static int
+iod_cont_name(const char *path, char *name, size_t len)
+{
+	size_t	i = 0;
+
+	while (*path == '/')
+		path++;
+	if (*path == '\0')
+		return -EINVAL;
+	for (; *path != '\0'; path++) {
+		if (i + 1 >= len)
+			return -ENAMETOOLONG;
+		name[i++] = *path == '/' ? '%' : *path;
+	}
+	name[i] = '\0';
+	return 0;
+}
+
+static int
+iod_cont_dirs(const char *name, char *bb_dir, char *central_dir)
+{
+	int	n;
+
+	n = snprintf(bb_dir, PATH_MAX, "%s/%s", iod_env.ie_bb_root, name);
+	if (n >= PATH_MAX)
+		return -ENAMETOOLONG;
+	n = snprintf(central_dir, PATH_MAX, "%s/%s", iod_env.ie_central_root,
+		     name);
+	if (n >= PATH_MAX)
+		return -ENAMETOOLONG;
+	return 0;
+}
+
+/** Caller holds ie_lock. */
+static struct iod_cont *
+iod_cont_find_open(const char *name)
+{
+	struct iod_cont	*cont;
+	struct iod_list	*pos;
+
+	iod_list_for_each(pos, &iod_env.ie_conts) {
+		cont = iod_list_entry(pos, struct iod_cont, ic_link);
+		if (strcmp(cont->ic_name, name) == 0)
+			return cont;
+	}
+	return NULL;
+}
+
+static void
+iod_cont_free(struct iod_cont *cont)
+{
+	struct iod_obj	*obj;
+	unsigned long	i;
+
+	iod_wal_close(cont, 0);
+	for (i = 0; i < cont->ic_hash_size; i++) {
+		while ((obj = cont->ic_hash[i]) != NULL) {
+			cont->ic_hash[i] = obj->io_hnext;
+			iod_obj_free(obj);
+		}
+	}
+	free(cont->ic_hash);
+	iod_cat_free(cont);
+	iod_pack_fini(cont);
+	iod_trans_free_all(cont);
+	pthread_cond_destroy(&cont->ic_persist_cond);
+	pthread_mutex_destroy(&cont->ic_persist_lock);
+	pthread_mutex_destroy(&cont->ic_lock);
+	cont->ic_magic = IOD_MAGIC_DEAD;
+	free(cont);
+}
+
+iod_ret_t
+iod_container_open(const char *path, iod_hint_list_t *hints, unsigned int mode,
+		   iod_handle_t *coh, iod_event_t *event)
+{
+	struct iod_cont	*cont;
+	struct stat	st;
+	char		name[NAME_MAX + 1];
+	int		rc;
+
+	(void)hints;
+	if (!iod_env.ie_initialized || path == NULL || coh == NULL ||
+	    !(mode & (IOD_CONT_RO | IOD_CONT_WO | IOD_CONT_RW)) ||
+	    ((mode & IOD_CONT_CREATE) && (mode & IOD_CONT_RO)))
+		return iod_ev_return(event, IOD_EV_CONT_OPEN, -EINVAL);
+	rc = iod_cont_name(path, name, sizeof(name));
+	if (rc != 0)
+		return iod_ev_return(event, IOD_EV_CONT_OPEN, rc);
+
+	pthread_mutex_lock(&iod_env.ie_lock);
+	cont = iod_cont_find_open(name);
+	if (cont != NULL) {
+		cont->ic_ref++;
+		cont->ic_mode |= mode & ~IOD_CONT_CREATE;
+		goto out;
+	}
+
+	cont = calloc(1, sizeof(*cont));
+	if (cont == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+	strcpy(cont->ic_name, name);
+	rc = iod_cont_dirs(name, cont->ic_bb_dir, cont->ic_central_dir);
+	if (rc != 0)
+		goto out_free;
+	pthread_mutex_init(&cont->ic_lock, NULL);
+	pthread_mutex_init(&cont->ic_persist_lock, NULL);
+	pthread_cond_init(&cont->ic_persist_cond, NULL);
+	iod_pack_init(cont);
+	iod_list_init(&cont->ic_reclaim);
+	cont->ic_magic = IOD_MAGIC_CONT;
+	cont->ic_ref = 1;
+	cont->ic_mode = mode & ~IOD_CONT_CREATE;
+	cont->ic_next_oid = 1;
+
+	if (stat(cont->ic_bb_dir, &st) != 0) {
+		if (!(mode & IOD_CONT_CREATE)) {
+			rc = -ENOENT;
+			goto out_free;
+		}
+		rc = iod_mkdir_p(cont->ic_bb_dir);
+		if (rc == 0)
+			rc = iod_mkdir_p(cont->ic_central_dir);
+		if (rc == 0)
+			rc = iod_trans_init(cont);
+	} else {
+		rc = iod_meta_load(cont);
+	}
+	if (rc == 0)
+		rc = iod_pack_open(cont);
+	if (rc == 0)
+		rc = iod_wal_open(cont);
+	if (rc == 0)
+		rc = iod_cat_build(cont);
+	if (rc == 0)
+		rc = iod_trans_lease_start(cont);
+	if (rc != 0)
+		goto out_free;
+	iod_pack_start(cont);
+	iod_list_add_tail(&cont->ic_link, &iod_env.ie_conts);
+out:
+	pthread_mutex_unlock(&iod_env.ie_lock);
+	if (rc == 0)
+		coh->cookie = (uint64_t)(uintptr_t)cont;
+	return iod_ev_return(event, IOD_EV_CONT_OPEN, rc);
+
+out_free:
+	pthread_mutex_unlock(&iod_env.ie_lock);
+	iod_cont_free(cont);
+	return iod_ev_return(event, IOD_EV_CONT_OPEN, rc);
+}
+
+iod_ret_t
+iod_container_close(iod_handle_t coh, iod_hint_list_t *hints,
+		    iod_event_t *event)
+{
+	struct iod_cont	*cont = iod_cont_lookup(coh);
+	int		rc;
+
+	(void)hints;
+	if (cont == NULL)
+		return iod_ev_return(event, IOD_EV_CONT_CLOSE, -EINVAL);
+
+	pthread_mutex_lock(&iod_env.ie_lock);
+	if (--cont->ic_ref > 0) {
+		pthread_mutex_unlock(&iod_env.ie_lock);
+		return iod_ev_return(event, IOD_EV_CONT_CLOSE, 0);
+	}
+	iod_list_del_init(&cont->ic_link);
+	pthread_mutex_unlock(&iod_env.ie_lock);
+
+	iod_trans_lease_stop(cont);
+	iod_pack_stop(cont);
+	iod_persist_drain(cont);
+	rc = iod_meta_save(cont);
+	if (rc == 0)
+		iod_pack_checkpointed(cont);
+	iod_wal_close(cont, rc == 0);
+	iod_cont_free(cont);
+	return iod_ev_return(event, IOD_EV_CONT_CLOSE, rc);
+}
+
+iod_ret_t
+iod_container_unlink(const char *path, int force, iod_event_t *event)
+{
+	char		name[NAME_MAX + 1];
+	char		bb_dir[PATH_MAX];
+	char		central_dir[PATH_MAX];
+	unsigned long	nobjs;
+	struct stat	st;
+	int		rc;
+
+	if (!iod_env.ie_initialized || path == NULL)
+		return iod_ev_return(event, IOD_EV_CONT_UNLINK, -EINVAL);
+	rc = iod_cont_name(path, name, sizeof(name));
+	if (rc == 0)
+		rc = iod_cont_dirs(name, bb_dir, central_dir);
+	if (rc != 0)
+		return iod_ev_return(event, IOD_EV_CONT_UNLINK, rc);
+
+	pthread_mutex_lock(&iod_env.ie_lock);
+	if (iod_cont_find_open(name) != NULL) {
+		rc = -EBUSY;
+	} else if (stat(bb_dir, &st) != 0) {
+		rc = -ENOENT;
+	} else {
+		rc = iod_meta_peek(bb_dir, &nobjs);
+		if (rc == 0 && nobjs > 0 && !force)
+			rc = -ENOTEMPTY;
+		if (rc == 0 || rc == -ENOENT)
+			rc = iod_rm_rf(bb_dir);
+		if (rc == 0)
+			rc = iod_rm_rf(central_dir);
+	}
+	pthread_mutex_unlock(&iod_env.ie_lock);
+	return iod_ev_return(event, IOD_EV_CONT_UNLINK, rc);
+}
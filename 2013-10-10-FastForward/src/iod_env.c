@@ -0,0 +1,356 @@
+/*
+ * IOD service instantiation and shared helpers.
+ *
+ * Engine settings come from the hints passed to iod_initialize, falling back
+ * to environment variables and then to built-in defaults:
+ *
+ *   hint "iod.bb_root"       / env IOD_BB_ROOT       burst buffer directory
+ *   hint "iod.central_root"  / env IOD_CENTRAL_ROOT  central storage stand-in
+ *   hint "iod.threads"       / env IOD_THREADS       worker threads
+ *   hint "iod.wal"           / env IOD_WAL           0 to run without the
+ *                                                    write-ahead log
+ *   hint "iod.trans_fanout"  / env IOD_TRANS_FANOUT  sub-coordinator fan-out
+ *                                                    of multi-leader finishes,
+ *                                                    0 to count them flat
+ *   hint "iod.persist_budget" / env IOD_PERSIST_BUDGET
+ *                                                    bytes a persist keeps in
+ *                                                    flight to central storage
+ *   hint "iod.bb_capacity"   / env IOD_BB_CAPACITY   burst buffer bytes a
+ *                                                    container's data logs
+ *                                                    may take, 0 for no limit
+ *   hint "iod.bb_watermarks" / env IOD_BB_WATERMARKS "high,low" percent of the
+ *                                                    capacity where eviction
+ *                                                    starts and stops
+ *   hint "iod.readahead"     / env IOD_READAHEAD     hyperslabs fetched ahead
+ *                                                    of strided array reads,
+ *                                                    0 for none
+ *   hint "iod.cksum_verify"  / env IOD_CKSUM_VERIFY  one in this many burst
+ *                                                    buffer reads re-checks
+ *                                                    the log checksums, 0
+ *                                                    for none
+ *   hint "iod.pack_max"      / env IOD_PACK_MAX      data logs up to this
+ *                                                    many bytes are packed in
+ *                                                    shared segment files, 0
+ *                                                    for a file per object
+ *   hint "iod.pack_segment"  / env IOD_PACK_SEGMENT  bytes per segment file
+ *   hint "iod.trans_lease"   / env IOD_TRANS_LEASE   milliseconds a write TID
+ *                                                    may go without a start,
+ *                                                    finish or write before
+ *                                                    it is aborted, 0 for
+ *                                                    never
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "iod_internal.h"
+
+#define IOD_DEFAULT_BB_ROOT		"/tmp/iod_bb"
+#define IOD_DEFAULT_CENTRAL_ROOT	"/tmp/iod_central"
+#define IOD_DEFAULT_THREADS		4
+#define IOD_DEFAULT_TRANS_FANOUT	"32"
+#define IOD_DEFAULT_PERSIST_BUDGET	(64ULL << 20)
+#define IOD_DEFAULT_BB_WATERMARKS	"90,75"
+#define IOD_DEFAULT_READAHEAD		"2"
+#define IOD_DEFAULT_CKSUM_VERIFY	"64"
+#define IOD_DEFAULT_PACK_MAX		"65536"
+#define IOD_DEFAULT_PACK_SEGMENT	"67108864"
+#define IOD_DEFAULT_TRANS_LEASE		"0"
+
+struct iod_env iod_env = {
+	.ie_lock	= PTHREAD_MUTEX_INITIALIZER,
+	.ie_conts	= IOD_LIST_HEAD_INIT(iod_env.ie_conts),
+};
+
+const char *
+iod_hint_get(iod_hint_list_t *hints, const char *key)
+{
+	iod_size_t	i;
+
+	if (hints == NULL)
+		return NULL;
+	for (i = 0; i < hints->num_hint; i++) {
+		if (hints->hint[i].key != NULL &&
+		    strcmp(hints->hint[i].key, key) == 0)
+			return hints->hint[i].value;
+	}
+	return NULL;
+}
+
+static const char *
+iod_setting(iod_hint_list_t *hints, const char *key, const char *env,
+	    const char *dflt)
+{
+	const char	*val;
+
+	val = iod_hint_get(hints, key);
+	if (val == NULL)
+		val = getenv(env);
+	return val != NULL ? val : dflt;
+}
+
+int
+iod_mkdir_p(const char *path)
+{
+	char	buf[PATH_MAX];
+	char	*p;
+
+	if (strlen(path) >= sizeof(buf))
+		return -ENAMETOOLONG;
+	strcpy(buf, path);
+	for (p = buf + 1; *p != '\0'; p++) {
+		if (*p != '/')
+			continue;
+		*p = '\0';
+		if (mkdir(buf, 0755) != 0 && errno != EEXIST)
+			return -errno;
+		*p = '/';
+	}
+	if (mkdir(buf, 0755) != 0 && errno != EEXIST)
+		return -errno;
+	return 0;
+}
+
+int
+iod_rm_rf(const char *path)
+{
+	char		child[PATH_MAX];
+	struct dirent	*de;
+	struct stat	st;
+	DIR		*dir;
+	int		rc = 0;
+
+	if (lstat(path, &st) != 0)
+		return errno == ENOENT ? 0 : -errno;
+	if (!S_ISDIR(st.st_mode))
+		return unlink(path) == 0 ? 0 : -errno;
+
+	dir = opendir(path);
+	if (dir == NULL)
+		return -errno;
+	while ((de = readdir(dir)) != NULL) {
+		if (strcmp(de->d_name, ".") == 0 ||
+		    strcmp(de->d_name, "..") == 0)
+			continue;
+		snprintf(child, sizeof(child), "%s/%s", path, de->d_name);
+		rc = iod_rm_rf(child);
+		if (rc != 0)
+			break;
+	}
+	closedir(dir);
+	if (rc == 0 && rmdir(path) != 0)
+		rc = -errno;
+	return rc;
+}
+
+int
+iod_pread_full(int fd, void *buf, size_t len, off_t off)
+{
+	char	*p = buf;
+	ssize_t	n;
+
+	while (len > 0) {
+		n = pread(fd, p, len, off);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		if (n == 0) {
+			/* past EOF of a sparse log reads as zero */
+			memset(p, 0, len);
+			return 0;
+		}
+		p += n;
+		off += n;
+		len -= n;
+	}
+	return 0;
+}
+
+int
+iod_pwrite_full(int fd, const void *buf, size_t len, off_t off)
+{
+	const char	*p = buf;
+	ssize_t		n;
+
+	while (len > 0) {
+		n = pwrite(fd, p, len, off);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		p += n;
+		off += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/** containers keep a lot of data logs open, use the whole fd budget */
+static void
+iod_raise_nofile(void)
+{
+	struct rlimit	rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) != 0)
+		return;
+	if (rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+}
+
+iod_ret_t
+iod_initialize(iod_comm_t comm, iod_hint_list_t *hints,
+	       unsigned int total_cnranks, unsigned int cnranks,
+	       iod_event_t *event)
+{
+	const char	*val;
+	unsigned int	high;
+	unsigned int	low;
+	int		nthreads;
+	int		rc = 0;
+
+	(void)comm;
+	if ((total_cnranks == 0) != (cnranks == 0))
+		return iod_ev_return(event, IOD_EV_SYS_INIT, -EINVAL);
+
+	pthread_mutex_lock(&iod_env.ie_lock);
+	/* re-calling it only refreshes the CN rank counts */
+	iod_env.ie_total_cnranks = total_cnranks;
+	iod_env.ie_cnranks = cnranks;
+	if (iod_env.ie_initialized)
+		goto out;
+
+	val = iod_setting(hints, "iod.bb_root", "IOD_BB_ROOT",
+			  IOD_DEFAULT_BB_ROOT);
+	if (strlen(val) >= sizeof(iod_env.ie_bb_root)) {
+		rc = -ENAMETOOLONG;
+		goto out;
+	}
+	strcpy(iod_env.ie_bb_root, val);
+
+	val = iod_setting(hints, "iod.central_root", "IOD_CENTRAL_ROOT",
+			  IOD_DEFAULT_CENTRAL_ROOT);
+	if (strlen(val) >= sizeof(iod_env.ie_central_root)) {
+		rc = -ENAMETOOLONG;
+		goto out;
+	}
+	strcpy(iod_env.ie_central_root, val);
+
+	val = iod_setting(hints, "iod.threads", "IOD_THREADS", NULL);
+	nthreads = val != NULL ? atoi(val) : IOD_DEFAULT_THREADS;
+	if (nthreads <= 0) {
+		rc = -EINVAL;
+		goto out;
+	}
+	iod_env.ie_nthreads = nthreads;
+
+	val = iod_setting(hints, "iod.wal", "IOD_WAL", "1");
+	iod_env.ie_wal = atoi(val) != 0;
+
+	val = iod_setting(hints, "iod.trans_fanout", "IOD_TRANS_FANOUT",
+			  IOD_DEFAULT_TRANS_FANOUT);
+	iod_env.ie_fanout = strtoul(val, NULL, 0);
+
+	val = iod_setting(hints, "iod.persist_budget", "IOD_PERSIST_BUDGET",
+			  NULL);
+	iod_env.ie_persist_budget = val != NULL ? strtoull(val, NULL, 0) :
+						  IOD_DEFAULT_PERSIST_BUDGET;
+	if (iod_env.ie_persist_budget == 0) {
+		rc = -EINVAL;
+		goto out;
+	}
+
+	val = iod_setting(hints, "iod.bb_capacity", "IOD_BB_CAPACITY", "0");
+	iod_env.ie_bb_capacity = strtoull(val, NULL, 0);
+	val = iod_setting(hints, "iod.bb_watermarks", "IOD_BB_WATERMARKS",
+			  IOD_DEFAULT_BB_WATERMARKS);
+	if (sscanf(val, "%u,%u", &high, &low) != 2 || high > 100 ||
+	    low > high) {
+		rc = -EINVAL;
+		goto out;
+	}
+	iod_env.ie_bb_high = iod_env.ie_bb_capacity / 100 * high +
+			     iod_env.ie_bb_capacity % 100 * high / 100;
+	iod_env.ie_bb_low = iod_env.ie_bb_capacity / 100 * low +
+			    iod_env.ie_bb_capacity % 100 * low / 100;
+
+	val = iod_setting(hints, "iod.readahead", "IOD_READAHEAD",
+			  IOD_DEFAULT_READAHEAD);
+	iod_env.ie_readahead = strtoul(val, NULL, 0);
+
+	val = iod_setting(hints, "iod.cksum_verify", "IOD_CKSUM_VERIFY",
+			  IOD_DEFAULT_CKSUM_VERIFY);
+	iod_env.ie_cks_verify = strtoul(val, NULL, 0);
+
+	/* packed writes must be carried whole by the write-ahead log */
+	val = iod_setting(hints, "iod.pack_max", "IOD_PACK_MAX",
+			  IOD_DEFAULT_PACK_MAX);
+	iod_env.ie_pack_max = iod_min(strtoull(val, NULL, 0),
+				      (iod_size_t)IOD_WAL_INLINE_MAX);
+	val = iod_setting(hints, "iod.pack_segment", "IOD_PACK_SEGMENT",
+			  IOD_DEFAULT_PACK_SEGMENT);
+	iod_env.ie_pack_seg = strtoull(val, NULL, 0);
+	if (iod_env.ie_pack_seg < iod_env.ie_pack_max) {
+		rc = -EINVAL;
+		goto out;
+	}
+
+	val = iod_setting(hints, "iod.trans_lease", "IOD_TRANS_LEASE",
+			  IOD_DEFAULT_TRANS_LEASE);
+	iod_env.ie_trans_lease = strtoull(val, NULL, 0);
+
+	rc = iod_mkdir_p(iod_env.ie_bb_root);
+	if (rc == 0)
+		rc = iod_mkdir_p(iod_env.ie_central_root);
+	if (rc != 0)
+		goto out;
+
+	iod_raise_nofile();
+	rc = iod_sched_init(iod_env.ie_nthreads);
+	if (rc == 0)
+		iod_env.ie_initialized = 1;
+out:
+	pthread_mutex_unlock(&iod_env.ie_lock);
+	return iod_ev_return(event, IOD_EV_SYS_INIT, rc);
+}
+
+iod_ret_t
+iod_finalize(iod_hint_list_t *hints, iod_event_t *event)
+{
+	struct iod_cont	*cont;
+	iod_handle_t	coh;
+	int		rc = 0;
+	int		rc2;
+
+	if (!iod_env.ie_initialized)
+		return iod_ev_return(event, IOD_EV_SYS_FINI, -EINVAL);
+
+	/* finish queued asynchronous work before tearing containers down */
+	iod_sched_fini();
+
+	pthread_mutex_lock(&iod_env.ie_lock);
+	while (!iod_list_empty(&iod_env.ie_conts)) {
+		cont = iod_list_entry(iod_env.ie_conts.next, struct iod_cont,
+				      ic_link);
+		/* drop every reference, the last close checkpoints it */
+		cont->ic_ref = 1;
+		coh.cookie = (uint64_t)(uintptr_t)cont;
+		pthread_mutex_unlock(&iod_env.ie_lock);
+		rc2 = iod_container_close(coh, hints, NULL);
+		if (rc == 0)
+			rc = rc2;
+		pthread_mutex_lock(&iod_env.ie_lock);
+	}
+	iod_env.ie_initialized = 0;
+	pthread_mutex_unlock(&iod_env.ie_lock);
+	return iod_ev_return(event, IOD_EV_SYS_FINI, rc);
+}
@@ -0,0 +1,449 @@
+/*
+ * IOD event queues and events.
+ *
+ * Launching and completing an event only touches atomic counters and, on
+ * completion, pushes the event onto the EQ's intrusive MPSC queue, so many
+ * threads can complete into one EQ without sharing a lock. Pollers are the
+ * single consumer and take eq_lock among themselves. A poller that has to
+ * wait sleeps on an eventfd that completions only write while a poller is
+ * about to sleep.
+ */
+
+#define _GNU_SOURCE
+#include <poll.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "iod_internal.h"
+
+static struct iod_eq *
+iod_eq_lookup(iod_handle_t eqh)
+{
+	struct iod_eq	*eq = (struct iod_eq *)(uintptr_t)eqh.cookie;
+
+	if (eq == NULL || eq->eq_magic != IOD_MAGIC_EQ)
+		return NULL;
+	return eq;
+}
+
+static struct iod_event_priv *
+iod_ev_priv(iod_event_t *ev)
+{
+	return (struct iod_event_priv *)ev->opaque;
+}
+
+static unsigned int
+iod_eq_load(unsigned int *cnt)
+{
+	return __atomic_load_n(cnt, __ATOMIC_SEQ_CST);
+}
+
+/* --------------------------- completion queue --------------------------- */
+
+static void
+iod_eq_push(struct iod_eq *eq, struct iod_event_priv *priv)
+{
+	struct iod_event_priv	*prev;
+
+	__atomic_store_n(&priv->ep_next, NULL, __ATOMIC_RELAXED);
+	prev = __atomic_exchange_n(&eq->eq_head, priv, __ATOMIC_ACQ_REL);
+	/* until this store the consumer cannot see past prev */
+	__atomic_store_n(&prev->ep_next, priv, __ATOMIC_RELEASE);
+}
+
+/**
+ * Take the oldest completion. Returns NULL when the queue is empty or its
+ * head is still being pushed. Caller holds eq_lock.
+ */
+static struct iod_event_priv *
+iod_eq_pop(struct iod_eq *eq)
+{
+	struct iod_event_priv	*tail = eq->eq_tail;
+	struct iod_event_priv	*next;
+
+	next = __atomic_load_n(&tail->ep_next, __ATOMIC_ACQUIRE);
+	if (tail == &eq->eq_stub) {
+		if (next == NULL)
+			return NULL;
+		eq->eq_tail = tail = next;
+		next = __atomic_load_n(&tail->ep_next, __ATOMIC_ACQUIRE);
+	}
+	if (next != NULL) {
+		eq->eq_tail = next;
+		return tail;
+	}
+	if (tail != __atomic_load_n(&eq->eq_head, __ATOMIC_ACQUIRE))
+		return NULL;
+	/* tail is the last one: put the stub behind it to take it */
+	iod_eq_push(eq, &eq->eq_stub);
+	next = __atomic_load_n(&tail->ep_next, __ATOMIC_ACQUIRE);
+	if (next == NULL)
+		return NULL;
+	eq->eq_tail = next;
+	return tail;
+}
+
+/** wake the pollers, if any is about to sleep */
+static void
+iod_eq_wake(struct iod_eq *eq)
+{
+	uint64_t	one = 1;
+	ssize_t		rc;
+
+	if (iod_eq_load(&eq->eq_nwaiters) == 0)
+		return;
+	/* only fails with the counter saturated, which wakes them as well */
+	rc = write(eq->eq_fd, &one, sizeof(one));
+	(void)rc;
+}
+
+/* --------------------------------- EQs ---------------------------------- */
+
+int
+iod_eq_create(iod_handle_t *eqh)
+{
+	struct iod_eq	*eq;
+
+	if (eqh == NULL)
+		return -EINVAL;
+	eq = calloc(1, sizeof(*eq));
+	if (eq == NULL)
+		return -ENOMEM;
+	eq->eq_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (eq->eq_fd < 0) {
+		free(eq);
+		return -errno;
+	}
+	pthread_mutex_init(&eq->eq_lock, NULL);
+	iod_list_init(&eq->eq_events);
+	eq->eq_head = &eq->eq_stub;
+	eq->eq_tail = &eq->eq_stub;
+	eq->eq_magic = IOD_MAGIC_EQ;
+	eqh->cookie = (uint64_t)(uintptr_t)eq;
+	return 0;
+}
+
+iod_ret_t
+iod_eq_destroy(iod_handle_t eqh, iod_event_t *ev)
+{
+	struct iod_event_priv	*priv;
+	struct iod_eq		*eq = iod_eq_lookup(eqh);
+
+	if (eq == NULL)
+		return iod_ev_return(ev, IOD_EV_EQ_DESTROY, -EINVAL);
+
+	pthread_mutex_lock(&eq->eq_lock);
+	if (iod_eq_load(&eq->eq_ninflight) != 0 ||
+	    iod_eq_load(&eq->eq_ncomp) != 0) {
+		pthread_mutex_unlock(&eq->eq_lock);
+		return iod_ev_return(ev, IOD_EV_EQ_DESTROY, -EBUSY);
+	}
+	eq->eq_magic = IOD_MAGIC_DEAD;
+	/* events not finalized yet outlive the EQ */
+	while (!iod_list_empty(&eq->eq_events)) {
+		priv = iod_list_entry(eq->eq_events.next,
+				      struct iod_event_priv, ep_link);
+		iod_list_del_init(&priv->ep_link);
+		priv->ep_eq = NULL;
+	}
+	pthread_mutex_unlock(&eq->eq_lock);
+
+	close(eq->eq_fd);
+	pthread_mutex_destroy(&eq->eq_lock);
+	free(eq);
+	return iod_ev_return(ev, IOD_EV_EQ_DESTROY, 0);
+}
+
+/* -------------------------------- events -------------------------------- */
+
+int
+iod_event_init(iod_event_t *ev, iod_handle_t eqh)
+{
+	struct iod_event_priv	*priv;
+	struct iod_eq		*eq = iod_eq_lookup(eqh);
+
+	if (ev == NULL || eq == NULL)
+		return -EINVAL;
+	priv = calloc(1, sizeof(*priv));
+	if (priv == NULL)
+		return -ENOMEM;
+	priv->ep_eq = eq;
+	priv->ep_ev = ev;
+	pthread_mutex_lock(&eq->eq_lock);
+	iod_list_add_tail(&priv->ep_link, &eq->eq_events);
+	pthread_mutex_unlock(&eq->eq_lock);
+
+	ev->ev_status = IOD_EVS_INIT;
+	ev->rc = 0;
+	ev->opaque = priv;
+	return 0;
+}
+
+void
+iod_event_fini(iod_event_t *ev)
+{
+	struct iod_event_priv	*priv;
+
+	if (ev == NULL || ev->opaque == NULL)
+		return;
+	priv = iod_ev_priv(ev);
+	/* events still queued on the EQ are owned by IOD */
+	if (ev->ev_status == IOD_EVS_INFLIGHT ||
+	    __atomic_load_n(&priv->ep_queued, __ATOMIC_ACQUIRE))
+		return;
+	if (priv->ep_eq != NULL) {
+		pthread_mutex_lock(&priv->ep_eq->eq_lock);
+		iod_list_del_init(&priv->ep_link);
+		pthread_mutex_unlock(&priv->ep_eq->eq_lock);
+	}
+	free(priv);
+	ev->opaque = NULL;
+	ev->ev_status = IOD_EVS_FINI;
+}
+
+void
+iod_ev_launch(iod_event_t *ev, iod_ev_type_t type)
+{
+	struct iod_event_priv	*priv = iod_ev_priv(ev);
+
+	ev->ev_type = type;
+	ev->rc = 0;
+	__atomic_store_n(&priv->ep_abort, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&ev->ev_status, IOD_EVS_INFLIGHT, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&priv->ep_eq->eq_ninflight, 1, __ATOMIC_SEQ_CST);
+}
+
+void
+iod_ev_complete(iod_event_t *ev, int rc)
+{
+	struct iod_event_priv	*priv = iod_ev_priv(ev);
+	struct iod_eq		*eq = priv->ep_eq;
+	int			aborted;
+
+	aborted = __atomic_load_n(&priv->ep_abort, __ATOMIC_ACQUIRE) &&
+		  rc == -ECANCELED;
+	ev->rc = rc;
+	/* the callback runs before the event becomes visible to pollers */
+	if (ev->cb_fn != NULL && *ev->cb_fn != NULL)
+		(*ev->cb_fn)(ev);
+
+	/* queued before it stops being in flight, so queries always see it */
+	__atomic_store_n(&priv->ep_queued, 1, __ATOMIC_RELEASE);
+	if (aborted)
+		__atomic_add_fetch(&eq->eq_naborted, 1, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&ev->ev_status, aborted ? IOD_EVS_ABORTED :
+			 IOD_EVS_COMPLETED, __ATOMIC_RELEASE);
+	iod_eq_push(eq, priv);
+	__atomic_add_fetch(&eq->eq_ncomp, 1, __ATOMIC_SEQ_CST);
+	__atomic_sub_fetch(&eq->eq_ninflight, 1, __ATOMIC_SEQ_CST);
+	iod_eq_wake(eq);
+}
+
+int
+iod_ev_aborted(iod_event_t *ev)
+{
+	return __atomic_load_n(&iod_ev_priv(ev)->ep_abort, __ATOMIC_ACQUIRE);
+}
+
+iod_ret_t
+iod_event_abort(iod_event_t *ev)
+{
+	if (ev == NULL || ev->opaque == NULL)
+		return -EINVAL;
+	if (__atomic_load_n(&ev->ev_status, __ATOMIC_ACQUIRE) !=
+	    IOD_EVS_INFLIGHT)
+		return -EALREADY;
+	__atomic_store_n(&iod_ev_priv(ev)->ep_abort, 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/* ------------------------------- polling -------------------------------- */
+
+static void
+iod_deadline(struct timespec *ts, uint64_t usec)
+{
+	uint64_t	nsec;
+
+	clock_gettime(CLOCK_MONOTONIC, ts);
+	nsec = ts->tv_nsec + (usec % 1000000) * 1000;
+	ts->tv_sec += usec / 1000000 + nsec / 1000000000;
+	ts->tv_nsec = nsec % 1000000000;
+}
+
+/**
+ * Sleep until the eventfd fires or \a deadline, if not NULL, passes.
+ * Returns -ETIMEDOUT once the deadline passed.
+ */
+static int
+iod_eq_sleep(struct iod_eq *eq, const struct timespec *deadline)
+{
+	struct pollfd	pfd = { eq->eq_fd, POLLIN, 0 };
+	struct timespec	now;
+	struct timespec	rel;
+	uint64_t	cnt;
+	ssize_t		rc;
+
+	if (deadline != NULL) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		rel.tv_sec = deadline->tv_sec - now.tv_sec;
+		rel.tv_nsec = deadline->tv_nsec - now.tv_nsec;
+		if (rel.tv_nsec < 0) {
+			rel.tv_sec--;
+			rel.tv_nsec += 1000000000;
+		}
+		if (rel.tv_sec < 0)
+			return -ETIMEDOUT;
+	}
+	if (ppoll(&pfd, 1, deadline != NULL ? &rel : NULL, NULL) == 0)
+		return -ETIMEDOUT;
+	/* reset the eventfd unless another poller did */
+	rc = read(eq->eq_fd, &cnt, sizeof(cnt));
+	(void)rc;
+	return 0;
+}
+
+/** take up to \a n_events completions. Caller holds eq_lock. */
+static int
+iod_eq_take(struct iod_eq *eq, int n_events, iod_event_t **events)
+{
+	struct iod_event_priv	*priv;
+	int			n = 0;
+
+	while (n < n_events && (priv = iod_eq_pop(eq)) != NULL) {
+		__atomic_store_n(&priv->ep_queued, 0, __ATOMIC_RELEASE);
+		if (priv->ep_ev->ev_status == IOD_EVS_ABORTED)
+			__atomic_sub_fetch(&eq->eq_naborted, 1,
+					   __ATOMIC_SEQ_CST);
+		__atomic_sub_fetch(&eq->eq_ncomp, 1, __ATOMIC_SEQ_CST);
+		events[n++] = priv->ep_ev;
+	}
+	return n;
+}
+
+iod_ret_t
+iod_eq_poll(iod_handle_t eqh, int wait_if, uint64_t timeout, int n_events,
+	    iod_event_t **events)
+{
+	struct iod_eq		*eq = iod_eq_lookup(eqh);
+	struct timespec		ts;
+	struct timespec		*deadline = NULL;
+	int			n;
+	int			rc;
+
+	if (eq == NULL || n_events < 0 || (n_events > 0 && events == NULL))
+		return -EINVAL;
+
+	if (timeout != (uint64_t)IOD_EQ_WAIT && timeout != IOD_EQ_NOWAIT) {
+		iod_deadline(&ts, timeout);
+		deadline = &ts;
+	}
+
+	for (;;) {
+		if (iod_eq_load(&eq->eq_ncomp) > 0) {
+			pthread_mutex_lock(&eq->eq_lock);
+			n = iod_eq_take(eq, n_events, events);
+			pthread_mutex_unlock(&eq->eq_lock);
+			if (n > 0 || n_events == 0) {
+				/* pass on what is left to other pollers */
+				if (iod_eq_load(&eq->eq_ncomp) > 0)
+					iod_eq_wake(eq);
+				return n;
+			}
+			/* a completion is midway through its push */
+			sched_yield();
+			continue;
+		}
+		if (timeout == IOD_EQ_NOWAIT)
+			return 0;
+		if (wait_if && iod_eq_load(&eq->eq_ninflight) == 0)
+			return 0;
+
+		/* announce the sleep, then look again: no wakeup is lost */
+		__atomic_add_fetch(&eq->eq_nwaiters, 1, __ATOMIC_SEQ_CST);
+		rc = 0;
+		if (iod_eq_load(&eq->eq_ncomp) == 0 &&
+		    !(wait_if && iod_eq_load(&eq->eq_ninflight) == 0))
+			rc = iod_eq_sleep(eq, deadline);
+		__atomic_sub_fetch(&eq->eq_nwaiters, 1, __ATOMIC_SEQ_CST);
+		/* timed out: one last look, then give up */
+		if (rc != 0)
+			timeout = IOD_EQ_NOWAIT;
+	}
+}
+
+/** the query class of \a priv, or 0 if it is neither in flight nor queued */
+static iod_ev_query_t
+iod_eq_kind(struct iod_event_priv *priv)
+{
+	switch (__atomic_load_n(&priv->ep_ev->ev_status, __ATOMIC_ACQUIRE)) {
+	case IOD_EVS_INFLIGHT:
+		return IOD_EVQ_INFLIGHT;
+	case IOD_EVS_ABORTED:
+		return __atomic_load_n(&priv->ep_queued, __ATOMIC_ACQUIRE) ?
+		       IOD_EVQ_ABORTED : 0;
+	case IOD_EVS_COMPLETED:
+		return __atomic_load_n(&priv->ep_queued, __ATOMIC_ACQUIRE) ?
+		       IOD_EVQ_COMPLETED : 0;
+	default:
+		return 0;
+	}
+}
+
+/** Caller holds eq_lock. In flight events come first. */
+static int
+iod_eq_collect(struct iod_eq *eq, iod_ev_query_t query,
+	       unsigned int n_events, iod_event_t **events)
+{
+	struct iod_event_priv	*priv;
+	struct iod_list		*pos;
+	iod_ev_query_t		kind;
+	unsigned int		count = 0;
+	int			inflight;
+
+	for (inflight = 1; inflight >= 0; inflight--) {
+		iod_list_for_each(pos, &eq->eq_events) {
+			if (count == n_events)
+				return count;
+			priv = iod_list_entry(pos, struct iod_event_priv,
+					      ep_link);
+			kind = iod_eq_kind(priv);
+			if (!(query & kind) ||
+			    (kind == IOD_EVQ_INFLIGHT) != inflight)
+				continue;
+			events[count++] = priv->ep_ev;
+		}
+	}
+	return count;
+}
+
+int
+iod_eq_query(iod_handle_t eqh, iod_ev_query_t query, unsigned int n_events,
+	     iod_event_t **events)
+{
+	struct iod_eq	*eq = iod_eq_lookup(eqh);
+	unsigned int	naborted;
+	unsigned int	ncomp;
+	int		count = 0;
+
+	if (eq == NULL)
+		return -EINVAL;
+
+	if (events == NULL) {
+		/* an aborted completion is counted before it is queued */
+		naborted = iod_eq_load(&eq->eq_naborted);
+		ncomp = iod_eq_load(&eq->eq_ncomp);
+		if (query & IOD_EVQ_COMPLETED)
+			count += ncomp > naborted ? ncomp - naborted : 0;
+		if (query & IOD_EVQ_INFLIGHT)
+			count += iod_eq_load(&eq->eq_ninflight);
+		if (query & IOD_EVQ_ABORTED)
+			count += naborted;
+		return count;
+	}
+	pthread_mutex_lock(&eq->eq_lock);
+	count = iod_eq_collect(eq, query, n_events, events);
+	pthread_mutex_unlock(&eq->eq_lock);
+	return count;
+}
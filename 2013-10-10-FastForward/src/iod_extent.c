@@ -0,0 +1,814 @@
+/*
+ * Per-TID extent layers of blob and array objects.
+ *
+ * A layer holds the logical ranges one TID wrote, sorted and non-overlapping,
+ * each pointing into the object's data log. A read at TID t takes every byte
+ * from the newest visible layer that covers it; bytes no layer covers are
+ * holes, or live on central storage once the object has been purged from the
+ * burst buffer.
+ *
+ * So that a read does not have to walk every layer, each committed TID also
+ * gets a version: the root of a copy-on-write treap holding the merged view of
+ * all committed layers up to it. A commit path-copies the previous version
+ * for each range the TID wrote and shares every untouched subtree, so a
+ * version costs O(k log n) nodes for k written ranges whatever the object
+ * size. A read at t looks in the uncommitted layer of t, if any, and then in
+ * the newest version <= t.
+ */
+
+#include "iod_internal.h"
+
+/** node of a version treap, shared between versions by reference count */
+struct iod_xnode {
+	struct iod_xnode	*xn_left;
+	struct iod_xnode	*xn_right;
+	struct iod_extent	xn_ext;
+	uint32_t		xn_prio;
+	uint32_t		xn_refs;
+};
+
+static uint32_t
+iod_xprio(const struct iod_extent *ext)
+{
+	uint64_t	h = ext->ie_off ^ (ext->ie_addr << 17);
+
+	return (h * 0x9e3779b97f4a7c15ULL) >> 32;
+}
+
+static struct iod_xnode *
+iod_xnode_get(struct iod_xnode *n)
+{
+	if (n != NULL)
+		n->xn_refs++;
+	return n;
+}
+
+static void
+iod_xnode_put(struct iod_xnode *n)
+{
+	if (n == NULL || --n->xn_refs > 0)
+		return;
+	iod_xnode_put(n->xn_left);
+	iod_xnode_put(n->xn_right);
+	free(n);
+}
+
+/** new node owning the references \a l and \a r, dropped on failure */
+static struct iod_xnode *
+iod_xnode_new(const struct iod_extent *ext, uint32_t prio,
+	      struct iod_xnode *l, struct iod_xnode *r)
+{
+	struct iod_xnode	*n;
+
+	n = malloc(sizeof(*n));
+	if (n == NULL) {
+		iod_xnode_put(l);
+		iod_xnode_put(r);
+		return NULL;
+	}
+	n->xn_left = l;
+	n->xn_right = r;
+	n->xn_ext = *ext;
+	n->xn_prio = prio;
+	n->xn_refs = 1;
+	return n;
+}
+
+/**
+ * Split the treap \a n into the bytes below \a x and the bytes from \a x on,
+ * cutting an extent that straddles \a x. \a n is left intact.
+ */
+static int
+iod_xnode_split(struct iod_xnode *n, iod_off_t x, struct iod_xnode **l,
+		struct iod_xnode **r)
+{
+	const struct iod_extent	*e;
+	struct iod_extent	cut;
+	struct iod_xnode	*sub;
+	int			rc;
+
+	*l = NULL;
+	*r = NULL;
+	if (n == NULL)
+		return 0;
+	e = &n->xn_ext;
+	if (e->ie_off + e->ie_len <= x) {
+		rc = iod_xnode_split(n->xn_right, x, &sub, r);
+		if (rc != 0)
+			return rc;
+		*l = iod_xnode_new(e, n->xn_prio, iod_xnode_get(n->xn_left),
+				   sub);
+		if (*l != NULL)
+			return 0;
+	} else if (e->ie_off >= x) {
+		rc = iod_xnode_split(n->xn_left, x, l, &sub);
+		if (rc != 0)
+			return rc;
+		*r = iod_xnode_new(e, n->xn_prio, sub,
+				   iod_xnode_get(n->xn_right));
+		if (*r != NULL)
+			return 0;
+	} else {
+		cut = *e;
+		cut.ie_len = x - e->ie_off;
+		*l = iod_xnode_new(&cut, n->xn_prio,
+				   iod_xnode_get(n->xn_left), NULL);
+		cut.ie_off = x;
+		cut.ie_len = e->ie_off + e->ie_len - x;
+		cut.ie_addr = e->ie_addr + (x - e->ie_off);
+		*r = iod_xnode_new(&cut, n->xn_prio, NULL,
+				   iod_xnode_get(n->xn_right));
+		if (*l != NULL && *r != NULL)
+			return 0;
+	}
+	iod_xnode_put(*l);
+	iod_xnode_put(*r);
+	*l = NULL;
+	*r = NULL;
+	return -ENOMEM;
+}
+
+/** \a n as a node only the caller refers to, copied if it is shared */
+static struct iod_xnode *
+iod_xnode_own(struct iod_xnode *n)
+{
+	struct iod_xnode	*c;
+
+	if (n->xn_refs == 1)
+		return n;
+	c = iod_xnode_new(&n->xn_ext, n->xn_prio, iod_xnode_get(n->xn_left),
+			  iod_xnode_get(n->xn_right));
+	iod_xnode_put(n);
+	return c;
+}
+
+/** join \a a and \a b, all of \a a below \a b. Consumes both. */
+static int
+iod_xnode_merge(struct iod_xnode *a, struct iod_xnode *b,
+		struct iod_xnode **out)
+{
+	struct iod_xnode	*sub;
+	int			rc;
+
+	if (a == NULL || b == NULL) {
+		*out = a != NULL ? a : b;
+		return 0;
+	}
+	/* nodes only this path refers to are changed in place */
+	if (a->xn_prio >= b->xn_prio) {
+		a = iod_xnode_own(a);
+		if (a == NULL) {
+			iod_xnode_put(b);
+			return -ENOMEM;
+		}
+		sub = a->xn_right;
+		a->xn_right = NULL;
+		rc = iod_xnode_merge(sub, b, &a->xn_right);
+		if (rc != 0) {
+			iod_xnode_put(a);
+			return rc;
+		}
+		*out = a;
+	} else {
+		b = iod_xnode_own(b);
+		if (b == NULL) {
+			iod_xnode_put(a);
+			return -ENOMEM;
+		}
+		sub = b->xn_left;
+		b->xn_left = NULL;
+		rc = iod_xnode_merge(a, sub, &b->xn_left);
+		if (rc != 0) {
+			iod_xnode_put(b);
+			return rc;
+		}
+		*out = b;
+	}
+	return 0;
+}
+
+/** the treap \a root with \a ext laid over it; \a root is left intact */
+static int
+iod_xnode_insert(struct iod_xnode *root, const struct iod_extent *ext,
+		 struct iod_xnode **out)
+{
+	struct iod_xnode	*l;
+	struct iod_xnode	*m;
+	struct iod_xnode	*r;
+	struct iod_xnode	*n;
+	int			rc;
+
+	rc = iod_xnode_split(root, ext->ie_off, &l, &m);
+	if (rc != 0)
+		return rc;
+	rc = iod_xnode_split(m, ext->ie_off + ext->ie_len, &n, &r);
+	iod_xnode_put(m);
+	iod_xnode_put(n);
+	if (rc != 0) {
+		iod_xnode_put(l);
+		return rc;
+	}
+	n = iod_xnode_new(ext, iod_xprio(ext), NULL, NULL);
+	if (n == NULL) {
+		iod_xnode_put(l);
+		iod_xnode_put(r);
+		return -ENOMEM;
+	}
+	rc = iod_xnode_merge(l, n, &m);
+	if (rc != 0) {
+		iod_xnode_put(r);
+		return rc;
+	}
+	return iod_xnode_merge(m, r, out);
+}
+
+/** the newest version of \a obj at or below \a tid, NULL if none */
+static struct iod_xver *
+iod_xver_find(struct iod_obj *obj, iod_trans_id_t tid)
+{
+	unsigned long	lo = 0;
+	unsigned long	hi = obj->io_nvers;
+	unsigned long	mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (obj->io_vers[mid].xv_tid <= tid)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo > 0 ? &obj->io_vers[lo - 1] : NULL;
+}
+
+/** add the version of committed \a layer on top of the newest version */
+static int
+iod_xver_add(struct iod_obj *obj, struct iod_layer *layer)
+{
+	struct iod_xnode	*root = NULL;
+	struct iod_xnode	*n;
+	struct iod_xver		*v;
+	unsigned long		max;
+	unsigned long		i;
+	int			rc;
+
+	if (obj->io_nvers > 0) {
+		v = &obj->io_vers[obj->io_nvers - 1];
+		if (v->xv_tid >= layer->il_tid)
+			return -EINVAL;
+		root = iod_xnode_get(v->xv_root);
+	}
+	if (obj->io_nvers == obj->io_maxvers) {
+		max = iod_max(obj->io_maxvers * 2, 8UL);
+		v = realloc(obj->io_vers, max * sizeof(*v));
+		if (v == NULL) {
+			iod_xnode_put(root);
+			return -ENOMEM;
+		}
+		obj->io_vers = v;
+		obj->io_maxvers = max;
+	}
+	for (i = 0; i < layer->il_nr; i++) {
+		rc = iod_xnode_insert(root, &layer->il_ext[i], &n);
+		iod_xnode_put(root);
+		if (rc != 0)
+			return rc;
+		root = n;
+	}
+	v = &obj->io_vers[obj->io_nvers++];
+	v->xv_tid = layer->il_tid;
+	v->xv_root = root;
+	return 0;
+}
+
+/** drop every version of \a obj */
+void
+iod_extent_fini(struct iod_obj *obj)
+{
+	while (obj->io_nvers > 0)
+		iod_xnode_put(obj->io_vers[--obj->io_nvers].xv_root);
+	free(obj->io_vers);
+	obj->io_vers = NULL;
+	obj->io_maxvers = 0;
+}
+
+/**
+ * Rebuild the versions of \a obj from its committed layers, after layers
+ * were loaded, dropped or added below the newest one. Caller holds io_lock
+ * for write.
+ */
+int
+iod_extent_rebuild(struct iod_obj *obj)
+{
+	struct iod_layer	*layer;
+	struct iod_list		*pos;
+	int			rc = 0;
+
+	while (obj->io_nvers > 0)
+		iod_xnode_put(obj->io_vers[--obj->io_nvers].xv_root);
+	for (pos = obj->io_layers.prev; pos != &obj->io_layers && rc == 0;
+	     pos = pos->prev) {
+		layer = iod_list_entry(pos, struct iod_layer, il_link);
+		if (layer->il_committed)
+			rc = iod_xver_add(obj, layer);
+	}
+	obj->io_vers_stale = rc != 0;
+	return rc;
+}
+
+/**
+ * Mark \a layer readable and add its version. Layers commit in TID order, so
+ * this is one path-copying pass over the ranges the TID wrote. Caller holds
+ * io_lock for write.
+ */
+void
+iod_layer_commit(struct iod_obj *obj, struct iod_layer *layer)
+{
+	layer->il_committed = 1;
+	if (obj->io_vers_stale || iod_xver_add(obj, layer) != 0)
+		iod_extent_rebuild(obj);
+}
+
+/** find the layer of \a tid, creating it. Caller holds io_lock for write. */
+struct iod_layer *
+iod_layer_get(struct iod_obj *obj, iod_trans_id_t tid)
+{
+	struct iod_layer	*layer;
+	struct iod_list		*pos;
+
+	iod_list_for_each(pos, &obj->io_layers) {
+		layer = iod_list_entry(pos, struct iod_layer, il_link);
+		if (layer->il_tid == tid)
+			return layer;
+		if (layer->il_tid < tid)
+			break;
+	}
+
+	layer = calloc(1, sizeof(*layer));
+	if (layer == NULL)
+		return NULL;
+	layer->il_tid = tid;
+	/* keep the list newest first: insert before the first older one */
+	iod_list_add_tail(&layer->il_link, pos);
+	return layer;
+}
+
+void
+iod_layer_free(struct iod_layer *layer)
+{
+	iod_list_del_init(&layer->il_link);
+	free(layer->il_ext);
+	free(layer);
+}
+
+/** index of the first extent ending after \a off */
+static unsigned long
+iod_layer_search(struct iod_layer *layer, iod_off_t off)
+{
+	unsigned long	lo = 0;
+	unsigned long	hi = layer->il_nr;
+	unsigned long	mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (layer->il_ext[mid].ie_off + layer->il_ext[mid].ie_len <= off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/**
+ * Record that [off, off + len) now lives at \a addr of the data log, replacing
+ * whatever this layer held there before. Extents that continue each other both
+ * logically and in the log are merged.
+ */
+int
+iod_layer_insert(struct iod_layer *layer, iod_off_t off, iod_size_t len,
+		 uint64_t addr)
+{
+	struct iod_extent	repl[3];
+	struct iod_extent	*ext;
+	unsigned long		first;
+	unsigned long		last;
+	unsigned long		nrepl = 0;
+	iod_off_t		end = off + len;
+	iod_size_t		removed = 0;
+	long			delta;
+
+	if (len == 0)
+		return 0;
+
+	first = iod_layer_search(layer, off);
+	for (last = first; last < layer->il_nr; last++) {
+		ext = &layer->il_ext[last];
+		if (ext->ie_off >= end)
+			break;
+		removed += ext->ie_len;
+	}
+
+	if (first < last && layer->il_ext[first].ie_off < off) {
+		ext = &layer->il_ext[first];
+		repl[nrepl].ie_off = ext->ie_off;
+		repl[nrepl].ie_len = off - ext->ie_off;
+		repl[nrepl].ie_addr = ext->ie_addr;
+		nrepl++;
+	}
+	repl[nrepl].ie_off = off;
+	repl[nrepl].ie_len = len;
+	repl[nrepl].ie_addr = addr;
+	nrepl++;
+	if (first < last) {
+		ext = &layer->il_ext[last - 1];
+		if (ext->ie_off + ext->ie_len > end) {
+			repl[nrepl].ie_off = end;
+			repl[nrepl].ie_len = ext->ie_off + ext->ie_len - end;
+			repl[nrepl].ie_addr = ext->ie_addr + (end - ext->ie_off);
+			nrepl++;
+		}
+	}
+
+	/* merge with a neighbour that continues the new extent */
+	if (first > 0 && nrepl > 0 && repl[0].ie_off == off) {
+		ext = &layer->il_ext[first - 1];
+		if (ext->ie_off + ext->ie_len == off &&
+		    ext->ie_addr + ext->ie_len == addr) {
+			first--;
+			removed += ext->ie_len;
+			repl[0].ie_off = ext->ie_off;
+			repl[0].ie_addr = ext->ie_addr;
+			repl[0].ie_len += ext->ie_len;
+		}
+	}
+	if (last < layer->il_nr && repl[nrepl - 1].ie_off + repl[nrepl - 1].ie_len
+	    == end && repl[nrepl - 1].ie_addr + repl[nrepl - 1].ie_len ==
+	    layer->il_ext[last].ie_addr && layer->il_ext[last].ie_off == end) {
+		removed += layer->il_ext[last].ie_len;
+		repl[nrepl - 1].ie_len += layer->il_ext[last].ie_len;
+		last++;
+	}
+
+	delta = (long)nrepl - (long)(last - first);
+	if (layer->il_nr + delta > layer->il_max) {
+		unsigned long	max = iod_max(layer->il_max * 2, 16UL);
+
+		while (max < layer->il_nr + delta)
+			max *= 2;
+		ext = realloc(layer->il_ext, max * sizeof(*ext));
+		if (ext == NULL)
+			return -ENOMEM;
+		layer->il_ext = ext;
+		layer->il_max = max;
+	}
+	memmove(&layer->il_ext[last + delta], &layer->il_ext[last],
+		(layer->il_nr - last) * sizeof(*ext));
+	memcpy(&layer->il_ext[first], repl, nrepl * sizeof(*ext));
+	layer->il_nr += delta;
+
+	for (; nrepl > 0; nrepl--)
+		layer->il_bytes += repl[nrepl - 1].ie_len;
+	layer->il_bytes -= removed;
+	return 0;
+}
+
+/* ---------------------------- resolution ------------------------------ */
+
+struct iod_resolve {
+	struct iod_obj		*rs_obj;
+	iod_off_t		rs_cur;		/* resolved up to here */
+	iod_off_t		rs_end;
+	iod_seg_cb_t		rs_cb;
+	void			*rs_arg;
+};
+
+/** report [rs_cur, \a upto) as not held by any version */
+static int
+iod_resolve_gap(struct iod_resolve *rs, iod_off_t upto)
+{
+	struct iod_seg	seg;
+
+	if (upto <= rs->rs_cur)
+		return 0;
+	seg.is_off = rs->rs_cur;
+	seg.is_len = upto - rs->rs_cur;
+	seg.is_src = rs->rs_obj->io_purged != 0 ? IOD_SEG_CENTRAL :
+						  IOD_SEG_HOLE;
+	seg.is_addr = 0;
+	rs->rs_cur = upto;
+	return rs->rs_cb(&seg, rs->rs_arg);
+}
+
+/** report the part of \a ext in [rs_cur, rs_end) as BB */
+static int
+iod_resolve_ext(struct iod_resolve *rs, const struct iod_extent *ext)
+{
+	struct iod_seg	seg;
+	iod_off_t	s = iod_max(rs->rs_cur, ext->ie_off);
+	iod_off_t	e = iod_min(rs->rs_end, ext->ie_off + ext->ie_len);
+
+	seg.is_off = s;
+	seg.is_len = e - s;
+	seg.is_src = IOD_SEG_BB;
+	seg.is_addr = ext->ie_addr + (s - ext->ie_off);
+	rs->rs_cur = e;
+	return rs->rs_cb(&seg, rs->rs_arg);
+}
+
+/** in-order walk of the extents of \a n overlapping [rs_cur, rs_end) */
+static int
+iod_resolve_tree(struct iod_xnode *n, struct iod_resolve *rs)
+{
+	const struct iod_extent	*e;
+	int			rc;
+
+	if (n == NULL || rs->rs_cur >= rs->rs_end)
+		return 0;
+	e = &n->xn_ext;
+	if (rs->rs_cur < e->ie_off) {
+		rc = iod_resolve_tree(n->xn_left, rs);
+		if (rc != 0)
+			return rc;
+	}
+	if (e->ie_off < rs->rs_end && e->ie_off + e->ie_len > rs->rs_cur) {
+		rc = iod_resolve_gap(rs, e->ie_off);
+		if (rc == 0)
+			rc = iod_resolve_ext(rs, e);
+		if (rc != 0)
+			return rc;
+	}
+	if (e->ie_off + e->ie_len < rs->rs_end)
+		return iod_resolve_tree(n->xn_right, rs);
+	return 0;
+}
+
+/** resolve [rs_cur, \a upto) in version \a v */
+static int
+iod_resolve_ver(struct iod_resolve *rs, struct iod_xver *v, iod_off_t upto)
+{
+	iod_off_t	end = rs->rs_end;
+	int		rc;
+
+	rs->rs_end = upto;
+	rc = iod_resolve_tree(v != NULL ? v->xv_root : NULL, rs);
+	if (rc == 0)
+		rc = iod_resolve_gap(rs, upto);
+	rs->rs_end = end;
+	return rc;
+}
+
+/* walk of the layers themselves, used while the versions are stale */
+static int
+iod_resolve_from(struct iod_obj *obj, struct iod_list *pos,
+		 iod_trans_id_t tid, iod_off_t off, iod_size_t len,
+		 iod_seg_cb_t cb, void *arg)
+{
+	struct iod_layer	*layer = NULL;
+	struct iod_extent	*ext;
+	struct iod_seg		seg;
+	unsigned long		i;
+	iod_off_t		cur = off;
+	iod_off_t		end = off + len;
+	iod_off_t		s;
+	iod_off_t		e;
+	int			rc;
+
+	for (; pos != &obj->io_layers; pos = pos->next) {
+		layer = iod_list_entry(pos, struct iod_layer, il_link);
+		if (iod_ver_visible(layer->il_tid, layer->il_committed, tid))
+			break;
+	}
+	if (pos == &obj->io_layers) {
+		seg.is_off = off;
+		seg.is_len = len;
+		seg.is_src = obj->io_purged != 0 ? IOD_SEG_CENTRAL :
+						   IOD_SEG_HOLE;
+		seg.is_addr = 0;
+		return cb(&seg, arg);
+	}
+
+	for (i = iod_layer_search(layer, off); i < layer->il_nr; i++) {
+		ext = &layer->il_ext[i];
+		if (ext->ie_off >= end)
+			break;
+		if (ext->ie_off > cur) {
+			rc = iod_resolve_from(obj, pos->next, tid, cur,
+					      ext->ie_off - cur, cb, arg);
+			if (rc != 0)
+				return rc;
+			cur = ext->ie_off;
+		}
+		s = cur;
+		e = iod_min(end, ext->ie_off + ext->ie_len);
+		seg.is_off = s;
+		seg.is_len = e - s;
+		seg.is_src = IOD_SEG_BB;
+		seg.is_addr = ext->ie_addr + (s - ext->ie_off);
+		rc = cb(&seg, arg);
+		if (rc != 0)
+			return rc;
+		cur = e;
+	}
+	if (cur < end)
+		return iod_resolve_from(obj, pos->next, tid, cur, end - cur,
+					cb, arg);
+	return 0;
+}
+
+/**
+ * Split [off, off + len) as seen at \a tid into segments by where the newest
+ * visible copy of each byte lives. Segments are reported in ascending offset
+ * order. Caller holds io_lock.
+ */
+int
+iod_extent_resolve(struct iod_obj *obj, iod_trans_id_t tid, iod_off_t off,
+		   iod_size_t len, iod_seg_cb_t cb, void *arg)
+{
+	struct iod_resolve	rs = { obj, off, off + len, cb, arg };
+	struct iod_layer	*layer = NULL;
+	struct iod_extent	*ext;
+	struct iod_xver		*v;
+	struct iod_list		*pos;
+	unsigned long		i;
+	int			rc;
+
+	if (len == 0)
+		return 0;
+	if (obj->io_vers_stale)
+		return iod_resolve_from(obj, obj->io_layers.next, tid, off,
+					len, cb, arg);
+
+	/* uncommitted layers are the newest, so this stops early */
+	iod_list_for_each(pos, &obj->io_layers) {
+		layer = iod_list_entry(pos, struct iod_layer, il_link);
+		if (layer->il_tid <= tid)
+			break;
+	}
+	if (pos == &obj->io_layers || layer->il_tid != tid ||
+	    layer->il_committed)
+		layer = NULL;
+	v = iod_xver_find(obj, tid);
+	if (layer == NULL)
+		return iod_resolve_ver(&rs, v, rs.rs_end);
+
+	for (i = iod_layer_search(layer, off); i < layer->il_nr; i++) {
+		ext = &layer->il_ext[i];
+		if (ext->ie_off >= rs.rs_end)
+			break;
+		rc = iod_resolve_ver(&rs, v, ext->ie_off);
+		if (rc == 0)
+			rc = iod_resolve_ext(&rs, ext);
+		if (rc != 0)
+			return rc;
+	}
+	return iod_resolve_ver(&rs, v, rs.rs_end);
+}
+
+/* ----------------------------- flattening ------------------------------ */
+
+/** an extent of one of the layers being flattened */
+struct iod_fext {
+	iod_off_t		fe_off;
+	iod_off_t		fe_end;
+	uint64_t		fe_addr;
+	unsigned long		fe_layer;	/* 0 is the newest */
+};
+
+static int
+iod_fext_cmp(const void *a, const void *b)
+{
+	const struct iod_fext	*fa = a;
+	const struct iod_fext	*fb = b;
+
+	return fa->fe_off < fb->fe_off ? -1 : fa->fe_off > fb->fe_off;
+}
+
+/** min-heap of the extents covering the sweep point, newest layer on top */
+static void
+iod_fheap_push(struct iod_fext **heap, unsigned long *nr, struct iod_fext *fe)
+{
+	unsigned long	i = (*nr)++;
+
+	while (i > 0 && heap[(i - 1) / 2]->fe_layer > fe->fe_layer) {
+		heap[i] = heap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	heap[i] = fe;
+}
+
+static void
+iod_fheap_pop(struct iod_fext **heap, unsigned long *nr)
+{
+	struct iod_fext	*last = heap[--(*nr)];
+	unsigned long	i = 0;
+	unsigned long	c;
+
+	while ((c = 2 * i + 1) < *nr) {
+		if (c + 1 < *nr && heap[c + 1]->fe_layer < heap[c]->fe_layer)
+			c++;
+		if (heap[c]->fe_layer >= last->fe_layer)
+			break;
+		heap[i] = heap[c];
+		i = c;
+	}
+	heap[i] = last;
+}
+
+static int
+iod_flat_add(struct iod_layer *out, iod_off_t off, iod_size_t len,
+	     uint64_t addr)
+{
+	struct iod_extent	*ext;
+	unsigned long		max;
+
+	out->il_bytes += len;
+	if (out->il_nr > 0) {
+		ext = &out->il_ext[out->il_nr - 1];
+		if (ext->ie_off + ext->ie_len == off &&
+		    ext->ie_addr + ext->ie_len == addr) {
+			ext->ie_len += len;
+			return 0;
+		}
+	}
+	if (out->il_nr == out->il_max) {
+		max = iod_max(out->il_max * 2, 16UL);
+		ext = realloc(out->il_ext, max * sizeof(*ext));
+		if (ext == NULL)
+			return -ENOMEM;
+		out->il_ext = ext;
+		out->il_max = max;
+	}
+	ext = &out->il_ext[out->il_nr++];
+	ext->ie_off = off;
+	ext->ie_len = len;
+	ext->ie_addr = addr;
+	return 0;
+}
+
+/**
+ * Merge \a nr layers, newest first, into \a out, which is zeroed by the
+ * caller: the sorted extents that stay visible above all of them, so that
+ * no byte a newer layer overwrote is kept. A sweep over the extent starts
+ * keeps the extents covering the sweep point on a heap ordered by layer;
+ * the top one is visible until it ends or a newer one starts. \a skipped
+ * returns the bytes of the layers left out. The layers are not changed.
+ */
+int
+iod_layer_flatten(struct iod_layer **layers, unsigned long nr,
+		  struct iod_layer *out, iod_size_t *skipped)
+{
+	struct iod_fext		*fe;
+	struct iod_fext		**heap;
+	struct iod_fext		*top;
+	unsigned long		nfe = 0;
+	unsigned long		nheap = 0;
+	unsigned long		i;
+	unsigned long		j;
+	iod_size_t		total = 0;
+	iod_off_t		pos = 0;
+	iod_off_t		end;
+	int			rc = 0;
+
+	for (i = 0; i < nr; i++)
+		nfe += layers[i]->il_nr;
+	fe = malloc(iod_max(nfe, 1UL) * sizeof(*fe));
+	heap = malloc(iod_max(nfe, 1UL) * sizeof(*heap));
+	if (fe == NULL || heap == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+	for (i = 0, nfe = 0; i < nr; i++) {
+		for (j = 0; j < layers[i]->il_nr; j++, nfe++) {
+			fe[nfe].fe_off = layers[i]->il_ext[j].ie_off;
+			fe[nfe].fe_end = fe[nfe].fe_off +
+					 layers[i]->il_ext[j].ie_len;
+			fe[nfe].fe_addr = layers[i]->il_ext[j].ie_addr;
+			fe[nfe].fe_layer = i;
+			total += layers[i]->il_ext[j].ie_len;
+		}
+	}
+	qsort(fe, nfe, sizeof(*fe), iod_fext_cmp);
+
+	/* extents that ended stay on the heap until they reach the top */
+	for (j = 0; rc == 0 && (j < nfe || nheap > 0);) {
+		if (nheap == 0)
+			pos = fe[j].fe_off;
+		while (j < nfe && fe[j].fe_off <= pos)
+			iod_fheap_push(heap, &nheap, &fe[j++]);
+		while (nheap > 0 && heap[0]->fe_end <= pos)
+			iod_fheap_pop(heap, &nheap);
+		if (nheap == 0)
+			continue;
+		top = heap[0];
+		end = top->fe_end;
+		if (j < nfe && fe[j].fe_off < end)
+			end = fe[j].fe_off;
+		rc = iod_flat_add(out, pos, end - pos,
+				  top->fe_addr + (pos - top->fe_off));
+		pos = end;
+	}
+	*skipped = total - out->il_bytes;
+out:
+	free(heap);
+	free(fe);
+	return rc;
+}
@@ -0,0 +1,241 @@
+/*
+ * Per-call hints, compiled into typed policies.
+ *
+ * The hints a call takes are parsed into a struct iod_policy before the
+ * engine looks at them, and I/O paths branch on its fields. A list given
+ * to iod_hint_compile is parsed once: the list it returns starts with a
+ * tag hint whose key is iod_hint_tag itself, found by pointer without a
+ * string compare, and carries the policy just in front of it. The rest of
+ * the compiled list copies the hints it was made from, so code that looks
+ * keys up by name sees the same list.
+ *
+ * A policy given to iod_obj_open_read/write stays with the handle, and the
+ * hints of each call through it override it field by field.
+ */
+
+#include <stddef.h>
+
+#include "iod_internal.h"
+
+/** a compiled list: the policy, then the list handed out */
+struct iod_hint_policy {
+	struct iod_policy	hp_pol;
+	iod_hint_list_t		hp_list;	/* hint[0] is the tag */
+};
+
+static const char iod_hint_tag[] = "iod.policy";
+
+const struct iod_policy iod_policy_default;
+
+static int
+iod_hint_bool(const char *val, unsigned int bit, struct iod_policy *pol)
+{
+	if (strcmp(val, "1") == 0 || strcmp(val, "true") == 0)
+		pol->ip_flags |= bit;
+	else if (strcmp(val, "0") == 0 || strcmp(val, "false") == 0)
+		pol->ip_flags &= ~bit;
+	else
+		return -EINVAL;
+	pol->ip_set |= bit;
+	return 0;
+}
+
+static int
+iod_hint_ulong(const char *val, unsigned long max, unsigned long *out)
+{
+	unsigned long	v;
+	char		*end;
+
+	errno = 0;
+	v = strtoul(val, &end, 0);
+	if (*val == '\0' || *val == '-' || *end != '\0' || errno != 0 ||
+	    v > max)
+		return -EINVAL;
+	*out = v;
+	return 0;
+}
+
+/** parse one hint into \a pol; keys it does not know are left alone */
+static int
+iod_hint_parse(const iod_hint_t *hint, struct iod_policy *pol)
+{
+	const char	*key = hint->key;
+	const char	*val = hint->value;
+	unsigned long	v;
+	long		l;
+	char		*end;
+	int		rc = 0;
+
+	if (key == NULL || key == iod_hint_tag)
+		return 0;
+	if (val == NULL)
+		return -EINVAL;
+	if (strcmp(key, "access") == 0) {
+		if (strcmp(val, "sequential") == 0)
+			pol->ip_access = IOD_ACCESS_SEQUENTIAL;
+		else if (strcmp(val, "random") == 0)
+			pol->ip_access = IOD_ACCESS_RANDOM;
+		else if (strcmp(val, "normal") == 0)
+			pol->ip_access = IOD_ACCESS_NORMAL;
+		else
+			return -EINVAL;
+		pol->ip_set |= IOD_POL_ACCESS;
+	} else if (strcmp(key, "write_once") == 0) {
+		rc = iod_hint_bool(val, IOD_POL_WRITE_ONCE, pol);
+	} else if (strcmp(key, "skip_bb") == 0) {
+		rc = iod_hint_bool(val, IOD_POL_SKIP_BB, pol);
+	} else if (strcmp(key, "lowest_readable") == 0) {
+		rc = iod_hint_bool(val, IOD_POL_LOWEST_READABLE, pol);
+	} else if (strcmp(key, "adjacent_readable") == 0) {
+		rc = iod_hint_bool(val, IOD_POL_ADJACENT_READABLE, pol);
+	} else if (strcmp(key, "prefetch") == 0) {
+		rc = iod_hint_ulong(val, IOD_PREFETCH_MAX, &v);
+		pol->ip_prefetch = v;
+		pol->ip_set |= IOD_POL_PREFETCH;
+	} else if (strcmp(key, "persist_priority") == 0) {
+		errno = 0;
+		l = strtol(val, &end, 0);
+		if (*val == '\0' || *end != '\0' || errno != 0 ||
+		    l < INT_MIN || l > INT_MAX)
+			return -EINVAL;
+		pol->ip_persist_pri = l;
+		pol->ip_set |= IOD_POL_PERSIST_PRI;
+	} else if (strcmp(key, "rank") == 0) {
+		rc = iod_hint_ulong(val, UINT_MAX, &pol->ip_rank);
+		pol->ip_set |= IOD_POL_RANK;
+	} else if (strcmp(key, "fanout") == 0) {
+		rc = iod_hint_ulong(val, UINT_MAX, &v);
+		pol->ip_fanout = v;
+		pol->ip_set |= IOD_POL_FANOUT;
+	}
+	return rc;
+}
+
+/** \a over on top of \a base, field by field as \a over sets them */
+static void
+iod_policy_merge(struct iod_policy *out, const struct iod_policy *base,
+		 const struct iod_policy *over)
+{
+	unsigned int	set = over->ip_set;
+
+	*out = *base;
+	out->ip_set |= set;
+	out->ip_flags = (base->ip_flags & ~set) | (over->ip_flags & set);
+	if (set & IOD_POL_ACCESS)
+		out->ip_access = over->ip_access;
+	if (set & IOD_POL_PREFETCH)
+		out->ip_prefetch = over->ip_prefetch;
+	if (set & IOD_POL_PERSIST_PRI)
+		out->ip_persist_pri = over->ip_persist_pri;
+	if (set & IOD_POL_RANK)
+		out->ip_rank = over->ip_rank;
+	if (set & IOD_POL_FANOUT)
+		out->ip_fanout = over->ip_fanout;
+}
+
+/** the policy compiled into \a hints, or NULL for a plain list */
+static inline const struct iod_policy *
+iod_hint_compiled(iod_hint_list_t *hints)
+{
+	if (hints->num_hint == 0 || hints->hint[0].key != iod_hint_tag)
+		return NULL;
+	return &((struct iod_hint_policy *)((char *)hints -
+		 offsetof(struct iod_hint_policy, hp_list)))->hp_pol;
+}
+
+/**
+ * The policy \a hints give on top of \a base (NULL for the defaults), in
+ * \a out. Points at \a base or at a compiled policy where it can, and
+ * builds the result in \a buf otherwise.
+ */
+int
+iod_policy_resolve(const struct iod_policy *base, iod_hint_list_t *hints,
+		   struct iod_policy *buf, const struct iod_policy **out)
+{
+	const struct iod_policy	*over;
+	struct iod_policy	parsed;
+	iod_size_t		i;
+	int			rc;
+
+	if (base == NULL)
+		base = &iod_policy_default;
+	if (hints == NULL || hints->num_hint == 0) {
+		*out = base;
+		return 0;
+	}
+	over = iod_hint_compiled(hints);
+	if (over == NULL) {
+		memset(&parsed, 0, sizeof(parsed));
+		for (i = 0; i < hints->num_hint; i++) {
+			rc = iod_hint_parse(&hints->hint[i], &parsed);
+			if (rc != 0)
+				return rc;
+		}
+		over = &parsed;
+	}
+	if (base->ip_set == 0 && over != &parsed) {
+		*out = over;
+		return 0;
+	}
+	iod_policy_merge(buf, base, over);
+	*out = buf;
+	return 0;
+}
+
+iod_ret_t
+iod_hint_compile(iod_hint_list_t *hints, iod_hint_list_t **policy)
+{
+	struct iod_hint_policy	*hp;
+	const struct iod_policy	*pol;
+	struct iod_policy	buf;
+	iod_size_t		nr = 0;
+	iod_size_t		i;
+	size_t			size;
+	char			*str;
+	int			rc;
+
+	if (policy == NULL)
+		return -EINVAL;
+	rc = iod_policy_resolve(NULL, hints, &buf, &pol);
+	if (rc != 0)
+		return rc;
+
+	size = sizeof(*hp) + sizeof(hp->hp_list.hint[0]);
+	for (i = 0; hints != NULL && i < hints->num_hint; i++) {
+		if (hints->hint[i].key == NULL ||
+		    hints->hint[i].key == iod_hint_tag)
+			continue;
+		size += sizeof(hp->hp_list.hint[0]) +
+			strlen(hints->hint[i].key) +
+			strlen(hints->hint[i].value) + 2;
+		nr++;
+	}
+	hp = malloc(size);
+	if (hp == NULL)
+		return -ENOMEM;
+	hp->hp_pol = *pol;
+	hp->hp_list.num_hint = nr + 1;
+	hp->hp_list.hint[0].key = iod_hint_tag;
+	hp->hp_list.hint[0].value = "";
+	str = (char *)&hp->hp_list.hint[nr + 1];
+	for (i = 0, nr = 1; hints != NULL && i < hints->num_hint; i++) {
+		if (hints->hint[i].key == NULL ||
+		    hints->hint[i].key == iod_hint_tag)
+			continue;
+		hp->hp_list.hint[nr].key = strcpy(str, hints->hint[i].key);
+		str += strlen(str) + 1;
+		hp->hp_list.hint[nr].value = strcpy(str, hints->hint[i].value);
+		str += strlen(str) + 1;
+		nr++;
+	}
+	*policy = &hp->hp_list;
+	return 0;
+}
+
+void
+iod_hint_free(iod_hint_list_t *policy)
+{
+	if (policy == NULL || iod_hint_compiled(policy) == NULL)
+		return;
+	free((char *)policy - offsetof(struct iod_hint_policy, hp_list));
+}
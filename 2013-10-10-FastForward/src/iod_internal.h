@@ -0,0 +1,868 @@
+/*
+ * Internal definitions of the single-node IOD reference engine.
+ *
+ * The engine keeps every container in a directory under the burst buffer root
+ * (NVMe-backed local files) and migrates persisted transactions to a second
+ * directory that stands in for DAOS central storage:
+ *
+ *   <bb_root>/<container>/meta		catalog checkpoint, written on close
+ *   <bb_root>/<container>/wal		write-ahead log since the checkpoint
+ *   <bb_root>/<container>/<oid>		per-object append-only data log
+ *   <central_root>/<container>/<target>/<oid>	striped durable object shards
+ *
+ * Every TID writes its data at the tail of the object's data log and records
+ * the logical ranges it covered in a per-TID layer, so older versions stay
+ * readable without copying unchanged data.
+ */
+
+#ifndef _IOD_INTERNAL_H_
+#define _IOD_INTERNAL_H_
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "iod_api.h"
+#include "iod_list.h"
+
+#define IOD_MAX_DIMS		32
+#define IOD_SCRATCH_LEN		32
+
+/** magic values stored in every object behind an iod_handle_t */
+#define IOD_MAGIC_CONT		0x10dc0a7eU
+#define IOD_MAGIC_OBJH		0x10d0b7e0U
+#define IOD_MAGIC_EQ		0x10de9000U
+#define IOD_MAGIC_DEAD		0xdeadbeefU
+
+#define iod_min(a, b)		((a) < (b) ? (a) : (b))
+#define iod_max(a, b)		((a) > (b) ? (a) : (b))
+
+/** engine-wide state, set up by iod_initialize */
+struct iod_env {
+	int			ie_initialized;
+	pthread_mutex_t		ie_lock;	/* protects ie_conts */
+	char			ie_bb_root[PATH_MAX];
+	char			ie_central_root[PATH_MAX];
+	unsigned int		ie_nthreads;
+	int			ie_wal;		/* log small updates */
+	unsigned int		ie_fanout;	/* of multi-leader finishes */
+	iod_size_t		ie_persist_budget;	/* bytes in flight */
+	iod_size_t		ie_bb_capacity;	/* per container, 0: none */
+	iod_size_t		ie_bb_high;	/* eviction starts above */
+	iod_size_t		ie_bb_low;	/* and stops at or below */
+	unsigned int		ie_readahead;	/* slabs fetched ahead */
+	unsigned int		ie_cks_verify;	/* one read in this checks */
+	iod_size_t		ie_pack_max;	/* largest packed data log */
+	iod_size_t		ie_pack_seg;	/* bytes per segment file */
+	uint64_t		ie_trans_lease;	/* ms of write TIDs, 0: none */
+	unsigned int		ie_total_cnranks;
+	unsigned int		ie_cnranks;
+	struct iod_list		ie_conts;	/* open containers */
+};
+
+extern struct iod_env iod_env;
+
+/* ---------------------------- events ------------------------------------ */
+
+/** IOD private part of an iod_event_t, hung off ev->opaque */
+struct iod_event_priv {
+	struct iod_eq		*ep_eq;		/* NULL once the EQ is gone */
+	iod_event_t		*ep_ev;
+	struct iod_list		ep_link;	/* on eq_events */
+	struct iod_event_priv	*ep_next;	/* completion queue */
+	int			ep_queued;	/* completed, not polled yet */
+	int			ep_abort;	/* iod_event_abort was called */
+};
+
+/**
+ * Completions are pushed without locks onto an intrusive MPSC queue; only
+ * pollers, the one consumer, and event setup take eq_lock. The counters are
+ * updated atomically.
+ */
+struct iod_eq {
+	uint32_t		eq_magic;
+	pthread_mutex_t		eq_lock;	/* pollers and eq_events */
+	int			eq_fd;		/* eventfd waking pollers */
+	struct iod_list		eq_events;	/* every event on the EQ */
+	struct iod_event_priv	*eq_head;	/* last pushed completion */
+	struct iod_event_priv	*eq_tail;	/* next one to poll */
+	struct iod_event_priv	eq_stub;
+	unsigned int		eq_ninflight;
+	unsigned int		eq_ncomp;	/* completed, not polled yet */
+	unsigned int		eq_naborted;
+	unsigned int		eq_nwaiters;	/* pollers about to sleep */
+};
+
+void iod_ev_launch(iod_event_t *ev, iod_ev_type_t type);
+void iod_ev_complete(iod_event_t *ev, int rc);
+int iod_ev_aborted(iod_event_t *ev);
+
+/**
+ * Report \a rc of an operation that completed inline. With an event the
+ * result is delivered through the EQ and the call itself succeeds.
+ */
+static inline iod_ret_t
+iod_ev_return(iod_event_t *ev, iod_ev_type_t type, int rc)
+{
+	if (ev == NULL)
+		return rc;
+	iod_ev_launch(ev, type);
+	iod_ev_complete(ev, rc);
+	return 0;
+}
+
+/* ---------------------------- scheduler --------------------------------- */
+
+struct iod_op;
+typedef int (*iod_op_fn_t)(struct iod_op *op);
+
+/** asynchronous operation executed by the worker pool */
+struct iod_op {
+	struct iod_list		op_link;
+	iod_event_t		*op_ev;
+	iod_op_fn_t		op_fn;
+	iod_trans_id_t		op_tid;
+	union {
+		iod_blob_io_t	blob;
+		iod_array_io_t	array;
+		struct {
+			iod_handle_t	oh;
+			iod_hint_list_t	*hints;
+			iod_size_t	num;
+			iod_kv_params_t	*kvs;
+		} kv;
+		struct {
+			iod_handle_t	oh;
+			struct iod_obj	*obj;		/* readahead */
+			iod_hyperslab_t	*slab;
+		} fetch;
+		struct iod_cont	*cont;		/* persist, rollback */
+		struct {
+			struct iod_cont		*cont;
+			struct iod_pack_seg	*seg;
+		} pack;				/* compaction */
+	} op_u;
+};
+
+int iod_sched_init(unsigned int nthreads);
+void iod_sched_fini(void);
+struct iod_op *iod_op_alloc(iod_event_t *ev, iod_ev_type_t type,
+			    iod_op_fn_t fn, iod_trans_id_t tid);
+int iod_sched_submit(struct iod_op *op);
+int iod_sched_defer(struct iod_op *op);
+
+/* ---------------------------- extents ----------------------------------- */
+
+/** logical range of an object stored at \a ie_addr of the data log */
+struct iod_extent {
+	iod_off_t		ie_off;
+	iod_size_t		ie_len;
+	uint64_t		ie_addr;
+};
+
+/** the ranges one TID wrote into one object */
+struct iod_layer {
+	struct iod_list		il_link;	/* on io_layers, newest first */
+	iod_trans_id_t		il_tid;
+	int			il_committed;	/* TID became readable */
+	unsigned long		il_nr;
+	unsigned long		il_max;
+	struct iod_extent	*il_ext;	/* sorted, non-overlapping */
+	iod_size_t		il_bytes;
+};
+
+/** where one resolved piece of a logical range lives */
+enum {
+	IOD_SEG_HOLE,		/* never written, reads as zero */
+	IOD_SEG_BB,		/* data log on the burst buffer */
+	IOD_SEG_CENTRAL,	/* purged from BB, on central storage */
+};
+
+struct iod_seg {
+	iod_off_t		is_off;
+	iod_size_t		is_len;
+	int			is_src;
+	uint64_t		is_addr;	/* data log offset for BB */
+};
+
+typedef int (*iod_seg_cb_t)(const struct iod_seg *seg, void *arg);
+
+struct iod_xnode;
+
+/** merged view of all committed layers up to xv_tid */
+struct iod_xver {
+	iod_trans_id_t		xv_tid;
+	struct iod_xnode	*xv_root;
+};
+
+struct iod_obj;
+struct iod_layer *iod_layer_get(struct iod_obj *obj, iod_trans_id_t tid);
+int iod_layer_insert(struct iod_layer *layer, iod_off_t off, iod_size_t len,
+		     uint64_t addr);
+void iod_layer_free(struct iod_layer *layer);
+void iod_layer_commit(struct iod_obj *obj, struct iod_layer *layer);
+int iod_extent_rebuild(struct iod_obj *obj);
+void iod_extent_fini(struct iod_obj *obj);
+int iod_extent_resolve(struct iod_obj *obj, iod_trans_id_t tid, iod_off_t off,
+		       iod_size_t len, iod_seg_cb_t cb, void *arg);
+int iod_layer_flatten(struct iod_layer **layers, unsigned long nr,
+		      struct iod_layer *out, iod_size_t *skipped);
+
+/* ---------------------------- data movement ----------------------------- */
+
+/** position inside an iod_mem_desc_t consumed as one byte stream */
+struct iod_memcur {
+	iod_mem_desc_t		*mc_desc;
+	unsigned long		mc_idx;
+	iod_size_t		mc_off;
+};
+
+iod_size_t iod_mem_len(iod_mem_desc_t *md);
+void iod_mem_cksum(iod_mem_desc_t *md, iod_checksum_t *cs);
+void iod_memcur_init(struct iod_memcur *mc, iod_mem_desc_t *md);
+int iod_memcur_write(struct iod_memcur *mc, int fd, iod_size_t len,
+		     uint64_t addr, iod_checksum_t *cs);
+int iod_memcur_read(struct iod_memcur *mc, int fd, iod_size_t len,
+		    uint64_t addr);
+int iod_memcur_fill(struct iod_memcur *mc, const void *buf, iod_size_t len);
+int iod_memcur_drain(struct iod_memcur *mc, void *buf, iod_size_t len);
+char *iod_memcur_take(struct iod_memcur *mc, iod_size_t len);
+
+/* ---------------------------- hyperslabs -------------------------------- */
+
+/**
+ * A hyperslab compiled against the dataspace of an array: sp_runs runs of
+ * sp_run_len bytes, sp_stride bytes apart, starting at each of sp_nrows row
+ * offsets of the array's byte image.
+ */
+struct iod_slab_plan {
+	iod_size_t		sp_nrows;
+	iod_off_t		*sp_row;	/* ascending */
+	iod_size_t		sp_runs;
+	iod_size_t		sp_run_len;
+	iod_size_t		sp_stride;
+	iod_size_t		sp_bytes;	/* bytes selected */
+	iod_off_t		sp_row0;	/* sp_row of a one row plan */
+};
+
+struct iod_obj;
+int iod_slab_compile(struct iod_obj *obj, const iod_size_t *dims,
+		     iod_hyperslab_t *slab, struct iod_slab_plan *sp);
+void iod_slab_plan_free(struct iod_slab_plan *sp);
+int iod_slab_write(struct iod_obj *obj, iod_trans_id_t tid,
+		   const struct iod_slab_plan *sp, struct iod_memcur *mc);
+int iod_slab_read(struct iod_obj *obj, iod_trans_id_t tid,
+		  const struct iod_slab_plan *sp, struct iod_memcur *mc);
+
+/* ---------------------------- chunks ------------------------------------ */
+
+/**
+ * Where the chunks of a chunked array live. Chunks are numbered row-major
+ * over the chunk grid, and the first write of a chunk gives it the next slot
+ * of the object's byte space, so chunks never written take no space and a
+ * slot never moves.
+ */
+struct iod_chunk_index {
+	uint64_t		*ci_chunk;	/* chunk number of each slot */
+	uint64_t		ci_nslots;
+	uint64_t		ci_maxslots;
+	uint64_t		*ci_hash;	/* slot + 1, 0 if free */
+	uint64_t		ci_hash_size;	/* power of two */
+};
+
+#define IOD_CHUNK_NONE		((uint64_t)-1)
+
+struct iod_obj;
+iod_size_t iod_chunk_bytes(struct iod_obj *obj);
+uint64_t iod_chunk_find(struct iod_obj *obj, uint64_t chunk);
+int iod_chunk_slot(struct iod_obj *obj, uint64_t chunk, uint64_t *slot);
+void iod_chunk_fini(struct iod_obj *obj);
+int iod_chunk_write(struct iod_obj *obj, iod_trans_id_t tid,
+		    const iod_size_t *dims, iod_hyperslab_t *slab,
+		    iod_mem_desc_t *md);
+int iod_chunk_read(struct iod_obj *obj, iod_trans_id_t tid,
+		   const iod_size_t *dims, iod_hyperslab_t *slab,
+		   iod_mem_desc_t *md);
+int iod_chunk_ranges(struct iod_obj *obj, const iod_size_t *dims,
+		     iod_hyperslab_t *slab, iod_seg_cb_t cb, void *arg);
+
+/* ---------------------------- hint policies ----------------------------- */
+
+#define IOD_ACCESS_NORMAL	0
+#define IOD_ACCESS_SEQUENTIAL	1	/* read ahead from the first step */
+#define IOD_ACCESS_RANDOM	2	/* never read ahead */
+
+#define IOD_PREFETCH_MAX	64	/* hyperslabs read ahead at most */
+
+/* the fields of a policy its hints set, and the flags among them */
+#define IOD_POL_ACCESS		(1U << 0)
+#define IOD_POL_PREFETCH	(1U << 1)
+#define IOD_POL_PERSIST_PRI	(1U << 2)
+#define IOD_POL_RANK		(1U << 3)
+#define IOD_POL_FANOUT		(1U << 4)
+#define IOD_POL_WRITE_ONCE	(1U << 5)
+#define IOD_POL_SKIP_BB		(1U << 6)
+#define IOD_POL_LOWEST_READABLE	(1U << 7)
+#define IOD_POL_ADJACENT_READABLE (1U << 8)
+
+/** typed form of a hint list, see iod_hint.c */
+struct iod_policy {
+	unsigned int		ip_set;		/* IOD_POL_* given */
+	unsigned int		ip_flags;	/* IOD_POL_* flags on */
+	unsigned int		ip_access;	/* IOD_ACCESS_* */
+	unsigned int		ip_prefetch;	/* hyperslabs read ahead */
+	int			ip_persist_pri;	/* higher ships first */
+	unsigned int		ip_fanout;
+	unsigned long		ip_rank;
+};
+
+extern const struct iod_policy iod_policy_default;
+
+int iod_policy_resolve(const struct iod_policy *base, iod_hint_list_t *hints,
+		       struct iod_policy *buf, const struct iod_policy **out);
+
+/* --------------------------- containers/objects ------------------------- */
+
+/** versioned small attribute: scratchpad, first dimension length */
+struct iod_vattr {
+	struct iod_vattr	*va_next;	/* next older version */
+	iod_trans_id_t		va_tid;
+	int			va_committed;
+	iod_checksum_t		va_cs;
+	iod_size_t		va_len;
+	char			va_data[0];
+};
+
+/** IOD_CAT_* flags of a catalog entry */
+#define IOD_CAT_CREATED		0x1	/* ce_create committed */
+#define IOD_CAT_UNLINKED	0x2	/* ce_unlink committed */
+#define IOD_CAT_DEAD		0x4	/* creation rolled back */
+
+#define IOD_CAT_SHIFT		12	/* entries per chunk, log2 */
+#define IOD_CAT_CHUNK		(1UL << IOD_CAT_SHIFT)
+
+/** the committed TIDs that modified an object, see iod_cat_reserve */
+struct iod_cat_mods {
+	struct iod_cat_mods	*cm_next;	/* on ic_cat_retired */
+	unsigned long		cm_nr;		/* published TIDs */
+	unsigned long		cm_max;
+	iod_trans_id_t		cm_tid[0];	/* in commit order */
+};
+
+/** an object as listings see it, see iod_cat.c */
+struct iod_cat_ent {
+	iod_obj_id_t		ce_oid;
+	iod_trans_id_t		ce_create;
+	iod_trans_id_t		ce_unlink;	/* IOD_TID_UNKNOWN if live */
+	char			*ce_name;
+	struct iod_cat_mods	*ce_mods;	/* NULL if never modified */
+	uint32_t		ce_flags;
+};
+
+struct iod_cat_chunk {
+	iod_trans_id_t		ck_latest;	/* newest change committed */
+	struct iod_cat_ent	ck_ent[IOD_CAT_CHUNK];
+};
+
+/** chunks of catalog entries; a grown spine keeps the one it replaced */
+struct iod_cat_spine {
+	struct iod_cat_spine	*cs_old;
+	unsigned long		cs_max;
+	struct iod_cat_chunk	*cs_chunk[0];
+};
+
+/** catalog of one object type, by ascending object ID */
+struct iod_cat {
+	struct iod_cat_spine	*ca_spine;
+	unsigned long		ca_nr;		/* published entries */
+};
+
+/** a segment file data logs are packed into, see iod_pack.c */
+struct iod_pack_seg {
+	uint32_t		ps_id;
+	int			ps_fd;
+	uint64_t		ps_tail;	/* next free byte */
+	uint64_t		ps_live;	/* bytes of slots in use */
+	struct iod_obj		**ps_objs;	/* slot owners, or NULL */
+	unsigned long		ps_nobjs;
+	unsigned long		ps_maxobjs;
+	int			ps_queued;	/* a compaction is queued */
+	int			ps_retired;	/* empty, gone at checkpoint */
+};
+
+/** the segments of a container */
+struct iod_pack {
+	pthread_mutex_t		pk_lock;
+	struct iod_pack_seg	**pk_segs;
+	unsigned long		pk_nsegs;
+	unsigned long		pk_maxsegs;
+	struct iod_pack_seg	*pk_cur;	/* slots are cut from it */
+	uint32_t		pk_next_id;
+	int			pk_active;	/* compactions may be queued */
+};
+
+struct iod_kv;
+struct iod_wal;
+struct iod_trans_agg;
+
+struct iod_obj {
+	struct iod_obj		*io_hnext;	/* catalog hash chain */
+	struct iod_cont		*io_cont;
+	iod_obj_id_t		io_oid;
+	iod_obj_type_t		io_type;
+	char			*io_name;
+	iod_trans_id_t		io_create_tid;
+	int			io_create_committed;
+	iod_trans_id_t		io_unlink_tid;	/* IOD_TID_UNKNOWN if live */
+	int			io_unlink_committed;
+	struct iod_cat_ent	*io_cat;	/* NULL until cataloged */
+	struct iod_cat_chunk	*io_cat_chunk;
+	struct iod_cat_mods	*io_mods;	/* published as ce_mods */
+	unsigned long		io_mods_resv;	/* slots dirty lists hold */
+
+	pthread_rwlock_t	io_lock;
+	int			io_nopen;
+	int			io_fd;		/* BB data log, -1 until used */
+	uint64_t		io_tail;	/* next free byte of the log */
+	int			io_writers;	/* appends in flight */
+	struct iod_pack_seg	*io_seg;	/* packed: segment of the log */
+	unsigned long		io_slot;	/* index in ps_objs */
+	uint64_t		io_base;	/* log byte 0 in io_fd */
+	uint64_t		io_cap;		/* bytes the slot holds */
+	iod_size_t		io_size;	/* highest logical byte written */
+	struct iod_list		io_layers;
+	struct iod_xver		*io_vers;	/* by ascending TID */
+	unsigned long		io_nvers;
+	unsigned long		io_maxvers;
+	int			io_vers_stale;	/* io_vers lags io_layers */
+	iod_trans_id_t		io_purged;	/* TIDs <= this are purged */
+	iod_trans_id_t		io_last_dirty;
+	iod_trans_id_t		io_lease_tid;	/* wrote it since lease scan */
+
+	/* burst buffer cache, see iod_cache.c */
+	iod_size_t		io_bb_bytes;	/* data log bytes on BB */
+	uint64_t		io_cache_stamp;	/* ic_cache_clock at last use */
+	iod_trans_id_t		io_cache_tid;	/* TID of the last use */
+	int			io_cache_ref;	/* TIDs used in, up to 2 */
+	int			io_cache_ghost;	/* list evicted from, or 0 */
+	unsigned int		io_pol_flags;	/* IOD_POL_* of the writes */
+	int			io_persist_pri;
+	struct iod_ra		*io_ra;		/* see iod_readahead.c */
+	struct iod_log_cks	*io_cks;	/* by log address */
+	unsigned long		io_ncks;
+	unsigned long		io_maxcks;
+
+	/* array objects */
+	uint32_t		io_cell_size;
+	uint32_t		io_ndims;
+	iod_size_t		io_dims[IOD_MAX_DIMS];
+	iod_size_t		io_chunk[IOD_MAX_DIMS];
+	int			io_chunked;
+	struct iod_chunk_index	io_chunks;
+	iod_size_t		io_dim0_max;
+	struct iod_vattr	*io_dim0;
+	iod_size_t		io_dim0_next;	/* first entry not reserved */
+
+	/* placement for migration to central storage */
+	iod_layout_t		io_layout;
+	uint32_t		io_seq[IOD_MAX_DIMS];
+
+	struct iod_vattr	*io_scratch;
+	struct iod_kv		*io_kv;
+};
+
+/** handle returned by iod_obj_open_read/write */
+struct iod_objh {
+	uint32_t		oh_magic;
+	int			oh_write;
+	struct iod_obj		*oh_obj;
+	struct iod_policy	oh_pol;		/* from the open hints */
+};
+
+struct iod_trans {
+	iod_trans_id_t		it_tid;
+	iod_trans_status_t	it_status;
+	unsigned int		it_num_ranks;
+	unsigned int		it_nstarted;
+	unsigned int		it_nfinished;
+	unsigned int		it_rdref;
+	struct iod_obj		**it_dirty;	/* objects touched by the TID */
+	unsigned long		it_ndirty;
+	unsigned long		it_dirty_max;
+	iod_event_t		**it_waiters;	/* finish events */
+	unsigned long		it_nwaiters;
+	unsigned long		it_waiters_max;
+	int			it_unlogged;	/* wrote what the WAL skips */
+	int			it_indep;	/* IOD_TRANS_INDEPENDENT */
+	uint64_t		it_group;	/* WAL group of its commit */
+	struct iod_trans_agg	*it_agg;	/* finish tree, if counted so */
+	struct iod_list		it_reclaim;	/* on ic_reclaim when aborted */
+	uint64_t		it_renewed;	/* ms, lease last renewed */
+	int			it_used;	/* used since the lease scan */
+};
+
+/** multi-leader TIDs whose finishes can be counted in a tree at once */
+#define IOD_TRANS_AGG_SLOTS	16
+
+struct iod_cont {
+	uint32_t		ic_magic;
+	struct iod_list		ic_link;	/* on iod_env.ie_conts */
+	int			ic_ref;
+	unsigned int		ic_mode;
+	char			ic_name[NAME_MAX + 1];
+	char			ic_bb_dir[PATH_MAX];
+	char			ic_central_dir[PATH_MAX];
+
+	pthread_mutex_t		ic_lock;	/* catalog and TID table */
+	struct iod_obj		**ic_hash;
+	unsigned long		ic_hash_size;
+	unsigned long		ic_nobjs;
+	uint64_t		ic_next_oid;
+	struct iod_cat		ic_cat[IOD_OBJ_KV + 1];	/* by type */
+	struct iod_cat_mods	*ic_cat_retired;	/* freed once no diff */
+	unsigned int		ic_cat_diffs;	/* diffs scanning ce_mods */
+
+	struct iod_trans	**ic_trans;	/* sorted by TID */
+	unsigned long		ic_ntrans;
+	unsigned long		ic_trans_max;
+	iod_container_tids_t	ic_tids;
+	iod_trans_id_t		ic_unsettled;	/* TIDs below are settled */
+	iod_trans_id_t		ic_persisted;	/* newest TID on central */
+	iod_trans_id_t		ic_trans_floor;	/* TIDs below are forgotten */
+	pthread_mutex_t		ic_persist_lock;	/* one persist runs */
+	pthread_cond_t		ic_persist_cond;	/* all below are 0 */
+	unsigned int		ic_persist_bg;	/* background persists */
+	unsigned int		ic_fetch_bg;	/* readahead fetches */
+	unsigned int		ic_pack_bg;	/* queued compactions */
+	unsigned int		ic_reclaim_bg;	/* a rollback op is queued */
+	struct iod_list		ic_reclaim;	/* aborted, to roll back */
+	uint64_t		ic_cks_tick;	/* BB reads, for sampling */
+	iod_container_stats_t	ic_stats;
+	iod_size_t		ic_bb_used;	/* data log bytes on BB */
+	uint64_t		ic_cache_clock;
+	iod_size_t		ic_cache_p;	/* ARC target of list 1 */
+	struct iod_wal		*ic_wal;	/* NULL if running without */
+	struct iod_pack		ic_pack;
+	struct iod_trans_agg	*ic_agg[IOD_TRANS_AGG_SLOTS];	/* by TID */
+	struct iod_trans_agg	*ic_agg_retired;	/* freed on close */
+	pthread_t		ic_reaper;	/* expires write TID leases */
+	pthread_cond_t		ic_reaper_cond;
+	int			ic_reaper_on;
+	int			ic_reaper_stop;
+};
+
+struct iod_cont *iod_cont_lookup(iod_handle_t coh);
+struct iod_objh *iod_objh_lookup(iod_handle_t oh);
+struct iod_obj *iod_obj_find(struct iod_cont *cont, iod_obj_id_t oid);
+int iod_obj_insert(struct iod_cont *cont, struct iod_obj *obj);
+struct iod_obj *iod_obj_alloc(struct iod_cont *cont, iod_obj_id_t oid,
+			      iod_obj_type_t type);
+void iod_obj_free(struct iod_obj *obj);
+void iod_obj_remove(struct iod_cont *cont, struct iod_obj *obj);
+int iod_obj_log_open(struct iod_obj *obj);
+int iod_obj_log_file(struct iod_obj *obj);
+int iod_obj_visible(struct iod_obj *obj, iod_trans_id_t tid);
+int iod_obj_log_begin(struct iod_obj *obj, iod_size_t len, uint64_t *addr);
+void iod_obj_log_end(struct iod_obj *obj);
+int iod_obj_log_path(struct iod_obj *obj, char *buf, size_t len);
+int iod_obj_write_prep(struct iod_objh *h, iod_obj_type_t type,
+		       iod_trans_id_t tid, const struct iod_policy *pol);
+int iod_obj_read_prep(struct iod_objh *h, iod_obj_type_t type,
+		      iod_trans_id_t tid, const struct iod_policy *pol);
+int iod_obj_read_range(struct iod_obj *obj, iod_trans_id_t tid, iod_off_t off,
+		       iod_size_t len, struct iod_memcur *mc);
+int iod_obj_write_range(struct iod_obj *obj, iod_trans_id_t tid, iod_off_t off,
+			iod_size_t len, struct iod_memcur *mc);
+int iod_obj_log_append(struct iod_obj *obj, iod_size_t len,
+		       struct iod_memcur *mc, uint64_t *addr,
+		       iod_checksum_t *cs);
+int iod_obj_write_vec(struct iod_obj *obj, iod_trans_id_t tid,
+		      const struct iod_extent *ext, unsigned long nr,
+		      struct iod_memcur *mc, uint64_t *addr_out);
+int iod_obj_write_lock(struct iod_obj *obj, iod_trans_id_t tid);
+
+/** one entry of a blob or array list, prepared with the rest of the list */
+struct iod_xfer {
+	struct iod_objh		*xf_h;		/* NULL if not a handle */
+	iod_hint_list_t		*xf_hints;
+	const struct iod_policy	*xf_pol;	/* resolved from xf_hints */
+	struct iod_policy	xf_buf;
+	int			xf_rc;
+};
+
+int iod_xfer_prep(struct iod_cont *cont, iod_obj_type_t type,
+		  iod_trans_id_t tid, int write, struct iod_xfer *xf,
+		  iod_size_t num);
+
+static inline int
+iod_ver_visible(iod_trans_id_t vtid, int committed, iod_trans_id_t tid)
+{
+	return vtid <= tid && (committed || vtid == tid);
+}
+
+static inline int
+iod_oid_cmp(iod_obj_id_t a, iod_obj_id_t b)
+{
+	if (a.oid_hi != b.oid_hi)
+		return a.oid_hi < b.oid_hi ? -1 : 1;
+	if (a.oid_lo != b.oid_lo)
+		return a.oid_lo < b.oid_lo ? -1 : 1;
+	return 0;
+}
+
+struct iod_vattr *iod_vattr_get(struct iod_vattr *head, iod_trans_id_t tid);
+int iod_vattr_set(struct iod_vattr **head, iod_trans_id_t tid,
+		  const void *data, iod_size_t len, const iod_checksum_t *cs);
+void iod_vattr_commit(struct iod_vattr *head, iod_trans_id_t tid);
+void iod_vattr_drop(struct iod_vattr **head, iod_trans_id_t tid);
+void iod_vattr_free(struct iod_vattr *head);
+
+iod_size_t iod_array_dim0(struct iod_obj *obj, iod_trans_id_t tid);
+void iod_array_next_init(struct iod_obj *obj);
+int iod_array_ranges(struct iod_obj *obj, iod_trans_id_t tid,
+		     iod_hyperslab_t *slab, iod_seg_cb_t cb, void *arg);
+void iod_readahead(struct iod_obj *obj, iod_trans_id_t tid,
+		   iod_hyperslab_t *slab, const iod_size_t *dims,
+		   const struct iod_policy *pol);
+
+/* ---------------------------- transactions ------------------------------ */
+
+struct iod_trans *iod_trans_find(struct iod_cont *cont, iod_trans_id_t tid);
+int iod_trans_init(struct iod_cont *cont);
+int iod_trans_restore(struct iod_cont *cont, iod_trans_id_t tid,
+		      iod_trans_status_t status);
+int iod_trans_dirty(struct iod_cont *cont, iod_trans_id_t tid,
+		    struct iod_obj *obj);
+int iod_trans_dirty_logged(struct iod_cont *cont, iod_trans_id_t tid,
+			   struct iod_obj *obj);
+void iod_trans_unlogged(struct iod_cont *cont, iod_trans_id_t tid);
+int iod_trans_writable(struct iod_cont *cont, iod_trans_id_t tid);
+int iod_trans_get(struct iod_cont *cont, iod_trans_id_t tid);
+void iod_trans_put(struct iod_cont *cont, iod_trans_id_t tid);
+void iod_trans_persisted(struct iod_cont *cont, iod_trans_id_t lo,
+			 iod_trans_id_t hi);
+void iod_trans_free_all(struct iod_cont *cont);
+int iod_trans_replay_dirty(struct iod_cont *cont, iod_trans_id_t tid,
+			   struct iod_obj *obj);
+int iod_trans_replay_end(struct iod_cont *cont, iod_trans_id_t tid,
+			 int commit);
+void iod_trans_replay_fini(struct iod_cont *cont);
+int iod_trans_lease_start(struct iod_cont *cont);
+void iod_trans_lease_stop(struct iod_cont *cont);
+
+/**
+ * Renew the lease of write TID \a tid on a write to \a obj that skipped
+ * ic_lock. The reaper takes the mark once per scan, so it is mostly only
+ * read here.
+ */
+static inline void
+iod_trans_touch(struct iod_obj *obj, iod_trans_id_t tid)
+{
+	if (iod_env.ie_trans_lease != 0 &&
+	    __atomic_load_n(&obj->io_lease_tid, __ATOMIC_RELAXED) != tid)
+		__atomic_store_n(&obj->io_lease_tid, tid, __ATOMIC_RELAXED);
+}
+
+/* ---------------------------- catalog ----------------------------------- */
+
+int iod_cat_build(struct iod_cont *cont);
+int iod_cat_add(struct iod_cont *cont, struct iod_obj *obj);
+void iod_cat_sync(struct iod_obj *obj);
+int iod_cat_reserve(struct iod_cont *cont, struct iod_obj *obj);
+void iod_cat_unreserve(struct iod_obj *obj);
+void iod_cat_mod(struct iod_obj *obj, iod_trans_id_t tid);
+void iod_cat_free(struct iod_cont *cont);
+
+/* ---------------------------- key-value --------------------------------- */
+
+void iod_kv_free(struct iod_kv *kv);
+void iod_kv_commit(struct iod_obj *obj, iod_trans_id_t tid);
+void iod_kv_drop(struct iod_obj *obj, iod_trans_id_t tid);
+void iod_kv_prune(struct iod_obj *obj, iod_trans_id_t tid);
+int iod_kv_save(struct iod_obj *obj, FILE *fp);
+int iod_kv_load(struct iod_obj *obj, FILE *fp);
+int iod_kv_persist(struct iod_obj *obj, iod_trans_id_t tid, const char *path);
+int iod_kv_replay(struct iod_obj *obj, iod_trans_id_t tid, const char *key,
+		  int deleted, uint64_t addr, iod_size_t len,
+		  const iod_checksum_t *cs);
+
+/* ---------------------------- write-ahead log --------------------------- */
+
+enum {
+	IOD_WAL_CREATE = 1,	/* blob or KV object, payload its name */
+	IOD_WAL_KV_SET,		/* payload key, then value */
+	IOD_WAL_KV_UNLINK,	/* payload key */
+	IOD_WAL_BLOB,		/* payload ranges, then data if inline */
+	IOD_WAL_COMMIT,		/* TID became readable */
+	IOD_WAL_ABORT,		/* TID was aborted */
+	IOD_WAL_BATCH,		/* payload whole records, of one list */
+	IOD_WAL_UNLINK,		/* object unlinked, no payload */
+};
+
+/** record flags */
+#define IOD_WAL_INLINE		0x1	/* data follows, not synced in log */
+#define IOD_WAL_PARTIAL		0x2	/* TID wrote what the WAL skips */
+
+/** blob writes up to this size carry their data in the log record */
+#define IOD_WAL_INLINE_MAX	(64 * 1024)
+
+/** header of one log record, followed by wr_len bytes of payload */
+struct iod_wal_rec {
+	uint32_t		wr_type;
+	uint32_t		wr_flags;
+	uint64_t		wr_len;
+	iod_obj_id_t		wr_oid;
+	iod_trans_id_t		wr_tid;
+	uint64_t		wr_addr;	/* bytes in the data log */
+	uint64_t		wr_arg;		/* key length, range count or
+						 * object type */
+	iod_checksum_t		wr_vcs;		/* value checksum */
+	iod_checksum_t		wr_cs;		/* record, wr_cs zeroed */
+};
+
+/** records gathered to go to the log as one IOD_WAL_BATCH record */
+struct iod_wal_batch {
+	char			*wt_data;
+	size_t			wt_len;
+	size_t			wt_max;
+	uint64_t		wt_nr;
+};
+
+int iod_wal_open(struct iod_cont *cont);
+void iod_wal_close(struct iod_cont *cont, int checkpointed);
+int iod_wal_log(struct iod_wal *wal, struct iod_wal_rec *rec,
+		const void *p1, size_t l1, const void *p2, size_t l2,
+		uint64_t *group);
+int iod_wal_log_mem(struct iod_wal *wal, struct iod_wal_rec *rec,
+		    const void *p1, size_t l1, iod_mem_desc_t *md,
+		    uint64_t *group);
+int iod_wal_batch_add(struct iod_wal_batch *wt, struct iod_wal_rec *rec,
+		      const void *p1, size_t l1, const void *p2, size_t l2);
+int iod_wal_batch_add_mem(struct iod_wal_batch *wt, struct iod_wal_rec *rec,
+			  const void *p1, size_t l1, iod_mem_desc_t *md);
+int iod_wal_batch_log(struct iod_wal *wal, struct iod_wal_batch *wt,
+		      iod_trans_id_t tid, uint64_t *group);
+int iod_wal_wait(struct iod_wal *wal, uint64_t group);
+iod_ret_t iod_wal_return(struct iod_wal *wal, uint64_t group,
+			 iod_event_t *ev, iod_ev_type_t type, int rc);
+
+/* ---------------------------- migration --------------------------------- */
+
+int iod_central_read(struct iod_obj *obj, iod_off_t off, iod_size_t len,
+		     char *buf);
+int iod_central_obj_path(struct iod_obj *obj, uint32_t target, char *buf,
+			 size_t len);
+int iod_central_io(struct iod_obj *obj, int *fds, iod_off_t off,
+		   iod_size_t len, char *buf, int write);
+int iod_migrate_transpose(struct iod_obj *obj, iod_trans_id_t tid);
+int iod_central_reshard(struct iod_obj *obj, const iod_layout_t *old);
+uint32_t iod_place_target(struct iod_obj *obj, const iod_layout_t *layout,
+			  uint64_t stripe);
+int iod_place_check(const iod_layout_t *layout);
+void iod_persist_drain(struct iod_cont *cont);
+
+struct iod_pipe;
+struct iod_pdst;
+
+struct iod_pipe *iod_pipe_start(iod_size_t budget, unsigned int nthreads);
+struct iod_pdst *iod_pipe_dst(struct iod_pipe *p, int fd, int cks_fd);
+void iod_pipe_dst_close(struct iod_pipe *p, struct iod_pdst *d);
+int iod_pipe_put(struct iod_pipe *p, struct iod_pdst *d, int src, uint64_t addr,
+		 iod_size_t len, iod_off_t off);
+int iod_pipe_finish(struct iod_pipe *p);
+iod_size_t iod_obj_purge_locked(struct iod_obj *obj, iod_trans_id_t tid);
+int iod_fetch_slab(struct iod_obj *obj, iod_trans_id_t tid,
+		   iod_hyperslab_t *slab, iod_size_t *staged);
+
+/* ---------------------------- burst buffer cache ------------------------ */
+
+int iod_cache_admit(struct iod_cont *cont, iod_size_t len);
+void iod_cache_evict(struct iod_cont *cont, iod_size_t len);
+void iod_cache_shed(struct iod_obj *obj);
+void iod_cache_touch(struct iod_obj *obj, iod_trans_id_t tid);
+void iod_cache_read(struct iod_obj *obj, int src, iod_size_t len);
+void iod_cache_punch(struct iod_obj *obj, uint64_t addr, iod_size_t len);
+void iod_cache_release(struct iod_obj *obj);
+
+static inline iod_size_t
+iod_cache_used(struct iod_cont *cont)
+{
+	return __atomic_load_n(&cont->ic_bb_used, __ATOMIC_RELAXED);
+}
+
+/** \a len more bytes of the data log of \a obj are on the burst buffer */
+static inline void
+iod_cache_charge(struct iod_obj *obj, iod_size_t len)
+{
+	__atomic_add_fetch(&obj->io_bb_bytes, len, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&obj->io_cont->ic_bb_used, len, __ATOMIC_RELAXED);
+}
+
+static inline void
+iod_cache_uncharge(struct iod_obj *obj, iod_size_t len)
+{
+	__atomic_sub_fetch(&obj->io_bb_bytes, len, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&obj->io_cont->ic_bb_used, len, __ATOMIC_RELAXED);
+}
+
+/* ---------------------------- small-object packing ---------------------- */
+
+#define IOD_PACK_NONE		UINT32_MAX	/* segment ID of no segment */
+
+void iod_pack_init(struct iod_cont *cont);
+void iod_pack_fini(struct iod_cont *cont);
+int iod_pack_attach(struct iod_obj *obj, uint32_t id, uint64_t base,
+		    uint64_t cap);
+int iod_pack_open(struct iod_cont *cont);
+void iod_pack_start(struct iod_cont *cont);
+void iod_pack_stop(struct iod_cont *cont);
+void iod_pack_checkpointed(struct iod_cont *cont);
+int iod_pack_fit(struct iod_obj *obj, uint64_t end);
+void iod_pack_release(struct iod_obj *obj);
+int iod_pack_sync(struct iod_cont *cont);
+
+/** where byte \a addr of the data log of \a obj is in io_fd */
+static inline uint64_t
+iod_obj_log_pos(const struct iod_obj *obj, uint64_t addr)
+{
+	return obj->io_base + addr;
+}
+
+/* ---------------------------- checksums --------------------------------- */
+
+/** the checksum of a piece of a data log, as it was appended */
+struct iod_log_cks {
+	uint64_t		lk_addr;
+	iod_size_t		lk_len;
+	iod_trans_id_t		lk_tid;		/* of the write */
+	iod_checksum_t		lk_cs;
+};
+
+void iod_cksum_init(iod_checksum_t *cs);
+void iod_cksum_update(iod_checksum_t *cs, const void *buf, size_t len);
+void iod_cksum_combine(iod_checksum_t *cs, const iod_checksum_t *next,
+		       iod_size_t len);
+int iod_cks_add(struct iod_obj *obj, iod_trans_id_t tid, uint64_t addr,
+		iod_size_t len, const iod_checksum_t *cs);
+void iod_cks_drop(struct iod_obj *obj, uint64_t addr, iod_size_t len);
+int iod_cks_verify(struct iod_obj *obj, uint64_t addr, iod_size_t len);
+
+/* ---------------------------- metadata ---------------------------------- */
+
+int iod_meta_save(struct iod_cont *cont);
+int iod_meta_load(struct iod_cont *cont);
+int iod_meta_peek(const char *bb_dir, unsigned long *nobjs);
+
+/* ---------------------------- helpers ----------------------------------- */
+
+const char *iod_hint_get(iod_hint_list_t *hints, const char *key);
+int iod_mkdir_p(const char *path);
+int iod_rm_rf(const char *path);
+int iod_pread_full(int fd, void *buf, size_t len, off_t off);
+int iod_pwrite_full(int fd, const void *buf, size_t len, off_t off);
+
+#endif /* _IOD_INTERNAL_H_ */
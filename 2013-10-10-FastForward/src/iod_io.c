@@ -0,0 +1,638 @@
+/*
+ * Data movement between user memory descriptors and object data logs.
+ *
+ * An iod_mem_desc_t is consumed as one byte stream through an iod_memcur, so
+ * blob fragments and array runs never have to line up with memory fragments.
+ * The memory pieces of a transfer are handed to the kernel directly as the
+ * iovecs of preadv/pwritev, one call per contiguous range of the data log.
+ * Appends to the log are checksummed piece by piece on the way, see
+ * iod_cksum.c.
+ */
+
+#define _GNU_SOURCE
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "iod_internal.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX			1024
+#endif
+
+#define IOD_CKS_WRITE		(256UL << 10)	/* summed, then written */
+
+/** iovecs gathered for one vectored call on a contiguous log range */
+struct iod_iov_batch {
+	int		ib_fd;
+	int		ib_write;
+	uint64_t	ib_addr;	/* log offset of ib_iov[0] */
+	iod_size_t	ib_len;
+	int		ib_nr;
+	iod_checksum_t	*ib_cs;		/* of the bytes written, or NULL */
+	struct iovec	ib_iov[IOV_MAX];
+};
+
+iod_size_t
+iod_mem_len(iod_mem_desc_t *md)
+{
+	iod_size_t	len = 0;
+	unsigned long	i;
+
+	for (i = 0; i < md->nfrag; i++)
+		len += md->frag[i].len;
+	return len;
+}
+
+void
+iod_memcur_init(struct iod_memcur *mc, iod_mem_desc_t *md)
+{
+	mc->mc_desc = md;
+	mc->mc_idx = 0;
+	mc->mc_off = 0;
+}
+
+/** the contiguous piece of memory at the cursor, at most \a len bytes */
+static char *
+iod_memcur_piece(struct iod_memcur *mc, iod_size_t len, iod_size_t *plen)
+{
+	iod_mem_frag_t	*frag;
+
+	while (mc->mc_idx < mc->mc_desc->nfrag) {
+		frag = &mc->mc_desc->frag[mc->mc_idx];
+		if (mc->mc_off < frag->len) {
+			*plen = iod_min(len, frag->len - mc->mc_off);
+			return (char *)frag->addr + mc->mc_off;
+		}
+		mc->mc_idx++;
+		mc->mc_off = 0;
+	}
+	*plen = 0;
+	return NULL;
+}
+
+/**
+ * Transfer all of \a iov at \a off, resuming after short transfers. A read
+ * past the end of the file zero fills the rest.
+ */
+static int
+iod_rw_full(int fd, struct iovec *iov, int nr, off_t off, int write)
+{
+	ssize_t	n;
+
+	while (nr > 0) {
+		n = write ? pwritev(fd, iov, nr, off) : preadv(fd, iov, nr, off);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		if (n == 0) {
+			if (write)
+				return -EIO;
+			for (; nr > 0; iov++, nr--)
+				memset(iov->iov_base, 0, iov->iov_len);
+			return 0;
+		}
+		off += n;
+		while (nr > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			nr--;
+		}
+		if (nr > 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	return 0;
+}
+
+static void
+iod_batch_init(struct iod_iov_batch *b, int fd, int write)
+{
+	b->ib_fd = fd;
+	b->ib_write = write;
+	b->ib_addr = 0;
+	b->ib_len = 0;
+	b->ib_nr = 0;
+	b->ib_cs = NULL;
+}
+
+static int
+iod_batch_flush(struct iod_iov_batch *b)
+{
+	int	rc;
+
+	if (b->ib_nr == 0)
+		return 0;
+	rc = iod_rw_full(b->ib_fd, b->ib_iov, b->ib_nr, b->ib_addr,
+			 b->ib_write);
+	b->ib_addr += b->ib_len;
+	b->ib_len = 0;
+	b->ib_nr = 0;
+	return rc;
+}
+
+/**
+ * Queue \a len bytes of the cursor for log offset \a addr. The batch is
+ * submitted when the log range stops being contiguous or IOV_MAX is reached.
+ */
+static int
+iod_batch_add(struct iod_iov_batch *b, struct iod_memcur *mc, iod_size_t len,
+	      uint64_t addr)
+{
+	iod_size_t	plen;
+	char		*p;
+	int		rc;
+
+	if (b->ib_nr > 0 && b->ib_addr + b->ib_len != addr) {
+		rc = iod_batch_flush(b);
+		if (rc != 0)
+			return rc;
+	}
+	if (b->ib_nr == 0)
+		b->ib_addr = addr;
+	while (len > 0) {
+		p = iod_memcur_piece(mc, len, &plen);
+		if (p == NULL)
+			return -EINVAL;
+		if (b->ib_nr == IOV_MAX) {
+			rc = iod_batch_flush(b);
+			if (rc != 0)
+				return rc;
+		}
+		if (b->ib_cs != NULL)
+			iod_cksum_update(b->ib_cs, p, plen);
+		b->ib_iov[b->ib_nr].iov_base = p;
+		b->ib_iov[b->ib_nr].iov_len = plen;
+		b->ib_nr++;
+		b->ib_len += plen;
+		mc->mc_off += plen;
+		len -= plen;
+	}
+	return 0;
+}
+
+/**
+ * Write \a len bytes at \a p to \a fd at \a addr, adding them to \a cs a
+ * cache-sized step before each step goes out.
+ */
+static int
+iod_write_cksum(int fd, char *p, iod_size_t len, uint64_t addr,
+		iod_checksum_t *cs)
+{
+	struct iovec	iov;
+	iod_size_t	done;
+	int		rc = 0;
+
+	for (done = 0; done < len && rc == 0; done += iov.iov_len) {
+		iov.iov_base = p + done;
+		iov.iov_len = iod_min(len - done, IOD_CKS_WRITE);
+		iod_cksum_update(cs, iov.iov_base, iov.iov_len);
+		rc = iod_rw_full(fd, &iov, 1, addr + done, 1);
+	}
+	return rc;
+}
+
+static int
+iod_memcur_rw(struct iod_memcur *mc, int fd, iod_size_t len, uint64_t addr,
+	      int write, iod_checksum_t *cs)
+{
+	struct iod_iov_batch	*b;
+	struct iovec		iov;
+	iod_size_t		plen;
+	int			rc;
+
+	/* a single memory fragment needs no batch */
+	iov.iov_base = iod_memcur_piece(mc, len, &plen);
+	if (iov.iov_base != NULL && plen == len) {
+		iov.iov_len = len;
+		mc->mc_off += len;
+		if (cs != NULL)
+			return iod_write_cksum(fd, iov.iov_base, len, addr, cs);
+		return iod_rw_full(fd, &iov, 1, addr, write);
+	}
+
+	b = malloc(sizeof(*b));
+	if (b == NULL)
+		return -ENOMEM;
+	iod_batch_init(b, fd, write);
+	b->ib_cs = cs;
+	rc = iod_batch_add(b, mc, len, addr);
+	if (rc == 0)
+		rc = iod_batch_flush(b);
+	free(b);
+	return rc;
+}
+
+/**
+ * write \a len bytes from the cursor to \a fd at \a addr, and add them to
+ * \a cs unless that is NULL
+ */
+int
+iod_memcur_write(struct iod_memcur *mc, int fd, iod_size_t len, uint64_t addr,
+		 iod_checksum_t *cs)
+{
+	return iod_memcur_rw(mc, fd, len, addr, 1, cs);
+}
+
+/** read \a len bytes of \a fd at \a addr into the cursor */
+int
+iod_memcur_read(struct iod_memcur *mc, int fd, iod_size_t len, uint64_t addr)
+{
+	return iod_memcur_rw(mc, fd, len, addr, 0, NULL);
+}
+
+/**
+ * The next \a len bytes of the cursor if they are contiguous in memory, NULL
+ * if they cross a fragment boundary. The cursor advances only on success.
+ */
+char *
+iod_memcur_take(struct iod_memcur *mc, iod_size_t len)
+{
+	iod_size_t	plen;
+	char		*p;
+
+	p = iod_memcur_piece(mc, len, &plen);
+	if (p == NULL || plen < len)
+		return NULL;
+	mc->mc_off += len;
+	return p;
+}
+
+/** copy \a len bytes of \a buf into the cursor, zeroes if \a buf is NULL */
+int
+iod_memcur_fill(struct iod_memcur *mc, const void *buf, iod_size_t len)
+{
+	const char	*src = buf;
+	iod_size_t	plen;
+	char		*p;
+
+	while (len > 0) {
+		p = iod_memcur_piece(mc, len, &plen);
+		if (p == NULL)
+			return -EINVAL;
+		if (src != NULL) {
+			memcpy(p, src, plen);
+			src += plen;
+		} else {
+			memset(p, 0, plen);
+		}
+		mc->mc_off += plen;
+		len -= plen;
+	}
+	return 0;
+}
+
+/** copy \a len bytes at the cursor into \a buf */
+int
+iod_memcur_drain(struct iod_memcur *mc, void *buf, iod_size_t len)
+{
+	char		*dst = buf;
+	iod_size_t	plen;
+	char		*p;
+
+	while (len > 0) {
+		p = iod_memcur_piece(mc, len, &plen);
+		if (p == NULL)
+			return -EINVAL;
+		memcpy(dst, p, plen);
+		dst += plen;
+		mc->mc_off += plen;
+		len -= plen;
+	}
+	return 0;
+}
+
+void
+iod_mem_cksum(iod_mem_desc_t *md, iod_checksum_t *cs)
+{
+	unsigned long	i;
+
+	iod_cksum_init(cs);
+	for (i = 0; i < md->nfrag; i++)
+		iod_cksum_update(cs, md->frag[i].addr, md->frag[i].len);
+}
+
+struct iod_read_arg {
+	struct iod_obj		*ra_obj;
+	struct iod_memcur	*ra_mc;
+	struct iod_iov_batch	ra_batch;	/* BB pieces not read yet */
+};
+
+static int
+iod_read_seg(const struct iod_seg *seg, void *arg)
+{
+	struct iod_read_arg	*ra = arg;
+	char			*buf;
+	int			rc;
+
+	switch (seg->is_src) {
+	case IOD_SEG_BB:
+		rc = iod_cks_verify(ra->ra_obj, seg->is_addr, seg->is_len);
+		if (rc != 0)
+			return rc;
+		iod_cache_read(ra->ra_obj, IOD_SEG_BB, seg->is_len);
+		/* log-adjacent segments are read by one preadv */
+		return iod_batch_add(&ra->ra_batch, ra->ra_mc, seg->is_len,
+				     iod_obj_log_pos(ra->ra_obj, seg->is_addr));
+	case IOD_SEG_CENTRAL:
+		buf = malloc(seg->is_len);
+		if (buf == NULL)
+			return -ENOMEM;
+		iod_cache_read(ra->ra_obj, IOD_SEG_CENTRAL, seg->is_len);
+		rc = iod_central_read(ra->ra_obj, seg->is_off, seg->is_len,
+				      buf);
+		if (rc == 0)
+			rc = iod_memcur_fill(ra->ra_mc, buf, seg->is_len);
+		free(buf);
+		return rc;
+	default:
+		return iod_memcur_fill(ra->ra_mc, NULL, seg->is_len);
+	}
+}
+
+/**
+ * Read the logical range [off, off + len) of \a obj as seen at \a tid into
+ * the cursor. Caller holds io_lock.
+ */
+int
+iod_obj_read_range(struct iod_obj *obj, iod_trans_id_t tid, iod_off_t off,
+		   iod_size_t len, struct iod_memcur *mc)
+{
+	struct iod_read_arg	*ra;
+	int			rc;
+
+	rc = iod_obj_log_open(obj);
+	if (rc != 0)
+		return rc;
+	ra = malloc(sizeof(*ra));
+	if (ra == NULL)
+		return -ENOMEM;
+	ra->ra_obj = obj;
+	ra->ra_mc = mc;
+	iod_batch_init(&ra->ra_batch, obj->io_fd, 0);
+	rc = iod_extent_resolve(obj, tid, off, len, iod_read_seg, ra);
+	if (rc == 0)
+		rc = iod_batch_flush(&ra->ra_batch);
+	free(ra);
+	return rc;
+}
+
+/**
+ * Append \a len bytes from the cursor to the data log of \a obj in one piece
+ * and return where they went in \a addr, and their checksum in \a cs for
+ * the caller to record.
+ */
+int
+iod_obj_log_append(struct iod_obj *obj, iod_size_t len, struct iod_memcur *mc,
+		   uint64_t *addr, iod_checksum_t *cs)
+{
+	int	rc;
+
+	rc = iod_cache_admit(obj->io_cont, len);
+	if (rc != 0)
+		return rc;
+	pthread_rwlock_wrlock(&obj->io_lock);
+	rc = iod_obj_log_begin(obj, len, addr);
+	pthread_rwlock_unlock(&obj->io_lock);
+	if (rc != 0)
+		return rc;
+	iod_cksum_init(cs);
+	rc = iod_memcur_write(mc, obj->io_fd, len, iod_obj_log_pos(obj, *addr),
+			      cs);
+	iod_obj_log_end(obj);
+	return rc;
+}
+
+/**
+ * Take io_lock of \a obj for write to record a change of write TID \a tid,
+ * once more making sure the TID is open: a write that skipped ic_lock may
+ * get here after the TID was aborted, and even after its rollback already
+ * went through \a obj. While the TID is still the last to mark \a obj that
+ * rollback is yet to come; otherwise the TID is looked up under ic_lock.
+ * Returns -ECANCELED for an aborted TID, without io_lock.
+ */
+int
+iod_obj_write_lock(struct iod_obj *obj, iod_trans_id_t tid)
+{
+	struct iod_cont	*cont = obj->io_cont;
+	int		rc;
+
+	pthread_rwlock_wrlock(&obj->io_lock);
+	if (__atomic_load_n(&obj->io_last_dirty, __ATOMIC_RELAXED) == tid)
+		return 0;
+	pthread_rwlock_unlock(&obj->io_lock);
+
+	pthread_mutex_lock(&cont->ic_lock);
+	rc = iod_trans_writable(cont, tid);
+	/* a rollback now has to wait for io_lock */
+	if (rc == 0)
+		pthread_rwlock_wrlock(&obj->io_lock);
+	pthread_mutex_unlock(&cont->ic_lock);
+	return rc;
+}
+
+/**
+ * Append the bytes of the logical ranges \a ext (ie_addr unused) from the
+ * cursor to the data log of \a obj as one contiguous piece, and map them in
+ * the layer of \a tid. The start of the piece is returned in \a addr unless
+ * that is NULL.
+ */
+int
+iod_obj_write_vec(struct iod_obj *obj, iod_trans_id_t tid,
+		  const struct iod_extent *ext, unsigned long nr,
+		  struct iod_memcur *mc, uint64_t *addr_out)
+{
+	struct iod_layer	*layer;
+	iod_checksum_t		cs;
+	iod_size_t		total = 0;
+	uint64_t		addr;
+	unsigned long		i;
+	int			rc;
+
+	for (i = 0; i < nr; i++)
+		total += ext[i].ie_len;
+	if (total == 0)
+		return 0;
+	rc = iod_obj_log_append(obj, total, mc, &addr, &cs);
+	if (rc != 0)
+		return rc;
+	if (addr_out != NULL)
+		*addr_out = addr;
+
+	rc = iod_obj_write_lock(obj, tid);
+	if (rc != 0)
+		return rc;
+	rc = iod_cks_add(obj, tid, addr, total, &cs);
+	layer = iod_layer_get(obj, tid);
+	if (layer == NULL)
+		rc = -ENOMEM;
+	for (i = 0; i < nr && rc == 0; i++) {
+		if (ext[i].ie_len == 0)
+			continue;
+		rc = iod_layer_insert(layer, ext[i].ie_off, ext[i].ie_len,
+				      addr);
+		addr += ext[i].ie_len;
+		if (rc == 0 && ext[i].ie_off + ext[i].ie_len > obj->io_size)
+			obj->io_size = ext[i].ie_off + ext[i].ie_len;
+	}
+	pthread_rwlock_unlock(&obj->io_lock);
+	return rc;
+}
+
+/**
+ * Append \a len bytes from the cursor to the data log of \a obj and map them
+ * at logical \a off in the layer of \a tid.
+ */
+int
+iod_obj_write_range(struct iod_obj *obj, iod_trans_id_t tid, iod_off_t off,
+		    iod_size_t len, struct iod_memcur *mc)
+{
+	struct iod_extent	ext = { off, len, 0 };
+
+	return iod_obj_write_vec(obj, tid, &ext, 1, mc, NULL);
+}
+
+/**
+ * Check a write of \a tid through \a h and record \a tid as touching it.
+ * The placement hints of \a pol stay with the object for the cache and
+ * persists to go by. Caller holds ic_lock.
+ */
+static int
+iod_obj_write_prep_locked(struct iod_objh *h, iod_obj_type_t type,
+			  iod_trans_id_t tid, const struct iod_policy *pol)
+{
+	struct iod_obj	*obj = h->oh_obj;
+	unsigned int	set = pol->ip_set & (IOD_POL_WRITE_ONCE |
+					     IOD_POL_SKIP_BB);
+	int		rc;
+
+	if (!h->oh_write)
+		return -EPERM;
+	if (obj->io_type != type)
+		return -EINVAL;
+	if (!iod_obj_visible(obj, tid))
+		return -ENOENT;
+	if (type == IOD_OBJ_ARRAY)
+		rc = iod_trans_dirty(obj->io_cont, tid, obj);
+	else	/* blob and KV updates go to the write-ahead log */
+		rc = iod_trans_dirty_logged(obj->io_cont, tid, obj);
+	if (rc != 0)
+		return rc;
+	obj->io_pol_flags = (obj->io_pol_flags & ~set) | (pol->ip_flags & set);
+	if (pol->ip_set & IOD_POL_PERSIST_PRI)
+		obj->io_persist_pri = pol->ip_persist_pri;
+	iod_cache_touch(obj, tid);
+	return 0;
+}
+
+/** check a read of \a tid through \a h. Caller holds ic_lock. */
+static int
+iod_obj_read_prep_locked(struct iod_objh *h, iod_obj_type_t type,
+			 iod_trans_id_t tid, const struct iod_policy *pol)
+{
+	struct iod_obj	*obj = h->oh_obj;
+
+	if (obj->io_type != type)
+		return -EINVAL;
+	if (!iod_obj_visible(obj, tid))
+		return -ENOENT;
+	/* a "skip_bb" read is not a use */
+	if (!(pol->ip_flags & IOD_POL_SKIP_BB))
+		iod_cache_touch(obj, tid);
+	return 0;
+}
+
+/**
+ * A write of \a tid, still open, to an object \a tid wrote before and nobody
+ * unlinked, with no placement hints to apply, has nothing to record under
+ * ic_lock: only the use and the lease of \a tid are stamped.
+ */
+static int
+iod_obj_write_again(struct iod_objh *h, iod_obj_type_t type,
+		    iod_trans_id_t tid, const struct iod_policy *pol)
+{
+	struct iod_obj	*obj = h->oh_obj;
+	uint64_t	stamp;
+
+	if (!h->oh_write || obj->io_type != type ||
+	    (pol->ip_set & (IOD_POL_WRITE_ONCE | IOD_POL_SKIP_BB |
+			    IOD_POL_PERSIST_PRI)) ||
+	    __atomic_load_n(&obj->io_last_dirty, __ATOMIC_ACQUIRE) != tid ||
+	    __atomic_load_n(&obj->io_cache_tid, __ATOMIC_RELAXED) != tid ||
+	    __atomic_load_n(&obj->io_unlink_tid, __ATOMIC_RELAXED) !=
+	    IOD_TID_UNKNOWN)
+		return 0;
+	stamp = __atomic_add_fetch(&obj->io_cont->ic_cache_clock, 1,
+				   __ATOMIC_RELAXED);
+	__atomic_store_n(&obj->io_cache_stamp, stamp, __ATOMIC_RELAXED);
+	iod_trans_touch(obj, tid);
+	return 1;
+}
+
+int
+iod_obj_write_prep(struct iod_objh *h, iod_obj_type_t type,
+		   iod_trans_id_t tid, const struct iod_policy *pol)
+{
+	struct iod_cont	*cont = h->oh_obj->io_cont;
+	int		rc;
+
+	if (iod_obj_write_again(h, type, tid, pol))
+		return 0;
+	pthread_mutex_lock(&cont->ic_lock);
+	rc = iod_obj_write_prep_locked(h, type, tid, pol);
+	pthread_mutex_unlock(&cont->ic_lock);
+	return rc;
+}
+
+int
+iod_obj_read_prep(struct iod_objh *h, iod_obj_type_t type, iod_trans_id_t tid,
+		  const struct iod_policy *pol)
+{
+	struct iod_cont	*cont = h->oh_obj->io_cont;
+	int		rc;
+
+	pthread_mutex_lock(&cont->ic_lock);
+	rc = iod_obj_read_prep_locked(h, type, tid, pol);
+	pthread_mutex_unlock(&cont->ic_lock);
+	return rc;
+}
+
+/**
+ * Resolve the policies of the \a num entries \a xf of a list given to
+ * \a cont, and prepare them all for \a tid under one hold of ic_lock. The
+ * result of each goes to xf_rc; a handle of another container is -EINVAL.
+ */
+int
+iod_xfer_prep(struct iod_cont *cont, iod_obj_type_t type, iod_trans_id_t tid,
+	      int write, struct iod_xfer *xf, iod_size_t num)
+{
+	iod_size_t	i;
+	int		rc = 0;
+
+	for (i = 0; i < num; i++) {
+		if (xf[i].xf_h == NULL || xf[i].xf_h->oh_obj->io_cont != cont)
+			xf[i].xf_rc = -EINVAL;
+		else
+			xf[i].xf_rc = iod_policy_resolve(&xf[i].xf_h->oh_pol,
+							 xf[i].xf_hints,
+							 &xf[i].xf_buf,
+							 &xf[i].xf_pol);
+	}
+	pthread_mutex_lock(&cont->ic_lock);
+	for (i = 0; i < num; i++) {
+		if (xf[i].xf_rc == 0 && write)
+			xf[i].xf_rc = iod_obj_write_prep_locked(xf[i].xf_h,
+								type, tid,
+								xf[i].xf_pol);
+		else if (xf[i].xf_rc == 0)
+			xf[i].xf_rc = iod_obj_read_prep_locked(xf[i].xf_h,
+							       type, tid,
+							       xf[i].xf_pol);
+		if (rc == 0)
+			rc = xf[i].xf_rc;
+	}
+	pthread_mutex_unlock(&cont->ic_lock);
+	return rc;
+}
@@ -0,0 +1,1615 @@
+/*
+ * IOD key-value objects.
+ *
+ * Keys live in DRAM in a hash table; every key carries a chain of versions,
+ * newest TID first. Values are appended to the object's data log like blob
+ * data, an unlinked key is a version without a value.
+ *
+ * Listings page through the keys by offset in key order, so each committed
+ * TID also gets a view: the root of a copy-on-write treap of the keys visible
+ * at it, ordered by key and counting the keys below every node. Offset seeks,
+ * key ranks and key counts are then O(log n). A commit path-copies the
+ * previous view for each key the TID set or unlinked, sharing every untouched
+ * subtree, as the extent versions of blobs do. A reader at t takes the newest
+ * view <= t and, if t is still open, the keys t itself added or unlinked on
+ * top of it.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <unistd.h>
+
+#include "iod_internal.h"
+
+struct iod_kv_ver {
+	struct iod_kv_ver	*kv_next;	/* next older version */
+	iod_trans_id_t		kv_tid;
+	int			kv_committed;
+	int			kv_deleted;
+	uint64_t		kv_addr;	/* value in the data log */
+	iod_size_t		kv_len;
+	iod_checksum_t		kv_cs;
+};
+
+struct iod_kv_ent {
+	struct iod_kv_ent	*ke_next;	/* hash chain */
+	struct iod_kv_ver	*ke_vers;
+	uint32_t		ke_hash;
+	char			ke_key[];
+};
+
+/** node of a view treap, shared between views by reference count */
+struct iod_knode {
+	struct iod_knode	*kn_left;
+	struct iod_knode	*kn_right;
+	struct iod_kv_ent	*kn_ent;
+	uint64_t		kn_size;	/* keys in the subtree */
+	uint32_t		kn_refs;
+};
+
+struct iod_kv_view {
+	iod_trans_id_t		kw_tid;
+	struct iod_knode	*kw_root;
+};
+
+/** keys an open TID set or unlinked */
+struct iod_kv_pend {
+	struct iod_kv_pend	*kp_next;
+	iod_trans_id_t		kp_tid;
+	struct iod_kv_ent	**kp_ents;
+	unsigned long		kp_nr;
+	unsigned long		kp_max;
+};
+
+struct iod_kv {
+	struct iod_kv_ent	**kv_hash;
+	unsigned long		kv_hsize;	/* power of two */
+	unsigned long		kv_nr;		/* keys with any version */
+	struct iod_kv_view	*kv_views;	/* oldest TID first */
+	unsigned long		kv_nviews;
+	unsigned long		kv_maxviews;
+	int			kv_stale;	/* views could not be built */
+	struct iod_kv_pend	*kv_pend;
+};
+
+/* ------------------------------- views ---------------------------------- */
+
+static inline uint32_t
+iod_kv_prio(const struct iod_kv_ent *ent)
+{
+	return (ent->ke_hash * 0x9e3779b97f4a7c15ULL) >> 32;
+}
+
+static inline uint32_t
+iod_knode_prio(const struct iod_knode *n)
+{
+	return iod_kv_prio(n->kn_ent);
+}
+
+static inline uint64_t
+iod_knode_size(const struct iod_knode *n)
+{
+	return n != NULL ? n->kn_size : 0;
+}
+
+static struct iod_knode *
+iod_knode_get(struct iod_knode *n)
+{
+	if (n != NULL)
+		n->kn_refs++;
+	return n;
+}
+
+static void
+iod_knode_put(struct iod_knode *n)
+{
+	if (n == NULL || --n->kn_refs > 0)
+		return;
+	iod_knode_put(n->kn_left);
+	iod_knode_put(n->kn_right);
+	free(n);
+}
+
+static void
+iod_knode_fix(struct iod_knode *n)
+{
+	n->kn_size = 1 + iod_knode_size(n->kn_left) +
+		     iod_knode_size(n->kn_right);
+}
+
+/** new node owning the references \a l and \a r, dropped on failure */
+static struct iod_knode *
+iod_knode_new(struct iod_kv_ent *ent, struct iod_knode *l,
+	      struct iod_knode *r)
+{
+	struct iod_knode	*n;
+
+	n = malloc(sizeof(*n));
+	if (n == NULL) {
+		iod_knode_put(l);
+		iod_knode_put(r);
+		return NULL;
+	}
+	n->kn_left = l;
+	n->kn_right = r;
+	n->kn_ent = ent;
+	n->kn_refs = 1;
+	iod_knode_fix(n);
+	return n;
+}
+
+/**
+ * Split the treap \a n into the keys below \a key and the rest. \a n is left
+ * intact.
+ */
+static int
+iod_knode_split(struct iod_knode *n, const char *key, struct iod_knode **l,
+		struct iod_knode **r)
+{
+	struct iod_knode	*sub;
+	int			c;
+	int			rc;
+
+	*l = NULL;
+	*r = NULL;
+	if (n == NULL)
+		return 0;
+	c = strcmp(n->kn_ent->ke_key, key);
+	if (c < 0) {
+		rc = iod_knode_split(n->kn_right, key, &sub, r);
+		if (rc != 0)
+			return rc;
+		*l = iod_knode_new(n->kn_ent, iod_knode_get(n->kn_left), sub);
+		if (*l != NULL)
+			return 0;
+	} else {
+		rc = iod_knode_split(n->kn_left, key, l, &sub);
+		if (rc != 0)
+			return rc;
+		*r = iod_knode_new(n->kn_ent, sub, iod_knode_get(n->kn_right));
+		if (*r != NULL)
+			return 0;
+	}
+	iod_knode_put(*l);
+	iod_knode_put(*r);
+	*l = NULL;
+	*r = NULL;
+	return -ENOMEM;
+}
+
+/** \a n as a node only the caller refers to, copied if it is shared */
+static struct iod_knode *
+iod_knode_own(struct iod_knode *n)
+{
+	struct iod_knode	*c;
+
+	if (n->kn_refs == 1)
+		return n;
+	c = iod_knode_new(n->kn_ent, iod_knode_get(n->kn_left),
+			  iod_knode_get(n->kn_right));
+	iod_knode_put(n);
+	return c;
+}
+
+/** join \a a and \a b, all of \a a below \a b. Consumes both. */
+static int
+iod_knode_merge(struct iod_knode *a, struct iod_knode *b,
+		struct iod_knode **out)
+{
+	struct iod_knode	*sub;
+	int			rc;
+
+	if (a == NULL || b == NULL) {
+		*out = a != NULL ? a : b;
+		return 0;
+	}
+	if (iod_knode_prio(a) >= iod_knode_prio(b)) {
+		a = iod_knode_own(a);
+		if (a == NULL) {
+			iod_knode_put(b);
+			return -ENOMEM;
+		}
+		sub = a->kn_right;
+		a->kn_right = NULL;
+		rc = iod_knode_merge(sub, b, &a->kn_right);
+		if (rc != 0) {
+			iod_knode_put(a);
+			return rc;
+		}
+		iod_knode_fix(a);
+		*out = a;
+	} else {
+		b = iod_knode_own(b);
+		if (b == NULL) {
+			iod_knode_put(a);
+			return -ENOMEM;
+		}
+		sub = b->kn_left;
+		b->kn_left = NULL;
+		rc = iod_knode_merge(a, sub, &b->kn_left);
+		if (rc != 0) {
+			iod_knode_put(b);
+			return rc;
+		}
+		iod_knode_fix(b);
+		*out = b;
+	}
+	return 0;
+}
+
+/** \a n with the key of \a ent added. Consumes \a n. */
+static int
+iod_knode_add(struct iod_knode *n, struct iod_kv_ent *ent,
+	      struct iod_knode **out)
+{
+	struct iod_knode	**pp;
+	struct iod_knode	*l;
+	struct iod_knode	*r;
+	int			rc;
+
+	if (n != NULL && iod_kv_prio(ent) <= iod_knode_prio(n)) {
+		n = iod_knode_own(n);
+		if (n == NULL)
+			return -ENOMEM;
+		pp = strcmp(ent->ke_key, n->kn_ent->ke_key) < 0 ?
+		     &n->kn_left : &n->kn_right;
+		l = *pp;
+		*pp = NULL;
+		rc = iod_knode_add(l, ent, pp);
+		if (rc != 0) {
+			iod_knode_put(n);
+			return rc;
+		}
+		iod_knode_fix(n);
+		*out = n;
+		return 0;
+	}
+	rc = iod_knode_split(n, ent->ke_key, &l, &r);
+	iod_knode_put(n);
+	if (rc != 0)
+		return rc;
+	*out = iod_knode_new(ent, l, r);
+	return *out != NULL ? 0 : -ENOMEM;
+}
+
+/** \a n with \a key removed. Consumes \a n. */
+static int
+iod_knode_del(struct iod_knode *n, const char *key, struct iod_knode **out)
+{
+	struct iod_knode	**pp;
+	struct iod_knode	*sub;
+	int			c;
+	int			rc;
+
+	if (n == NULL) {
+		*out = NULL;
+		return 0;
+	}
+	c = strcmp(key, n->kn_ent->ke_key);
+	if (c == 0) {
+		sub = iod_knode_get(n->kn_left);
+		rc = iod_knode_merge(sub, iod_knode_get(n->kn_right), out);
+		iod_knode_put(n);
+		return rc;
+	}
+	n = iod_knode_own(n);
+	if (n == NULL)
+		return -ENOMEM;
+	pp = c < 0 ? &n->kn_left : &n->kn_right;
+	sub = *pp;
+	*pp = NULL;
+	rc = iod_knode_del(sub, key, pp);
+	if (rc != 0) {
+		iod_knode_put(n);
+		return rc;
+	}
+	iod_knode_fix(n);
+	*out = n;
+	return 0;
+}
+
+/** the \a k-th key of the treap \a n, NULL past its end */
+static struct iod_kv_ent *
+iod_knode_select(const struct iod_knode *n, uint64_t k)
+{
+	uint64_t	ls;
+
+	while (n != NULL) {
+		ls = iod_knode_size(n->kn_left);
+		if (k == ls)
+			return n->kn_ent;
+		if (k < ls) {
+			n = n->kn_left;
+		} else {
+			k -= ls + 1;
+			n = n->kn_right;
+		}
+	}
+	return NULL;
+}
+
+/** number of keys of the treap \a n below \a key */
+static uint64_t
+iod_knode_rank(const struct iod_knode *n, const char *key)
+{
+	uint64_t	rank = 0;
+	int		c;
+
+	while (n != NULL) {
+		c = strcmp(n->kn_ent->ke_key, key);
+		if (c == 0)
+			return rank + iod_knode_size(n->kn_left);
+		if (c < 0) {
+			rank += iod_knode_size(n->kn_left) + 1;
+			n = n->kn_right;
+		} else {
+			n = n->kn_left;
+		}
+	}
+	return rank;
+}
+
+/* -------------------------------- keys ---------------------------------- */
+
+static uint32_t
+iod_kv_hash(const char *key)
+{
+	uint32_t	h = 2166136261U;
+
+	while (*key != '\0')
+		h = (h ^ (unsigned char)*key++) * 16777619U;
+	return h;
+}
+
+static void
+iod_kv_views_fini(struct iod_kv *kv)
+{
+	while (kv->kv_nviews > 0)
+		iod_knode_put(kv->kv_views[--kv->kv_nviews].kw_root);
+}
+
+void
+iod_kv_free(struct iod_kv *kv)
+{
+	struct iod_kv_pend	*pend;
+	struct iod_kv_ver	*ver;
+	struct iod_kv_ent	*ent;
+	unsigned long		i;
+
+	iod_kv_views_fini(kv);
+	free(kv->kv_views);
+	while ((pend = kv->kv_pend) != NULL) {
+		kv->kv_pend = pend->kp_next;
+		free(pend->kp_ents);
+		free(pend);
+	}
+	for (i = 0; i < kv->kv_hsize; i++) {
+		while ((ent = kv->kv_hash[i]) != NULL) {
+			kv->kv_hash[i] = ent->ke_next;
+			while ((ver = ent->ke_vers) != NULL) {
+				ent->ke_vers = ver->kv_next;
+				free(ver);
+			}
+			free(ent);
+		}
+	}
+	free(kv->kv_hash);
+	free(kv);
+}
+
+static struct iod_kv_ent *
+iod_kv_lookup(struct iod_kv *kv, const char *key)
+{
+	struct iod_kv_ent	*ent;
+	uint32_t		h;
+
+	if (kv == NULL || kv->kv_hsize == 0)
+		return NULL;
+	h = iod_kv_hash(key);
+	for (ent = kv->kv_hash[h & (kv->kv_hsize - 1)]; ent != NULL;
+	     ent = ent->ke_next) {
+		if (ent->ke_hash == h && strcmp(ent->ke_key, key) == 0)
+			return ent;
+	}
+	return NULL;
+}
+
+static int
+iod_kv_rehash(struct iod_kv *kv)
+{
+	struct iod_kv_ent	**hash;
+	struct iod_kv_ent	*ent;
+	unsigned long		size = iod_max(kv->kv_hsize * 2, 64UL);
+	unsigned long		i;
+
+	hash = calloc(size, sizeof(*hash));
+	if (hash == NULL)
+		return -ENOMEM;
+	for (i = 0; i < kv->kv_hsize; i++) {
+		while ((ent = kv->kv_hash[i]) != NULL) {
+			kv->kv_hash[i] = ent->ke_next;
+			ent->ke_next = hash[ent->ke_hash & (size - 1)];
+			hash[ent->ke_hash & (size - 1)] = ent;
+		}
+	}
+	free(kv->kv_hash);
+	kv->kv_hash = hash;
+	kv->kv_hsize = size;
+	return 0;
+}
+
+static struct iod_kv_ent *
+iod_kv_ent_get(struct iod_obj *obj, const char *key)
+{
+	struct iod_kv		*kv = obj->io_kv;
+	struct iod_kv_ent	*ent;
+	size_t			len;
+
+	if (kv == NULL) {
+		kv = calloc(1, sizeof(*kv));
+		if (kv == NULL)
+			return NULL;
+		obj->io_kv = kv;
+	}
+	ent = iod_kv_lookup(kv, key);
+	if (ent != NULL)
+		return ent;
+	if (kv->kv_nr >= kv->kv_hsize && iod_kv_rehash(kv) != 0)
+		return NULL;
+
+	len = strlen(key);
+	ent = malloc(sizeof(*ent) + len + 1);
+	if (ent == NULL)
+		return NULL;
+	memcpy(ent->ke_key, key, len + 1);
+	ent->ke_vers = NULL;
+	ent->ke_hash = iod_kv_hash(key);
+	ent->ke_next = kv->kv_hash[ent->ke_hash & (kv->kv_hsize - 1)];
+	kv->kv_hash[ent->ke_hash & (kv->kv_hsize - 1)] = ent;
+	kv->kv_nr++;
+	return ent;
+}
+
+/** free \a ent if it is left with no version at all */
+static void
+iod_kv_ent_put(struct iod_kv *kv, struct iod_kv_ent *ent)
+{
+	struct iod_kv_ent	**pp;
+
+	if (ent->ke_vers != NULL)
+		return;
+	for (pp = &kv->kv_hash[ent->ke_hash & (kv->kv_hsize - 1)]; *pp != ent;
+	     pp = &(*pp)->ke_next)
+		;
+	*pp = ent->ke_next;
+	kv->kv_nr--;
+	free(ent);
+}
+
+/** add or replace the version of \a tid. Caller holds io_lock for write. */
+static struct iod_kv_ver *
+iod_kv_ver_add(struct iod_kv_ent *ent, iod_trans_id_t tid, int deleted,
+	       uint64_t addr, iod_size_t len, const iod_checksum_t *cs)
+{
+	struct iod_kv_ver	**pp;
+	struct iod_kv_ver	*ver;
+
+	for (pp = &ent->ke_vers; *pp != NULL && (*pp)->kv_tid > tid;
+	     pp = &(*pp)->kv_next)
+		;
+	if (*pp != NULL && (*pp)->kv_tid == tid) {
+		ver = *pp;
+	} else {
+		ver = calloc(1, sizeof(*ver));
+		if (ver == NULL)
+			return NULL;
+		ver->kv_next = *pp;
+		ver->kv_tid = tid;
+		*pp = ver;
+	}
+	ver->kv_deleted = deleted;
+	ver->kv_addr = addr;
+	ver->kv_len = len;
+	ver->kv_cs = *cs;
+	return ver;
+}
+
+static struct iod_kv_ver *
+iod_kv_ver_get(struct iod_kv_ent *ent, iod_trans_id_t tid)
+{
+	struct iod_kv_ver	*ver;
+
+	for (ver = ent->ke_vers; ver != NULL; ver = ver->kv_next) {
+		if (iod_ver_visible(ver->kv_tid, ver->kv_committed, tid))
+			return ver->kv_deleted ? NULL : ver;
+	}
+	return NULL;
+}
+
+static struct iod_kv_pend *
+iod_kv_pend_find(struct iod_kv *kv, iod_trans_id_t tid)
+{
+	struct iod_kv_pend	*pend;
+
+	for (pend = kv->kv_pend; pend != NULL; pend = pend->kp_next) {
+		if (pend->kp_tid == tid)
+			return pend;
+	}
+	return NULL;
+}
+
+/**
+ * Record that open \a tid is about to set or unlink \a ent, before its
+ * version is added. Caller holds io_lock for write.
+ */
+static int
+iod_kv_pend_add(struct iod_kv *kv, struct iod_kv_ent *ent,
+		iod_trans_id_t tid)
+{
+	struct iod_kv_pend	*pend;
+	struct iod_kv_ent	**ents;
+	struct iod_kv_ver	*ver;
+	unsigned long		max;
+
+	for (ver = ent->ke_vers; ver != NULL && ver->kv_tid > tid;
+	     ver = ver->kv_next)
+		;
+	if (ver != NULL && ver->kv_tid == tid)
+		return 0;
+	pend = iod_kv_pend_find(kv, tid);
+	if (pend == NULL) {
+		pend = calloc(1, sizeof(*pend));
+		if (pend == NULL)
+			return -ENOMEM;
+		pend->kp_tid = tid;
+		pend->kp_next = kv->kv_pend;
+		kv->kv_pend = pend;
+	}
+	if (pend->kp_nr == pend->kp_max) {
+		max = iod_max(pend->kp_max * 2, 16UL);
+		ents = realloc(pend->kp_ents, max * sizeof(*ents));
+		if (ents == NULL)
+			return -ENOMEM;
+		pend->kp_ents = ents;
+		pend->kp_max = max;
+	}
+	pend->kp_ents[pend->kp_nr++] = ent;
+	return 0;
+}
+
+/** unlink the changes of \a tid from \a kv, NULL if it made none */
+static struct iod_kv_pend *
+iod_kv_pend_take(struct iod_kv *kv, iod_trans_id_t tid)
+{
+	struct iod_kv_pend	**pp;
+	struct iod_kv_pend	*pend;
+
+	for (pp = &kv->kv_pend; (pend = *pp) != NULL; pp = &pend->kp_next) {
+		if (pend->kp_tid == tid) {
+			*pp = pend->kp_next;
+			return pend;
+		}
+	}
+	return NULL;
+}
+
+/** the newest view of \a kv at or below \a tid, NULL if none */
+static struct iod_kv_view *
+iod_kv_view_find(struct iod_kv *kv, iod_trans_id_t tid)
+{
+	unsigned long	lo = 0;
+	unsigned long	hi = kv->kv_nviews;
+	unsigned long	mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (kv->kv_views[mid].kw_tid <= tid)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo > 0 ? &kv->kv_views[lo - 1] : NULL;
+}
+
+/** add the view of committed \a tid, which changed \a ents, on top */
+static int
+iod_kv_view_add(struct iod_kv *kv, iod_trans_id_t tid,
+		struct iod_kv_ent **ents, unsigned long nr)
+{
+	struct iod_kv_view	*v;
+	struct iod_knode	*root = NULL;
+	unsigned long		max;
+	unsigned long		i;
+	int			was;
+	int			is;
+	int			rc;
+
+	v = kv->kv_nviews > 0 ? &kv->kv_views[kv->kv_nviews - 1] : NULL;
+	if (v != NULL && v->kw_tid >= tid)
+		return -EINVAL;
+	if (kv->kv_nviews == kv->kv_maxviews) {
+		max = iod_max(kv->kv_maxviews * 2, 8UL);
+		v = realloc(kv->kv_views, max * sizeof(*v));
+		if (v == NULL)
+			return -ENOMEM;
+		kv->kv_views = v;
+		kv->kv_maxviews = max;
+		v = kv->kv_nviews > 0 ? &kv->kv_views[kv->kv_nviews - 1] :
+					NULL;
+	}
+	if (v != NULL)
+		root = iod_knode_get(v->kw_root);
+	for (i = 0; i < nr; i++) {
+		was = v != NULL && iod_kv_ver_get(ents[i], v->kw_tid) != NULL;
+		is = iod_kv_ver_get(ents[i], tid) != NULL;
+		if (was == is)
+			continue;
+		/* nodes only the new view refers to are changed in place */
+		if (was)
+			rc = iod_knode_del(root, ents[i]->ke_key, &root);
+		else
+			rc = iod_knode_add(root, ents[i], &root);
+		if (rc != 0)
+			return rc;
+	}
+	v = &kv->kv_views[kv->kv_nviews++];
+	v->kw_tid = tid;
+	v->kw_root = root;
+	return 0;
+}
+
+static int
+iod_kv_ent_cmp(const void *a, const void *b)
+{
+	const struct iod_kv_ent	*x = *(const struct iod_kv_ent **)a;
+	const struct iod_kv_ent	*y = *(const struct iod_kv_ent **)b;
+
+	return strcmp(x->ke_key, y->ke_key);
+}
+
+struct iod_kv_tent {
+	iod_trans_id_t		kt_tid;
+	struct iod_kv_ent	*kt_ent;
+};
+
+static int
+iod_kv_tent_cmp(const void *a, const void *b)
+{
+	const struct iod_kv_tent	*x = a;
+	const struct iod_kv_tent	*y = b;
+
+	if (x->kt_tid != y->kt_tid)
+		return x->kt_tid < y->kt_tid ? -1 : 1;
+	return strcmp(x->kt_ent->ke_key, y->kt_ent->ke_key);
+}
+
+/**
+ * Rebuild the views of \a kv from the committed versions of its keys, after
+ * a load or a commit below the newest view. Caller holds io_lock for write.
+ */
+static int
+iod_kv_rebuild(struct iod_kv *kv)
+{
+	struct iod_kv_tent	*tents = NULL;
+	struct iod_kv_ent	**ents = NULL;
+	struct iod_kv_ver	*ver;
+	struct iod_kv_ent	*ent;
+	unsigned long		nr = 0;
+	unsigned long		max = 0;
+	unsigned long		i;
+	unsigned long		j;
+	int			rc = 0;
+
+	iod_kv_views_fini(kv);
+	for (i = 0; i < kv->kv_hsize; i++) {
+		for (ent = kv->kv_hash[i]; ent != NULL; ent = ent->ke_next) {
+			for (ver = ent->ke_vers; ver != NULL;
+			     ver = ver->kv_next)
+				max += ver->kv_committed;
+		}
+	}
+	if (max > 0) {
+		tents = malloc(max * sizeof(*tents));
+		ents = malloc(max * sizeof(*ents));
+		if (tents == NULL || ents == NULL)
+			rc = -ENOMEM;
+	}
+	for (i = 0; rc == 0 && i < kv->kv_hsize; i++) {
+		for (ent = kv->kv_hash[i]; ent != NULL; ent = ent->ke_next) {
+			for (ver = ent->ke_vers; ver != NULL;
+			     ver = ver->kv_next) {
+				if (!ver->kv_committed)
+					continue;
+				tents[nr].kt_tid = ver->kv_tid;
+				tents[nr++].kt_ent = ent;
+			}
+		}
+	}
+	if (rc == 0 && nr > 1)
+		qsort(tents, nr, sizeof(*tents), iod_kv_tent_cmp);
+	for (i = 0; rc == 0 && i < nr; i++)
+		ents[i] = tents[i].kt_ent;
+	for (i = 0; rc == 0 && i < nr; i = j) {
+		for (j = i + 1; j < nr && tents[j].kt_tid == tents[i].kt_tid;
+		     j++)
+			;
+		rc = iod_kv_view_add(kv, tents[i].kt_tid, &ents[i], j - i);
+	}
+	free(tents);
+	free(ents);
+	kv->kv_stale = rc != 0;
+	return rc;
+}
+
+/**
+ * Mark the versions of \a tid readable and add its view. TIDs commit in
+ * order, so this is one path-copying pass over the keys the TID changed.
+ * Caller holds io_lock for write.
+ */
+void
+iod_kv_commit(struct iod_obj *obj, iod_trans_id_t tid)
+{
+	struct iod_kv		*kv = obj->io_kv;
+	struct iod_kv_pend	*pend;
+	struct iod_kv_ver	*ver;
+	unsigned long		i;
+
+	pend = iod_kv_pend_take(kv, tid);
+	if (pend == NULL)
+		return;
+	for (i = 0; i < pend->kp_nr; i++) {
+		for (ver = pend->kp_ents[i]->ke_vers; ver != NULL;
+		     ver = ver->kv_next) {
+			if (ver->kv_tid == tid)
+				ver->kv_committed = 1;
+		}
+	}
+	/* neighbouring keys walk mostly the same, cached, path */
+	qsort(pend->kp_ents, pend->kp_nr, sizeof(*pend->kp_ents),
+	      iod_kv_ent_cmp);
+	if (kv->kv_stale ||
+	    iod_kv_view_add(kv, tid, pend->kp_ents, pend->kp_nr) != 0)
+		iod_kv_rebuild(kv);
+	free(pend->kp_ents);
+	free(pend);
+}
+
+void
+iod_kv_drop(struct iod_obj *obj, iod_trans_id_t tid)
+{
+	struct iod_kv_pend	*pend;
+	struct iod_kv_ver	**pp;
+	struct iod_kv_ver	*ver;
+	struct iod_kv_ent	*ent;
+	unsigned long		i;
+
+	pend = iod_kv_pend_take(obj->io_kv, tid);
+	if (pend == NULL)
+		return;
+	for (i = 0; i < pend->kp_nr; i++) {
+		ent = pend->kp_ents[i];
+		pp = &ent->ke_vers;
+		while ((ver = *pp) != NULL) {
+			if (ver->kv_tid == tid) {
+				*pp = ver->kv_next;
+				free(ver);
+			} else {
+				pp = &ver->kv_next;
+			}
+		}
+		iod_kv_ent_put(obj->io_kv, ent);
+	}
+	free(pend->kp_ents);
+	free(pend);
+}
+
+/**
+ * Forget the versions and views that no TID above \a tid can see any more:
+ * everything older than the newest committed version at or below \a tid.
+ * Caller holds io_lock for write.
+ */
+void
+iod_kv_prune(struct iod_obj *obj, iod_trans_id_t tid)
+{
+	struct iod_kv		*kv = obj->io_kv;
+	struct iod_kv_view	*v;
+	struct iod_kv_ver	*ver;
+	struct iod_kv_ver	*old;
+	struct iod_kv_ent	*ent;
+	struct iod_kv_ent	*next;
+	unsigned long		i;
+
+	if (kv == NULL)
+		return;
+	for (i = 0; i < kv->kv_hsize; i++) {
+		for (ent = kv->kv_hash[i]; ent != NULL; ent = next) {
+			next = ent->ke_next;
+			for (ver = ent->ke_vers; ver != NULL;
+			     ver = ver->kv_next) {
+				if (ver->kv_committed && ver->kv_tid <= tid)
+					break;
+			}
+			if (ver == NULL)
+				continue;
+			while ((old = ver->kv_next) != NULL) {
+				ver->kv_next = old->kv_next;
+				free(old);
+			}
+			/* a key unlinked for good needs no tombstone either */
+			if (ver->kv_deleted && ent->ke_vers == ver) {
+				ent->ke_vers = NULL;
+				free(ver);
+				iod_kv_ent_put(kv, ent);
+			}
+		}
+	}
+	if (kv->kv_stale) {
+		iod_kv_rebuild(kv);
+		return;
+	}
+	v = iod_kv_view_find(kv, tid);
+	if (v == NULL || v == kv->kv_views)
+		return;
+	i = v - kv->kv_views;
+	while (i-- > 0)
+		iod_knode_put(kv->kv_views[i].kw_root);
+	i = v - kv->kv_views;
+	memmove(kv->kv_views, v, (kv->kv_nviews - i) * sizeof(*v));
+	kv->kv_nviews -= i;
+}
+
+/* ------------------------------- reads ---------------------------------- */
+
+/** a key a reader sees added to or unlinked from its view */
+struct iod_kv_ev {
+	struct iod_kv_ent	*ev_ent;
+	int			ev_add;
+};
+
+/** what a reader at one TID sees: a view and its own changes over it */
+struct iod_kv_snap {
+	struct iod_knode	*ks_root;
+	struct iod_kv_ev	*ks_ev;		/* sorted by key */
+	unsigned long		ks_nev;
+	iod_size_t		ks_num;		/* visible keys */
+};
+
+/** position in a snapshot: next rank in the view, next change */
+struct iod_kv_cur {
+	struct iod_kv_snap	*kc_snap;
+	uint64_t		kc_rank;
+	unsigned long		kc_ev;
+};
+
+static int
+iod_kv_ev_cmp(const void *a, const void *b)
+{
+	const struct iod_kv_ev	*x = a;
+	const struct iod_kv_ev	*y = b;
+
+	return strcmp(x->ev_ent->ke_key, y->ev_ent->ke_key);
+}
+
+static int
+iod_kv_ev_push(struct iod_kv_snap *ks, unsigned long *max,
+	       struct iod_kv_ent *ent, int add)
+{
+	struct iod_kv_ev	*ev;
+
+	if (ks->ks_nev == *max) {
+		*max = iod_max(*max * 2, 16UL);
+		ev = realloc(ks->ks_ev, *max * sizeof(*ev));
+		if (ev == NULL)
+			return -ENOMEM;
+		ks->ks_ev = ev;
+	}
+	ks->ks_ev[ks->ks_nev].ev_ent = ent;
+	ks->ks_ev[ks->ks_nev++].ev_add = add;
+	if (add)
+		ks->ks_num++;
+	else
+		ks->ks_num--;
+	return 0;
+}
+
+/**
+ * Take the snapshot of \a kv at \a tid. The view costs nothing; an open
+ * \a tid adds the keys it changed, sorted. Should the views be stale, every
+ * visible key becomes a change over an empty view. Caller holds io_lock.
+ */
+static int
+iod_kv_snap_init(struct iod_kv *kv, iod_trans_id_t tid,
+		 struct iod_kv_snap *ks)
+{
+	struct iod_kv_view	*v = NULL;
+	struct iod_kv_pend	*pend = NULL;
+	struct iod_kv_ent	*ent;
+	unsigned long		max = 0;
+	unsigned long		i;
+	int			was;
+	int			is;
+	int			rc = 0;
+
+	memset(ks, 0, sizeof(*ks));
+	if (kv == NULL)
+		return 0;
+	if (kv->kv_stale) {
+		for (i = 0; i < kv->kv_hsize && rc == 0; i++) {
+			for (ent = kv->kv_hash[i]; ent != NULL && rc == 0;
+			     ent = ent->ke_next) {
+				if (iod_kv_ver_get(ent, tid) != NULL)
+					rc = iod_kv_ev_push(ks, &max, ent, 1);
+			}
+		}
+	} else {
+		v = iod_kv_view_find(kv, tid);
+		pend = iod_kv_pend_find(kv, tid);
+		if (v != NULL) {
+			ks->ks_root = v->kw_root;
+			ks->ks_num = iod_knode_size(v->kw_root);
+		}
+	}
+	for (i = 0; pend != NULL && i < pend->kp_nr && rc == 0; i++) {
+		ent = pend->kp_ents[i];
+		was = v != NULL && iod_kv_ver_get(ent, v->kw_tid) != NULL;
+		is = iod_kv_ver_get(ent, tid) != NULL;
+		if (was != is)
+			rc = iod_kv_ev_push(ks, &max, ent, is);
+	}
+	if (rc != 0) {
+		free(ks->ks_ev);
+		return rc;
+	}
+	if (ks->ks_nev > 1)
+		qsort(ks->ks_ev, ks->ks_nev, sizeof(*ks->ks_ev),
+		      iod_kv_ev_cmp);
+	return 0;
+}
+
+/**
+ * Position \a kc at the \a off-th visible key of \a ks. Walks the changes
+ * below it, O(log n) each.
+ */
+static void
+iod_kv_cur_seek(struct iod_kv_snap *ks, uint64_t off, struct iod_kv_cur *kc)
+{
+	struct iod_kv_ev	*ev;
+	uint64_t		cnt;
+
+	kc->kc_snap = ks;
+	kc->kc_rank = 0;
+	for (kc->kc_ev = 0; kc->kc_ev < ks->ks_nev; kc->kc_ev++) {
+		ev = &ks->ks_ev[kc->kc_ev];
+		cnt = iod_knode_rank(ks->ks_root, ev->ev_ent->ke_key) -
+		      kc->kc_rank;
+		if (off < cnt)
+			break;
+		off -= cnt;
+		kc->kc_rank += cnt;
+		if (!ev->ev_add) {
+			kc->kc_rank++;
+			continue;
+		}
+		if (off == 0)
+			return;
+		off--;
+	}
+	kc->kc_rank += off;
+}
+
+/** the key at \a kc, which then moves past it; NULL at the end */
+static struct iod_kv_ent *
+iod_kv_cur_next(struct iod_kv_cur *kc)
+{
+	struct iod_kv_snap	*ks = kc->kc_snap;
+	struct iod_kv_ent	*ent;
+	struct iod_kv_ev	*ev;
+	int			c;
+
+	for (;;) {
+		ent = iod_knode_select(ks->ks_root, kc->kc_rank);
+		ev = kc->kc_ev < ks->ks_nev ? &ks->ks_ev[kc->kc_ev] : NULL;
+		if (ev == NULL) {
+			kc->kc_rank += ent != NULL;
+			return ent;
+		}
+		c = ent == NULL ? 1 : strcmp(ent->ke_key,
+					     ev->ev_ent->ke_key);
+		if (c < 0) {
+			kc->kc_rank++;
+			return ent;
+		}
+		kc->kc_ev++;
+		if (c == 0)
+			kc->kc_rank++;
+		if (ev->ev_add)
+			return ev->ev_ent;
+	}
+}
+
+/* ------------------------------- set ------------------------------------ */
+
+/**
+ * Add the version of open \a tid to \a ent and record the key as changed by
+ * it. Caller holds io_lock for write.
+ */
+static int
+iod_kv_ver_set(struct iod_kv *kv, struct iod_kv_ent *ent, iod_trans_id_t tid,
+	       int deleted, uint64_t addr, iod_size_t len,
+	       const iod_checksum_t *cs)
+{
+	if (iod_kv_pend_add(kv, ent, tid) != 0) {
+		iod_kv_ent_put(kv, ent);
+		return -ENOMEM;
+	}
+	if (iod_kv_ver_add(ent, tid, deleted, addr, len, cs) == NULL) {
+		/* only a new version can fail, the key just recorded */
+		iod_kv_pend_find(kv, tid)->kp_nr--;
+		iod_kv_ent_put(kv, ent);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+/**
+ * Log the change of \a key by \a tid, value \a val included. Caller holds
+ * io_lock for write, so the records of a key are in version order.
+ */
+static int
+iod_kv_log(struct iod_obj *obj, int type, iod_trans_id_t tid,
+	   const char *key, const void *val, iod_size_t len, uint64_t addr,
+	   const iod_checksum_t *cs, uint64_t *group)
+{
+	struct iod_wal_rec	rec = { 0 };
+
+	rec.wr_type = type;
+	rec.wr_oid = obj->io_oid;
+	rec.wr_tid = tid;
+	rec.wr_addr = addr;
+	rec.wr_arg = strlen(key);
+	rec.wr_vcs = *cs;
+	return iod_wal_log(obj->io_cont->ic_wal, &rec, key, rec.wr_arg,
+			   val, len, group);
+}
+
+/** \a tid changed \a obj without a log record: it cannot be replayed whole */
+static void
+iod_kv_unlogged(struct iod_obj *obj, iod_trans_id_t tid)
+{
+	pthread_mutex_lock(&obj->io_cont->ic_lock);
+	iod_trans_dirty(obj->io_cont, tid, obj);
+	pthread_mutex_unlock(&obj->io_cont->ic_lock);
+}
+
+static int
+iod_kv_set_one(struct iod_objh *h, iod_trans_id_t tid, iod_kv_t *kv,
+	       iod_checksum_t *cs, uint64_t *group)
+{
+	struct iod_obj		*obj = h->oh_obj;
+	struct iod_kv_ent	*ent;
+	iod_checksum_t		sum;
+	uint64_t		addr;
+	int			unlogged = 0;
+	int			rc;
+
+	if (kv == NULL || kv->key == NULL ||
+	    strlen(kv->key) >= IOD_KV_KEY_MAXLEN ||
+	    kv->value_len > IOD_KV_VALUE_MAXLEN ||
+	    (kv->value_len > 0 && kv->value == NULL))
+		return -EINVAL;
+	if (cs != NULL) {
+		sum = *cs;
+	} else {
+		iod_cksum_init(&sum);
+		iod_cksum_update(&sum, kv->value, kv->value_len);
+	}
+
+	rc = iod_cache_admit(obj->io_cont, kv->value_len);
+	if (rc != 0)
+		return rc;
+	pthread_rwlock_wrlock(&obj->io_lock);
+	rc = iod_obj_log_begin(obj, kv->value_len, &addr);
+	pthread_rwlock_unlock(&obj->io_lock);
+	if (rc != 0)
+		return rc;
+	rc = iod_pwrite_full(obj->io_fd, kv->value, kv->value_len,
+			     iod_obj_log_pos(obj, addr));
+	iod_obj_log_end(obj);
+	if (rc != 0)
+		return rc;
+
+	rc = iod_obj_write_lock(obj, tid);
+	if (rc != 0)
+		return rc;
+	ent = iod_kv_ent_get(obj, kv->key);
+	if (ent == NULL)
+		rc = -ENOMEM;
+	else
+		rc = iod_kv_ver_set(obj->io_kv, ent, tid, 0, addr,
+				    kv->value_len, &sum);
+	if (rc == 0) {
+		rc = iod_kv_log(obj, IOD_WAL_KV_SET, tid, kv->key, kv->value,
+				kv->value_len, addr, &sum, group);
+		unlogged = rc != 0;
+	}
+	pthread_rwlock_unlock(&obj->io_lock);
+	if (unlogged)
+		iod_kv_unlogged(obj, tid);
+	return rc;
+}
+
+iod_ret_t
+iod_kv_set(iod_handle_t oh, iod_trans_id_t tid, iod_hint_list_t *hints,
+	   iod_kv_t *kv, iod_checksum_t *cs, iod_event_t *event)
+{
+	struct iod_objh		*h = iod_objh_lookup(oh);
+	const struct iod_policy	*pol;
+	struct iod_policy	buf;
+	uint64_t		group = 0;
+	int			rc;
+
+	if (h == NULL)
+		return iod_ev_return(event, IOD_EV_KV_SET, -EINVAL);
+	rc = iod_policy_resolve(&h->oh_pol, hints, &buf, &pol);
+	if (rc == 0)
+		rc = iod_obj_write_prep(h, IOD_OBJ_KV, tid, pol);
+	if (rc == 0)
+		rc = iod_kv_set_one(h, tid, kv, cs, &group);
+	/* the event completes with the sync of the group it was logged in */
+	return iod_wal_return(h->oh_obj->io_cont->ic_wal, group, event,
+			      IOD_EV_KV_SET, rc);
+}
+
+static int
+iod_kv_set_list_exec(iod_handle_t oh, iod_trans_id_t tid,
+		     iod_hint_list_t *hints, iod_size_t num,
+		     iod_kv_params_t *kvs)
+{
+	struct iod_objh		*h = iod_objh_lookup(oh);
+	const struct iod_policy	*pol;
+	struct iod_policy	buf;
+	iod_size_t		i;
+	uint64_t		group;
+	uint64_t		last = 0;
+	int			rc;
+	int			rc2;
+
+	if (h == NULL || (num > 0 && kvs == NULL))
+		return -EINVAL;
+	rc = iod_policy_resolve(&h->oh_pol, hints, &buf, &pol);
+	if (rc == 0)
+		rc = iod_obj_write_prep(h, IOD_OBJ_KV, tid, pol);
+	if (rc != 0)
+		return rc;
+	for (i = 0; i < num; i++) {
+		group = 0;
+		rc2 = iod_kv_set_one(h, tid, kvs[i].kv, kvs[i].cs, &group);
+		last = iod_max(last, group);
+		if (kvs[i].ret != NULL)
+			*kvs[i].ret = rc2;
+		if (rc == 0)
+			rc = rc2;
+	}
+	/* one sync covers the whole list */
+	rc2 = iod_wal_wait(h->oh_obj->io_cont->ic_wal, last);
+	return rc != 0 ? rc : rc2;
+}
+
+static int
+iod_kv_set_list_op(struct iod_op *op)
+{
+	return iod_kv_set_list_exec(op->op_u.kv.oh, op->op_tid,
+				    op->op_u.kv.hints, op->op_u.kv.num,
+				    op->op_u.kv.kvs);
+}
+
+iod_ret_t
+iod_kv_set_list(iod_handle_t oh, iod_trans_id_t tid, iod_hint_list_t *hints,
+		iod_size_t num, iod_kv_params_t *kvs, iod_event_t *event)
+{
+	struct iod_op	*op;
+
+	if (event == NULL)
+		return iod_kv_set_list_exec(oh, tid, hints, num, kvs);
+	op = iod_op_alloc(event, IOD_EV_KV_SET, iod_kv_set_list_op, tid);
+	if (op == NULL)
+		return -ENOMEM;
+	op->op_u.kv.oh = oh;
+	op->op_u.kv.hints = hints;
+	op->op_u.kv.num = num;
+	op->op_u.kv.kvs = kvs;
+	return iod_sched_submit(op);
+}
+
+iod_ret_t
+iod_kv_unlink_keys(iod_handle_t oh, iod_trans_id_t tid, iod_hint_list_t *hints,
+		   iod_size_t num, iod_kv_params_t *kvs, iod_event_t *event)
+{
+	struct iod_objh		*h = iod_objh_lookup(oh);
+	const struct iod_policy	*pol;
+	struct iod_policy	buf;
+	struct iod_kv_ent	*ent;
+	struct iod_obj		*obj;
+	iod_checksum_t		sum;
+	iod_size_t		i;
+	uint64_t		group = 0;
+	int			unlogged = 0;
+	int			rc;
+	int			rc2;
+
+	if (h == NULL || (num > 0 && kvs == NULL))
+		return iod_ev_return(event, IOD_EV_KV_UNLINK_KEY, -EINVAL);
+	rc = iod_policy_resolve(&h->oh_pol, hints, &buf, &pol);
+	if (rc == 0)
+		rc = iod_obj_write_prep(h, IOD_OBJ_KV, tid, pol);
+	if (rc != 0)
+		return iod_ev_return(event, IOD_EV_KV_UNLINK_KEY, rc);
+	obj = h->oh_obj;
+	iod_cksum_init(&sum);
+
+	rc = iod_obj_write_lock(obj, tid);
+	if (rc != 0)
+		return iod_ev_return(event, IOD_EV_KV_UNLINK_KEY, rc);
+	for (i = 0; i < num; i++) {
+		if (kvs[i].kv == NULL || kvs[i].kv->key == NULL) {
+			rc2 = -EINVAL;
+		} else {
+			ent = iod_kv_lookup(obj->io_kv, kvs[i].kv->key);
+			if (ent == NULL || iod_kv_ver_get(ent, tid) == NULL)
+				rc2 = -ENOENT;
+			else
+				rc2 = iod_kv_ver_set(obj->io_kv, ent, tid, 1, 0,
+						     0, &sum);
+			if (rc2 == 0) {
+				rc2 = iod_kv_log(obj, IOD_WAL_KV_UNLINK, tid,
+						 kvs[i].kv->key, NULL, 0, 0,
+						 &sum, &group);
+				unlogged |= rc2 != 0;
+			}
+		}
+		if (kvs[i].ret != NULL)
+			*kvs[i].ret = rc2;
+		if (rc == 0)
+			rc = rc2;
+	}
+	pthread_rwlock_unlock(&obj->io_lock);
+	if (unlogged)
+		iod_kv_unlogged(obj, tid);
+	return iod_wal_return(obj->io_cont->ic_wal, group, event,
+			      IOD_EV_KV_UNLINK_KEY, rc);
+}
+
+/** Redo a logged set or, if \a deleted, unlink of \a key by open \a tid. */
+int
+iod_kv_replay(struct iod_obj *obj, iod_trans_id_t tid, const char *key,
+	      int deleted, uint64_t addr, iod_size_t len,
+	      const iod_checksum_t *cs)
+{
+	struct iod_kv_ent	*ent;
+	int			rc;
+
+	pthread_rwlock_wrlock(&obj->io_lock);
+	ent = iod_kv_ent_get(obj, key);
+	if (ent == NULL)
+		rc = -ENOMEM;
+	else
+		rc = iod_kv_ver_set(obj->io_kv, ent, tid, deleted, addr, len,
+				    cs);
+	pthread_rwlock_unlock(&obj->io_lock);
+	return rc;
+}
+
+/* ------------------------------- get ------------------------------------ */
+
+iod_ret_t
+iod_kv_get_num(iod_handle_t oh, iod_trans_id_t tid, iod_size_t *num,
+	       iod_event_t *event)
+{
+	struct iod_objh		*h = iod_objh_lookup(oh);
+	struct iod_kv_snap	ks;
+	struct iod_obj		*obj;
+	int			rc;
+
+	if (h == NULL || num == NULL)
+		return iod_ev_return(event, IOD_EV_KV_GET_NUM, -EINVAL);
+	rc = iod_obj_read_prep(h, IOD_OBJ_KV, tid, &h->oh_pol);
+	if (rc != 0)
+		return iod_ev_return(event, IOD_EV_KV_GET_NUM, rc);
+	obj = h->oh_obj;
+
+	pthread_rwlock_rdlock(&obj->io_lock);
+	rc = iod_kv_snap_init(obj->io_kv, tid, &ks);
+	pthread_rwlock_unlock(&obj->io_lock);
+	if (rc == 0)
+		*num = ks.ks_num;
+	free(ks.ks_ev);
+	return iod_ev_return(event, IOD_EV_KV_GET_NUM, rc);
+}
+
+/**
+ * Copy the value of \a ver into \a buf of \a *len bytes; \a *len returns the
+ * value length. Caller holds io_lock.
+ */
+static int
+iod_kv_ver_read(struct iod_obj *obj, struct iod_kv_ver *ver, void *buf,
+		iod_size_t *len, iod_checksum_t *cs)
+{
+	iod_size_t	buf_len = *len;
+
+	*len = ver->kv_len;
+	if (cs != NULL)
+		*cs = ver->kv_cs;
+	if (buf == NULL || buf_len < ver->kv_len)
+		return -EOVERFLOW;
+	return iod_pread_full(obj->io_fd, buf, ver->kv_len,
+			      iod_obj_log_pos(obj, ver->kv_addr));
+}
+
+/**
+ * Fill \a kvs with the pairs from the \a offset-th visible key on, in key
+ * order. Returns the number of pairs filled.
+ */
+static int
+iod_kv_list(iod_handle_t oh, iod_trans_id_t tid, iod_hint_list_t *hints,
+	    iod_off_t offset, iod_size_t num, iod_kv_params_t *kvs, int values)
+{
+	struct iod_objh		*h = iod_objh_lookup(oh);
+	const struct iod_policy	*pol;
+	struct iod_policy	buf;
+	struct iod_kv_snap	ks;
+	struct iod_kv_cur	kc;
+	struct iod_kv_ver	*ver;
+	struct iod_kv_ent	*ent;
+	struct iod_obj		*obj;
+	iod_kv_t		*kv;
+	iod_size_t		n = 0;
+	int			rc;
+
+	if (h == NULL || (num > 0 && kvs == NULL))
+		return -EINVAL;
+	rc = iod_policy_resolve(&h->oh_pol, hints, &buf, &pol);
+	if (rc == 0)
+		rc = iod_obj_read_prep(h, IOD_OBJ_KV, tid, pol);
+	if (rc != 0)
+		return rc;
+	obj = h->oh_obj;
+
+	pthread_rwlock_rdlock(&obj->io_lock);
+	rc = iod_obj_log_open(obj);
+	if (rc == 0)
+		rc = iod_kv_snap_init(obj->io_kv, tid, &ks);
+	if (rc != 0) {
+		pthread_rwlock_unlock(&obj->io_lock);
+		return rc;
+	}
+	iod_kv_cur_seek(&ks, offset, &kc);
+	while (rc == 0 && n < num && (ent = iod_kv_cur_next(&kc)) != NULL) {
+		ver = iod_kv_ver_get(ent, tid);
+		kv = kvs[n].kv;
+		if (kv == NULL || kv->key == NULL) {
+			rc = -EINVAL;
+			break;
+		}
+		/* the caller owns the key and value buffers */
+		strcpy((char *)kv->key, ent->ke_key);
+		rc = 0;
+		if (values)
+			rc = iod_kv_ver_read(obj, ver, (void *)kv->value,
+					     &kv->value_len, kvs[n].cs);
+		if (kvs[n].ret != NULL)
+			*kvs[n].ret = rc;
+		rc = rc == -EOVERFLOW ? 0 : rc;
+		n++;
+	}
+	pthread_rwlock_unlock(&obj->io_lock);
+	free(ks.ks_ev);
+	return rc != 0 ? rc : (int)n;
+}
+
+iod_ret_t
+iod_kv_get_list(iod_handle_t oh, iod_trans_id_t tid, iod_hint_list_t *hints,
+		iod_off_t offset, iod_size_t num, iod_kv_params_t *kvs,
+		iod_event_t *event)
+{
+	return iod_ev_return(event, IOD_EV_KV_GET,
+			     iod_kv_list(oh, tid, hints, offset, num, kvs, 1));
+}
+
+iod_ret_t
+iod_kv_list_key(iod_handle_t oh, iod_trans_id_t tid, iod_hint_list_t *hints,
+		iod_off_t offset, iod_size_t num, iod_kv_params_t *kvs,
+		iod_event_t *event)
+{
+	return iod_ev_return(event, IOD_EV_KV_LIST_KEY,
+			     iod_kv_list(oh, tid, hints, offset, num, kvs, 0));
+}
+
+iod_ret_t
+iod_kv_get_value(iod_handle_t oh, iod_trans_id_t tid, const char *key,
+		 char *value, iod_size_t *len, iod_checksum_t *cs,
+		 iod_event_t *event)
+{
+	struct iod_objh		*h = iod_objh_lookup(oh);
+	struct iod_kv_ver	*ver = NULL;
+	struct iod_kv_ent	*ent;
+	struct iod_obj		*obj;
+	int			rc;
+
+	if (h == NULL || key == NULL || len == NULL)
+		return iod_ev_return(event, IOD_EV_KV_GET_VALUE, -EINVAL);
+	rc = iod_obj_read_prep(h, IOD_OBJ_KV, tid, &h->oh_pol);
+	if (rc != 0)
+		return iod_ev_return(event, IOD_EV_KV_GET_VALUE, rc);
+	obj = h->oh_obj;
+
+	pthread_rwlock_rdlock(&obj->io_lock);
+	ent = iod_kv_lookup(obj->io_kv, key);
+	if (ent != NULL)
+		ver = iod_kv_ver_get(ent, tid);
+	rc = iod_obj_log_open(obj);
+	if (rc == 0)
+		rc = ver == NULL ? -ENOENT :
+				   iod_kv_ver_read(obj, ver, value, len, cs);
+	pthread_rwlock_unlock(&obj->io_lock);
+	return iod_ev_return(event, IOD_EV_KV_GET_VALUE, rc);
+}
+
+/* ---------------------------- checkpoint -------------------------------- */
+
+/**
+ * Checkpoint record of a KV object: the key count, then per key its length,
+ * the key and its committed versions.
+ */
+int
+iod_kv_save(struct iod_obj *obj, FILE *fp)
+{
+	struct iod_kv		*kv = obj->io_kv;
+	struct iod_kv_ver	*ver;
+	struct iod_kv_ent	*ent = NULL;
+	uint64_t		nr = kv != NULL ? kv->kv_nr : 0;
+	uint64_t		nver;
+	uint32_t		klen;
+	unsigned long		i = 0;
+
+	if (fwrite(&nr, sizeof(nr), 1, fp) != 1)
+		return -EIO;
+	for (; nr > 0; nr--) {
+		/* next key of the hash table, in no particular order */
+		ent = ent != NULL ? ent->ke_next : NULL;
+		while (ent == NULL)
+			ent = kv->kv_hash[i++];
+		klen = strlen(ent->ke_key);
+		nver = 0;
+		for (ver = ent->ke_vers; ver != NULL; ver = ver->kv_next)
+			nver += ver->kv_committed;
+		if (fwrite(&klen, sizeof(klen), 1, fp) != 1 ||
+		    fwrite(ent->ke_key, 1, klen, fp) != klen ||
+		    fwrite(&nver, sizeof(nver), 1, fp) != 1)
+			return -EIO;
+		for (ver = ent->ke_vers; ver != NULL; ver = ver->kv_next) {
+			if (!ver->kv_committed)
+				continue;
+			if (fwrite(&ver->kv_tid, sizeof(ver->kv_tid), 1,
+				   fp) != 1 ||
+			    fwrite(&ver->kv_deleted, sizeof(ver->kv_deleted),
+				   1, fp) != 1 ||
+			    fwrite(&ver->kv_addr, sizeof(ver->kv_addr), 1,
+				   fp) != 1 ||
+			    fwrite(&ver->kv_len, sizeof(ver->kv_len), 1,
+				   fp) != 1 ||
+			    fwrite(&ver->kv_cs, sizeof(ver->kv_cs), 1, fp) != 1)
+				return -EIO;
+		}
+	}
+	return 0;
+}
+
+int
+iod_kv_load(struct iod_obj *obj, FILE *fp)
+{
+	struct iod_kv_ver	ver;
+	struct iod_kv_ver	*v;
+	struct iod_kv_ent	*ent;
+	char			key[IOD_KV_KEY_MAXLEN];
+	uint64_t		nr;
+	uint64_t		nver;
+	uint32_t		klen;
+
+	if (fread(&nr, sizeof(nr), 1, fp) != 1)
+		return -EIO;
+	if (nr == 0)
+		return 0;
+	for (; nr > 0; nr--) {
+		if (fread(&klen, sizeof(klen), 1, fp) != 1 ||
+		    klen >= IOD_KV_KEY_MAXLEN ||
+		    fread(key, 1, klen, fp) != klen ||
+		    fread(&nver, sizeof(nver), 1, fp) != 1)
+			return -EIO;
+		key[klen] = '\0';
+		ent = iod_kv_ent_get(obj, key);
+		if (ent == NULL)
+			return -ENOMEM;
+		for (; nver > 0; nver--) {
+			if (fread(&ver.kv_tid, sizeof(ver.kv_tid), 1,
+				  fp) != 1 ||
+			    fread(&ver.kv_deleted, sizeof(ver.kv_deleted), 1,
+				  fp) != 1 ||
+			    fread(&ver.kv_addr, sizeof(ver.kv_addr), 1,
+				  fp) != 1 ||
+			    fread(&ver.kv_len, sizeof(ver.kv_len), 1,
+				  fp) != 1 ||
+			    fread(&ver.kv_cs, sizeof(ver.kv_cs), 1, fp) != 1)
+				return -EIO;
+			v = iod_kv_ver_add(ent, ver.kv_tid, ver.kv_deleted,
+					   ver.kv_addr, ver.kv_len, &ver.kv_cs);
+			if (v == NULL) {
+				iod_kv_ent_put(obj->io_kv, ent);
+				return -ENOMEM;
+			}
+			v->kv_committed = 1;
+		}
+		iod_kv_ent_put(obj->io_kv, ent);
+	}
+	return iod_kv_rebuild(obj->io_kv);
+}
+
+/**
+ * Write the pairs visible at \a tid to the central shard \a path as a flat
+ * sequence of (key length, key, value length, value) records. Caller holds
+ * io_lock.
+ */
+int
+iod_kv_persist(struct iod_obj *obj, iod_trans_id_t tid, const char *path)
+{
+	struct iod_kv_snap	ks;
+	struct iod_kv_cur	kc;
+	struct iod_kv_ver	*ver;
+	struct iod_kv_ent	*ent;
+	char			tmp[PATH_MAX];
+	char			*buf;
+	uint32_t		klen;
+	FILE			*fp;
+	int			rc;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+		return -ENAMETOOLONG;
+	buf = malloc(IOD_KV_VALUE_MAXLEN);
+	if (buf == NULL)
+		return -ENOMEM;
+	rc = iod_kv_snap_init(obj->io_kv, tid, &ks);
+	if (rc != 0) {
+		free(buf);
+		return rc;
+	}
+	fp = fopen(tmp, "w");
+	if (fp == NULL) {
+		free(ks.ks_ev);
+		free(buf);
+		return -errno;
+	}
+	if (ks.ks_num > 0)
+		rc = iod_obj_log_open(obj);
+	iod_kv_cur_seek(&ks, 0, &kc);
+	while (rc == 0 && (ent = iod_kv_cur_next(&kc)) != NULL) {
+		ver = iod_kv_ver_get(ent, tid);
+		rc = iod_pread_full(obj->io_fd, buf, ver->kv_len,
+				    iod_obj_log_pos(obj, ver->kv_addr));
+		if (rc != 0)
+			break;
+		klen = strlen(ent->ke_key);
+		if (fwrite(&klen, sizeof(klen), 1, fp) != 1 ||
+		    fwrite(ent->ke_key, 1, klen, fp) != klen ||
+		    fwrite(&ver->kv_len, sizeof(ver->kv_len), 1, fp) != 1 ||
+		    fwrite(buf, 1, ver->kv_len, fp) != ver->kv_len)
+			rc = -EIO;
+	}
+	if (fclose(fp) != 0 && rc == 0)
+		rc = -EIO;
+	free(ks.ks_ev);
+	free(buf);
+	if (rc == 0 && rename(tmp, path) != 0)
+		rc = -errno;
+	if (rc != 0)
+		unlink(tmp);
+	return rc;
+}
@@ -0,0 +1,75 @@
+/*
+ * Minimal intrusive doubly-linked list used inside the IOD engine.
+ */
+
+#ifndef _IOD_LIST_H_
+#define _IOD_LIST_H_
+
+#include <stddef.h>
+
+struct iod_list {
+	struct iod_list	*next;
+	struct iod_list	*prev;
+};
+
+#define IOD_LIST_HEAD_INIT(name)	{ &(name), &(name) }
+
+#define iod_container_of(ptr, type, member)				\
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define iod_list_entry(ptr, type, member)				\
+	iod_container_of(ptr, type, member)
+
+#define iod_list_for_each(pos, head)					\
+	for (pos = (head)->next; pos != (head); pos = pos->next)
+
+#define iod_list_for_each_safe(pos, n, head)				\
+	for (pos = (head)->next, n = pos->next; pos != (head);		\
+	     pos = n, n = pos->next)
+
+static inline void
+iod_list_init(struct iod_list *head)
+{
+	head->next = head;
+	head->prev = head;
+}
+
+static inline int
+iod_list_empty(const struct iod_list *head)
+{
+	return head->next == head;
+}
+
+static inline void
+__iod_list_add(struct iod_list *item, struct iod_list *prev,
+	       struct iod_list *next)
+{
+	next->prev = item;
+	item->next = next;
+	item->prev = prev;
+	prev->next = item;
+}
+
+/** add \a item right after \a head */
+static inline void
+iod_list_add(struct iod_list *item, struct iod_list *head)
+{
+	__iod_list_add(item, head, head->next);
+}
+
+/** add \a item right before \a head, i.e. at the tail of the list */
+static inline void
+iod_list_add_tail(struct iod_list *item, struct iod_list *head)
+{
+	__iod_list_add(item, head->prev, head);
+}
+
+static inline void
+iod_list_del_init(struct iod_list *item)
+{
+	item->prev->next = item->next;
+	item->next->prev = item->prev;
+	iod_list_init(item);
+}
+
+#endif /* _IOD_LIST_H_ */
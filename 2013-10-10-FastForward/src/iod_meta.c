@@ -0,0 +1,672 @@
+/*
+ * Catalog checkpoint of a container.
+ *
+ * The last close of a container writes everything that is committed --
+ * objects, their layers, versioned attributes and KV versions, and the
+ * readable TIDs -- to <bb_dir>/meta, so that the next open finds the
+ * container as it was. Versions of TIDs that were still in flight are not
+ * saved and read as aborted after the reopen.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <unistd.h>
+
+#include "iod_internal.h"
+
+#define IOD_META_MAGIC		0x494f444d45544137ULL	/* "IODMETA7" */
+
+struct iod_meta_hdr {
+	uint64_t		mh_magic;
+	uint64_t		mh_nobjs;
+	uint64_t		mh_ntrans;
+	uint64_t		mh_next_oid;
+	iod_container_tids_t	mh_tids;
+	iod_trans_id_t		mh_persisted;
+};
+
+static int
+iod_put(FILE *fp, const void *buf, size_t len)
+{
+	return len == 0 || fwrite(buf, len, 1, fp) == 1 ? 0 : -EIO;
+}
+
+static int
+iod_get(FILE *fp, void *buf, size_t len)
+{
+	return len == 0 || fread(buf, len, 1, fp) == 1 ? 0 : -EIO;
+}
+
+static int
+iod_meta_path(const char *bb_dir, const char *name, char *buf)
+{
+	if (snprintf(buf, PATH_MAX, "%s/%s", bb_dir, name) >= PATH_MAX)
+		return -ENAMETOOLONG;
+	return 0;
+}
+
+/** objects whose creation is committed; unlinked ones stay for older TIDs */
+static int
+iod_meta_keep(struct iod_obj *obj)
+{
+	return obj->io_create_tid != IOD_TID_UNKNOWN &&
+	       obj->io_create_committed;
+}
+
+/* -------------------------------- save ---------------------------------- */
+
+static int
+iod_vattr_save(struct iod_vattr *head, FILE *fp)
+{
+	struct iod_vattr	*va;
+	uint64_t		nr = 0;
+	int			rc = 0;
+
+	for (va = head; va != NULL; va = va->va_next)
+		nr += va->va_committed;
+	rc = iod_put(fp, &nr, sizeof(nr));
+	for (va = head; va != NULL && rc == 0; va = va->va_next) {
+		if (!va->va_committed)
+			continue;
+		rc = iod_put(fp, &va->va_tid, sizeof(va->va_tid));
+		if (rc == 0)
+			rc = iod_put(fp, &va->va_cs, sizeof(va->va_cs));
+		if (rc == 0)
+			rc = iod_put(fp, &va->va_len, sizeof(va->va_len));
+		if (rc == 0)
+			rc = iod_put(fp, va->va_data, va->va_len);
+	}
+	return rc;
+}
+
+static int
+iod_layers_save(struct iod_obj *obj, FILE *fp)
+{
+	struct iod_layer	*layer;
+	struct iod_list		*pos;
+	uint64_t		nr = 0;
+	uint64_t		n;
+	int			rc;
+
+	iod_list_for_each(pos, &obj->io_layers) {
+		layer = iod_list_entry(pos, struct iod_layer, il_link);
+		nr += layer->il_committed;
+	}
+	rc = iod_put(fp, &nr, sizeof(nr));
+	iod_list_for_each(pos, &obj->io_layers) {
+		if (rc != 0)
+			break;
+		layer = iod_list_entry(pos, struct iod_layer, il_link);
+		if (!layer->il_committed)
+			continue;
+		n = layer->il_nr;
+		rc = iod_put(fp, &layer->il_tid, sizeof(layer->il_tid));
+		if (rc == 0)
+			rc = iod_put(fp, &n, sizeof(n));
+		if (rc == 0)
+			rc = iod_put(fp, layer->il_ext,
+				     n * sizeof(*layer->il_ext));
+	}
+	return rc;
+}
+
+/** the checksum records of the data log */
+static int
+iod_cks_save(struct iod_obj *obj, FILE *fp)
+{
+	uint64_t	nr = obj->io_ncks;
+	int		rc;
+
+	rc = iod_put(fp, &nr, sizeof(nr));
+	if (rc == 0)
+		rc = iod_put(fp, obj->io_cks, nr * sizeof(*obj->io_cks));
+	return rc;
+}
+
+/** the committed TIDs that modified the object, for diffs */
+static int
+iod_mods_save(struct iod_obj *obj, FILE *fp)
+{
+	uint64_t	nr = obj->io_mods != NULL ? obj->io_mods->cm_nr : 0;
+	int		rc;
+
+	rc = iod_put(fp, &nr, sizeof(nr));
+	if (rc == 0 && nr > 0)
+		rc = iod_put(fp, obj->io_mods->cm_tid,
+			     nr * sizeof(obj->io_mods->cm_tid[0]));
+	return rc;
+}
+
+/** the chunk index as the chunk number of every slot, in slot order */
+static int
+iod_chunks_save(struct iod_obj *obj, FILE *fp)
+{
+	struct iod_chunk_index	*ci = &obj->io_chunks;
+	int			rc;
+
+	rc = iod_put(fp, &ci->ci_nslots, sizeof(ci->ci_nslots));
+	if (rc == 0)
+		rc = iod_put(fp, ci->ci_chunk,
+			     ci->ci_nslots * sizeof(*ci->ci_chunk));
+	return rc;
+}
+
+static int
+iod_obj_save(struct iod_obj *obj, FILE *fp)
+{
+	iod_trans_id_t	unlink_tid;
+	uint32_t	nlen;
+	uint32_t	nd = obj->io_ndims;
+	int32_t		type = obj->io_type;
+	int32_t		chunked = obj->io_chunked;
+	int32_t		loc = obj->io_layout.loc;
+	int32_t		placement = obj->io_layout.placement;
+	uint32_t	nw;
+	uint32_t	seg;
+	int		rc;
+
+	seg = obj->io_seg != NULL ? obj->io_seg->ps_id : IOD_PACK_NONE;
+	nw = obj->io_layout.target_weights != NULL ?
+	     obj->io_layout.target_num : 0;
+	unlink_tid = obj->io_unlink_committed ? obj->io_unlink_tid :
+						IOD_TID_UNKNOWN;
+	nlen = obj->io_name != NULL ? strlen(obj->io_name) : 0;
+	rc = iod_put(fp, &obj->io_oid, sizeof(obj->io_oid));
+	if (rc == 0)
+		rc = iod_put(fp, &type, sizeof(type));
+	if (rc == 0)
+		rc = iod_put(fp, &obj->io_create_tid,
+			     sizeof(obj->io_create_tid));
+	if (rc == 0)
+		rc = iod_put(fp, &unlink_tid, sizeof(unlink_tid));
+	if (rc == 0)
+		rc = iod_put(fp, &nlen, sizeof(nlen));
+	if (rc == 0)
+		rc = iod_put(fp, obj->io_name, nlen);
+	if (rc == 0)
+		rc = iod_put(fp, &obj->io_tail, sizeof(obj->io_tail));
+	if (rc == 0)
+		rc = iod_put(fp, &seg, sizeof(seg));
+	if (rc == 0)
+		rc = iod_put(fp, &obj->io_base, sizeof(obj->io_base));
+	if (rc == 0)
+		rc = iod_put(fp, &obj->io_cap, sizeof(obj->io_cap));
+	if (rc == 0)
+		rc = iod_put(fp, &obj->io_size, sizeof(obj->io_size));
+	if (rc == 0)
+		rc = iod_put(fp, &obj->io_purged, sizeof(obj->io_purged));
+	if (rc == 0)
+		rc = iod_put(fp, &obj->io_bb_bytes, sizeof(obj->io_bb_bytes));
+
+	if (rc == 0)
+		rc = iod_put(fp, &obj->io_cell_size,
+			     sizeof(obj->io_cell_size));
+	if (rc == 0)
+		rc = iod_put(fp, &nd, sizeof(nd));
+	if (rc == 0)
+		rc = iod_put(fp, obj->io_dims, nd * sizeof(obj->io_dims[0]));
+	if (rc == 0)
+		rc = iod_put(fp, obj->io_chunk, nd * sizeof(obj->io_chunk[0]));
+	if (rc == 0)
+		rc = iod_put(fp, &chunked, sizeof(chunked));
+	if (rc == 0)
+		rc = iod_put(fp, &obj->io_dim0_max, sizeof(obj->io_dim0_max));
+	if (rc == 0)
+		rc = iod_put(fp, obj->io_seq, nd * sizeof(obj->io_seq[0]));
+	if (rc == 0)
+		rc = iod_put(fp, &loc, sizeof(loc));
+	if (rc == 0)
+		rc = iod_put(fp, &obj->io_layout.target_num,
+			     sizeof(obj->io_layout.target_num));
+	if (rc == 0)
+		rc = iod_put(fp, &obj->io_layout.stripe_size,
+			     sizeof(obj->io_layout.stripe_size));
+	if (rc == 0)
+		rc = iod_put(fp, &placement, sizeof(placement));
+	if (rc == 0)
+		rc = iod_put(fp, &nw, sizeof(nw));
+	if (rc == 0 && nw > 0)
+		rc = iod_put(fp, obj->io_layout.target_weights,
+			     nw * sizeof(uint32_t));
+
+	if (rc == 0)
+		rc = iod_vattr_save(obj->io_dim0, fp);
+	if (rc == 0)
+		rc = iod_vattr_save(obj->io_scratch, fp);
+	if (rc == 0)
+		rc = iod_layers_save(obj, fp);
+	if (rc == 0)
+		rc = iod_cks_save(obj, fp);
+	if (rc == 0)
+		rc = iod_mods_save(obj, fp);
+	if (rc == 0 && obj->io_chunked)
+		rc = iod_chunks_save(obj, fp);
+	if (rc == 0 && obj->io_type == IOD_OBJ_KV)
+		rc = iod_kv_save(obj, fp);
+	return rc;
+}
+
+static int
+iod_trans_save(struct iod_trans *trans, FILE *fp)
+{
+	int32_t		status = trans->it_status;
+	uint64_t	nr = 0;
+	unsigned long	i;
+	int		rc;
+
+	for (i = 0; i < trans->it_ndirty; i++)
+		nr += iod_meta_keep(trans->it_dirty[i]);
+	rc = iod_put(fp, &trans->it_tid, sizeof(trans->it_tid));
+	if (rc == 0)
+		rc = iod_put(fp, &status, sizeof(status));
+	/* objects still to be migrated by a later persist */
+	if (rc == 0)
+		rc = iod_put(fp, &nr, sizeof(nr));
+	for (i = 0; i < trans->it_ndirty && rc == 0; i++) {
+		if (iod_meta_keep(trans->it_dirty[i]))
+			rc = iod_put(fp, &trans->it_dirty[i]->io_oid,
+				     sizeof(iod_obj_id_t));
+	}
+	return rc;
+}
+
+static int
+iod_trans_readable(struct iod_trans *trans)
+{
+	return trans->it_status == IOD_TRANS_READABLE ||
+	       trans->it_status == IOD_TRANS_DURABLE;
+}
+
+/** Called on the last close, nobody else references \a cont. */
+int
+iod_meta_save(struct iod_cont *cont)
+{
+	struct iod_meta_hdr	hdr = { 0 };
+	struct iod_obj		*obj;
+	char			path[PATH_MAX];
+	char			tmp[PATH_MAX];
+	unsigned long		i;
+	FILE			*fp;
+	int			rc;
+
+	rc = iod_meta_path(cont->ic_bb_dir, "meta", path);
+	if (rc == 0)
+		rc = iod_meta_path(cont->ic_bb_dir, "meta.tmp", tmp);
+	if (rc != 0)
+		return rc;
+
+	hdr.mh_magic = IOD_META_MAGIC;
+	for (i = 0; i < cont->ic_hash_size; i++) {
+		for (obj = cont->ic_hash[i]; obj != NULL; obj = obj->io_hnext)
+			hdr.mh_nobjs += iod_meta_keep(obj);
+	}
+	for (i = 0; i < cont->ic_ntrans; i++)
+		hdr.mh_ntrans += iod_trans_readable(cont->ic_trans[i]);
+	hdr.mh_next_oid = cont->ic_next_oid;
+	hdr.mh_tids = cont->ic_tids;
+	hdr.mh_persisted = cont->ic_persisted;
+
+	fp = fopen(tmp, "w");
+	if (fp == NULL)
+		return -errno;
+	rc = iod_put(fp, &hdr, sizeof(hdr));
+	for (i = 0; i < cont->ic_hash_size && rc == 0; i++) {
+		for (obj = cont->ic_hash[i]; obj != NULL && rc == 0;
+		     obj = obj->io_hnext) {
+			if (iod_meta_keep(obj))
+				rc = iod_obj_save(obj, fp);
+		}
+	}
+	for (i = 0; i < cont->ic_ntrans && rc == 0; i++) {
+		if (iod_trans_readable(cont->ic_trans[i]))
+			rc = iod_trans_save(cont->ic_trans[i], fp);
+	}
+	if (fflush(fp) != 0 || fsync(fileno(fp)) != 0)
+		rc = rc != 0 ? rc : -errno;
+	if (fclose(fp) != 0 && rc == 0)
+		rc = -EIO;
+	if (rc == 0 && rename(tmp, path) != 0)
+		rc = -errno;
+	if (rc != 0)
+		unlink(tmp);
+	return rc;
+}
+
+/* -------------------------------- load ---------------------------------- */
+
+static int
+iod_vattr_load(struct iod_vattr **head, FILE *fp)
+{
+	iod_trans_id_t	tid;
+	iod_checksum_t	cs;
+	iod_size_t	len;
+	uint64_t	nr;
+	char		data[IOD_SCRATCH_LEN];
+	int		rc;
+
+	rc = iod_get(fp, &nr, sizeof(nr));
+	for (; nr > 0 && rc == 0; nr--) {
+		rc = iod_get(fp, &tid, sizeof(tid));
+		if (rc == 0)
+			rc = iod_get(fp, &cs, sizeof(cs));
+		if (rc == 0)
+			rc = iod_get(fp, &len, sizeof(len));
+		if (rc == 0 && len > sizeof(data))
+			rc = -EIO;
+		if (rc == 0)
+			rc = iod_get(fp, data, len);
+		if (rc == 0)
+			rc = iod_vattr_set(head, tid, data, len, &cs);
+		if (rc == 0)
+			iod_vattr_commit(*head, tid);
+	}
+	return rc;
+}
+
+static int
+iod_layers_load(struct iod_obj *obj, FILE *fp)
+{
+	struct iod_layer	*layer;
+	struct iod_extent	ext;
+	iod_trans_id_t		tid;
+	uint64_t		nr;
+	uint64_t		n;
+	int			rc;
+
+	rc = iod_get(fp, &nr, sizeof(nr));
+	for (; nr > 0 && rc == 0; nr--) {
+		rc = iod_get(fp, &tid, sizeof(tid));
+		if (rc == 0)
+			rc = iod_get(fp, &n, sizeof(n));
+		if (rc != 0)
+			break;
+		layer = iod_layer_get(obj, tid);
+		if (layer == NULL)
+			return -ENOMEM;
+		layer->il_committed = 1;
+		for (; n > 0 && rc == 0; n--) {
+			rc = iod_get(fp, &ext, sizeof(ext));
+			if (rc == 0)
+				rc = iod_layer_insert(layer, ext.ie_off,
+						      ext.ie_len, ext.ie_addr);
+		}
+	}
+	return rc != 0 ? rc : iod_extent_rebuild(obj);
+}
+
+static int
+iod_cks_load(struct iod_obj *obj, FILE *fp)
+{
+	uint64_t	nr;
+	int		rc;
+
+	rc = iod_get(fp, &nr, sizeof(nr));
+	if (rc != 0 || nr == 0)
+		return rc;
+	if (nr > SIZE_MAX / sizeof(*obj->io_cks))
+		return -EIO;
+	obj->io_cks = malloc(nr * sizeof(*obj->io_cks));
+	if (obj->io_cks == NULL)
+		return -ENOMEM;
+	obj->io_ncks = nr;
+	obj->io_maxcks = nr;
+	return iod_get(fp, obj->io_cks, nr * sizeof(*obj->io_cks));
+}
+
+static int
+iod_mods_load(struct iod_obj *obj, FILE *fp)
+{
+	struct iod_cat_mods	*cm;
+	uint64_t		nr;
+	int			rc;
+
+	rc = iod_get(fp, &nr, sizeof(nr));
+	if (rc != 0 || nr == 0)
+		return rc;
+	if (nr > (SIZE_MAX - sizeof(*cm)) / sizeof(cm->cm_tid[0]))
+		return -EIO;
+	cm = malloc(sizeof(*cm) + nr * sizeof(cm->cm_tid[0]));
+	if (cm == NULL)
+		return -ENOMEM;
+	cm->cm_next = NULL;
+	cm->cm_nr = nr;
+	cm->cm_max = nr;
+	obj->io_mods = cm;
+	return iod_get(fp, cm->cm_tid, nr * sizeof(cm->cm_tid[0]));
+}
+
+static int
+iod_chunks_load(struct iod_obj *obj, FILE *fp)
+{
+	uint64_t	chunk;
+	uint64_t	slot;
+	uint64_t	nr;
+	uint64_t	i;
+	int		rc;
+
+	rc = iod_get(fp, &nr, sizeof(nr));
+	for (i = 0; i < nr && rc == 0; i++) {
+		rc = iod_get(fp, &chunk, sizeof(chunk));
+		if (rc == 0)
+			rc = iod_chunk_slot(obj, chunk, &slot);
+		if (rc == 0 && slot != i)
+			rc = -EIO;
+	}
+	return rc;
+}
+
+static int
+iod_obj_load(struct iod_cont *cont, FILE *fp)
+{
+	struct iod_obj	*obj;
+	iod_obj_id_t	oid;
+	uint32_t	nlen;
+	uint32_t	nd;
+	int32_t		type;
+	int32_t		chunked;
+	int32_t		loc;
+	int32_t		placement;
+	uint32_t	nw;
+	uint32_t	seg;
+	uint64_t	base;
+	uint64_t	cap;
+	int		rc;
+
+	rc = iod_get(fp, &oid, sizeof(oid));
+	if (rc == 0)
+		rc = iod_get(fp, &type, sizeof(type));
+	if (rc != 0)
+		return rc;
+	obj = iod_obj_alloc(cont, oid, type);
+	if (obj == NULL)
+		return -ENOMEM;
+	obj->io_create_committed = 1;
+	rc = iod_get(fp, &obj->io_create_tid, sizeof(obj->io_create_tid));
+	if (rc == 0)
+		rc = iod_get(fp, &obj->io_unlink_tid,
+			     sizeof(obj->io_unlink_tid));
+	obj->io_unlink_committed = obj->io_unlink_tid != IOD_TID_UNKNOWN;
+	if (rc == 0)
+		rc = iod_get(fp, &nlen, sizeof(nlen));
+	if (rc == 0 && nlen >= IOD_OBJ_NAME_MAXLEN)
+		rc = -EIO;
+	if (rc == 0 && nlen > 0) {
+		obj->io_name = calloc(1, nlen + 1);
+		rc = obj->io_name == NULL ? -ENOMEM :
+					    iod_get(fp, obj->io_name, nlen);
+	}
+	if (rc == 0)
+		rc = iod_get(fp, &obj->io_tail, sizeof(obj->io_tail));
+	if (rc == 0)
+		rc = iod_get(fp, &seg, sizeof(seg));
+	if (rc == 0)
+		rc = iod_get(fp, &base, sizeof(base));
+	if (rc == 0)
+		rc = iod_get(fp, &cap, sizeof(cap));
+	if (rc == 0)
+		rc = iod_pack_attach(obj, seg, base, cap);
+	if (rc == 0)
+		rc = iod_get(fp, &obj->io_size, sizeof(obj->io_size));
+	if (rc == 0)
+		rc = iod_get(fp, &obj->io_purged, sizeof(obj->io_purged));
+	if (rc == 0)
+		rc = iod_get(fp, &obj->io_bb_bytes, sizeof(obj->io_bb_bytes));
+	if (rc == 0)
+		obj->io_cont->ic_bb_used += obj->io_bb_bytes;
+
+	if (rc == 0)
+		rc = iod_get(fp, &obj->io_cell_size,
+			     sizeof(obj->io_cell_size));
+	if (rc == 0)
+		rc = iod_get(fp, &nd, sizeof(nd));
+	if (rc == 0 && nd > IOD_MAX_DIMS)
+		rc = -EIO;
+	obj->io_ndims = nd;
+	if (rc == 0)
+		rc = iod_get(fp, obj->io_dims, nd * sizeof(obj->io_dims[0]));
+	if (rc == 0)
+		rc = iod_get(fp, obj->io_chunk, nd * sizeof(obj->io_chunk[0]));
+	if (rc == 0)
+		rc = iod_get(fp, &chunked, sizeof(chunked));
+	obj->io_chunked = chunked;
+	if (rc == 0)
+		rc = iod_get(fp, &obj->io_dim0_max, sizeof(obj->io_dim0_max));
+	if (rc == 0)
+		rc = iod_get(fp, obj->io_seq, nd * sizeof(obj->io_seq[0]));
+	if (rc == 0)
+		rc = iod_get(fp, &loc, sizeof(loc));
+	obj->io_layout.loc = loc;
+	if (rc == 0)
+		rc = iod_get(fp, &obj->io_layout.target_num,
+			     sizeof(obj->io_layout.target_num));
+	if (rc == 0)
+		rc = iod_get(fp, &obj->io_layout.stripe_size,
+			     sizeof(obj->io_layout.stripe_size));
+	if (rc == 0)
+		rc = iod_get(fp, &placement, sizeof(placement));
+	obj->io_layout.placement = placement;
+	if (rc == 0)
+		rc = iod_get(fp, &nw, sizeof(nw));
+	if (rc == 0 && nw > 0 && nw != obj->io_layout.target_num)
+		rc = -EIO;
+	if (rc == 0 && nw > 0) {
+		obj->io_layout.target_weights = malloc(nw * sizeof(uint32_t));
+		rc = obj->io_layout.target_weights == NULL ? -ENOMEM :
+		     iod_get(fp, obj->io_layout.target_weights,
+			     nw * sizeof(uint32_t));
+	}
+
+	if (rc == 0)
+		rc = iod_vattr_load(&obj->io_dim0, fp);
+	if (rc == 0)
+		iod_array_next_init(obj);
+	if (rc == 0)
+		rc = iod_vattr_load(&obj->io_scratch, fp);
+	if (rc == 0)
+		rc = iod_layers_load(obj, fp);
+	if (rc == 0)
+		rc = iod_cks_load(obj, fp);
+	if (rc == 0)
+		rc = iod_mods_load(obj, fp);
+	if (rc == 0 && obj->io_chunked)
+		rc = iod_chunks_load(obj, fp);
+	if (rc == 0 && obj->io_type == IOD_OBJ_KV)
+		rc = iod_kv_load(obj, fp);
+	if (rc == 0)
+		rc = iod_obj_insert(cont, obj);
+	if (rc != 0)
+		iod_obj_free(obj);
+	return rc;
+}
+
+static int
+iod_trans_load(struct iod_cont *cont, FILE *fp)
+{
+	struct iod_trans	*trans;
+	struct iod_obj		*obj;
+	iod_trans_id_t		tid;
+	iod_obj_id_t		oid;
+	int32_t			status;
+	uint64_t		nr;
+	int			rc;
+
+	rc = iod_get(fp, &tid, sizeof(tid));
+	if (rc == 0)
+		rc = iod_get(fp, &status, sizeof(status));
+	if (rc == 0)
+		rc = iod_get(fp, &nr, sizeof(nr));
+	if (rc == 0)
+		rc = iod_trans_restore(cont, tid, status);
+	if (rc != 0)
+		return rc;
+	trans = iod_trans_find(cont, tid);
+	trans->it_dirty = calloc(nr + 1, sizeof(*trans->it_dirty));
+	if (trans->it_dirty == NULL)
+		return -ENOMEM;
+	trans->it_dirty_max = nr + 1;
+	for (; nr > 0 && rc == 0; nr--) {
+		rc = iod_get(fp, &oid, sizeof(oid));
+		obj = rc == 0 ? iod_obj_find(cont, oid) : NULL;
+		if (obj != NULL)
+			trans->it_dirty[trans->it_ndirty++] = obj;
+	}
+	return rc;
+}
+
+/** Load the checkpoint of a container that is being opened. */
+int
+iod_meta_load(struct iod_cont *cont)
+{
+	struct iod_meta_hdr	hdr;
+	char			path[PATH_MAX];
+	uint64_t		i;
+	FILE			*fp;
+	int			rc;
+
+	rc = iod_meta_path(cont->ic_bb_dir, "meta", path);
+	if (rc != 0)
+		return rc;
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		/* created but never closed: start over empty */
+		return errno == ENOENT ? iod_trans_init(cont) : -errno;
+
+	rc = iod_get(fp, &hdr, sizeof(hdr));
+	if (rc == 0 && hdr.mh_magic != IOD_META_MAGIC)
+		rc = -EIO;
+	for (i = 0; i < hdr.mh_nobjs && rc == 0; i++)
+		rc = iod_obj_load(cont, fp);
+	for (i = 0; i < hdr.mh_ntrans && rc == 0; i++)
+		rc = iod_trans_load(cont, fp);
+	fclose(fp);
+	if (rc != 0)
+		return rc;
+
+	cont->ic_next_oid = iod_max(cont->ic_next_oid, hdr.mh_next_oid);
+	cont->ic_tids = hdr.mh_tids;
+	cont->ic_persisted = hdr.mh_persisted;
+	return iod_trans_init(cont);
+}
+
+int
+iod_meta_peek(const char *bb_dir, unsigned long *nobjs)
+{
+	struct iod_meta_hdr	hdr;
+	char			path[PATH_MAX];
+	FILE			*fp;
+	int			rc;
+
+	rc = iod_meta_path(bb_dir, "meta", path);
+	if (rc != 0)
+		return rc;
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return -errno;
+	rc = iod_get(fp, &hdr, sizeof(hdr));
+	fclose(fp);
+	if (rc == 0 && hdr.mh_magic != IOD_META_MAGIC)
+		rc = -EIO;
+	if (rc == 0)
+		*nobjs = hdr.mh_nobjs;
+	return rc;
+}
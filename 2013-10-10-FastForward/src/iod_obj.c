@@ -0,0 +1,1397 @@
+/*
+ * IOD object catalog, object handles and per-object attributes.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "iod_internal.h"
+
+#define IOD_HASH_INIT		1024
+
+struct iod_objh *
+iod_objh_lookup(iod_handle_t oh)
+{
+	struct iod_objh	*h = (struct iod_objh *)(uintptr_t)oh.cookie;
+
+	if (h == NULL || h->oh_magic != IOD_MAGIC_OBJH)
+		return NULL;
+	return h;
+}
+
+static unsigned long
+iod_oid_hash(iod_obj_id_t oid, unsigned long size)
+{
+	uint64_t	h = oid.oid_lo * 0x9e3779b97f4a7c15ULL ^ oid.oid_hi;
+
+	return (unsigned long)(h >> 17) & (size - 1);
+}
+
+/** Caller holds ic_lock. */
+struct iod_obj *
+iod_obj_find(struct iod_cont *cont, iod_obj_id_t oid)
+{
+	struct iod_obj	*obj;
+
+	if (cont->ic_hash == NULL)
+		return NULL;
+	obj = cont->ic_hash[iod_oid_hash(oid, cont->ic_hash_size)];
+	for (; obj != NULL; obj = obj->io_hnext) {
+		if (iod_oid_cmp(obj->io_oid, oid) == 0)
+			return obj;
+	}
+	return NULL;
+}
+
+static int
+iod_hash_grow(struct iod_cont *cont)
+{
+	struct iod_obj	**hash;
+	struct iod_obj	*obj;
+	unsigned long	size;
+	unsigned long	i;
+	unsigned long	b;
+
+	size = cont->ic_hash_size == 0 ? IOD_HASH_INIT :
+					 cont->ic_hash_size * 2;
+	hash = calloc(size, sizeof(*hash));
+	if (hash == NULL)
+		return -ENOMEM;
+	for (i = 0; i < cont->ic_hash_size; i++) {
+		while ((obj = cont->ic_hash[i]) != NULL) {
+			cont->ic_hash[i] = obj->io_hnext;
+			b = iod_oid_hash(obj->io_oid, size);
+			obj->io_hnext = hash[b];
+			hash[b] = obj;
+		}
+	}
+	free(cont->ic_hash);
+	cont->ic_hash = hash;
+	cont->ic_hash_size = size;
+	return 0;
+}
+
+/** Caller holds ic_lock. */
+int
+iod_obj_insert(struct iod_cont *cont, struct iod_obj *obj)
+{
+	unsigned long	b;
+	int		rc;
+
+	if (cont->ic_nobjs >= cont->ic_hash_size) {
+		rc = iod_hash_grow(cont);
+		if (rc != 0)
+			return rc;
+	}
+	b = iod_oid_hash(obj->io_oid, cont->ic_hash_size);
+	obj->io_hnext = cont->ic_hash[b];
+	cont->ic_hash[b] = obj;
+	cont->ic_nobjs++;
+	if (obj->io_oid.oid_lo >= cont->ic_next_oid)
+		cont->ic_next_oid = obj->io_oid.oid_lo + 1;
+	return 0;
+}
+
+/** Caller holds ic_lock. */
+void
+iod_obj_remove(struct iod_cont *cont, struct iod_obj *obj)
+{
+	struct iod_obj	**pp;
+
+	pp = &cont->ic_hash[iod_oid_hash(obj->io_oid, cont->ic_hash_size)];
+	for (; *pp != NULL; pp = &(*pp)->io_hnext) {
+		if (*pp == obj) {
+			*pp = obj->io_hnext;
+			cont->ic_nobjs--;
+			return;
+		}
+	}
+}
+
+struct iod_obj *
+iod_obj_alloc(struct iod_cont *cont, iod_obj_id_t oid, iod_obj_type_t type)
+{
+	struct iod_obj	*obj;
+	uint32_t	i;
+
+	obj = calloc(1, sizeof(*obj));
+	if (obj == NULL)
+		return NULL;
+	obj->io_cont = cont;
+	obj->io_oid = oid;
+	obj->io_type = type;
+	obj->io_unlink_tid = IOD_TID_UNKNOWN;
+	obj->io_last_dirty = IOD_TID_UNKNOWN;
+	obj->io_lease_tid = IOD_TID_UNKNOWN;
+	obj->io_fd = -1;
+	pthread_rwlock_init(&obj->io_lock, NULL);
+	iod_list_init(&obj->io_layers);
+
+	obj->io_layout.loc = IOD_LOC_BB;
+	obj->io_layout.target_num = 1;
+	obj->io_layout.stripe_size = 0;
+	obj->io_layout.dims_seq = obj->io_seq;
+	obj->io_layout.placement = IOD_PLACE_ROUND_ROBIN;
+	obj->io_layout.target_weights = NULL;
+	for (i = 0; i < IOD_MAX_DIMS; i++)
+		obj->io_seq[i] = i;
+	return obj;
+}
+
+void
+iod_obj_free(struct iod_obj *obj)
+{
+	while (!iod_list_empty(&obj->io_layers))
+		iod_layer_free(iod_list_entry(obj->io_layers.next,
+					      struct iod_layer, il_link));
+	iod_extent_fini(obj);
+	iod_chunk_fini(obj);
+	iod_vattr_free(obj->io_dim0);
+	iod_vattr_free(obj->io_scratch);
+	if (obj->io_kv != NULL)
+		iod_kv_free(obj->io_kv);
+	free(obj->io_ra);
+	free(obj->io_cks);
+	free(obj->io_mods);
+	if (obj->io_seg != NULL)
+		iod_pack_release(obj);
+	else if (obj->io_fd >= 0)
+		close(obj->io_fd);
+	pthread_rwlock_destroy(&obj->io_lock);
+	free(obj->io_layout.target_weights);
+	free(obj->io_name);
+	free(obj);
+}
+
+int
+iod_obj_log_path(struct iod_obj *obj, char *buf, size_t len)
+{
+	int	n;
+
+	n = snprintf(buf, len, "%s/%016llx.%016llx", obj->io_cont->ic_bb_dir,
+		     (unsigned long long)obj->io_oid.oid_hi,
+		     (unsigned long long)obj->io_oid.oid_lo);
+	return n < (int)len ? 0 : -ENAMETOOLONG;
+}
+
+/** open the BB data log of its own of \a obj, creating it. */
+int
+iod_obj_log_file(struct iod_obj *obj)
+{
+	char	path[PATH_MAX];
+	int	fd;
+	int	rc;
+
+	if (obj->io_fd >= 0)
+		return 0;
+	rc = iod_obj_log_path(obj, path, sizeof(path));
+	if (rc != 0)
+		return rc;
+	fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+		return -errno;
+	/* two racing readers under a shared lock may both get here */
+	if (!__sync_bool_compare_and_swap(&obj->io_fd, -1, fd))
+		close(fd);
+	return 0;
+}
+
+/**
+ * open the BB data log for reading, unless nothing was logged yet; a packed
+ * one is always open. Caller holds io_lock.
+ */
+int
+iod_obj_log_open(struct iod_obj *obj)
+{
+	if (obj->io_fd >= 0 || obj->io_tail == 0)
+		return 0;
+	return iod_obj_log_file(obj);
+}
+
+/**
+ * Reserve \a len bytes at the tail of the data log, made room for, and
+ * return where they start in \a addr. The caller writes them at
+ * iod_obj_log_pos() and then calls iod_obj_log_end(), with or without
+ * io_lock; the log does not move in between. Caller holds io_lock for write.
+ */
+int
+iod_obj_log_begin(struct iod_obj *obj, iod_size_t len, uint64_t *addr)
+{
+	int	rc;
+
+	rc = iod_pack_fit(obj, obj->io_tail + len);
+	if (rc != 0)
+		return rc;
+	iod_cache_charge(obj, len);
+	*addr = __sync_fetch_and_add(&obj->io_tail, len);
+	__atomic_add_fetch(&obj->io_writers, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/** the bytes iod_obj_log_begin() reserved are written, or failed to be */
+void
+iod_obj_log_end(struct iod_obj *obj)
+{
+	__atomic_sub_fetch(&obj->io_writers, 1, __ATOMIC_RELEASE);
+}
+
+int
+iod_obj_visible(struct iod_obj *obj, iod_trans_id_t tid)
+{
+	if (!iod_ver_visible(obj->io_create_tid, obj->io_create_committed,
+			     tid))
+		return 0;
+	if (obj->io_unlink_tid == IOD_TID_UNKNOWN)
+		return 1;
+	return !iod_ver_visible(obj->io_unlink_tid, obj->io_unlink_committed,
+				tid);
+}
+
+/* ------------------------- versioned attributes ------------------------- */
+
+struct iod_vattr *
+iod_vattr_get(struct iod_vattr *head, iod_trans_id_t tid)
+{
+	for (; head != NULL; head = head->va_next) {
+		if (iod_ver_visible(head->va_tid, head->va_committed, tid))
+			return head;
+	}
+	return NULL;
+}
+
+int
+iod_vattr_set(struct iod_vattr **head, iod_trans_id_t tid, const void *data,
+	      iod_size_t len, const iod_checksum_t *cs)
+{
+	struct iod_vattr	*va;
+	struct iod_vattr	**pp;
+
+	/* the list is ordered newest TID first */
+	for (pp = head; *pp != NULL && (*pp)->va_tid > tid;
+	     pp = &(*pp)->va_next)
+		;
+	if (*pp != NULL && (*pp)->va_tid == tid && (*pp)->va_len == len) {
+		va = *pp;
+	} else {
+		va = calloc(1, sizeof(*va) + len);
+		if (va == NULL)
+			return -ENOMEM;
+		if (*pp != NULL && (*pp)->va_tid == tid) {
+			va->va_next = (*pp)->va_next;
+			free(*pp);
+		} else {
+			va->va_next = *pp;
+		}
+		*pp = va;
+	}
+	va->va_tid = tid;
+	va->va_len = len;
+	memcpy(va->va_data, data, len);
+	if (cs != NULL)
+		va->va_cs = *cs;
+	else
+		iod_cksum_init(&va->va_cs);
+	return 0;
+}
+
+void
+iod_vattr_commit(struct iod_vattr *head, iod_trans_id_t tid)
+{
+	for (; head != NULL; head = head->va_next) {
+		if (head->va_tid == tid)
+			head->va_committed = 1;
+	}
+}
+
+void
+iod_vattr_drop(struct iod_vattr **head, iod_trans_id_t tid)
+{
+	struct iod_vattr	*va;
+
+	while (*head != NULL) {
+		va = *head;
+		if (va->va_tid == tid) {
+			*head = va->va_next;
+			free(va);
+		} else {
+			head = &va->va_next;
+		}
+	}
+}
+
+void
+iod_vattr_free(struct iod_vattr *head)
+{
+	struct iod_vattr	*va;
+
+	while (head != NULL) {
+		va = head;
+		head = va->va_next;
+		free(va);
+	}
+}
+
+/* appends raise the version of their TID in place, see iod_array_grow */
+static iod_size_t
+iod_dim0_of(struct iod_vattr *va)
+{
+	if (va == NULL)
+		return 0;
+	return __atomic_load_n((iod_size_t *)va->va_data, __ATOMIC_RELAXED);
+}
+
+iod_size_t
+iod_array_dim0(struct iod_obj *obj, iod_trans_id_t tid)
+{
+	return iod_dim0_of(iod_vattr_get(obj->io_dim0, tid));
+}
+
+/**
+ * Start reserving first dimension entries of \a obj past every length any
+ * TID gave it, when it is created or loaded.
+ */
+void
+iod_array_next_init(struct iod_obj *obj)
+{
+	struct iod_vattr	*va;
+
+	obj->io_dim0_next = 0;
+	for (va = obj->io_dim0; va != NULL; va = va->va_next)
+		obj->io_dim0_next = iod_max(obj->io_dim0_next,
+					    iod_dim0_of(va));
+}
+
+/* ------------------------------- create --------------------------------- */
+
+static int
+iod_array_struct_check(iod_array_struct_t *as)
+{
+	iod_size_t	bytes;
+	iod_size_t	edge;
+	uint32_t	seen = 0;
+	uint32_t	i;
+
+	if (as == NULL || as->cell_size == 0 || as->num_dims == 0 ||
+	    as->num_dims > IOD_MAX_DIMS || as->current_dims == NULL)
+		return -EINVAL;
+	if (as->firstdim_max != 0 && as->current_dims[0] > as->firstdim_max)
+		return -EINVAL;
+	if (as->chunk_dims != NULL) {
+		/* a chunk slot must be addressable */
+		for (i = 0, bytes = as->cell_size; i < as->num_dims; i++) {
+			edge = iod_max(as->chunk_dims[i], (iod_size_t)1);
+			if (bytes > (iod_size_t)LLONG_MAX / edge)
+				return -EINVAL;
+			bytes *= edge;
+		}
+	}
+	if (as->dims_seq != NULL) {
+		for (i = 0; i < as->num_dims; i++) {
+			if (as->dims_seq[i] >= as->num_dims ||
+			    (seen & (1U << as->dims_seq[i])))
+				return -EINVAL;
+			seen |= 1U << as->dims_seq[i];
+		}
+	}
+	return 0;
+}
+
+static void
+iod_obj_set_struct(struct iod_obj *obj, iod_array_struct_t *as)
+{
+	uint32_t	i;
+
+	obj->io_cell_size = as->cell_size;
+	obj->io_ndims = as->num_dims;
+	obj->io_dim0_max = as->firstdim_max != 0 ? as->firstdim_max :
+						   as->current_dims[0];
+	for (i = 0; i < as->num_dims; i++) {
+		obj->io_dims[i] = as->current_dims[i];
+		if (as->chunk_dims != NULL)
+			obj->io_chunk[i] = as->chunk_dims[i];
+		if (as->dims_seq != NULL)
+			obj->io_seq[i] = as->dims_seq[i];
+	}
+	obj->io_chunked = as->chunk_dims != NULL;
+}
+
+/** check a creation before the container is locked for it */
+static int
+iod_obj_create_check(struct iod_cont *cont, iod_obj_type_t type,
+		     const char *name, iod_array_struct_t *array_struct,
+		     iod_obj_id_t *oid)
+{
+	int	rc;
+
+	if (oid == NULL || type == IOD_OBJ_ANY || type > IOD_OBJ_KV)
+		return -EINVAL;
+	if (name != NULL && strlen(name) >= IOD_OBJ_NAME_MAXLEN)
+		return -ENAMETOOLONG;
+	if (type == IOD_OBJ_ARRAY) {
+		rc = iod_array_struct_check(array_struct);
+		if (rc != 0)
+			return rc;
+	}
+	if (!(cont->ic_mode & (IOD_CONT_WO | IOD_CONT_RW)))
+		return -EPERM;
+	return 0;
+}
+
+/**
+ * Create an object that passed iod_obj_create_check. Its log record goes
+ * to \a wt, or to the log right away if that is NULL. Caller holds ic_lock.
+ */
+static int
+iod_obj_create_locked(struct iod_cont *cont, iod_trans_id_t tid,
+		      iod_obj_type_t type, const char *name,
+		      iod_array_struct_t *array_struct,
+		      struct iod_wal_batch *wt, iod_obj_id_t *oid)
+{
+	struct iod_wal_rec rec = { 0 };
+	struct iod_obj	*obj;
+	iod_obj_id_t	id;
+	iod_size_t	dim0;
+	uint64_t	group;
+	size_t		len;
+	int		rc;
+
+	/* object IDs sort ARRAY < BLOB < KV, the listing order */
+	id.oid_hi = type;
+	id.oid_lo = cont->ic_next_oid;
+	obj = iod_obj_alloc(cont, id, type);
+	if (obj == NULL)
+		return -ENOMEM;
+	obj->io_create_tid = tid;
+	if (name != NULL && type != IOD_OBJ_KV) {
+		obj->io_name = strdup(name);
+		if (obj->io_name == NULL) {
+			rc = -ENOMEM;
+			goto out_free;
+		}
+	}
+	if (type == IOD_OBJ_ARRAY) {
+		iod_obj_set_struct(obj, array_struct);
+		dim0 = array_struct->current_dims[0];
+		rc = iod_vattr_set(&obj->io_dim0, tid, &dim0, sizeof(dim0),
+				   NULL);
+		if (rc != 0)
+			goto out_free;
+		iod_array_next_init(obj);
+	}
+
+	rc = iod_cat_add(cont, obj);
+	if (rc != 0)
+		goto out_free;
+	/* array creations are not logged, their dimensions are attributes */
+	if (type == IOD_OBJ_ARRAY)
+		rc = iod_trans_dirty(cont, tid, obj);
+	else
+		rc = iod_trans_dirty_logged(cont, tid, obj);
+	if (rc != 0)
+		goto out_free;
+	rc = iod_obj_insert(cont, obj);
+	if (rc != 0)
+		goto out_free;
+	if (type != IOD_OBJ_ARRAY && cont->ic_wal != NULL) {
+		rec.wr_type = IOD_WAL_CREATE;
+		rec.wr_oid = id;
+		rec.wr_tid = tid;
+		rec.wr_arg = type;
+		len = obj->io_name != NULL ? strlen(obj->io_name) : 0;
+		if (wt != NULL)
+			rc = iod_wal_batch_add(wt, &rec, obj->io_name, len,
+					       NULL, 0);
+		else
+			rc = iod_wal_log(cont->ic_wal, &rec, obj->io_name,
+					 len, NULL, 0, &group);
+		if (rc != 0)
+			iod_trans_unlogged(cont, tid);
+	}
+	*oid = id;
+	return 0;
+
+out_free:
+	obj->io_create_tid = IOD_TID_UNKNOWN;
+	iod_cat_sync(obj);
+	iod_obj_free(obj);
+	return rc;
+}
+
+static int
+iod_obj_create_one(struct iod_cont *cont, iod_trans_id_t tid,
+		   iod_obj_type_t type, const char *name,
+		   iod_array_struct_t *array_struct, iod_obj_id_t *oid)
+{
+	int	rc;
+
+	rc = iod_obj_create_check(cont, type, name, array_struct, oid);
+	if (rc != 0)
+		return rc;
+	pthread_mutex_lock(&cont->ic_lock);
+	rc = iod_obj_create_locked(cont, tid, type, name, array_struct, NULL,
+				   oid);
+	pthread_mutex_unlock(&cont->ic_lock);
+	return rc;
+}
+
+iod_ret_t
+iod_obj_create(iod_handle_t coh, iod_trans_id_t tid, iod_hint_list_t *hints,
+	       iod_obj_type_t type, const char *name,
+	       iod_array_struct_t *array_struct, iod_obj_id_t *oid,
+	       iod_event_t *event)
+{
+	struct iod_cont	*cont = iod_cont_lookup(coh);
+	int		rc;
+
+	(void)hints;
+	if (cont == NULL)
+		return iod_ev_return(event, IOD_EV_OBJ_CREATE, -EINVAL);
+	rc = iod_obj_create_one(cont, tid, type, name, array_struct, oid);
+	return iod_ev_return(event, IOD_EV_OBJ_CREATE, rc);
+}
+
+/**
+ * The whole list is created under one hold of ic_lock, and the creations
+ * it logs go to the log as one record.
+ */
+iod_ret_t
+iod_obj_create_list(iod_handle_t coh, iod_trans_id_t tid, iod_size_t num,
+		    iod_obj_create_t *obj_create, iod_event_t *event)
+{
+	struct iod_cont		*cont = iod_cont_lookup(coh);
+	struct iod_wal_batch	wt = { 0 };
+	iod_obj_create_t	*oc;
+	iod_size_t		i;
+	uint64_t		group;
+	int			rc = 0;
+	int			rc2;
+
+	if (cont == NULL || (num > 0 && obj_create == NULL))
+		return iod_ev_return(event, IOD_EV_OBJ_CREATE, -EINVAL);
+	pthread_mutex_lock(&cont->ic_lock);
+	for (i = 0; i < num; i++) {
+		oc = &obj_create[i];
+		rc2 = iod_obj_create_check(cont, oc->type, oc->name,
+					   oc->array_struct, oc->oid);
+		if (rc2 == 0)
+			rc2 = iod_obj_create_locked(cont, tid, oc->type,
+						    oc->name,
+						    oc->array_struct, &wt,
+						    oc->oid);
+		if (oc->ret != NULL)
+			*oc->ret = rc2;
+		if (rc == 0)
+			rc = rc2;
+	}
+	if (iod_wal_batch_log(cont->ic_wal, &wt, tid, &group) != 0)
+		iod_trans_unlogged(cont, tid);
+	pthread_mutex_unlock(&cont->ic_lock);
+	return iod_ev_return(event, IOD_EV_OBJ_CREATE, rc);
+}
+
+/* --------------------------- open and close ----------------------------- */
+
+/** a handle with \a hints as the policy of every call through it */
+static int
+iod_objh_new(struct iod_cont *cont, iod_hint_list_t *hints, int write,
+	     struct iod_objh **hp)
+{
+	const struct iod_policy	*pol;
+	struct iod_objh		*h;
+	int			rc;
+
+	if (write && !(cont->ic_mode & (IOD_CONT_WO | IOD_CONT_RW)))
+		return -EPERM;
+	if (!write && !(cont->ic_mode & (IOD_CONT_RO | IOD_CONT_RW)))
+		return -EPERM;
+
+	h = calloc(1, sizeof(*h));
+	if (h == NULL)
+		return -ENOMEM;
+	rc = iod_policy_resolve(NULL, hints, &h->oh_pol, &pol);
+	if (rc != 0) {
+		free(h);
+		return rc;
+	}
+	h->oh_pol = *pol;
+	h->oh_write = write;
+	*hp = h;
+	return 0;
+}
+
+/** open \a oid through \a h, or free \a h. Caller holds ic_lock. */
+static int
+iod_obj_open_locked(struct iod_cont *cont, iod_obj_id_t oid,
+		    struct iod_objh *h, iod_handle_t *oh)
+{
+	struct iod_obj	*obj;
+
+	obj = iod_obj_find(cont, oid);
+	if (obj == NULL || (obj->io_unlink_tid != IOD_TID_UNKNOWN &&
+			    obj->io_unlink_committed)) {
+		free(h);
+		return -ENOENT;
+	}
+	obj->io_nopen++;
+	h->oh_magic = IOD_MAGIC_OBJH;
+	h->oh_obj = obj;
+	oh->cookie = (uint64_t)(uintptr_t)h;
+	return 0;
+}
+
+static int
+iod_obj_open_one(struct iod_cont *cont, iod_obj_id_t oid,
+		 iod_hint_list_t *hints, int write, iod_handle_t *oh)
+{
+	struct iod_objh	*h;
+	int		rc;
+
+	if (oh == NULL)
+		return -EINVAL;
+	rc = iod_objh_new(cont, hints, write, &h);
+	if (rc != 0)
+		return rc;
+	pthread_mutex_lock(&cont->ic_lock);
+	rc = iod_obj_open_locked(cont, oid, h, oh);
+	pthread_mutex_unlock(&cont->ic_lock);
+	return rc;
+}
+
+iod_ret_t
+iod_obj_open_write(iod_handle_t coh, iod_obj_id_t oid, iod_hint_list_t *hints,
+		   iod_handle_t *oh, iod_event_t *event)
+{
+	struct iod_cont	*cont = iod_cont_lookup(coh);
+
+	if (cont == NULL)
+		return iod_ev_return(event, IOD_EV_OBJ_OPEN_WR, -EINVAL);
+	return iod_ev_return(event, IOD_EV_OBJ_OPEN_WR,
+			     iod_obj_open_one(cont, oid, hints, 1, oh));
+}
+
+iod_ret_t
+iod_obj_open_read(iod_handle_t coh, iod_obj_id_t oid, iod_hint_list_t *hints,
+		  iod_handle_t *oh, iod_event_t *event)
+{
+	struct iod_cont	*cont = iod_cont_lookup(coh);
+
+	if (cont == NULL)
+		return iod_ev_return(event, IOD_EV_OBJ_OPEN_RD, -EINVAL);
+	return iod_ev_return(event, IOD_EV_OBJ_OPEN_RD,
+			     iod_obj_open_one(cont, oid, hints, 0, oh));
+}
+
+/** the handles are made first, then opened under one hold of ic_lock */
+static iod_ret_t
+iod_obj_open_list(iod_handle_t coh, iod_size_t num, iod_obj_open_t *open,
+		  int write, iod_event_t *event)
+{
+	struct iod_cont	*cont = iod_cont_lookup(coh);
+	iod_ev_type_t	type = write ? IOD_EV_OBJ_OPEN_WR : IOD_EV_OBJ_OPEN_RD;
+	struct iod_objh	**h;
+	iod_size_t	i;
+	int		rc = 0;
+	int		rc2;
+
+	if (cont == NULL || (num > 0 && open == NULL))
+		return iod_ev_return(event, type, -EINVAL);
+	h = calloc(iod_max(num, (iod_size_t)1), sizeof(*h));
+	if (h == NULL)
+		return iod_ev_return(event, type, -ENOMEM);
+	for (i = 0; i < num; i++) {
+		rc2 = open[i].oh == NULL ? -EINVAL :
+		      iod_objh_new(cont, open[i].hints, write, &h[i]);
+		if (rc2 != 0 && open[i].ret != NULL)
+			*open[i].ret = rc2;
+		if (rc == 0)
+			rc = rc2;
+	}
+	pthread_mutex_lock(&cont->ic_lock);
+	for (i = 0; i < num; i++) {
+		if (h[i] == NULL)
+			continue;
+		rc2 = iod_obj_open_locked(cont, open[i].oid, h[i], open[i].oh);
+		if (open[i].ret != NULL)
+			*open[i].ret = rc2;
+		if (rc == 0)
+			rc = rc2;
+	}
+	pthread_mutex_unlock(&cont->ic_lock);
+	free(h);
+	return iod_ev_return(event, type, rc);
+}
+
+iod_ret_t
+iod_obj_open_write_list(iod_handle_t coh, iod_size_t num,
+			iod_obj_open_t *open_write, iod_event_t *event)
+{
+	return iod_obj_open_list(coh, num, open_write, 1, event);
+}
+
+iod_ret_t
+iod_obj_open_read_list(iod_handle_t coh, iod_size_t num,
+		       iod_obj_open_t *open_read, iod_event_t *event)
+{
+	return iod_obj_open_list(coh, num, open_read, 0, event);
+}
+
+static int
+iod_obj_close_one(iod_handle_t oh)
+{
+	struct iod_objh	*h = iod_objh_lookup(oh);
+	struct iod_cont	*cont;
+
+	if (h == NULL)
+		return -EINVAL;
+	cont = h->oh_obj->io_cont;
+	pthread_mutex_lock(&cont->ic_lock);
+	h->oh_obj->io_nopen--;
+	pthread_mutex_unlock(&cont->ic_lock);
+	h->oh_magic = IOD_MAGIC_DEAD;
+	free(h);
+	return 0;
+}
+
+iod_ret_t
+iod_obj_close(iod_handle_t oh, iod_hint_list_t *hints, iod_event_t *event)
+{
+	(void)hints;
+	return iod_ev_return(event, IOD_EV_CONT_CLOSE, iod_obj_close_one(oh));
+}
+
+/** the handles of \a coh are closed under one hold of ic_lock */
+iod_ret_t
+iod_obj_close_list(iod_handle_t coh, iod_size_t num, iod_obj_close_t *obj_close,
+		   iod_event_t *event)
+{
+	struct iod_cont	*cont = iod_cont_lookup(coh);
+	struct iod_objh	**h;
+	iod_size_t	i;
+	int		rc = 0;
+	int		rc2;
+
+	if (cont == NULL || (num > 0 && obj_close == NULL))
+		return iod_ev_return(event, IOD_EV_CONT_CLOSE, -EINVAL);
+	h = calloc(iod_max(num, (iod_size_t)1), sizeof(*h));
+	if (h == NULL)
+		return iod_ev_return(event, IOD_EV_CONT_CLOSE, -ENOMEM);
+	pthread_mutex_lock(&cont->ic_lock);
+	for (i = 0; i < num; i++) {
+		h[i] = iod_objh_lookup(obj_close[i].oh);
+		if (h[i] == NULL || h[i]->oh_obj->io_cont != cont) {
+			h[i] = NULL;
+			continue;
+		}
+		h[i]->oh_obj->io_nopen--;
+		h[i]->oh_magic = IOD_MAGIC_DEAD;
+	}
+	pthread_mutex_unlock(&cont->ic_lock);
+	for (i = 0; i < num; i++) {
+		/* those of other containers close one by one */
+		rc2 = h[i] != NULL ? 0 : iod_obj_close_one(obj_close[i].oh);
+		if (obj_close[i].ret != NULL)
+			*obj_close[i].ret = rc2;
+		if (rc == 0)
+			rc = rc2;
+	}
+	for (i = 0; i < num; i++)
+		free(h[i]);
+	free(h);
+	return iod_ev_return(event, IOD_EV_CONT_CLOSE, rc);
+}
+
+/* ----------------------------- structure -------------------------------- */
+
+static int
+iod_array_get_struct_one(iod_handle_t oh, iod_trans_id_t tid,
+			 iod_array_struct_t *as)
+{
+	struct iod_objh	*h = iod_objh_lookup(oh);
+	struct iod_obj	*obj;
+	uint32_t	i;
+
+	if (h == NULL || as == NULL)
+		return -EINVAL;
+	obj = h->oh_obj;
+	if (obj->io_type != IOD_OBJ_ARRAY)
+		return -EINVAL;
+
+	pthread_rwlock_rdlock(&obj->io_lock);
+	as->cell_size = obj->io_cell_size;
+	as->num_dims = obj->io_ndims;
+	as->firstdim_max = obj->io_dim0_max;
+	for (i = 0; i < obj->io_ndims; i++) {
+		if (as->current_dims != NULL)
+			as->current_dims[i] = i == 0 ?
+				iod_array_dim0(obj, tid) : obj->io_dims[i];
+		if (as->chunk_dims != NULL)
+			as->chunk_dims[i] = obj->io_chunk[i];
+		if (as->dims_seq != NULL)
+			as->dims_seq[i] = obj->io_seq[i];
+	}
+	pthread_rwlock_unlock(&obj->io_lock);
+	return 0;
+}
+
+iod_ret_t
+iod_array_get_struct(iod_handle_t oh, iod_trans_id_t tid,
+		     iod_array_struct_t *array_struct, iod_event_t *event)
+{
+	return iod_ev_return(event, IOD_EV_ARR_GET_STRUCT,
+			     iod_array_get_struct_one(oh, tid, array_struct));
+}
+
+iod_ret_t
+iod_array_get_struct_list(iod_handle_t coh, iod_trans_id_t tid,
+			  iod_size_t num, iod_array_get_struct_t *get_struct,
+			  iod_event_t *event)
+{
+	iod_size_t	i;
+	int		rc = 0;
+	int		rc2;
+
+	if (iod_cont_lookup(coh) == NULL || (num > 0 && get_struct == NULL))
+		return iod_ev_return(event, IOD_EV_ARR_GET_STRUCT, -EINVAL);
+	for (i = 0; i < num; i++) {
+		rc2 = iod_array_get_struct_one(get_struct[i].oh, tid,
+					       get_struct[i].obj_struct);
+		if (get_struct[i].ret != NULL)
+			*get_struct[i].ret = rc2;
+		if (rc == 0)
+			rc = rc2;
+	}
+	return iod_ev_return(event, IOD_EV_ARR_GET_STRUCT, rc);
+}
+
+/*
+ * Growing the first dimension only changes the length versioned in io_dim0:
+ * the array image is row-major with the first dimension slowest, and chunks
+ * are numbered with an unbounded first dimension, so no cell moves. The
+ * first change of a TID adds its version under ic_lock and the write lock;
+ * later ones, from any number of ranks, raise that version in place under
+ * the read lock. Entries are reserved from io_dim0_next, which only grows.
+ */
+
+/** the most first dimension entries \a obj can have */
+static iod_size_t
+iod_array_dim0_cap(struct iod_obj *obj)
+{
+	iod_size_t	row = obj->io_cell_size;
+	uint32_t	d;
+
+	/* every cell must keep a byte offset */
+	for (d = 1; d < obj->io_ndims; d++) {
+		if (obj->io_dims[d] == 0)
+			return obj->io_dim0_max;
+		if (row > (iod_size_t)LLONG_MAX / obj->io_dims[d])
+			return 0;
+		row *= obj->io_dims[d];
+	}
+	return iod_min(obj->io_dim0_max, (iod_size_t)LLONG_MAX / row);
+}
+
+static void
+iod_array_next_raise(struct iod_obj *obj, iod_size_t len)
+{
+	iod_size_t	cur = __atomic_load_n(&obj->io_dim0_next,
+					      __ATOMIC_RELAXED);
+
+	while (cur < len &&
+	       !__atomic_compare_exchange_n(&obj->io_dim0_next, &cur, len, 0,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/**
+ * Make the first dimension of \a obj at write TID \a tid at least \a len.
+ * It never shrinks: -EINVAL if \a len is below the length before \a tid.
+ */
+static int
+iod_array_grow(struct iod_obj *obj, iod_trans_id_t tid, iod_size_t len)
+{
+	struct iod_vattr	*va;
+	iod_size_t		cur;
+	int			rc = -EAGAIN;
+
+	pthread_rwlock_rdlock(&obj->io_lock);
+	va = iod_vattr_get(obj->io_dim0, tid);
+	if (va != NULL && va->va_tid == tid && !va->va_committed) {
+		rc = 0;
+		if (len < iod_dim0_of(iod_vattr_get(va->va_next, tid)))
+			rc = -EINVAL;
+		cur = iod_dim0_of(va);
+		while (rc == 0 && cur < len &&
+		       !__atomic_compare_exchange_n((iod_size_t *)va->va_data,
+						    &cur, len, 0,
+						    __ATOMIC_RELAXED,
+						    __ATOMIC_RELAXED))
+			;
+	}
+	pthread_rwlock_unlock(&obj->io_lock);
+	if (rc != -EAGAIN)
+		return rc;
+
+	/* io_lock is taken before ic_lock goes, so no rollback gets between */
+	pthread_mutex_lock(&obj->io_cont->ic_lock);
+	rc = iod_trans_dirty(obj->io_cont, tid, obj);
+	if (rc == 0)
+		pthread_rwlock_wrlock(&obj->io_lock);
+	pthread_mutex_unlock(&obj->io_cont->ic_lock);
+	if (rc != 0)
+		return rc;
+
+	va = iod_vattr_get(obj->io_dim0, tid);
+	cur = iod_dim0_of(va);
+	if (va != NULL && va->va_tid == tid) {
+		/* another rank of the TID added it meanwhile */
+		if (len < iod_dim0_of(iod_vattr_get(va->va_next, tid)))
+			rc = -EINVAL;
+		else if (len > cur)
+			rc = iod_vattr_set(&obj->io_dim0, tid, &len,
+					   sizeof(len), NULL);
+	} else if (len < cur) {
+		rc = -EINVAL;
+	} else {
+		rc = iod_vattr_set(&obj->io_dim0, tid, &len, sizeof(len),
+				   NULL);
+	}
+	pthread_rwlock_unlock(&obj->io_lock);
+	return rc;
+}
+
+static int
+iod_array_extend_one(iod_handle_t oh, iod_trans_id_t tid,
+		     iod_size_t firstdim_len)
+{
+	struct iod_objh	*h = iod_objh_lookup(oh);
+	struct iod_obj	*obj;
+	int		rc;
+
+	if (h == NULL)
+		return -EINVAL;
+	if (!h->oh_write)
+		return -EPERM;
+	obj = h->oh_obj;
+	if (obj->io_type != IOD_OBJ_ARRAY ||
+	    firstdim_len > iod_array_dim0_cap(obj))
+		return -EINVAL;
+
+	rc = iod_array_grow(obj, tid, firstdim_len);
+	if (rc == 0)
+		iod_array_next_raise(obj, firstdim_len);
+	return rc;
+}
+
+iod_ret_t
+iod_array_extend(iod_handle_t oh, iod_trans_id_t tid, iod_size_t firstdim_len,
+		 iod_event_t *event)
+{
+	return iod_ev_return(event, IOD_EV_ARR_EXT,
+			     iod_array_extend_one(oh, tid, firstdim_len));
+}
+
+iod_ret_t
+iod_array_extend_list(iod_handle_t coh, iod_trans_id_t tid, iod_size_t num,
+		      iod_obj_extend_t *obj_extend, iod_event_t *event)
+{
+	iod_size_t	i;
+	int		rc = 0;
+	int		rc2;
+
+	if (iod_cont_lookup(coh) == NULL || (num > 0 && obj_extend == NULL))
+		return iod_ev_return(event, IOD_EV_ARR_EXT, -EINVAL);
+	for (i = 0; i < num; i++) {
+		rc2 = iod_array_extend_one(obj_extend[i].oh, tid,
+					   obj_extend[i].firstdim_len);
+		if (obj_extend[i].ret != NULL)
+			*obj_extend[i].ret = rc2;
+		if (rc == 0)
+			rc = rc2;
+	}
+	return iod_ev_return(event, IOD_EV_ARR_EXT, rc);
+}
+
+iod_ret_t
+iod_array_reserve(iod_handle_t oh, iod_trans_id_t tid, iod_size_t count,
+		  iod_size_t *start, iod_event_t *event)
+{
+	struct iod_objh	*h = iod_objh_lookup(oh);
+	struct iod_obj	*obj;
+	iod_size_t	cap;
+	iod_size_t	cur;
+	int		rc;
+
+	if (h == NULL || start == NULL)
+		return iod_ev_return(event, IOD_EV_ARR_EXT, -EINVAL);
+	if (!h->oh_write)
+		return iod_ev_return(event, IOD_EV_ARR_EXT, -EPERM);
+	obj = h->oh_obj;
+	if (obj->io_type != IOD_OBJ_ARRAY)
+		return iod_ev_return(event, IOD_EV_ARR_EXT, -EINVAL);
+
+	cap = iod_array_dim0_cap(obj);
+	cur = __atomic_load_n(&obj->io_dim0_next, __ATOMIC_RELAXED);
+	do {
+		if (count > cap || cur > cap - count)
+			return iod_ev_return(event, IOD_EV_ARR_EXT, -EINVAL);
+	} while (!__atomic_compare_exchange_n(&obj->io_dim0_next, &cur,
+					      cur + count, 0, __ATOMIC_RELAXED,
+					      __ATOMIC_RELAXED));
+
+	/* entries of a failed reservation are skipped, never handed out */
+	rc = iod_array_grow(obj, tid, cur + count);
+	if (rc == 0)
+		*start = cur;
+	return iod_ev_return(event, IOD_EV_ARR_EXT, rc);
+}
+
+/* ------------------------------- layout --------------------------------- */
+
+/**
+ * The weights \a layout places by, copied, or NULL if it places evenly.
+ * Returns -ENOMEM through \a rc.
+ */
+static uint32_t *
+iod_layout_weights(const iod_layout_t *layout, int *rc)
+{
+	uint32_t	*w;
+	uint32_t	i;
+
+	*rc = 0;
+	if (layout->placement != IOD_PLACE_STRAW ||
+	    layout->target_weights == NULL)
+		return NULL;
+	for (i = 1; i < layout->target_num; i++)
+		if (layout->target_weights[i] != layout->target_weights[0])
+			break;
+	if (i >= layout->target_num)
+		return NULL;
+	w = malloc(layout->target_num * sizeof(*w));
+	if (w == NULL) {
+		*rc = -ENOMEM;
+		return NULL;
+	}
+	memcpy(w, layout->target_weights, layout->target_num * sizeof(*w));
+	return w;
+}
+
+/** whether \a a and \a b put every central byte in the same place */
+static int
+iod_layout_same(const iod_layout_t *a, const iod_layout_t *b)
+{
+	if (a->target_num != b->target_num ||
+	    a->stripe_size != b->stripe_size || a->placement != b->placement)
+		return 0;
+	if (a->target_weights == NULL || b->target_weights == NULL)
+		return a->target_weights == b->target_weights;
+	return memcmp(a->target_weights, b->target_weights,
+		      a->target_num * sizeof(uint32_t)) == 0;
+}
+
+/**
+ * A change of target_num, stripe_size, placement or weights moves the
+ * shards the object already has on central storage before returning, with
+ * persists of the container held off and the object locked meanwhile.
+ */
+iod_ret_t
+iod_obj_set_layout(iod_handle_t oh, iod_trans_id_t tid, iod_hint_list_t *hints,
+		   iod_layout_t *layout, iod_event_t *event)
+{
+	struct iod_objh	*h = iod_objh_lookup(oh);
+	struct iod_obj	*obj;
+	iod_layout_t	old;
+	uint32_t	*weights = NULL;
+	uint32_t	seen = 0;
+	uint32_t	i;
+	int		rc = 0;
+
+	(void)tid;
+	(void)hints;
+	if (h == NULL || layout == NULL ||
+	    (layout->loc != IOD_LOC_BB && layout->loc != IOD_LOC_CENTRAL))
+		return iod_ev_return(event, IOD_EV_OBJ_SET_LAYOUT, -EINVAL);
+	obj = h->oh_obj;
+
+	if (obj->io_type == IOD_OBJ_ARRAY && layout->dims_seq != NULL) {
+		for (i = 0; i < obj->io_ndims; i++) {
+			if (layout->dims_seq[i] >= obj->io_ndims ||
+			    (seen & (1U << layout->dims_seq[i])))
+				rc = -EINVAL;
+			seen |= 1U << layout->dims_seq[i];
+		}
+		/* an extendable array keeps the first dimension slowest */
+		if (obj->io_dim0_max != obj->io_dims[0] &&
+		    layout->dims_seq[0] != 0)
+			rc = -EINVAL;
+		if (rc != 0)
+			return iod_ev_return(event, IOD_EV_OBJ_SET_LAYOUT, rc);
+	}
+	rc = iod_place_check(layout);
+	if (rc == 0 && obj->io_type != IOD_OBJ_KV)
+		weights = iod_layout_weights(layout, &rc);
+	if (rc != 0)
+		return iod_ev_return(event, IOD_EV_OBJ_SET_LAYOUT, rc);
+
+	pthread_mutex_lock(&obj->io_cont->ic_persist_lock);
+	pthread_rwlock_wrlock(&obj->io_lock);
+	old = obj->io_layout;
+	obj->io_layout.loc = layout->loc;
+	if (obj->io_type != IOD_OBJ_KV) {
+		obj->io_layout.target_num = iod_max(layout->target_num, 1U);
+		obj->io_layout.stripe_size = layout->stripe_size;
+		obj->io_layout.placement = layout->placement;
+		obj->io_layout.target_weights = weights;
+		if (!iod_layout_same(&old, &obj->io_layout))
+			rc = iod_central_reshard(obj, &old);
+		if (rc != 0) {
+			obj->io_layout = old;
+			free(weights);
+		} else {
+			free(old.target_weights);
+		}
+	}
+	if (rc == 0 && obj->io_type == IOD_OBJ_ARRAY &&
+	    layout->dims_seq != NULL)
+		memcpy(obj->io_seq, layout->dims_seq,
+		       obj->io_ndims * sizeof(uint32_t));
+	pthread_rwlock_unlock(&obj->io_lock);
+	pthread_mutex_unlock(&obj->io_cont->ic_persist_lock);
+	return iod_ev_return(event, IOD_EV_OBJ_SET_LAYOUT, rc);
+}
+
+iod_ret_t
+iod_obj_get_layout(iod_handle_t oh, iod_trans_id_t tid, iod_layout_t *layout,
+		   iod_event_t *event)
+{
+	struct iod_objh	*h = iod_objh_lookup(oh);
+	struct iod_obj	*obj;
+	uint32_t	i;
+
+	(void)tid;
+	if (h == NULL || layout == NULL)
+		return iod_ev_return(event, IOD_EV_OBJ_GET_LAYOUT, -EINVAL);
+	obj = h->oh_obj;
+
+	pthread_rwlock_rdlock(&obj->io_lock);
+	layout->loc = obj->io_layout.loc;
+	layout->target_num = obj->io_layout.target_num;
+	layout->stripe_size = obj->io_layout.stripe_size;
+	layout->placement = obj->io_layout.placement;
+	if (layout->dims_seq != NULL && obj->io_type == IOD_OBJ_ARRAY)
+		memcpy(layout->dims_seq, obj->io_seq,
+		       obj->io_ndims * sizeof(uint32_t));
+	for (i = 0; obj->io_layout.placement == IOD_PLACE_STRAW &&
+		    layout->target_weights != NULL &&
+		    i < obj->io_layout.target_num; i++)
+		layout->target_weights[i] =
+			obj->io_layout.target_weights != NULL ?
+			obj->io_layout.target_weights[i] : 1;
+	pthread_rwlock_unlock(&obj->io_lock);
+	return iod_ev_return(event, IOD_EV_OBJ_GET_LAYOUT, 0);
+}
+
+/* ------------------------------- unlink --------------------------------- */
+
+/**
+ * Unlink \a oid in \a tid. Its log record goes to \a wt, or to the log
+ * right away if that is NULL. Caller holds ic_lock.
+ */
+static int
+iod_obj_unlink_locked(struct iod_cont *cont, iod_obj_id_t oid,
+		      iod_trans_id_t tid, struct iod_wal_batch *wt)
+{
+	struct iod_wal_rec rec = { 0 };
+	struct iod_obj	*obj;
+	uint64_t	group;
+	int		rc;
+
+	obj = iod_obj_find(cont, oid);
+	if (obj == NULL || !iod_obj_visible(obj, tid))
+		return -ENOENT;
+	if (obj->io_nopen > 0)
+		return -EBUSY;
+	rc = iod_trans_dirty_logged(cont, tid, obj);
+	if (rc != 0)
+		return rc;
+	__atomic_store_n(&obj->io_unlink_tid, tid, __ATOMIC_RELAXED);
+	obj->io_unlink_committed = 0;
+	iod_cat_sync(obj);
+	if (cont->ic_wal == NULL)
+		return 0;
+	rec.wr_type = IOD_WAL_UNLINK;
+	rec.wr_oid = oid;
+	rec.wr_tid = tid;
+	if (wt != NULL)
+		rc = iod_wal_batch_add(wt, &rec, NULL, 0, NULL, 0);
+	else
+		rc = iod_wal_log(cont->ic_wal, &rec, NULL, 0, NULL, 0, &group);
+	if (rc != 0)
+		iod_trans_unlogged(cont, tid);
+	return 0;
+}
+
+iod_ret_t
+iod_obj_unlink(iod_handle_t coh, iod_obj_id_t oid, iod_trans_id_t tid,
+	       iod_event_t *event)
+{
+	struct iod_cont	*cont = iod_cont_lookup(coh);
+	int		rc;
+
+	if (cont == NULL)
+		return iod_ev_return(event, IOD_EV_OBJ_UNLINK, -EINVAL);
+	pthread_mutex_lock(&cont->ic_lock);
+	rc = iod_obj_unlink_locked(cont, oid, tid, NULL);
+	pthread_mutex_unlock(&cont->ic_lock);
+	return iod_ev_return(event, IOD_EV_OBJ_UNLINK, rc);
+}
+
+/**
+ * The whole list is unlinked under one hold of ic_lock, and the unlinks go
+ * to the log as one record.
+ */
+iod_ret_t
+iod_obj_unlink_list(iod_handle_t coh, iod_trans_id_t tid, iod_size_t num,
+		    iod_obj_unlink_t *obj_unlink, iod_event_t *event)
+{
+	struct iod_cont		*cont = iod_cont_lookup(coh);
+	struct iod_wal_batch	wt = { 0 };
+	iod_size_t		i;
+	uint64_t		group;
+	int			rc = 0;
+	int			rc2;
+
+	if (cont == NULL || (num > 0 && obj_unlink == NULL))
+		return iod_ev_return(event, IOD_EV_OBJ_UNLINK, -EINVAL);
+	pthread_mutex_lock(&cont->ic_lock);
+	for (i = 0; i < num; i++) {
+		rc2 = iod_obj_unlink_locked(cont, obj_unlink[i].oid, tid,
+					    &wt);
+		if (obj_unlink[i].ret != NULL)
+			*obj_unlink[i].ret = rc2;
+		if (rc == 0)
+			rc = rc2;
+	}
+	if (iod_wal_batch_log(cont->ic_wal, &wt, tid, &group) != 0)
+		iod_trans_unlogged(cont, tid);
+	pthread_mutex_unlock(&cont->ic_lock);
+	return iod_ev_return(event, IOD_EV_OBJ_UNLINK, rc);
+}
+
+/* ------------------------------ scratchpad ------------------------------ */
+
+static int
+iod_obj_set_scratch_one(iod_handle_t oh, iod_trans_id_t tid,
+			const char *scratch, iod_checksum_t *cs)
+{
+	struct iod_objh	*h = iod_objh_lookup(oh);
+	struct iod_obj	*obj;
+	int		rc;
+
+	if (h == NULL || scratch == NULL)
+		return -EINVAL;
+	if (!h->oh_write)
+		return -EPERM;
+	obj = h->oh_obj;
+
+	pthread_mutex_lock(&obj->io_cont->ic_lock);
+	rc = iod_trans_dirty(obj->io_cont, tid, obj);
+	if (rc == 0)
+		pthread_rwlock_wrlock(&obj->io_lock);
+	pthread_mutex_unlock(&obj->io_cont->ic_lock);
+	if (rc != 0)
+		return rc;
+
+	rc = iod_vattr_set(&obj->io_scratch, tid, scratch, IOD_SCRATCH_LEN,
+			   cs);
+	pthread_rwlock_unlock(&obj->io_lock);
+	return rc;
+}
+
+static int
+iod_obj_get_scratch_one(iod_handle_t oh, iod_trans_id_t tid,
+			const char *scratch, iod_checksum_t *cs)
+{
+	struct iod_objh		*h = iod_objh_lookup(oh);
+	struct iod_vattr	*va;
+	struct iod_obj		*obj;
+	int			rc = 0;
+
+	if (h == NULL || scratch == NULL)
+		return -EINVAL;
+	obj = h->oh_obj;
+
+	pthread_rwlock_rdlock(&obj->io_lock);
+	va = iod_vattr_get(obj->io_scratch, tid);
+	if (va == NULL) {
+		rc = -ENOENT;
+	} else {
+		/* the API hands the OUT buffer in as const char * */
+		memcpy((char *)scratch, va->va_data, IOD_SCRATCH_LEN);
+		if (cs != NULL)
+			*cs = va->va_cs;
+	}
+	pthread_rwlock_unlock(&obj->io_lock);
+	return rc;
+}
+
+iod_ret_t
+iod_obj_set_scratch(iod_handle_t oh, iod_trans_id_t tid, const char* scratch,
+		    iod_checksum_t *cs, iod_event_t *event)
+{
+	return iod_ev_return(event, IOD_EV_OBJ_SET_SCRA,
+			     iod_obj_set_scratch_one(oh, tid, scratch, cs));
+}
+
+iod_ret_t
+iod_obj_get_scratch(iod_handle_t oh, iod_trans_id_t tid, const char* scratch,
+		    iod_checksum_t *cs, iod_event_t *event)
+{
+	return iod_ev_return(event, IOD_EV_OBJ_GET_SCRA,
+			     iod_obj_get_scratch_one(oh, tid, scratch, cs));
+}
+
+iod_ret_t
+iod_obj_set_scratch_list(iod_handle_t coh, iod_trans_id_t tid, iod_size_t num,
+			 iod_obj_scratch_t *scratch_set, iod_event_t *event)
+{
+	iod_size_t	i;
+	int		rc = 0;
+	int		rc2;
+
+	if (iod_cont_lookup(coh) == NULL || (num > 0 && scratch_set == NULL))
+		return iod_ev_return(event, IOD_EV_OBJ_SET_SCRA, -EINVAL);
+	for (i = 0; i < num; i++) {
+		rc2 = iod_obj_set_scratch_one(scratch_set[i].oh, tid,
+					      scratch_set[i].scratch,
+					      scratch_set[i].cs);
+		if (scratch_set[i].ret != NULL)
+			*scratch_set[i].ret = rc2;
+		if (rc == 0)
+			rc = rc2;
+	}
+	return iod_ev_return(event, IOD_EV_OBJ_SET_SCRA, rc);
+}
+
+iod_ret_t
+iod_obj_get_scratch_list(iod_handle_t coh, iod_trans_id_t tid, iod_size_t num,
+			 iod_obj_scratch_t *scratch_get, iod_event_t *event)
+{
+	iod_size_t	i;
+	int		rc = 0;
+	int		rc2;
+
+	if (iod_cont_lookup(coh) == NULL || (num > 0 && scratch_get == NULL))
+		return iod_ev_return(event, IOD_EV_OBJ_GET_SCRA, -EINVAL);
+	for (i = 0; i < num; i++) {
+		rc2 = iod_obj_get_scratch_one(scratch_get[i].oh, tid,
+					      scratch_get[i].scratch,
+					      scratch_get[i].cs);
+		if (scratch_get[i].ret != NULL)
+			*scratch_get[i].ret = rc2;
+		if (rc == 0)
+			rc = rc2;
+	}
+	return iod_ev_return(event, IOD_EV_OBJ_GET_SCRA, rc);
+}
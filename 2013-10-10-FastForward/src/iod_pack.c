@@ -0,0 +1,526 @@
+/*
+ * Small-object packing on the burst buffer.
+ *
+ * A data log of its own per object costs a file, and containers written
+ * through HDF5 hold millions of objects of a few bytes: attribute KVs, small
+ * blobs and arrays. Data logs of up to "iod.pack_max" bytes are instead cut
+ * as slots out of large segment files, seg.<id> in the container directory.
+ * A packed object's io_fd is the descriptor of its segment and io_base where
+ * its slot starts, so log addresses, and everything that records them, are
+ * the same as in a file of its own. A log that outgrows its slot is copied
+ * whole into a slot twice the size, and past "iod.pack_max" into a file of
+ * its own, under io_lock for write once the appends in flight landed.
+ *
+ * A slot moved from, or whose object is gone, is dead space. Once a segment
+ * no slots are cut from any more is less than half live, a compaction on the
+ * worker threads moves its slots to the current segment. A slot is never
+ * written again after a move: the checkpoint still finds the log there until
+ * the next close, so an emptied segment is only removed once that close
+ * checkpointed the container, and an open removes the segment files its
+ * checkpoint does not know.
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "iod_internal.h"
+
+#define IOD_PACK_PREFIX		"seg."
+#define IOD_PACK_ALIGN		64	/* slot sizes are multiples of this */
+
+static int
+iod_pack_path(struct iod_cont *cont, uint32_t id, char *buf)
+{
+	if (snprintf(buf, PATH_MAX, "%s/" IOD_PACK_PREFIX "%08x",
+		     cont->ic_bb_dir, id) >= PATH_MAX)
+		return -ENAMETOOLONG;
+	return 0;
+}
+
+void
+iod_pack_init(struct iod_cont *cont)
+{
+	pthread_mutex_init(&cont->ic_pack.pk_lock, NULL);
+}
+
+void
+iod_pack_fini(struct iod_cont *cont)
+{
+	struct iod_pack		*pk = &cont->ic_pack;
+	struct iod_pack_seg	*seg;
+	unsigned long		i;
+
+	for (i = 0; i < pk->pk_nsegs; i++) {
+		seg = pk->pk_segs[i];
+		close(seg->ps_fd);
+		free(seg->ps_objs);
+		free(seg);
+	}
+	free(pk->pk_segs);
+	pthread_mutex_destroy(&pk->pk_lock);
+}
+
+static struct iod_pack_seg *
+iod_pack_find(struct iod_pack *pk, uint32_t id)
+{
+	unsigned long	i;
+
+	for (i = 0; i < pk->pk_nsegs; i++) {
+		if (pk->pk_segs[i]->ps_id == id)
+			return pk->pk_segs[i];
+	}
+	return NULL;
+}
+
+/** open segment \a id with \a flags and add it. Caller holds pk_lock. */
+static int
+iod_pack_seg_add(struct iod_cont *cont, uint32_t id, int flags,
+		 struct iod_pack_seg **out)
+{
+	struct iod_pack		*pk = &cont->ic_pack;
+	struct iod_pack_seg	**segs;
+	struct iod_pack_seg	*seg;
+	char			path[PATH_MAX];
+	unsigned long		max;
+	int			rc;
+
+	if (pk->pk_nsegs == pk->pk_maxsegs) {
+		max = iod_max(pk->pk_maxsegs * 2, 8UL);
+		segs = realloc(pk->pk_segs, max * sizeof(*segs));
+		if (segs == NULL)
+			return -ENOMEM;
+		pk->pk_segs = segs;
+		pk->pk_maxsegs = max;
+	}
+	rc = iod_pack_path(cont, id, path);
+	if (rc != 0)
+		return rc;
+	seg = calloc(1, sizeof(*seg));
+	if (seg == NULL)
+		return -ENOMEM;
+	seg->ps_fd = open(path, O_RDWR | flags, 0644);
+	if (seg->ps_fd < 0) {
+		rc = -errno;
+		free(seg);
+		return rc;
+	}
+	seg->ps_id = id;
+	if (id >= pk->pk_next_id)
+		pk->pk_next_id = id + 1;
+	pk->pk_segs[pk->pk_nsegs++] = seg;
+	*out = seg;
+	return 0;
+}
+
+/** queue the compaction of \a seg. Caller holds pk_lock. */
+static void
+iod_pack_queue(struct iod_cont *cont, struct iod_pack_seg *seg);
+
+/**
+ * \a seg lost a slot or stopped being cut from: retire it once empty, or
+ * compact it once less than half live. Caller holds pk_lock.
+ */
+static void
+iod_pack_check(struct iod_cont *cont, struct iod_pack_seg *seg)
+{
+	if (seg == cont->ic_pack.pk_cur || seg->ps_retired)
+		return;
+	if (seg->ps_live == 0)
+		seg->ps_retired = 1;
+	else if (seg->ps_live < seg->ps_tail / 2 && !seg->ps_queued)
+		iod_pack_queue(cont, seg);
+}
+
+/** add \a obj as the owner of a slot of \a seg. Caller holds pk_lock. */
+static int
+iod_pack_own(struct iod_pack_seg *seg, struct iod_obj *obj,
+	     unsigned long *slot)
+{
+	struct iod_obj	**objs;
+	unsigned long	max;
+
+	if (seg->ps_nobjs == seg->ps_maxobjs) {
+		max = iod_max(seg->ps_maxobjs * 2, 64UL);
+		objs = realloc(seg->ps_objs, max * sizeof(*objs));
+		if (objs == NULL)
+			return -ENOMEM;
+		seg->ps_objs = objs;
+		seg->ps_maxobjs = max;
+	}
+	*slot = seg->ps_nobjs;
+	seg->ps_objs[seg->ps_nobjs++] = obj;
+	return 0;
+}
+
+/**
+ * Cut a slot of \a cap bytes for \a obj from the current segment, starting a
+ * new one if it is full, and return where it is. Caller holds pk_lock.
+ */
+static int
+iod_pack_cut(struct iod_cont *cont, struct iod_obj *obj, uint64_t cap,
+	     struct iod_pack_seg **segp, uint64_t *base, unsigned long *slot)
+{
+	struct iod_pack		*pk = &cont->ic_pack;
+	struct iod_pack_seg	*seg = pk->pk_cur;
+	int			rc;
+
+	if (seg == NULL || seg->ps_tail + cap > iod_env.ie_pack_seg) {
+		rc = iod_pack_seg_add(cont, pk->pk_next_id,
+				      O_CREAT | O_TRUNC, &pk->pk_cur);
+		if (rc != 0)
+			return rc;
+		if (seg != NULL)
+			iod_pack_check(cont, seg);
+		seg = pk->pk_cur;
+	}
+	rc = iod_pack_own(seg, obj, slot);
+	if (rc != 0)
+		return rc;
+	*segp = seg;
+	*base = seg->ps_tail;
+	seg->ps_tail += cap;
+	seg->ps_live += cap;
+	return 0;
+}
+
+/** give the slot \a slot of \a cap bytes in \a seg up. Caller holds pk_lock. */
+static void
+iod_pack_drop(struct iod_cont *cont, struct iod_pack_seg *seg,
+	      unsigned long slot, uint64_t cap)
+{
+	seg->ps_objs[slot] = NULL;
+	seg->ps_live -= cap;
+	iod_pack_check(cont, seg);
+}
+
+/**
+ * Copy the log of \a obj into a new slot of \a cap bytes, or into a file of
+ * its own if \a cap is 0. A file of its own is not truncated: after a crash
+ * it already holds the appends the write-ahead log did not carry. Caller
+ * holds io_lock for write.
+ */
+static int
+iod_pack_move(struct iod_obj *obj, uint64_t cap)
+{
+	struct iod_cont		*cont = obj->io_cont;
+	struct iod_pack		*pk = &cont->ic_pack;
+	struct iod_pack_seg	*seg = NULL;
+	char			path[PATH_MAX];
+	iod_size_t		len = obj->io_tail;
+	unsigned long		slot = 0;
+	uint64_t		base = 0;
+	char			*buf;
+	int			fd = -1;
+	int			rc;
+
+	/* appends in flight go where they were given room */
+	while (__atomic_load_n(&obj->io_writers, __ATOMIC_ACQUIRE) > 0)
+		sched_yield();
+	buf = malloc(iod_max(len, (iod_size_t)1));
+	if (buf == NULL)
+		return -ENOMEM;
+	rc = iod_pread_full(obj->io_fd, buf, len, obj->io_base);
+	if (rc != 0)
+		goto out;
+
+	if (cap == 0) {
+		rc = iod_obj_log_path(obj, path, sizeof(path));
+		if (rc == 0) {
+			fd = open(path, O_RDWR | O_CREAT, 0644);
+			if (fd < 0)
+				rc = -errno;
+		}
+		if (rc == 0)
+			rc = iod_pwrite_full(fd, buf, len, 0);
+		if (rc != 0 && fd >= 0)
+			close(fd);
+	} else {
+		pthread_mutex_lock(&pk->pk_lock);
+		rc = iod_pack_cut(cont, obj, cap, &seg, &base, &slot);
+		pthread_mutex_unlock(&pk->pk_lock);
+		if (rc == 0)
+			rc = iod_pwrite_full(seg->ps_fd, buf, len, base);
+		if (rc != 0 && seg != NULL) {
+			pthread_mutex_lock(&pk->pk_lock);
+			iod_pack_drop(cont, seg, slot, cap);
+			pthread_mutex_unlock(&pk->pk_lock);
+		}
+	}
+	if (rc != 0)
+		goto out;
+
+	pthread_mutex_lock(&pk->pk_lock);
+	iod_pack_drop(cont, obj->io_seg, obj->io_slot, obj->io_cap);
+	obj->io_seg = seg;
+	obj->io_slot = slot;
+	obj->io_base = base;
+	obj->io_cap = cap;
+	obj->io_fd = seg != NULL ? seg->ps_fd : fd;
+	pthread_mutex_unlock(&pk->pk_lock);
+out:
+	free(buf);
+	return rc;
+}
+
+/** a slot for \a end bytes, grown from \a cap, or 0 if that is not packed */
+static uint64_t
+iod_pack_size(uint64_t cap, uint64_t end)
+{
+	uint64_t	max = iod_env.ie_pack_max;
+
+	if (end > max)
+		return 0;
+	cap = iod_max(cap * 2, (end + IOD_PACK_ALIGN - 1) &
+			       ~(uint64_t)(IOD_PACK_ALIGN - 1));
+	return iod_min(cap, max);
+}
+
+/**
+ * Make room in the data log of \a obj for it to grow to \a end bytes: a
+ * first log that small is packed, a packed one moves when it outgrows its
+ * slot, and any other is opened. Caller holds io_lock for write.
+ */
+int
+iod_pack_fit(struct iod_obj *obj, uint64_t end)
+{
+	struct iod_cont		*cont = obj->io_cont;
+	struct iod_pack		*pk = &cont->ic_pack;
+	struct iod_pack_seg	*seg;
+	uint64_t		cap;
+	int			rc;
+
+	if (obj->io_seg != NULL)
+		return end <= obj->io_cap ? 0 :
+		       iod_pack_move(obj, iod_pack_size(obj->io_cap, end));
+	if (obj->io_fd >= 0 || obj->io_tail > 0)
+		return iod_obj_log_file(obj);
+	if (end == 0)
+		return 0;
+	cap = iod_pack_size(0, end);
+	if (cap == 0)
+		return iod_obj_log_file(obj);
+
+	pthread_mutex_lock(&pk->pk_lock);
+	rc = iod_pack_cut(cont, obj, cap, &seg, &obj->io_base, &obj->io_slot);
+	if (rc == 0) {
+		obj->io_seg = seg;
+		obj->io_cap = cap;
+		obj->io_fd = seg->ps_fd;
+	}
+	pthread_mutex_unlock(&pk->pk_lock);
+	return rc;
+}
+
+/** \a obj is being freed: its slot, if any, is dead */
+void
+iod_pack_release(struct iod_obj *obj)
+{
+	struct iod_pack	*pk = &obj->io_cont->ic_pack;
+
+	if (obj->io_seg == NULL)
+		return;
+	pthread_mutex_lock(&pk->pk_lock);
+	iod_pack_drop(obj->io_cont, obj->io_seg, obj->io_slot, obj->io_cap);
+	obj->io_seg = NULL;
+	obj->io_fd = -1;
+	pthread_mutex_unlock(&pk->pk_lock);
+}
+
+/** the checkpoint being loaded packs \a obj in segment \a id */
+int
+iod_pack_attach(struct iod_obj *obj, uint32_t id, uint64_t base, uint64_t cap)
+{
+	struct iod_cont		*cont = obj->io_cont;
+	struct iod_pack		*pk = &cont->ic_pack;
+	struct iod_pack_seg	*seg;
+	int			rc = 0;
+
+	if (id == IOD_PACK_NONE)
+		return 0;
+	if (cap == 0 || obj->io_tail > cap)
+		return -EIO;
+	pthread_mutex_lock(&pk->pk_lock);
+	seg = iod_pack_find(pk, id);
+	if (seg == NULL)
+		rc = iod_pack_seg_add(cont, id, 0, &seg);
+	if (rc == 0)
+		rc = iod_pack_own(seg, obj, &obj->io_slot);
+	if (rc == 0) {
+		seg->ps_tail = iod_max(seg->ps_tail, base + cap);
+		seg->ps_live += cap;
+		obj->io_seg = seg;
+		obj->io_base = base;
+		obj->io_cap = cap;
+		obj->io_fd = seg->ps_fd;
+	}
+	pthread_mutex_unlock(&pk->pk_lock);
+	return rc;
+}
+
+/**
+ * The checkpoint is loaded: remove the segment files it does not know, and
+ * keep cutting slots from the newest segment it does, past its last live
+ * slot. Nothing the checkpoint knows lies beyond that.
+ */
+int
+iod_pack_open(struct iod_cont *cont)
+{
+	struct iod_pack		*pk = &cont->ic_pack;
+	struct iod_pack_seg	*seg;
+	struct dirent		*de;
+	char			path[PATH_MAX];
+	unsigned long		i;
+	unsigned int		id;
+	DIR			*dir;
+	int			n;
+
+	dir = opendir(cont->ic_bb_dir);
+	if (dir == NULL)
+		return -errno;
+	while ((de = readdir(dir)) != NULL) {
+		if (sscanf(de->d_name, IOD_PACK_PREFIX "%8x%n", &id, &n) != 1 ||
+		    de->d_name[n] != '\0' || iod_pack_find(pk, id) != NULL)
+			continue;
+		if (iod_pack_path(cont, id, path) == 0)
+			unlink(path);
+	}
+	closedir(dir);
+
+	for (i = 0; i < pk->pk_nsegs; i++) {
+		seg = pk->pk_segs[i];
+		if (pk->pk_cur == NULL || seg->ps_id > pk->pk_cur->ps_id)
+			pk->pk_cur = seg;
+	}
+	return 0;
+}
+
+/** the container is open: compact what the checkpoint left sparse */
+void
+iod_pack_start(struct iod_cont *cont)
+{
+	struct iod_pack	*pk = &cont->ic_pack;
+	unsigned long	i;
+
+	pthread_mutex_lock(&pk->pk_lock);
+	pk->pk_active = 1;
+	for (i = 0; i < pk->pk_nsegs; i++)
+		iod_pack_check(cont, pk->pk_segs[i]);
+	pthread_mutex_unlock(&pk->pk_lock);
+}
+
+/** no more compactions: the container is closing */
+void
+iod_pack_stop(struct iod_cont *cont)
+{
+	struct iod_pack	*pk = &cont->ic_pack;
+
+	pthread_mutex_lock(&pk->pk_lock);
+	pk->pk_active = 0;
+	pthread_mutex_unlock(&pk->pk_lock);
+}
+
+/** the checkpoint no longer finds anything in retired segments */
+void
+iod_pack_checkpointed(struct iod_cont *cont)
+{
+	struct iod_pack	*pk = &cont->ic_pack;
+	char		path[PATH_MAX];
+	unsigned long	i;
+
+	for (i = 0; i < pk->pk_nsegs; i++) {
+		if (pk->pk_segs[i]->ps_retired &&
+		    iod_pack_path(cont, pk->pk_segs[i]->ps_id, path) == 0)
+			unlink(path);
+	}
+}
+
+int
+iod_pack_sync(struct iod_cont *cont)
+{
+	struct iod_pack	*pk = &cont->ic_pack;
+	unsigned long	i;
+	int		rc = 0;
+
+	pthread_mutex_lock(&pk->pk_lock);
+	for (i = 0; i < pk->pk_nsegs; i++) {
+		if (!pk->pk_segs[i]->ps_retired &&
+		    fdatasync(pk->pk_segs[i]->ps_fd) != 0 && rc == 0)
+			rc = -errno;
+	}
+	pthread_mutex_unlock(&pk->pk_lock);
+	return rc;
+}
+
+/* ------------------------------ compaction ------------------------------ */
+
+/**
+ * Move every slot of one segment to the current one. An object is picked
+ * under ic_lock, which frees of rolled back objects hold, and moved under
+ * its io_lock; one that is busy stays, for a later compaction.
+ */
+static int
+iod_pack_compact_op(struct iod_op *op)
+{
+	struct iod_cont		*cont = op->op_u.pack.cont;
+	struct iod_pack_seg	*seg = op->op_u.pack.seg;
+	struct iod_pack		*pk = &cont->ic_pack;
+	struct iod_obj		*obj;
+	unsigned long		i;
+	int			busy;
+	int			rc = 0;
+
+	for (i = 0; rc == 0; i++) {
+		pthread_mutex_lock(&cont->ic_lock);
+		pthread_mutex_lock(&pk->pk_lock);
+		while (i < seg->ps_nobjs && seg->ps_objs[i] == NULL)
+			i++;
+		obj = i < seg->ps_nobjs ? seg->ps_objs[i] : NULL;
+		pthread_mutex_unlock(&pk->pk_lock);
+		busy = obj != NULL &&
+		       pthread_rwlock_trywrlock(&obj->io_lock) != 0;
+		pthread_mutex_unlock(&cont->ic_lock);
+		if (obj == NULL)
+			break;
+		if (busy)
+			continue;
+		if (obj->io_seg == seg)
+			rc = iod_pack_move(obj, obj->io_cap);
+		pthread_rwlock_unlock(&obj->io_lock);
+	}
+
+	pthread_mutex_lock(&pk->pk_lock);
+	seg->ps_queued = 0;
+	pthread_mutex_unlock(&pk->pk_lock);
+	pthread_mutex_lock(&cont->ic_lock);
+	if (__atomic_sub_fetch(&cont->ic_pack_bg, 1, __ATOMIC_RELAXED) == 0)
+		pthread_cond_broadcast(&cont->ic_persist_cond);
+	pthread_mutex_unlock(&cont->ic_lock);
+	return rc;
+}
+
+static void
+iod_pack_queue(struct iod_cont *cont, struct iod_pack_seg *seg)
+{
+	struct iod_op	*op;
+
+	if (!cont->ic_pack.pk_active)
+		return;
+	op = iod_op_alloc(NULL, IOD_EV_OBJ_SET_LAYOUT, iod_pack_compact_op,
+			  IOD_TID_UNKNOWN);
+	if (op == NULL)
+		return;
+	op->op_u.pack.cont = cont;
+	op->op_u.pack.seg = seg;
+	/* the close waits for it, and stops queueing under pk_lock first */
+	__atomic_add_fetch(&cont->ic_pack_bg, 1, __ATOMIC_RELAXED);
+	if (iod_sched_defer(op) != 0) {
+		__atomic_sub_fetch(&cont->ic_pack_bg, 1, __ATOMIC_RELAXED);
+		free(op);
+		return;
+	}
+	seg->ps_queued = 1;
+}
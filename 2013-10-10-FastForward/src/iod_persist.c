@@ -0,0 +1,1309 @@
+/*
+ * Migration between the burst buffer and central storage.
+ *
+ * Central storage keeps the newest persisted version of every object. Blob
+ * and array bytes are cut into stripe_size pieces placed on target_num
+ * shards as iod_place.c picks, a stripe of a chunked array counting whole
+ * chunk slots; an array whose dims_seq is not the identity is stored in the
+ * physical dimension order it names. KV objects are one shard. A persist
+ * streams blob and array bytes through the pipeline of iod_pipe.c, which
+ * leaves a checksum manifest beside every shard it writes; a layout change
+ * moves the shards already on central storage through it too.
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "iod_internal.h"
+
+#define IOD_MIGRATE_BUF		(1UL << 20)
+
+int
+iod_central_obj_path(struct iod_obj *obj, uint32_t target, char *buf,
+		     size_t len)
+{
+	int	n;
+
+	n = snprintf(buf, len, "%s/t%u/%016llx.%016llx",
+		     obj->io_cont->ic_central_dir, target,
+		     (unsigned long long)obj->io_oid.oid_hi,
+		     (unsigned long long)obj->io_oid.oid_lo);
+	return n < (int)len ? 0 : -ENAMETOOLONG;
+}
+
+static int
+iod_seq_identity(struct iod_obj *obj)
+{
+	uint32_t	i;
+
+	/* chunks are stored in slot order, whatever the dims_seq */
+	if (obj->io_type != IOD_OBJ_ARRAY || obj->io_chunked)
+		return 1;
+	for (i = 0; i < obj->io_ndims; i++) {
+		if (obj->io_seq[i] != i)
+			return 0;
+	}
+	return 1;
+}
+
+/** stripe unit in bytes of \a obj under \a layout, 0 for unstriped */
+static iod_size_t
+iod_stripe_bytes(struct iod_obj *obj, const iod_layout_t *layout)
+{
+	iod_size_t	unit = layout->stripe_size;
+
+	if (obj->io_type == IOD_OBJ_ARRAY)
+		unit *= obj->io_chunked ? iod_chunk_bytes(obj) :
+					  obj->io_cell_size;
+	return layout->target_num > 1 ? unit : 0;
+}
+
+/** whether a byte keeps its central offset in its shard under \a layout */
+static int
+iod_central_sparse(struct iod_obj *obj, const iod_layout_t *layout)
+{
+	return iod_stripe_bytes(obj, layout) == 0 ||
+	       layout->placement != IOD_PLACE_ROUND_ROBIN;
+}
+
+/**
+ * Map central byte \a off to its shard under \a layout and the offset
+ * inside it; \a run returns how many bytes stay contiguous in that shard.
+ * Round-robin packs each shard densely, hash placements leave every byte at
+ * its central offset.
+ */
+static void
+iod_central_map(struct iod_obj *obj, const iod_layout_t *layout,
+		iod_off_t off, uint32_t *target, iod_off_t *toff,
+		iod_size_t *run)
+{
+	iod_size_t	unit = iod_stripe_bytes(obj, layout);
+	uint64_t	stripe;
+
+	if (unit == 0) {
+		*target = 0;
+		*toff = off;
+		*run = (iod_size_t)-1 - off;
+		return;
+	}
+	stripe = off / unit;
+	*target = iod_place_target(obj, layout, stripe);
+	*toff = layout->placement == IOD_PLACE_ROUND_ROBIN ?
+		stripe / layout->target_num * unit + off % unit : off;
+	*run = unit - off % unit;
+}
+
+/** the inverse of iod_central_map: central byte at \a toff of \a target */
+static iod_off_t
+iod_central_unmap(struct iod_obj *obj, const iod_layout_t *layout,
+		  uint32_t target, iod_off_t toff)
+{
+	iod_size_t	unit = iod_stripe_bytes(obj, layout);
+
+	if (iod_central_sparse(obj, layout))
+		return toff;
+	return (toff / unit * layout->target_num + target) * unit +
+	       toff % unit;
+}
+
+static int
+iod_central_mkdir(struct iod_obj *obj, uint32_t target)
+{
+	char	dir[PATH_MAX];
+
+	if (snprintf(dir, sizeof(dir), "%s/t%u", obj->io_cont->ic_central_dir,
+		     target) >= (int)sizeof(dir))
+		return -ENAMETOOLONG;
+	return iod_mkdir_p(dir);
+}
+
+/** open shard \a target of \a obj, or the file named after it plus \a sfx */
+static int
+iod_central_open_as(struct iod_obj *obj, uint32_t target, const char *sfx,
+		    int flags)
+{
+	char	path[PATH_MAX];
+	int	fd;
+	int	rc;
+
+	rc = iod_central_obj_path(obj, target, path, sizeof(path));
+	if (rc == 0 && strlen(path) + strlen(sfx) >= sizeof(path))
+		rc = -ENAMETOOLONG;
+	if (rc != 0)
+		return rc;
+	strcat(path, sfx);
+	fd = open(path, flags, 0644);
+	if (fd < 0 && errno == ENOENT && (flags & O_CREAT)) {
+		rc = iod_central_mkdir(obj, target);
+		if (rc != 0)
+			return rc;
+		fd = open(path, flags, 0644);
+	}
+	return fd < 0 ? -errno : fd;
+}
+
+static int
+iod_central_open(struct iod_obj *obj, uint32_t target, int flags)
+{
+	return iod_central_open_as(obj, target, "", flags);
+}
+
+/** unlink shard \a target plus \a sfx, and its manifest */
+static int
+iod_central_unlink(struct iod_obj *obj, uint32_t target, const char *sfx)
+{
+	char	path[PATH_MAX];
+	int	rc;
+
+	rc = iod_central_obj_path(obj, target, path, sizeof(path));
+	if (rc == 0 && strlen(path) + strlen(sfx) + 4 >= sizeof(path))
+		rc = -ENAMETOOLONG;
+	if (rc != 0)
+		return rc;
+	strcat(path, sfx);
+	if (unlink(path) != 0 && errno != ENOENT)
+		rc = -errno;
+	strcat(path, ".cks");
+	if (unlink(path) != 0 && errno != ENOENT && rc == 0)
+		rc = -errno;
+	return rc;
+}
+
+/**
+ * Read or write central bytes [off, off + len) of \a obj, in layout order.
+ * \a fds, if not NULL, caches an open descriptor per shard (-1 for none) that
+ * the caller closes; otherwise each shard is opened for the call.
+ */
+int
+iod_central_io(struct iod_obj *obj, int *fds, iod_off_t off, iod_size_t len,
+	       char *buf, int write)
+{
+	uint32_t	target;
+	iod_off_t	toff;
+	iod_size_t	run;
+	int		fd;
+	int		rc = 0;
+
+	while (len > 0 && rc == 0) {
+		iod_central_map(obj, &obj->io_layout, off, &target, &toff,
+				&run);
+		run = iod_min(run, len);
+		if (fds != NULL && fds[target] >= 0)
+			fd = fds[target];
+		else
+			fd = iod_central_open(obj, target,
+					      write ? O_WRONLY | O_CREAT :
+						      O_RDONLY);
+		if (fd == -ENOENT && !write) {
+			/* never persisted there: reads as a hole */
+			memset(buf, 0, run);
+		} else if (fd < 0) {
+			return fd;
+		} else {
+			rc = write ? iod_pwrite_full(fd, buf, run, toff) :
+				     iod_pread_full(fd, buf, run, toff);
+			if (fds != NULL)
+				fds[target] = fd;
+			else
+				close(fd);
+		}
+		off += run;
+		buf += run;
+		len -= run;
+	}
+	return rc;
+}
+
+/** central byte offset of the cell at logical byte \a off of an array */
+static iod_off_t
+iod_array_phys(struct iod_obj *obj, iod_size_t dim0, iod_off_t off)
+{
+	iod_size_t	idx[IOD_MAX_DIMS];
+	iod_size_t	cell = off / obj->io_cell_size;
+	iod_size_t	dim;
+	iod_size_t	phys = 0;
+	int		d;
+
+	/* what is left indexes the first dimension, it may have grown */
+	for (d = obj->io_ndims - 1; d > 0; d--) {
+		idx[d] = cell % obj->io_dims[d];
+		cell /= obj->io_dims[d];
+	}
+	idx[0] = cell;
+	for (d = 0; d < (int)obj->io_ndims; d++) {
+		dim = obj->io_seq[d] == 0 ? dim0 : obj->io_dims[obj->io_seq[d]];
+		phys = phys * dim + idx[obj->io_seq[d]];
+	}
+	return phys * obj->io_cell_size + off % obj->io_cell_size;
+}
+
+/**
+ * Read logical bytes [off, off + len) of \a obj from central storage.
+ * Caller holds io_lock.
+ */
+int
+iod_central_read(struct iod_obj *obj, iod_off_t off, iod_size_t len,
+		 char *buf)
+{
+	iod_size_t	dim0;
+	iod_size_t	n;
+	int		rc;
+
+	if (iod_seq_identity(obj))
+		return iod_central_io(obj, NULL, off, len, buf, 0);
+
+	/* a permuted array maps cell by cell */
+	dim0 = obj->io_dims[0];
+	while (len > 0) {
+		n = iod_min(len, obj->io_cell_size - off % obj->io_cell_size);
+		rc = iod_central_io(obj, NULL, iod_array_phys(obj, dim0, off),
+				    n, buf, 0);
+		if (rc != 0)
+			return rc;
+		off += n;
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* ------------------------------ persist --------------------------------- */
+
+static void
+iod_central_remove(struct iod_obj *obj)
+{
+	uint32_t	i;
+
+	for (i = 0; i < obj->io_layout.target_num; i++)
+		iod_central_unlink(obj, i, "");
+}
+
+/** one object to persist and the newest TID in range that touched it */
+struct iod_pobj {
+	struct iod_obj		*po_obj;
+	iod_trans_id_t		po_last;
+	int			po_unlink;	/* unlinked in range */
+	int			po_pri;		/* "persist_priority" */
+};
+
+/** what one persist ships: TIDs (pr_lo, pr_hi] and the objects they touched */
+struct iod_persist {
+	struct iod_cont		*pr_cont;
+	struct iod_pipe		*pr_pipe;
+	iod_trans_id_t		pr_lo;
+	iod_trans_id_t		pr_hi;
+	struct iod_pobj		*pr_obj;
+	unsigned long		pr_nobj;
+	unsigned long		pr_max;
+	iod_size_t		pr_bytes;	/* queued on the pipeline */
+	iod_size_t		pr_skipped;	/* overwritten in range */
+};
+
+static int
+iod_pobj_cmp(const void *a, const void *b)
+{
+	const struct iod_pobj	*pa = a;
+	const struct iod_pobj	*pb = b;
+
+	if (pa->po_obj != pb->po_obj)
+		return pa->po_obj < pb->po_obj ? -1 : 1;
+	return pa->po_last < pb->po_last ? -1 : pa->po_last > pb->po_last;
+}
+
+/** higher "persist_priority" first */
+static int
+iod_pobj_pri_cmp(const void *a, const void *b)
+{
+	const struct iod_pobj	*pa = a;
+	const struct iod_pobj	*pb = b;
+
+	if (pa->po_pri != pb->po_pri)
+		return pa->po_pri > pb->po_pri ? -1 : 1;
+	return pa->po_obj < pb->po_obj ? -1 : pa->po_obj > pb->po_obj;
+}
+
+static int
+iod_persist_add(struct iod_persist *pr, struct iod_obj *obj,
+		iod_trans_id_t tid)
+{
+	struct iod_pobj	*po;
+	unsigned long	max;
+
+	if (pr->pr_nobj == pr->pr_max) {
+		max = iod_max(pr->pr_max * 2, 64UL);
+		po = realloc(pr->pr_obj, max * sizeof(*po));
+		if (po == NULL)
+			return -ENOMEM;
+		pr->pr_obj = po;
+		pr->pr_max = max;
+	}
+	po = &pr->pr_obj[pr->pr_nobj++];
+	po->po_obj = obj;
+	po->po_last = tid;
+	po->po_unlink = obj->io_unlink_tid == tid;
+	po->po_pri = obj->io_persist_pri;
+	return 0;
+}
+
+/**
+ * Pick the readable TIDs above ic_persisted up to \a tid and collect the
+ * objects they touched, once each, higher "persist_priority" first. Stops
+ * with -EAGAIN at a lower TID still open, which independent TIDs above it
+ * must not overtake on central storage; pr_hi then ends below it. Caller
+ * holds ic_lock.
+ */
+static int
+iod_persist_plan(struct iod_persist *pr, iod_trans_id_t tid)
+{
+	struct iod_cont		*cont = pr->pr_cont;
+	struct iod_trans	*trans = iod_trans_find(cont, tid);
+	unsigned long		i;
+	unsigned long		j;
+	unsigned long		n;
+	int			rc = 0;
+
+	pr->pr_lo = cont->ic_persisted;
+	pr->pr_hi = cont->ic_persisted;
+	/* a forgotten TID left nothing to persist */
+	if (trans == NULL && tid < cont->ic_trans_floor)
+		return 0;
+	if (trans == NULL || (trans->it_status != IOD_TRANS_READABLE &&
+			      trans->it_status != IOD_TRANS_DURABLE))
+		return -EINVAL;
+	if (trans->it_status == IOD_TRANS_DURABLE)
+		return 0;
+
+	for (i = 0; i < cont->ic_ntrans && rc == 0; i++) {
+		trans = cont->ic_trans[i];
+		if (trans->it_tid > tid)
+			break;
+		if (trans->it_status == IOD_TRANS_STARTED ||
+		    trans->it_status == IOD_TRANS_FINISHED) {
+			rc = -EAGAIN;
+			break;
+		}
+		if (trans->it_status != IOD_TRANS_READABLE)
+			continue;
+		for (j = 0; j < trans->it_ndirty && rc == 0; j++)
+			rc = iod_persist_add(pr, trans->it_dirty[j],
+					     trans->it_tid);
+		if (rc == 0)
+			pr->pr_hi = trans->it_tid;
+	}
+	if (rc == -ENOMEM)
+		return rc;
+
+	/* one entry per object, carrying its newest TID */
+	if (pr->pr_nobj > 1)
+		qsort(pr->pr_obj, pr->pr_nobj, sizeof(*pr->pr_obj),
+		      iod_pobj_cmp);
+	for (i = 0, n = 0; i < pr->pr_nobj; i++) {
+		if (n > 0 && pr->pr_obj[n - 1].po_obj == pr->pr_obj[i].po_obj) {
+			pr->pr_obj[n - 1].po_last = pr->pr_obj[i].po_last;
+			pr->pr_obj[n - 1].po_unlink |= pr->pr_obj[i].po_unlink;
+		} else {
+			pr->pr_obj[n++] = pr->pr_obj[i];
+		}
+	}
+	pr->pr_nobj = n;
+	for (i = 0; i < n && pr->pr_obj[i].po_pri == 0; i++)
+		;
+	if (i < n)
+		qsort(pr->pr_obj, n, sizeof(*pr->pr_obj), iod_pobj_pri_cmp);
+	return rc;
+}
+
+/**
+ * The pipeline destination of shard \a target, opened on first use: the
+ * shard itself, its manifest appended to, for a NULL \a sfx, else the file
+ * named after it plus \a sfx, truncated, with a manifest of its own.
+ */
+static int
+iod_central_dst(struct iod_pipe *p, struct iod_obj *obj, uint32_t target,
+		const char *sfx, struct iod_pdst **dsts)
+{
+	char	cks[16];
+	int	flags = O_WRONLY | O_CREAT | (sfx != NULL ? O_TRUNC : 0);
+	int	fd;
+	int	cks_fd;
+
+	if (dsts[target] != NULL)
+		return 0;
+	snprintf(cks, sizeof(cks), "%s.cks", sfx != NULL ? sfx : "");
+	fd = iod_central_open_as(obj, target, sfx != NULL ? sfx : "", flags);
+	if (fd < 0)
+		return fd;
+	cks_fd = iod_central_open_as(obj, target, cks, flags | O_APPEND);
+	if (cks_fd < 0) {
+		close(fd);
+		return cks_fd;
+	}
+	dsts[target] = iod_pipe_dst(p, fd, cks_fd);
+	return dsts[target] == NULL ? -ENOMEM : 0;
+}
+
+/**
+ * Flatten \a layers, newest first, into the bytes still visible above them
+ * all and queue those on the shards of \a obj. The data log is read through
+ * \a fd from \a base, where it was when the layers were picked: a packed log
+ * that moves since leaves its bytes where they were.
+ */
+static int
+iod_persist_delta(struct iod_persist *pr, struct iod_obj *obj,
+		  struct iod_layer **layers, unsigned long nr, int fd,
+		  uint64_t base)
+{
+	struct iod_layer	flat;
+	struct iod_pdst		**dsts;
+	struct iod_extent	*ext;
+	unsigned long		i;
+	uint32_t		ntgt = iod_max(obj->io_layout.target_num, 1U);
+	uint32_t		target;
+	iod_off_t		toff;
+	iod_size_t		skipped;
+	iod_size_t		done;
+	iod_size_t		run;
+	int			rc;
+
+	memset(&flat, 0, sizeof(flat));
+	rc = iod_layer_flatten(layers, nr, &flat, &skipped);
+	dsts = calloc(ntgt, sizeof(*dsts));
+	if (rc != 0 || dsts == NULL) {
+		free(flat.il_ext);
+		free(dsts);
+		return rc != 0 ? rc : -ENOMEM;
+	}
+	pr->pr_bytes += flat.il_bytes;
+	pr->pr_skipped += skipped;
+
+	for (i = 0; i < flat.il_nr && rc == 0; i++) {
+		ext = &flat.il_ext[i];
+		for (done = 0; done < ext->ie_len && rc == 0; done += run) {
+			iod_central_map(obj, &obj->io_layout,
+					ext->ie_off + done, &target, &toff,
+					&run);
+			run = iod_min(iod_min(run, ext->ie_len - done),
+				      IOD_MIGRATE_BUF);
+			rc = iod_central_dst(pr->pr_pipe, obj, target, NULL,
+					     dsts);
+			if (rc == 0)
+				rc = iod_pipe_put(pr->pr_pipe, dsts[target],
+						  fd, base + ext->ie_addr +
+						  done, run, toff);
+		}
+	}
+	for (i = 0; i < ntgt; i++)
+		if (dsts[i] != NULL)
+			iod_pipe_dst_close(pr->pr_pipe, dsts[i]);
+	free(dsts);
+	free(flat.il_ext);
+	return rc;
+}
+
+/**
+ * Ship one object. Blob and identity array bytes go through the pipeline
+ * from the committed layers of the range, flattened into one delta; the
+ * layers are immutable and so are read without io_lock. KV objects and
+ * permuted arrays are written whole as seen at their newest TID in range.
+ */
+static int
+iod_persist_obj(struct iod_persist *pr, struct iod_pobj *po)
+{
+	struct iod_obj		*obj = po->po_obj;
+	struct iod_layer	**layers = NULL;
+	struct iod_layer	*layer;
+	struct iod_list		*pos;
+	unsigned long		nr = 0;
+	char			path[PATH_MAX];
+	uint64_t		base;
+	int			fd;
+	int			rc;
+
+	pthread_rwlock_rdlock(&obj->io_lock);
+	if (po->po_unlink) {
+		iod_central_remove(obj);
+		rc = 0;
+	} else if (obj->io_type == IOD_OBJ_KV) {
+		rc = iod_central_obj_path(obj, 0, path, sizeof(path));
+		if (rc == 0)
+			rc = iod_central_mkdir(obj, 0);
+		if (rc == 0)
+			rc = iod_kv_persist(obj, po->po_last, path);
+	} else {
+		rc = iod_obj_log_open(obj);
+		if (rc == 0 && !iod_seq_identity(obj)) {
+			rc = iod_migrate_transpose(obj, po->po_last);
+		} else if (rc == 0) {
+			/* newest first, as they hang off io_layers */
+			iod_list_for_each(pos, &obj->io_layers)
+				nr++;
+			layers = malloc(iod_max(nr, 1UL) * sizeof(*layers));
+			if (layers == NULL)
+				rc = -ENOMEM;
+			nr = 0;
+			iod_list_for_each(pos, &obj->io_layers) {
+				layer = iod_list_entry(pos, struct iod_layer,
+						       il_link);
+				if (layers != NULL && layer->il_committed &&
+				    layer->il_tid > pr->pr_lo &&
+				    layer->il_tid <= pr->pr_hi)
+					layers[nr++] = layer;
+			}
+		}
+	}
+	fd = obj->io_fd;
+	base = obj->io_base;
+	pthread_rwlock_unlock(&obj->io_lock);
+
+	if (layers != NULL) {
+		rc = iod_persist_delta(pr, obj, layers, nr, fd, base);
+		free(layers);
+	}
+	return rc;
+}
+
+/**
+ * Persist every readable TID up to \a tid. The TIDs and objects are picked
+ * under ic_lock, then the objects are shipped through a pipeline with no
+ * container lock held, and the TIDs turn durable together once all of it
+ * is synced. Caller holds ic_persist_lock.
+ */
+static int
+iod_persist_run(struct iod_cont *cont, iod_trans_id_t tid)
+{
+	struct iod_persist	pr;
+	unsigned long		i;
+	int			rc;
+	int			rc2 = 0;
+	int			fin;
+
+	memset(&pr, 0, sizeof(pr));
+	pr.pr_cont = cont;
+	pthread_mutex_lock(&cont->ic_lock);
+	rc = iod_persist_plan(&pr, tid);
+	pthread_mutex_unlock(&cont->ic_lock);
+	if (rc != 0 && rc != -EAGAIN)
+		goto out;
+
+	if (pr.pr_nobj > 0) {
+		pr.pr_pipe = iod_pipe_start(iod_env.ie_persist_budget,
+					    iod_max(iod_env.ie_nthreads, 1U));
+		if (pr.pr_pipe == NULL) {
+			rc = -ENOMEM;
+			goto out;
+		}
+		for (i = 0; i < pr.pr_nobj && rc2 == 0; i++)
+			rc2 = iod_persist_obj(&pr, &pr.pr_obj[i]);
+		fin = iod_pipe_finish(pr.pr_pipe);
+		if (rc2 == 0)
+			rc2 = fin;
+		if (rc2 != 0) {
+			rc = rc2;
+			goto out;
+		}
+	}
+
+	pthread_mutex_lock(&cont->ic_lock);
+	iod_trans_persisted(cont, pr.pr_lo, pr.pr_hi);
+	cont->ic_stats.persist_bytes += pr.pr_bytes;
+	cont->ic_stats.persist_skipped += pr.pr_skipped;
+	pthread_mutex_unlock(&cont->ic_lock);
+	/* what just turned durable may now leave the burst buffer */
+	for (i = 0; i < pr.pr_nobj; i++)
+		if (!pr.pr_obj[i].po_unlink)
+			iod_cache_shed(pr.pr_obj[i].po_obj);
+	if (iod_env.ie_bb_capacity != 0 &&
+	    iod_cache_used(cont) > iod_env.ie_bb_high)
+		iod_cache_evict(cont, 0);
+out:
+	free(pr.pr_obj);
+	return rc;
+}
+
+/** a background persist, on its own thread so the worker pool stays free */
+static void *
+iod_persist_thread(void *arg)
+{
+	struct iod_op	*op = arg;
+	struct iod_cont	*cont = op->op_u.cont;
+	int		rc;
+
+	pthread_mutex_lock(&cont->ic_persist_lock);
+	rc = iod_persist_run(cont, op->op_tid);
+	pthread_mutex_unlock(&cont->ic_persist_lock);
+	iod_ev_complete(op->op_ev, rc);
+	free(op);
+
+	pthread_mutex_lock(&cont->ic_lock);
+	if (--cont->ic_persist_bg == 0)
+		pthread_cond_broadcast(&cont->ic_persist_cond);
+	pthread_mutex_unlock(&cont->ic_lock);
+	return NULL;
+}
+
+/**
+ * wait for the background persists, readahead, compactions and rollbacks of
+ * \a cont, before it is closed
+ */
+void
+iod_persist_drain(struct iod_cont *cont)
+{
+	pthread_mutex_lock(&cont->ic_lock);
+	while (cont->ic_persist_bg > 0 || cont->ic_fetch_bg > 0 ||
+	       __atomic_load_n(&cont->ic_pack_bg, __ATOMIC_RELAXED) > 0 ||
+	       cont->ic_reclaim_bg > 0)
+		pthread_cond_wait(&cont->ic_persist_cond, &cont->ic_lock);
+	pthread_mutex_unlock(&cont->ic_lock);
+}
+
+/**
+ * With an event the persist runs in the background, one at a time per
+ * container, and foreground I/O carries on while it streams.
+ */
+iod_ret_t
+iod_trans_persist(iod_handle_t coh, iod_trans_id_t tid, iod_hint_list_t *hints,
+		  iod_event_t *event)
+{
+	struct iod_cont	*cont = iod_cont_lookup(coh);
+	struct iod_op	*op;
+	pthread_attr_t	attr;
+	pthread_t	th;
+	int		rc;
+
+	(void)hints;
+	if (cont == NULL)
+		return iod_ev_return(event, IOD_EV_TRANS_PERSIST, -EINVAL);
+	if (event == NULL) {
+		pthread_mutex_lock(&cont->ic_persist_lock);
+		rc = iod_persist_run(cont, tid);
+		pthread_mutex_unlock(&cont->ic_persist_lock);
+		return rc;
+	}
+
+	op = iod_op_alloc(event, IOD_EV_TRANS_PERSIST, NULL, tid);
+	if (op == NULL)
+		return iod_ev_return(event, IOD_EV_TRANS_PERSIST, -ENOMEM);
+	op->op_u.cont = cont;
+	pthread_mutex_lock(&cont->ic_lock);
+	cont->ic_persist_bg++;
+	pthread_mutex_unlock(&cont->ic_lock);
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	rc = pthread_create(&th, &attr, iod_persist_thread, op);
+	pthread_attr_destroy(&attr);
+	if (rc != 0)
+		iod_persist_thread(op);	/* no thread to spare: run it here */
+	return 0;
+}
+
+/* ------------------------------ reshard --------------------------------- */
+
+/** one layout change of an object on its way through a pipeline */
+struct iod_reshard {
+	struct iod_pipe		*rs_pipe;
+	struct iod_obj		*rs_obj;
+	const iod_layout_t	*rs_old;
+	const char		*rs_sfx;	/* NULL: moved in place */
+	struct iod_pdst		**rs_dst;	/* by new target */
+	struct iod_seg		*rs_moved;	/* to punch out of old shards */
+	unsigned long		rs_nr;
+	unsigned long		rs_max;
+	iod_size_t		rs_bytes;	/* queued on the pipeline */
+};
+
+/** remember that \a len bytes at \a off of old shard \a t moved away */
+static int
+iod_reshard_moved(struct iod_reshard *rs, uint32_t t, iod_off_t off,
+		  iod_size_t len)
+{
+	struct iod_seg	*seg;
+	unsigned long	max;
+
+	seg = rs->rs_nr > 0 ? &rs->rs_moved[rs->rs_nr - 1] : NULL;
+	if (seg != NULL && seg->is_src == (int)t &&
+	    seg->is_off + seg->is_len == (iod_size_t)off) {
+		seg->is_len += len;
+		return 0;
+	}
+	if (rs->rs_nr == rs->rs_max) {
+		max = iod_max(rs->rs_max * 2, 16UL);
+		seg = realloc(rs->rs_moved, max * sizeof(*seg));
+		if (seg == NULL)
+			return -ENOMEM;
+		rs->rs_moved = seg;
+		rs->rs_max = max;
+	}
+	seg = &rs->rs_moved[rs->rs_nr++];
+	seg->is_off = off;
+	seg->is_len = len;
+	seg->is_src = t;
+	seg->is_addr = 0;
+	return 0;
+}
+
+/**
+ * Queue the data of old shard \a t, open on \a fd, for its shards under
+ * the new layout: the bytes that change target when moving in place, all
+ * of them otherwise.
+ */
+static int
+iod_reshard_shard(struct iod_reshard *rs, uint32_t t, int fd)
+{
+	struct iod_obj	*obj = rs->rs_obj;
+	uint32_t	target;
+	off_t		pos;
+	off_t		end;
+	iod_off_t	toff;
+	iod_off_t	ntoff;
+	iod_off_t	off;
+	iod_size_t	run;
+	iod_size_t	nrun;
+	int		rc = 0;
+
+	for (pos = 0; rc == 0; pos = end) {
+		pos = lseek(fd, pos, SEEK_DATA);
+		if (pos < 0)
+			return errno == ENXIO ? 0 : -errno;
+		end = lseek(fd, pos, SEEK_HOLE);
+		if (end < 0)
+			return -errno;
+		for (toff = pos; toff < (iod_off_t)end && rc == 0;
+		     toff += run) {
+			off = iod_central_unmap(obj, rs->rs_old, t, toff);
+			iod_central_map(obj, rs->rs_old, off, &target, &ntoff,
+					&run);
+			iod_central_map(obj, &obj->io_layout, off, &target,
+					&ntoff, &nrun);
+			run = iod_min(iod_min(run, nrun),
+				      iod_min(end - toff, IOD_MIGRATE_BUF));
+			if (rs->rs_sfx == NULL && target == t)
+				continue;	/* stays put */
+			rc = iod_central_dst(rs->rs_pipe, obj, target,
+					     rs->rs_sfx, rs->rs_dst);
+			if (rc == 0)
+				rc = iod_pipe_put(rs->rs_pipe,
+						  rs->rs_dst[target], fd, toff,
+						  run, ntoff);
+			if (rc == 0 && rs->rs_sfx == NULL)
+				rc = iod_reshard_moved(rs, t, toff, run);
+			rs->rs_bytes += run;
+		}
+	}
+	return rc;
+}
+
+/**
+ * Once the pipeline is synced, drop what the old layout left behind: the
+ * moved ranges of shards moved in place, the shards past the new
+ * target_num, or else put the copies in place of the old shards.
+ */
+static int
+iod_reshard_commit(struct iod_reshard *rs, uint32_t ontgt, uint32_t nntgt)
+{
+	struct iod_obj	*obj = rs->rs_obj;
+	struct iod_seg	*seg;
+	char		from[PATH_MAX];
+	char		to[PATH_MAX];
+	unsigned long	i;
+	uint32_t	t;
+	int		fd;
+	int		rc = 0;
+
+	for (i = 0; i < rs->rs_nr && rc == 0; i++) {
+		seg = &rs->rs_moved[i];
+		if ((uint32_t)seg->is_src >= nntgt)
+			continue;
+		fd = iod_central_open(obj, seg->is_src, O_WRONLY);
+		if (fd < 0)
+			return fd;
+		if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+			      seg->is_off, seg->is_len) != 0)
+			rc = -errno;
+		close(fd);
+	}
+	for (t = 0; t < nntgt && rc == 0 && rs->rs_sfx != NULL; t++) {
+		if (rs->rs_dst[t] == NULL) {
+			/* nothing lands there any more */
+			rc = iod_central_unlink(obj, t, "");
+			continue;
+		}
+		rc = iod_central_obj_path(obj, t, to, sizeof(to));
+		if (rc == 0 && strlen(to) + 8 >= sizeof(to))
+			rc = -ENAMETOOLONG;
+		if (rc != 0)
+			break;
+		snprintf(from, sizeof(from), "%s%s", to, rs->rs_sfx);
+		if (rename(from, to) != 0)
+			rc = -errno;
+		strcat(from, ".cks");
+		strcat(to, ".cks");
+		if (rc == 0 && rename(from, to) != 0)
+			rc = -errno;
+	}
+	for (t = nntgt; t < ontgt && rc == 0; t++)
+		rc = iod_central_unlink(obj, t, "");
+	return rc;
+}
+
+/**
+ * Move what \a obj has on central storage from layout \a old to its current
+ * one. A stripe that keeps its offset under both layouts, as hash placed
+ * ones do, moves in place if its target changes and stays put otherwise;
+ * anything else copies every shard to a new file that then replaces it.
+ * Caller holds ic_persist_lock and io_lock for write.
+ */
+int
+iod_central_reshard(struct iod_obj *obj, const iod_layout_t *old)
+{
+	struct iod_reshard	rs;
+	struct iod_cont		*cont = obj->io_cont;
+	uint32_t		ontgt = iod_max(old->target_num, 1U);
+	uint32_t		nntgt = iod_max(obj->io_layout.target_num, 1U);
+	uint32_t		t;
+	int			*fds;
+	int			found = 0;
+	int			rc = 0;
+	int			fin;
+
+	if (obj->io_type == IOD_OBJ_KV)
+		return 0;	/* one shard, whatever the layout */
+	memset(&rs, 0, sizeof(rs));
+	rs.rs_obj = obj;
+	rs.rs_old = old;
+	if (!iod_central_sparse(obj, old) ||
+	    !iod_central_sparse(obj, &obj->io_layout))
+		rs.rs_sfx = ".new";
+	fds = malloc(ontgt * sizeof(*fds));
+	rs.rs_dst = calloc(nntgt, sizeof(*rs.rs_dst));
+	if (fds == NULL || rs.rs_dst == NULL) {
+		rc = -ENOMEM;
+		ontgt = 0;
+	}
+	for (t = 0; t < ontgt; t++) {
+		fds[t] = iod_central_open(obj, t, O_RDONLY);
+		if (fds[t] >= 0)
+			found = 1;
+		else if (fds[t] != -ENOENT && rc == 0)
+			rc = fds[t];
+	}
+	if (rc != 0 || !found)
+		goto out;
+
+	rs.rs_pipe = iod_pipe_start(iod_env.ie_persist_budget,
+				    iod_max(iod_env.ie_nthreads, 1U));
+	if (rs.rs_pipe == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+	for (t = 0; t < ontgt && rc == 0; t++)
+		if (fds[t] >= 0)
+			rc = iod_reshard_shard(&rs, t, fds[t]);
+	for (t = 0; t < nntgt; t++)
+		if (rs.rs_dst[t] != NULL)
+			iod_pipe_dst_close(rs.rs_pipe, rs.rs_dst[t]);
+	fin = iod_pipe_finish(rs.rs_pipe);
+	if (rc == 0)
+		rc = fin;
+	/* rs_dst only tells which new shards got data from here on */
+	if (rc == 0)
+		rc = iod_reshard_commit(&rs, ontgt, nntgt);
+	for (t = 0; rc != 0 && rs.rs_sfx != NULL && t < nntgt; t++)
+		if (rs.rs_dst[t] != NULL)
+			iod_central_unlink(obj, t, rs.rs_sfx);
+	if (rc == 0) {
+		pthread_mutex_lock(&cont->ic_lock);
+		cont->ic_stats.reshard_bytes += rs.rs_bytes;
+		pthread_mutex_unlock(&cont->ic_lock);
+	}
+out:
+	for (t = 0; t < ontgt; t++)
+		if (fds[t] >= 0)
+			close(fds[t]);
+	free(fds);
+	free(rs.rs_dst);
+	free(rs.rs_moved);
+	return rc;
+}
+
+/* ------------------------------- purge ---------------------------------- */
+
+/**
+ * Drop the BB copy of every committed blob or array version up to \a tid
+ * and return the log bytes given back. Caller holds io_lock for write.
+ */
+iod_size_t
+iod_obj_purge_locked(struct iod_obj *obj, iod_trans_id_t tid)
+{
+	struct iod_layer	*layer;
+	struct iod_list		*pos;
+	struct iod_list		*n;
+	iod_size_t		freed = 0;
+	unsigned long		i;
+
+	iod_list_for_each_safe(pos, n, &obj->io_layers) {
+		layer = iod_list_entry(pos, struct iod_layer, il_link);
+		if (layer->il_tid > tid || !layer->il_committed)
+			continue;
+		for (i = 0; obj->io_fd >= 0 && i < layer->il_nr; i++) {
+			iod_cache_punch(obj, layer->il_ext[i].ie_addr,
+					layer->il_ext[i].ie_len);
+			freed += layer->il_ext[i].ie_len;
+		}
+		iod_layer_free(layer);
+	}
+	if (tid > obj->io_purged)
+		obj->io_purged = tid;
+	iod_extent_rebuild(obj);
+	return freed;
+}
+
+/**
+ * Drop the BB copy of every version of the object up to \a tid. Reads that
+ * fall through to a purged range are served from central storage.
+ */
+iod_ret_t
+iod_obj_purge(iod_handle_t oh, iod_trans_id_t tid, iod_hint_list_t *hints,
+	      iod_event_t *event)
+{
+	struct iod_objh		*h = iod_objh_lookup(oh);
+	struct iod_obj		*obj;
+	int			rc = 0;
+
+	(void)hints;
+	if (h == NULL)
+		return iod_ev_return(event, IOD_EV_OBJ_PURGE, -EINVAL);
+	obj = h->oh_obj;
+
+	pthread_mutex_lock(&obj->io_cont->ic_lock);
+	if (tid > obj->io_cont->ic_persisted)
+		rc = -EINVAL;
+	pthread_mutex_unlock(&obj->io_cont->ic_lock);
+	if (rc != 0 || tid == 0)
+		return iod_ev_return(event, IOD_EV_OBJ_PURGE, rc);
+
+	pthread_rwlock_wrlock(&obj->io_lock);
+	if (obj->io_type == IOD_OBJ_KV)
+		iod_kv_prune(obj, tid);
+	else
+		iod_obj_purge_locked(obj, tid);
+	pthread_rwlock_unlock(&obj->io_lock);
+	return iod_ev_return(event, IOD_EV_OBJ_PURGE, 0);
+}
+
+/* ------------------------------- fetch ---------------------------------- */
+
+/** the purged segments of an object, collected before staging them */
+struct iod_fetch_arg {
+	struct iod_obj		*fa_obj;
+	iod_trans_id_t		fa_tid;
+	struct iod_seg		*fa_seg;
+	unsigned long		fa_nr;
+	unsigned long		fa_max;
+	iod_size_t		fa_bytes;
+};
+
+static int
+iod_fetch_seg(const struct iod_seg *seg, void *arg)
+{
+	struct iod_fetch_arg	*fa = arg;
+	struct iod_seg		*segs;
+	unsigned long		max;
+
+	if (seg->is_src != IOD_SEG_CENTRAL)
+		return 0;
+	if (fa->fa_nr == fa->fa_max) {
+		max = iod_max(fa->fa_max * 2, 16UL);
+		segs = realloc(fa->fa_seg, max * sizeof(*segs));
+		if (segs == NULL)
+			return -ENOMEM;
+		fa->fa_seg = segs;
+		fa->fa_max = max;
+	}
+	fa->fa_seg[fa->fa_nr++] = *seg;
+	fa->fa_bytes += seg->is_len;
+	return 0;
+}
+
+/** the purged segments of one logical range a hyperslab touches */
+static int
+iod_fetch_range(const struct iod_seg *range, void *arg)
+{
+	struct iod_fetch_arg	*fa = arg;
+
+	return iod_extent_resolve(fa->fa_obj, fa->fa_tid, range->is_off,
+				  range->is_len, iod_fetch_seg, fa);
+}
+
+/** copy one purged segment back into the BB log. Caller holds io_lock. */
+static int
+iod_fetch_stage(struct iod_obj *obj, struct iod_layer *layer,
+		const struct iod_seg *seg, char *buf)
+{
+	iod_checksum_t	cs;
+	iod_size_t	done;
+	iod_size_t	n;
+	uint64_t	addr;
+	int		rc;
+
+	for (done = 0; done < seg->is_len; done += n) {
+		n = iod_min(seg->is_len - done, IOD_MIGRATE_BUF);
+		rc = iod_central_read(obj, seg->is_off + done, n, buf);
+		if (rc != 0)
+			return rc;
+		iod_cksum_init(&cs);
+		iod_cksum_update(&cs, buf, n);
+		rc = iod_obj_log_begin(obj, n, &addr);
+		if (rc != 0)
+			return rc;
+		rc = iod_pwrite_full(obj->io_fd, buf, n,
+				     iod_obj_log_pos(obj, addr));
+		iod_obj_log_end(obj);
+		if (rc == 0)
+			rc = iod_cks_add(obj, layer->il_tid, addr, n,
+					 &cs);
+		if (rc == 0)
+			rc = iod_layer_insert(layer, seg->is_off + done, n,
+					      addr);
+		if (rc != 0)
+			return rc;
+	}
+	return 0;
+}
+
+/**
+ * Stage the purged bytes \a slab selects at \a tid back into the BB log, in
+ * a committed layer at the purge TID beneath all newer versions: the ranges
+ * of a contiguous array, the whole chunks of a chunked one, and everything
+ * for a blob or without a slab. The segments are found under a read lock
+ * and room is made for them before the object is locked for staging; a
+ * segment staged twice meanwhile is only replaced by the same bytes.
+ */
+int
+iod_fetch_slab(struct iod_obj *obj, iod_trans_id_t tid, iod_hyperslab_t *slab,
+	       iod_size_t *staged)
+{
+	struct iod_fetch_arg	fa = { 0 };
+	struct iod_layer	*layer;
+	unsigned long		i;
+	char			*buf = NULL;
+	int			rc = 0;
+
+	if (staged != NULL)
+		*staged = 0;
+	if (obj->io_type == IOD_OBJ_KV)
+		return 0;
+	fa.fa_obj = obj;
+	fa.fa_tid = tid;
+	pthread_rwlock_rdlock(&obj->io_lock);
+	if (obj->io_purged == 0)
+		rc = 0;
+	else if (slab != NULL && obj->io_type == IOD_OBJ_ARRAY)
+		rc = iod_array_ranges(obj, tid, slab, iod_fetch_range, &fa);
+	else
+		rc = iod_extent_resolve(obj, tid, 0, obj->io_size,
+					iod_fetch_seg, &fa);
+	pthread_rwlock_unlock(&obj->io_lock);
+	if (rc != 0 || fa.fa_nr == 0)
+		goto out;
+
+	/* room for it if that can be had, else stage it anyway */
+	iod_cache_admit(obj->io_cont, fa.fa_bytes);
+	buf = malloc(IOD_MIGRATE_BUF);
+	if (buf == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+	pthread_rwlock_wrlock(&obj->io_lock);
+	rc = iod_obj_log_open(obj);
+	if (rc != 0)
+		goto unlock;
+	layer = iod_layer_get(obj, obj->io_purged);
+	if (layer == NULL) {
+		rc = -ENOMEM;
+		goto unlock;
+	}
+	layer->il_committed = 1;
+	for (i = 0; i < fa.fa_nr && rc == 0; i++)
+		rc = iod_fetch_stage(obj, layer, &fa.fa_seg[i], buf);
+	/* the staged layer sits below newer versions */
+	iod_extent_rebuild(obj);
+	if (rc == 0 && staged != NULL)
+		*staged = fa.fa_bytes;
+unlock:
+	pthread_rwlock_unlock(&obj->io_lock);
+out:
+	free(fa.fa_seg);
+	free(buf);
+	return rc;
+}
+
+static int
+iod_obj_fetch_op(struct iod_op *op)
+{
+	struct iod_objh	*h = iod_objh_lookup(op->op_u.fetch.oh);
+
+	if (h == NULL)
+		return -EINVAL;
+	return iod_fetch_slab(h->oh_obj, op->op_tid, op->op_u.fetch.slab,
+			      NULL);
+}
+
+/**
+ * Pre-stage an object from central storage, only the part \a slab selects
+ * of an array. With an event the staging runs on a worker thread, and the
+ * handle and slab must stay valid until it completes. The BB layout is not
+ * used by this engine.
+ */
+iod_ret_t
+iod_obj_fetch(iod_handle_t oh, iod_trans_id_t tid, iod_hint_list_t *hints,
+	      iod_hyperslab_t *slab, iod_layout_t *layout,
+	      iod_trans_id_t *new_tid, iod_event_t *event)
+{
+	struct iod_objh		*h = iod_objh_lookup(oh);
+	struct iod_op		*op;
+
+	(void)hints;
+	(void)layout;
+	if (h == NULL)
+		return iod_ev_return(event, IOD_EV_OBJ_FETCH, -EINVAL);
+	if (new_tid != NULL)
+		*new_tid = tid;
+	if (event == NULL)
+		return iod_fetch_slab(h->oh_obj, tid, slab, NULL);
+
+	op = iod_op_alloc(event, IOD_EV_OBJ_FETCH, iod_obj_fetch_op, tid);
+	if (op == NULL)
+		return iod_ev_return(event, IOD_EV_OBJ_FETCH, -ENOMEM);
+	op->op_u.fetch.oh = oh;
+	op->op_u.fetch.slab = slab;
+	return iod_sched_submit(op);
+}
+
+iod_ret_t
+iod_obj_replica(iod_handle_t oh, iod_trans_id_t tid, iod_hint_list_t *hints,
+		unsigned int this_only, iod_layout_t *layout,
+		iod_trans_id_t *new_tid, iod_event_t *event)
+{
+	(void)oh;
+	(void)tid;
+	(void)hints;
+	(void)this_only;
+	(void)layout;
+	(void)new_tid;
+	/* a single burst buffer has nowhere else to put a replica */
+	return iod_ev_return(event, IOD_EV_OBJ_REPLICA, -ENOSYS);
+}
+
+/* ------------------------------ snapshot -------------------------------- */
+
+static int
+iod_copy_file(const char *src, const char *dst)
+{
+	char	*buf;
+	ssize_t	n;
+	int	in;
+	int	out;
+	int	rc = 0;
+
+	in = open(src, O_RDONLY);
+	if (in < 0)
+		return -errno;
+	out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	buf = malloc(IOD_MIGRATE_BUF);
+	if (out < 0 || buf == NULL) {
+		rc = out < 0 ? -errno : -ENOMEM;
+		goto out;
+	}
+	while ((n = read(in, buf, IOD_MIGRATE_BUF)) > 0) {
+		if (write(out, buf, n) != n) {
+			rc = -EIO;
+			break;
+		}
+	}
+	if (n < 0)
+		rc = -errno;
+out:
+	free(buf);
+	if (out >= 0)
+		close(out);
+	close(in);
+	return rc;
+}
+
+static int
+iod_copy_tree(const char *src, const char *dst)
+{
+	struct dirent	*de;
+	struct stat	st;
+	char		s[PATH_MAX];
+	char		d[PATH_MAX];
+	DIR		*dir;
+	int		rc;
+
+	rc = iod_mkdir_p(dst);
+	if (rc != 0)
+		return rc;
+	dir = opendir(src);
+	if (dir == NULL)
+		return -errno;
+	while (rc == 0 && (de = readdir(dir)) != NULL) {
+		if (strcmp(de->d_name, ".") == 0 ||
+		    strcmp(de->d_name, "..") == 0)
+			continue;
+		if (snprintf(s, sizeof(s), "%s/%s", src, de->d_name) >=
+		    (int)sizeof(s) ||
+		    snprintf(d, sizeof(d), "%s/%s", dst, de->d_name) >=
+		    (int)sizeof(d)) {
+			rc = -ENAMETOOLONG;
+			break;
+		}
+		if (stat(s, &st) != 0)
+			rc = -errno;
+		else if (S_ISDIR(st.st_mode))
+			rc = iod_copy_tree(s, d);
+		else
+			rc = iod_copy_file(s, d);
+	}
+	closedir(dir);
+	return rc;
+}
+
+/**
+ * Persist the latest readable TID and copy the central image of the
+ * container to <central_root>/<container>@<snapshot>.
+ */
+iod_ret_t
+iod_container_snapshot(iod_handle_t coh, const char *snapshot,
+		       iod_hint_list_t *hints, iod_event_t *event)
+{
+	struct iod_cont	*cont = iod_cont_lookup(coh);
+	iod_trans_id_t	tid;
+	char		dst[PATH_MAX];
+	int		rc;
+
+	(void)hints;
+	if (cont == NULL || snapshot == NULL || *snapshot == '\0' ||
+	    strchr(snapshot, '/') != NULL)
+		return iod_ev_return(event, IOD_EV_CONT_SNAPSHOT, -EINVAL);
+	if (snprintf(dst, sizeof(dst), "%s@%s", cont->ic_central_dir,
+		     snapshot) >= (int)sizeof(dst))
+		return iod_ev_return(event, IOD_EV_CONT_SNAPSHOT,
+				     -ENAMETOOLONG);
+
+	pthread_mutex_lock(&cont->ic_persist_lock);
+	pthread_mutex_lock(&cont->ic_lock);
+	tid = cont->ic_tids.latest_rdable;
+	pthread_mutex_unlock(&cont->ic_lock);
+	rc = iod_persist_run(cont, tid);
+	if (rc == -EAGAIN)
+		rc = 0;		/* what is below the straggler */
+	if (rc == 0 && access(dst, F_OK) == 0)
+		rc = -EEXIST;
+	if (rc == 0)
+		rc = iod_copy_tree(cont->ic_central_dir, dst);
+	pthread_mutex_unlock(&cont->ic_persist_lock);
+	return iod_ev_return(event, IOD_EV_CONT_SNAPSHOT, rc);
+}
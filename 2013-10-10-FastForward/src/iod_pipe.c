@@ -0,0 +1,354 @@
+/*
+ * Streaming pipeline that moves burst buffer bytes to central storage.
+ *
+ * The persist planner cuts what it ships into pieces of at most one stripe
+ * unit run and queues each on its destination, one central shard file. A
+ * pool of reader threads pulls the pieces from the BB logs in queue order
+ * and checksums them; a pool of writer threads takes any destination whose
+ * oldest piece is ready and writes its pieces out in the order they were
+ * queued, so overlapping versions land oldest first while every shard of
+ * every object moves on its own. The bytes read but not yet written are
+ * capped by the budget given at start; the planner blocks on it.
+ *
+ * The checksum of every piece written goes to a manifest beside the shard,
+ * <shard>.cks, as (offset, length, checksum) records appended in write
+ * order, the newest record for a byte being the one that describes it.
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+
+#include "iod_internal.h"
+
+/** one range on its way from a BB log to a shard */
+struct iod_piece {
+	struct iod_piece	*pc_next;	/* on pd_head */
+	struct iod_piece	*pc_rnext;	/* on pp_rhead */
+	struct iod_pdst		*pc_dst;
+	int			pc_src;		/* BB log */
+	uint64_t		pc_addr;
+	iod_off_t		pc_off;		/* in the shard */
+	iod_size_t		pc_len;
+	char			*pc_buf;
+	iod_checksum_t		pc_cs;
+	int			pc_ready;	/* read, or failed */
+};
+
+/** a shard file and its pieces in write order */
+struct iod_pdst {
+	struct iod_pdst		*pd_next;	/* on pp_ready */
+	struct iod_piece	*pd_head;
+	struct iod_piece	*pd_tail;
+	int			pd_fd;
+	int			pd_cks_fd;
+	int			pd_busy;	/* a writer owns it */
+	int			pd_queued;	/* on pp_ready */
+	int			pd_closed;	/* no more pieces coming */
+};
+
+/** on-disk record of a manifest */
+struct iod_cks_rec {
+	uint64_t		cr_off;
+	uint64_t		cr_len;
+	iod_checksum_t		cr_cs;
+};
+
+struct iod_pipe {
+	pthread_mutex_t		pp_lock;
+	pthread_cond_t		pp_rcond;	/* pieces to read */
+	pthread_cond_t		pp_wcond;	/* destinations to write */
+	pthread_cond_t		pp_pcond;	/* budget or drain, planner */
+	struct iod_piece	*pp_rhead;
+	struct iod_piece	*pp_rtail;
+	struct iod_pdst		*pp_ready;
+	struct iod_pdst		*pp_ready_tail;
+	iod_size_t		pp_budget;
+	iod_size_t		pp_inflight;	/* queued, not written */
+	unsigned long		pp_ndst;	/* not synced yet */
+	int			pp_stop;
+	int			pp_rc;
+	unsigned int		pp_nth;
+	pthread_t		*pp_th;
+};
+
+static void
+iod_pipe_fail(struct iod_pipe *p, int rc)
+{
+	if (rc != 0 && p->pp_rc == 0)
+		p->pp_rc = rc;
+}
+
+/** hand \a d to the writers if it has work and no owner. Holds pp_lock. */
+static void
+iod_pipe_kick(struct iod_pipe *p, struct iod_pdst *d)
+{
+	if (d->pd_busy || d->pd_queued)
+		return;
+	if (d->pd_head == NULL ? !d->pd_closed : !d->pd_head->pc_ready)
+		return;
+	d->pd_queued = 1;
+	d->pd_next = NULL;
+	if (p->pp_ready == NULL)
+		p->pp_ready = d;
+	else
+		p->pp_ready_tail->pd_next = d;
+	p->pp_ready_tail = d;
+	pthread_cond_signal(&p->pp_wcond);
+}
+
+static void *
+iod_pipe_reader(void *arg)
+{
+	struct iod_pipe		*p = arg;
+	struct iod_piece	*pc;
+	int			rc;
+
+	pthread_mutex_lock(&p->pp_lock);
+	for (;;) {
+		while (p->pp_rhead == NULL && !p->pp_stop)
+			pthread_cond_wait(&p->pp_rcond, &p->pp_lock);
+		pc = p->pp_rhead;
+		if (pc == NULL)
+			break;
+		p->pp_rhead = pc->pc_rnext;
+		pthread_mutex_unlock(&p->pp_lock);
+
+		rc = -ENOMEM;
+		pc->pc_buf = malloc(pc->pc_len);
+		if (pc->pc_buf != NULL)
+			rc = iod_pread_full(pc->pc_src, pc->pc_buf, pc->pc_len,
+					    pc->pc_addr);
+		if (rc == 0) {
+			iod_cksum_init(&pc->pc_cs);
+			iod_cksum_update(&pc->pc_cs, pc->pc_buf, pc->pc_len);
+		}
+
+		pthread_mutex_lock(&p->pp_lock);
+		iod_pipe_fail(p, rc);
+		pc->pc_ready = 1;
+		if (pc == pc->pc_dst->pd_head)
+			iod_pipe_kick(p, pc->pc_dst);
+	}
+	pthread_mutex_unlock(&p->pp_lock);
+	return NULL;
+}
+
+static int
+iod_pipe_write(struct iod_pdst *d, struct iod_piece *pc)
+{
+	struct iod_cks_rec	rec;
+	int			rc;
+
+	rc = iod_pwrite_full(d->pd_fd, pc->pc_buf, pc->pc_len, pc->pc_off);
+	if (rc != 0 || d->pd_cks_fd < 0)
+		return rc;
+	rec.cr_off = pc->pc_off;
+	rec.cr_len = pc->pc_len;
+	rec.cr_cs = pc->pc_cs;
+	if (write(d->pd_cks_fd, &rec, sizeof(rec)) != sizeof(rec))
+		return -EIO;
+	return 0;
+}
+
+static void *
+iod_pipe_writer(void *arg)
+{
+	struct iod_pipe		*p = arg;
+	struct iod_piece	*pc;
+	struct iod_pdst		*d;
+	int			rc;
+
+	pthread_mutex_lock(&p->pp_lock);
+	for (;;) {
+		while (p->pp_ready == NULL && !p->pp_stop)
+			pthread_cond_wait(&p->pp_wcond, &p->pp_lock);
+		d = p->pp_ready;
+		if (d == NULL)
+			break;
+		p->pp_ready = d->pd_next;
+		d->pd_queued = 0;
+		d->pd_busy = 1;
+
+		while ((pc = d->pd_head) != NULL && pc->pc_ready) {
+			rc = p->pp_rc;
+			pthread_mutex_unlock(&p->pp_lock);
+			if (rc == 0)
+				rc = iod_pipe_write(d, pc);
+			free(pc->pc_buf);
+			pthread_mutex_lock(&p->pp_lock);
+			iod_pipe_fail(p, rc);
+			d->pd_head = pc->pc_next;
+			p->pp_inflight -= pc->pc_len;
+			pthread_cond_signal(&p->pp_pcond);
+			free(pc);
+		}
+		d->pd_busy = 0;
+		if (d->pd_head != NULL || !d->pd_closed)
+			continue;	/* a reader hands it back */
+
+		pthread_mutex_unlock(&p->pp_lock);
+		rc = fdatasync(d->pd_fd) == 0 ? 0 : -errno;
+		if (d->pd_cks_fd >= 0) {
+			if (rc == 0 && fdatasync(d->pd_cks_fd) != 0)
+				rc = -errno;
+			close(d->pd_cks_fd);
+		}
+		close(d->pd_fd);
+		free(d);
+		pthread_mutex_lock(&p->pp_lock);
+		iod_pipe_fail(p, rc);
+		p->pp_ndst--;
+		pthread_cond_signal(&p->pp_pcond);
+	}
+	pthread_mutex_unlock(&p->pp_lock);
+	return NULL;
+}
+
+/**
+ * Start a pipeline of \a nthreads readers and as many writers keeping at
+ * most \a budget bytes in flight.
+ */
+struct iod_pipe *
+iod_pipe_start(iod_size_t budget, unsigned int nthreads)
+{
+	struct iod_pipe	*p;
+	unsigned int	i;
+
+	p = calloc(1, sizeof(*p));
+	if (p == NULL)
+		return NULL;
+	p->pp_th = calloc(2 * nthreads, sizeof(*p->pp_th));
+	if (p->pp_th == NULL) {
+		free(p);
+		return NULL;
+	}
+	pthread_mutex_init(&p->pp_lock, NULL);
+	pthread_cond_init(&p->pp_rcond, NULL);
+	pthread_cond_init(&p->pp_wcond, NULL);
+	pthread_cond_init(&p->pp_pcond, NULL);
+	p->pp_budget = budget;
+
+	for (i = 0; i < 2 * nthreads; i++) {
+		if (pthread_create(&p->pp_th[i], NULL, i % 2 ? iod_pipe_writer :
+				   iod_pipe_reader, p) != 0)
+			break;
+	}
+	p->pp_nth = i;
+	if (i < 2) {
+		iod_pipe_finish(p);
+		return NULL;
+	}
+	return p;
+}
+
+/**
+ * Add a destination writing to \a fd, and its manifest to \a cks_fd (-1 for
+ * none). The pipeline owns both descriptors from now on.
+ */
+struct iod_pdst *
+iod_pipe_dst(struct iod_pipe *p, int fd, int cks_fd)
+{
+	struct iod_pdst	*d;
+
+	d = calloc(1, sizeof(*d));
+	if (d == NULL) {
+		close(fd);
+		if (cks_fd >= 0)
+			close(cks_fd);
+		return NULL;
+	}
+	d->pd_fd = fd;
+	d->pd_cks_fd = cks_fd;
+	pthread_mutex_lock(&p->pp_lock);
+	p->pp_ndst++;
+	pthread_mutex_unlock(&p->pp_lock);
+	return d;
+}
+
+/** no more pieces for \a d: it is synced and closed once they are written */
+void
+iod_pipe_dst_close(struct iod_pipe *p, struct iod_pdst *d)
+{
+	pthread_mutex_lock(&p->pp_lock);
+	d->pd_closed = 1;
+	iod_pipe_kick(p, d);
+	pthread_mutex_unlock(&p->pp_lock);
+}
+
+/**
+ * Queue \a len bytes at \a addr of BB log \a src for offset \a off of \a d,
+ * after everything queued on \a d so far. Blocks while the budget is spent.
+ * Returns the first error of the pipeline.
+ */
+int
+iod_pipe_put(struct iod_pipe *p, struct iod_pdst *d, int src, uint64_t addr,
+	     iod_size_t len, iod_off_t off)
+{
+	struct iod_piece	*pc;
+	int			rc;
+
+	pc = calloc(1, sizeof(*pc));
+	if (pc == NULL)
+		return -ENOMEM;
+	pc->pc_dst = d;
+	pc->pc_src = src;
+	pc->pc_addr = addr;
+	pc->pc_off = off;
+	pc->pc_len = len;
+
+	pthread_mutex_lock(&p->pp_lock);
+	/* one piece always fits, whatever the budget */
+	while (p->pp_rc == 0 && p->pp_inflight > 0 &&
+	       p->pp_inflight + len > p->pp_budget)
+		pthread_cond_wait(&p->pp_pcond, &p->pp_lock);
+	rc = p->pp_rc;
+	if (rc != 0) {
+		pthread_mutex_unlock(&p->pp_lock);
+		free(pc);
+		return rc;
+	}
+	p->pp_inflight += len;
+	if (d->pd_head == NULL)
+		d->pd_head = pc;
+	else
+		d->pd_tail->pc_next = pc;
+	d->pd_tail = pc;
+	if (p->pp_rhead == NULL)
+		p->pp_rhead = pc;
+	else
+		p->pp_rtail->pc_rnext = pc;
+	p->pp_rtail = pc;
+	pthread_cond_signal(&p->pp_rcond);
+	pthread_mutex_unlock(&p->pp_lock);
+	return 0;
+}
+
+/**
+ * Wait for every destination, all of which must have been closed, to be
+ * written and synced, then stop the threads. Returns the first error.
+ */
+int
+iod_pipe_finish(struct iod_pipe *p)
+{
+	unsigned int	i;
+	int		rc;
+
+	pthread_mutex_lock(&p->pp_lock);
+	while (p->pp_nth >= 2 && (p->pp_inflight > 0 || p->pp_ndst > 0))
+		pthread_cond_wait(&p->pp_pcond, &p->pp_lock);
+	p->pp_stop = 1;
+	pthread_cond_broadcast(&p->pp_rcond);
+	pthread_cond_broadcast(&p->pp_wcond);
+	pthread_mutex_unlock(&p->pp_lock);
+	for (i = 0; i < p->pp_nth; i++)
+		pthread_join(p->pp_th[i], NULL);
+
+	rc = p->pp_rc;
+	pthread_cond_destroy(&p->pp_pcond);
+	pthread_cond_destroy(&p->pp_wcond);
+	pthread_cond_destroy(&p->pp_rcond);
+	pthread_mutex_destroy(&p->pp_lock);
+	free(p->pp_th);
+	free(p);
+	return rc;
+}
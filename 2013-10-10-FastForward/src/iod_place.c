@@ -0,0 +1,165 @@
+/*
+ * Placement of the stripes of an object on its central storage targets.
+ *
+ * Round-robin puts stripe i on target i % target_num and packs each shard
+ * densely, so changing target_num moves almost every stripe. The hash
+ * placements pick the target of a stripe from a hash of the object ID and
+ * the stripe index alone:
+ *
+ * - jump consistent hash walks the hash through target counts 1, 2, ...;
+ *   going from N to N + 1 targets moves exactly the stripes that land on
+ *   the new one, 1/(N + 1) of them, in O(log N) per stripe.
+ * - the straw draw gives every target a straw of length ln(u) / weight,
+ *   u uniform in (0, 1] from the hash of (stripe, target), and takes the
+ *   longest, as CRUSH straw2 buckets do. A target wins in proportion to its
+ *   weight, and changing one weight only moves stripes to or from that
+ *   target. It costs O(N) per stripe.
+ *
+ * A hash placed stripe keeps its central offset inside whichever shard it
+ * lands on, so shards are sparse and a stripe that does not change target
+ * does not move at all.
+ */
+
+#include "iod_internal.h"
+
+#define IOD_LOG2_BITS		8	/* table index bits of iod_log2 */
+
+/** log2(1 + i / 256) for i in [0, 256], 32 fraction bits */
+static uint64_t		iod_log2_tab[(1 << IOD_LOG2_BITS) + 1];
+static pthread_once_t	iod_log2_once = PTHREAD_ONCE_INIT;
+
+static void
+iod_log2_init(void)
+{
+	unsigned __int128	y;
+	uint64_t		r;
+	int			i;
+	int			k;
+
+	/* bit by bit: squaring y in [1, 2) doubles its log */
+	for (i = 0; i <= 1 << IOD_LOG2_BITS; i++) {
+		y = ((unsigned __int128)((1 << IOD_LOG2_BITS) + i)) <<
+		    (62 - IOD_LOG2_BITS);
+		r = 0;
+		for (k = 31; k >= 0; k--) {
+			y = (y * y) >> 62;
+			if (y >= (unsigned __int128)2 << 62) {
+				y >>= 1;
+				r |= 1ULL << k;
+			}
+		}
+		iod_log2_tab[i] = i == 1 << IOD_LOG2_BITS ? 1ULL << 32 : r;
+	}
+}
+
+/** log2(x) of x >= 1 with 32 fraction bits, interpolated from the table */
+static uint64_t
+iod_log2(uint64_t x)
+{
+	uint64_t	f;
+	uint64_t	lo;
+	uint64_t	hi;
+	uint64_t	rem;
+	int		n = 63 - __builtin_clzll(x);
+
+	f = n == 0 ? 0 : x << (64 - n);		/* bits below the top one */
+	lo = iod_log2_tab[f >> (64 - IOD_LOG2_BITS)];
+	hi = iod_log2_tab[(f >> (64 - IOD_LOG2_BITS)) + 1];
+	rem = (f << IOD_LOG2_BITS) >> 32;
+	return ((uint64_t)n << 32) + lo + (((hi - lo) * rem) >> 32);
+}
+
+static uint64_t
+iod_mix64(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+/** Lamping and Veach, "A Fast, Minimal Memory, Consistent Hash Algorithm" */
+static uint32_t
+iod_place_jump(uint64_t key, uint32_t n)
+{
+	int64_t	b = -1;
+	int64_t	j = 0;
+
+	while (j < n) {
+		b = j;
+		key = key * 2862933555777941757ULL + 1;
+		j = (b + 1) * ((double)(1LL << 31) /
+			       (double)((key >> 33) + 1));
+	}
+	return b;
+}
+
+static uint32_t
+iod_place_straw(uint64_t key, const iod_layout_t *layout)
+{
+	int64_t		best = INT64_MIN;
+	int64_t		draw;
+	uint32_t	winner = 0;
+	uint32_t	w;
+	uint32_t	t;
+	uint64_t	u;
+
+	for (t = 0; t < layout->target_num; t++) {
+		w = layout->target_weights != NULL ?
+		    layout->target_weights[t] : 1;
+		if (w == 0)
+			continue;
+		/* u in [1, 2^32]: log2(u) - 32 is log2 of a (0, 1] draw */
+		u = (iod_mix64(key ^ (t * 0x9e3779b97f4a7c15ULL)) >> 32) + 1;
+		draw = ((int64_t)iod_log2(u) - (32LL << 32)) / w;
+		if (draw > best) {
+			best = draw;
+			winner = t;
+		}
+	}
+	return winner;
+}
+
+/** target of stripe \a stripe of \a obj under \a layout */
+uint32_t
+iod_place_target(struct iod_obj *obj, const iod_layout_t *layout,
+		 uint64_t stripe)
+{
+	uint64_t	key;
+
+	if (layout->target_num <= 1)
+		return 0;
+	if (layout->placement == IOD_PLACE_ROUND_ROBIN)
+		return stripe % layout->target_num;
+
+	key = iod_mix64(obj->io_oid.oid_hi ^ iod_mix64(obj->io_oid.oid_lo));
+	key = iod_mix64(key ^ stripe);
+	if (layout->placement == IOD_PLACE_JUMP)
+		return iod_place_jump(key, layout->target_num);
+	pthread_once(&iod_log2_once, iod_log2_init);
+	return iod_place_straw(key, layout);
+}
+
+/** check the placement and weights of a layout about to be set */
+int
+iod_place_check(const iod_layout_t *layout)
+{
+	uint64_t	sum = 0;
+	uint32_t	t;
+
+	switch (layout->placement) {
+	case IOD_PLACE_ROUND_ROBIN:
+	case IOD_PLACE_JUMP:
+		/* neither places by weight, target_weights is not read */
+		return 0;
+	case IOD_PLACE_STRAW:
+		for (t = 0; layout->target_weights != NULL &&
+			    t < layout->target_num; t++)
+			sum += layout->target_weights[t];
+		return layout->target_weights != NULL && sum == 0 ? -EINVAL : 0;
+	default:
+		return -EINVAL;
+	}
+}
@@ -0,0 +1,193 @@
+/*
+ * Readahead of array hyperslabs from central storage.
+ *
+ * Analysis codes walk an array in steps: the same shape of hyperslab with
+ * its start moved by the same amount each read. Every array read is checked
+ * against the previous one of its object, and once a step repeats, the next
+ * "iod.readahead" hyperslabs along it are fetched back from central storage
+ * on the worker threads, so the reads that reach them find their bytes on
+ * the burst buffer. Only objects with purged data read ahead, and the walk
+ * stops at the edge of the dataspace.
+ *
+ * The "prefetch" hint of a read sets how far ahead, "access" "sequential"
+ * trusts the first step already, and "random" or "skip_bb" reads leave the
+ * pattern alone.
+ *
+ * A purged object has been persisted, so its create TID is durable and the
+ * object lives until the container closes; that close waits for the fetches
+ * still queued, counted in ic_fetch_bg.
+ */
+
+#include "iod_internal.h"
+
+/** the access pattern seen on one array object */
+struct iod_ra {
+	int			ra_valid;
+	iod_size_t		ra_start[IOD_MAX_DIMS];	/* last read */
+	int64_t			ra_step[IOD_MAX_DIMS];	/* to it */
+	uint64_t		ra_shape;	/* count, stride, block */
+	unsigned int		ra_hits;	/* reads ra_step apart */
+	unsigned int		ra_ahead;	/* queued past last read */
+};
+
+static uint64_t
+iod_ra_shape(struct iod_obj *obj, iod_hyperslab_t *slab)
+{
+	uint64_t	h = 14695981039346656037ULL;
+	uint32_t	d;
+
+	for (d = 0; d < obj->io_ndims; d++) {
+		h = (h ^ slab->count[d]) * 1099511628211ULL;
+		h = (h ^ (slab->stride != NULL ? slab->stride[d] : 1)) *
+		    1099511628211ULL;
+		h = (h ^ (slab->block != NULL ? slab->block[d] : 1)) *
+		    1099511628211ULL;
+	}
+	return h;
+}
+
+static int
+iod_ra_op(struct iod_op *op)
+{
+	struct iod_obj	*obj = op->op_u.fetch.obj;
+	struct iod_cont	*cont = obj->io_cont;
+	iod_size_t	staged;
+	int		rc;
+
+	rc = iod_fetch_slab(obj, op->op_tid, op->op_u.fetch.slab, &staged);
+	free(op->op_u.fetch.slab);
+
+	pthread_mutex_lock(&cont->ic_lock);
+	cont->ic_stats.readahead_count++;
+	cont->ic_stats.readahead_bytes += staged;
+	if (--cont->ic_fetch_bg == 0)
+		pthread_cond_broadcast(&cont->ic_persist_cond);
+	pthread_mutex_unlock(&cont->ic_lock);
+	return rc;
+}
+
+/**
+ * Queue the fetch of \a slab moved \a k times by \a step, or return -ERANGE
+ * if that leaves \a dims.
+ */
+static int
+iod_ra_submit(struct iod_obj *obj, iod_trans_id_t tid, iod_hyperslab_t *slab,
+	      const int64_t *step, unsigned int k, const iod_size_t *dims)
+{
+	struct iod_cont	*cont = obj->io_cont;
+	iod_hyperslab_t	*ra;
+	struct iod_op	*op;
+	iod_size_t	*v;
+	uint32_t	nd = obj->io_ndims;
+	uint32_t	d;
+	int64_t		start;
+
+	ra = malloc(sizeof(*ra) + 4 * nd * sizeof(*v));
+	if (ra == NULL)
+		return -ENOMEM;
+	v = (iod_size_t *)(ra + 1);
+	ra->start = v;
+	ra->count = v + nd;
+	ra->stride = v + 2 * nd;
+	ra->block = v + 3 * nd;
+	for (d = 0; d < nd; d++) {
+		start = (int64_t)slab->start[d] + (int64_t)k * step[d];
+		ra->count[d] = slab->count[d];
+		ra->stride[d] = slab->stride != NULL ? slab->stride[d] : 1;
+		ra->block[d] = slab->block != NULL ? slab->block[d] : 1;
+		if (start < 0 || (iod_size_t)start +
+				 (ra->count[d] - 1) * ra->stride[d] +
+				 ra->block[d] > dims[d]) {
+			free(ra);
+			return -ERANGE;
+		}
+		ra->start[d] = start;
+	}
+
+	op = iod_op_alloc(NULL, IOD_EV_OBJ_FETCH, iod_ra_op, tid);
+	if (op == NULL) {
+		free(ra);
+		return -ENOMEM;
+	}
+	op->op_u.fetch.obj = obj;
+	op->op_u.fetch.slab = ra;
+	pthread_mutex_lock(&cont->ic_lock);
+	cont->ic_fetch_bg++;
+	pthread_mutex_unlock(&cont->ic_lock);
+	return iod_sched_submit(op);
+}
+
+/**
+ * \a slab of \a obj, inside \a dims, was read at \a tid under \a pol: learn
+ * the step and keep "iod.readahead" hyperslabs ahead of the reads once it
+ * repeats.
+ */
+void
+iod_readahead(struct iod_obj *obj, iod_trans_id_t tid, iod_hyperslab_t *slab,
+	      const iod_size_t *dims, const struct iod_policy *pol)
+{
+	struct iod_cont	*cont = obj->io_cont;
+	struct iod_ra	*ra;
+	int64_t		step[IOD_MAX_DIMS];
+	uint64_t	shape;
+	unsigned int	depth = iod_env.ie_readahead;
+	unsigned int	first;
+	unsigned int	k;
+	uint32_t	nd = obj->io_ndims;
+	uint32_t	d;
+	int		moved = 0;
+	int		trusted;
+
+	if (pol->ip_set & IOD_POL_PREFETCH)
+		depth = pol->ip_prefetch;
+	if (depth == 0 || pol->ip_access == IOD_ACCESS_RANDOM ||
+	    (pol->ip_flags & IOD_POL_SKIP_BB))
+		return;
+	for (d = 0; d < nd; d++)
+		if (slab->count[d] == 0)
+			return;
+	shape = iod_ra_shape(obj, slab);
+
+	pthread_mutex_lock(&cont->ic_lock);
+	ra = obj->io_ra;
+	if (ra == NULL) {
+		ra = calloc(1, sizeof(*ra));
+		obj->io_ra = ra;
+		if (ra == NULL)
+			goto out;
+	}
+	for (d = 0; d < nd; d++) {
+		step[d] = (int64_t)(slab->start[d] - ra->ra_start[d]);
+		moved |= step[d] != 0;
+	}
+	if (ra->ra_valid && moved && ra->ra_shape == shape &&
+	    memcmp(step, ra->ra_step, nd * sizeof(step[0])) == 0) {
+		ra->ra_hits++;
+		/* this read is one of those queued ahead */
+		if (ra->ra_ahead > 0)
+			ra->ra_ahead--;
+	} else {
+		ra->ra_hits = 0;
+		ra->ra_ahead = 0;
+	}
+	/* a sequential reader walks on from its first step */
+	trusted = ra->ra_hits > 0 ||
+		  (pol->ip_access == IOD_ACCESS_SEQUENTIAL && ra->ra_valid &&
+		   moved && ra->ra_shape == shape);
+	ra->ra_valid = 1;
+	ra->ra_shape = shape;
+	memcpy(ra->ra_start, slab->start, nd * sizeof(ra->ra_start[0]));
+	memcpy(ra->ra_step, step, nd * sizeof(ra->ra_step[0]));
+	if (!trusted || obj->io_purged == 0 || ra->ra_ahead >= depth)
+		goto out;
+	first = ra->ra_ahead + 1;
+	ra->ra_ahead = depth;
+	pthread_mutex_unlock(&cont->ic_lock);
+
+	for (k = first; k <= depth; k++)
+		if (iod_ra_submit(obj, tid, slab, step, k, dims) != 0)
+			break;
+	return;
+out:
+	pthread_mutex_unlock(&cont->ic_lock);
+}
@@ -0,0 +1,159 @@
+/*
+ * Worker pool executing asynchronous IOD operations.
+ *
+ * Calls that are given an event and move data (blob/array/KV I/O) are packed
+ * into an iod_op and queued here; the call returns immediately and the worker
+ * completes the event into its EQ. Work IOD queues for itself, such as
+ * readahead, has no event.
+ */
+
+#include "iod_internal.h"
+
+struct iod_sched {
+	pthread_mutex_t		is_lock;
+	pthread_cond_t		is_cond;
+	struct iod_list		is_queue;
+	pthread_t		*is_threads;
+	unsigned int		is_nthreads;
+	int			is_stop;
+};
+
+static struct iod_sched iod_sched;
+
+static void *
+iod_sched_worker(void *arg)
+{
+	struct iod_op	*op;
+	int		rc;
+
+	(void)arg;
+	pthread_mutex_lock(&iod_sched.is_lock);
+	for (;;) {
+		while (iod_list_empty(&iod_sched.is_queue) &&
+		       !iod_sched.is_stop)
+			pthread_cond_wait(&iod_sched.is_cond,
+					  &iod_sched.is_lock);
+		if (iod_list_empty(&iod_sched.is_queue))
+			break;
+		op = iod_list_entry(iod_sched.is_queue.next, struct iod_op,
+				    op_link);
+		iod_list_del_init(&op->op_link);
+		pthread_mutex_unlock(&iod_sched.is_lock);
+
+		if (op->op_ev != NULL && iod_ev_aborted(op->op_ev))
+			rc = -ECANCELED;
+		else
+			rc = op->op_fn(op);
+		if (op->op_ev != NULL)
+			iod_ev_complete(op->op_ev, rc);
+		free(op);
+
+		pthread_mutex_lock(&iod_sched.is_lock);
+	}
+	pthread_mutex_unlock(&iod_sched.is_lock);
+	return NULL;
+}
+
+int
+iod_sched_init(unsigned int nthreads)
+{
+	unsigned int	i;
+	int		rc;
+
+	pthread_mutex_init(&iod_sched.is_lock, NULL);
+	pthread_cond_init(&iod_sched.is_cond, NULL);
+	iod_list_init(&iod_sched.is_queue);
+	iod_sched.is_stop = 0;
+	iod_sched.is_threads = calloc(nthreads, sizeof(pthread_t));
+	if (iod_sched.is_threads == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < nthreads; i++) {
+		rc = pthread_create(&iod_sched.is_threads[i], NULL,
+				    iod_sched_worker, NULL);
+		if (rc != 0)
+			break;
+	}
+	iod_sched.is_nthreads = i;
+	if (i < nthreads) {
+		iod_sched_fini();
+		return -rc;
+	}
+	return 0;
+}
+
+/** drain the queue and join every worker */
+void
+iod_sched_fini(void)
+{
+	unsigned int	i;
+
+	pthread_mutex_lock(&iod_sched.is_lock);
+	iod_sched.is_stop = 1;
+	pthread_cond_broadcast(&iod_sched.is_cond);
+	pthread_mutex_unlock(&iod_sched.is_lock);
+
+	for (i = 0; i < iod_sched.is_nthreads; i++)
+		pthread_join(iod_sched.is_threads[i], NULL);
+	free(iod_sched.is_threads);
+	iod_sched.is_threads = NULL;
+	iod_sched.is_nthreads = 0;
+}
+
+struct iod_op *
+iod_op_alloc(iod_event_t *ev, iod_ev_type_t type, iod_op_fn_t fn,
+	     iod_trans_id_t tid)
+{
+	struct iod_op	*op;
+
+	op = calloc(1, sizeof(*op));
+	if (op == NULL)
+		return NULL;
+	iod_list_init(&op->op_link);
+	op->op_ev = ev;
+	op->op_fn = fn;
+	op->op_tid = tid;
+	if (ev != NULL)
+		iod_ev_launch(ev, type);
+	return op;
+}
+
+int
+iod_sched_submit(struct iod_op *op)
+{
+	int	rc;
+
+	pthread_mutex_lock(&iod_sched.is_lock);
+	if (iod_sched.is_nthreads == 0) {
+		/* no workers (not initialized): run it inline */
+		pthread_mutex_unlock(&iod_sched.is_lock);
+		rc = op->op_fn(op);
+		if (op->op_ev != NULL)
+			iod_ev_complete(op->op_ev, rc);
+		free(op);
+		return 0;
+	}
+	iod_list_add_tail(&op->op_link, &iod_sched.is_queue);
+	pthread_cond_signal(&iod_sched.is_cond);
+	pthread_mutex_unlock(&iod_sched.is_lock);
+	return 0;
+}
+
+/**
+ * Queue work IOD gives itself, but never run it inline: with no workers, or
+ * while they stop, it is refused with -EAGAIN, as the caller may hold what
+ * the work takes.
+ */
+int
+iod_sched_defer(struct iod_op *op)
+{
+	pthread_mutex_lock(&iod_sched.is_lock);
+	if (iod_sched.is_nthreads == 0 || iod_sched.is_stop) {
+		pthread_mutex_unlock(&iod_sched.is_lock);
+		return -EAGAIN;
+	}
+	iod_list_add_tail(&op->op_link, &iod_sched.is_queue);
+	pthread_cond_signal(&iod_sched.is_cond);
+	pthread_mutex_unlock(&iod_sched.is_lock);
+	return 0;
+}
@@ -0,0 +1,406 @@
+/*
+ * Hyperslab compiler.
+ *
+ * A selection is compiled once into a plan against the dataspace of an array.
+ * Trailing dimensions that are selected whole fold into the cell, the
+ * innermost remaining dimension becomes a fixed pattern of runs, and the outer
+ * dimensions expand into the byte offset of each row of that pattern.
+ *
+ * A write appends the packed memory buffer to the data log as is and maps
+ * every run onto it, so it never copies. A read stages the byte span of a
+ * window of nearby rows with one resolve and packs the selected cells out of
+ * it with copy loops specialized on the run size, instead of resolving and
+ * reading every run on its own.
+ */
+
+#include <limits.h>
+
+#include "iod_internal.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define IOD_HAVE_AVX2	1
+#endif
+
+#define IOD_SLAB_WINDOW		(4UL << 20)	/* staging buffer of a read */
+#define IOD_SLAB_GAP		(16UL << 10)	/* hole worth a new window */
+#define IOD_SLAB_DIRECT		(64UL << 10)	/* runs read in place */
+
+static int
+iod_slab_whole(iod_hyperslab_t *slab, const iod_size_t *dims, uint32_t d)
+{
+	iod_size_t	stride = slab->stride != NULL ? slab->stride[d] : 1;
+	iod_size_t	block = slab->block != NULL ? slab->block[d] : 1;
+
+	return slab->start[d] == 0 && slab->count[d] * block == dims[d] &&
+	       (slab->count[d] == 1 || stride == block);
+}
+
+/**
+ * Compile \a slab, already checked against \a dims, into \a sp. Rows come out
+ * in ascending offset order.
+ */
+int
+iod_slab_compile(struct iod_obj *obj, const iod_size_t *dims,
+		 iod_hyperslab_t *slab, struct iod_slab_plan *sp)
+{
+	iod_size_t	pitch[IOD_MAX_DIMS];
+	iod_size_t	idx[IOD_MAX_DIMS];
+	iod_size_t	nsel[IOD_MAX_DIMS];
+	iod_size_t	nrows = 1;
+	iod_size_t	stride;
+	iod_size_t	block;
+	iod_size_t	r;
+	iod_off_t	off;
+	uint32_t	nd = obj->io_ndims;
+	uint32_t	last;
+	int		d;
+
+	memset(sp, 0, sizeof(*sp));
+	sp->sp_row = &sp->sp_row0;
+	for (d = 0; d < (int)nd; d++) {
+		nsel[d] = slab->count[d] *
+			  (slab->block != NULL ? slab->block[d] : 1);
+		if (nsel[d] == 0)
+			return 0;
+		idx[d] = 0;
+	}
+	pitch[nd - 1] = obj->io_cell_size;
+	for (d = nd - 1; d > 0; d--)
+		pitch[d - 1] = pitch[d] * dims[d];
+
+	/* trailing dimensions selected whole are one contiguous cell */
+	for (last = nd - 1; last > 0 && iod_slab_whole(slab, dims, last);
+	     last--)
+		;
+
+	stride = slab->stride != NULL ? slab->stride[last] : 1;
+	block = slab->block != NULL ? slab->block[last] : 1;
+	if (stride == block || slab->count[last] == 1) {
+		sp->sp_runs = 1;
+		sp->sp_run_len = nsel[last] * pitch[last];
+	} else {
+		sp->sp_runs = slab->count[last];
+		sp->sp_run_len = block * pitch[last];
+		sp->sp_stride = stride * pitch[last];
+	}
+
+	for (d = 0; d < (int)last; d++)
+		nrows *= nsel[d];
+	if (nrows > 1) {
+		sp->sp_row = malloc(nrows * sizeof(*sp->sp_row));
+		if (sp->sp_row == NULL)
+			return -ENOMEM;
+	}
+	for (r = 0; r < nrows; r++) {
+		off = slab->start[last] * pitch[last];
+		for (d = 0; d < (int)last; d++) {
+			iod_size_t	b = slab->block != NULL ?
+					    slab->block[d] : 1;
+			iod_size_t	s = slab->stride != NULL ?
+					    slab->stride[d] : 1;
+
+			off += (slab->start[d] + idx[d] / b * s + idx[d] % b) *
+			       pitch[d];
+		}
+		sp->sp_row[r] = off;
+		/* odometer over the outer dimensions */
+		for (d = (int)last - 1; d >= 0; d--) {
+			if (++idx[d] < nsel[d])
+				break;
+			idx[d] = 0;
+		}
+	}
+	sp->sp_nrows = nrows;
+
+	/* rows that continue each other are one run */
+	if (sp->sp_runs == 1 && nrows > 1) {
+		for (r = 1; r < nrows; r++)
+			if (sp->sp_row[r] != sp->sp_row[r - 1] +
+					     (iod_off_t)sp->sp_run_len)
+				break;
+		if (r == nrows) {
+			sp->sp_row0 = sp->sp_row[0];
+			free(sp->sp_row);
+			sp->sp_row = &sp->sp_row0;
+			sp->sp_run_len *= nrows;
+			sp->sp_nrows = 1;
+		}
+	}
+	sp->sp_bytes = sp->sp_nrows * sp->sp_runs * sp->sp_run_len;
+	return 0;
+}
+
+void
+iod_slab_plan_free(struct iod_slab_plan *sp)
+{
+	if (sp->sp_row != &sp->sp_row0)
+		free(sp->sp_row);
+	sp->sp_row = &sp->sp_row0;
+	sp->sp_nrows = 0;
+}
+
+/** bytes from the first byte of a row to the end of its last run */
+static inline iod_size_t
+iod_slab_span(const struct iod_slab_plan *sp)
+{
+	return (sp->sp_runs - 1) * sp->sp_stride + sp->sp_run_len;
+}
+
+/**
+ * Append the bytes selected by \a sp from the cursor to the data log of
+ * \a obj and map each run in the layer of \a tid.
+ */
+int
+iod_slab_write(struct iod_obj *obj, iod_trans_id_t tid,
+	       const struct iod_slab_plan *sp, struct iod_memcur *mc)
+{
+	struct iod_layer	*layer;
+	iod_checksum_t		cs;
+	iod_size_t		r;
+	iod_size_t		i;
+	iod_off_t		end;
+	uint64_t		addr;
+	int			rc;
+
+	if (sp->sp_bytes == 0)
+		return 0;
+	rc = iod_obj_log_append(obj, sp->sp_bytes, mc, &addr, &cs);
+	if (rc != 0)
+		return rc;
+
+	rc = iod_obj_write_lock(obj, tid);
+	if (rc != 0)
+		return rc;
+	rc = iod_cks_add(obj, tid, addr, sp->sp_bytes, &cs);
+	layer = iod_layer_get(obj, tid);
+	if (layer == NULL)
+		rc = -ENOMEM;
+	for (r = 0; r < sp->sp_nrows && rc == 0; r++) {
+		for (i = 0; i < sp->sp_runs && rc == 0; i++) {
+			rc = iod_layer_insert(layer, sp->sp_row[r] +
+					      i * sp->sp_stride,
+					      sp->sp_run_len, addr);
+			addr += sp->sp_run_len;
+		}
+	}
+	end = sp->sp_row[sp->sp_nrows - 1] + iod_slab_span(sp);
+	if (rc == 0 && end > (iod_off_t)obj->io_size)
+		obj->io_size = end;
+	pthread_rwlock_unlock(&obj->io_lock);
+	return rc;
+}
+
+/* ---------------------------- pack kernels ------------------------------ */
+
+typedef void (*iod_pack_fn_t)(char *dst, const char *src, iod_size_t n,
+			      iod_size_t stride);
+
+static void
+iod_pack_4(char *dst, const char *src, iod_size_t n, iod_size_t stride)
+{
+	uint32_t	*d = (uint32_t *)dst;
+	iod_size_t	i;
+
+	for (i = 0; i < n; i++, src += stride)
+		memcpy(&d[i], src, 4);
+}
+
+static void
+iod_pack_8(char *dst, const char *src, iod_size_t n, iod_size_t stride)
+{
+	uint64_t	*d = (uint64_t *)dst;
+	iod_size_t	i;
+
+	for (i = 0; i < n; i++, src += stride)
+		memcpy(&d[i], src, 8);
+}
+
+static void
+iod_pack_16(char *dst, const char *src, iod_size_t n, iod_size_t stride)
+{
+	iod_size_t	i;
+
+	for (i = 0; i < n; i++, src += stride, dst += 16)
+		memcpy(dst, src, 16);
+}
+
+#ifdef IOD_HAVE_AVX2
+__attribute__((target("avx2"))) static void
+iod_pack_4_avx2(char *dst, const char *src, iod_size_t n, iod_size_t stride)
+{
+	__m256i		vidx;
+	iod_size_t	i;
+
+	vidx = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+				  _mm256_set1_epi32((int)stride));
+	for (i = 0; i + 8 <= n; i += 8, src += 8 * stride)
+		_mm256_storeu_si256((__m256i *)(dst + i * 4),
+				    _mm256_i32gather_epi32((const int *)src,
+							   vidx, 1));
+	iod_pack_4(dst + i * 4, src, n - i, stride);
+}
+
+__attribute__((target("avx2"))) static void
+iod_pack_8_avx2(char *dst, const char *src, iod_size_t n, iod_size_t stride)
+{
+	__m128i		vidx;
+	iod_size_t	i;
+
+	vidx = _mm_mullo_epi32(_mm_setr_epi32(0, 1, 2, 3),
+			       _mm_set1_epi32((int)stride));
+	for (i = 0; i + 4 <= n; i += 4, src += 4 * stride)
+		_mm256_storeu_si256((__m256i *)(dst + i * 8),
+				    _mm256_i32gather_epi64(
+					(const long long *)src, vidx, 1));
+	iod_pack_8(dst + i * 8, src, n - i, stride);
+}
+
+static int	iod_avx2 = -1;
+#endif
+
+/** the kernel packing \a len byte runs \a stride bytes apart */
+static iod_pack_fn_t
+iod_pack_fn(iod_size_t len, iod_size_t stride)
+{
+#ifdef IOD_HAVE_AVX2
+	if (iod_avx2 < 0)
+		iod_avx2 = __builtin_cpu_supports("avx2");
+	/* gather offsets are 32 bit */
+	if (iod_avx2 && stride <= INT_MAX / 8) {
+		if (len == 4)
+			return iod_pack_4_avx2;
+		if (len == 8)
+			return iod_pack_8_avx2;
+	}
+#endif
+	switch (len) {
+	case 4:
+		return iod_pack_4;
+	case 8:
+		return iod_pack_8;
+	case 16:
+		return iod_pack_16;
+	default:
+		return NULL;
+	}
+}
+
+/** copy the runs of one staged row at \a src into the cursor */
+static int
+iod_slab_pack(const struct iod_slab_plan *sp, iod_pack_fn_t fn,
+	      const char *src, struct iod_memcur *mc)
+{
+	iod_size_t	i;
+	char		*dst;
+	int		rc;
+
+	if (sp->sp_runs == 1)
+		return iod_memcur_fill(mc, src, sp->sp_run_len);
+	dst = iod_memcur_take(mc, sp->sp_runs * sp->sp_run_len);
+	if (dst != NULL && fn != NULL) {
+		fn(dst, src, sp->sp_runs, sp->sp_stride);
+		return 0;
+	}
+	for (i = 0; i < sp->sp_runs; i++, src += sp->sp_stride) {
+		if (dst != NULL) {
+			memcpy(dst, src, sp->sp_run_len);
+			dst += sp->sp_run_len;
+			continue;
+		}
+		rc = iod_memcur_fill(mc, src, sp->sp_run_len);
+		if (rc != 0)
+			return rc;
+	}
+	return 0;
+}
+
+/** rows [i, *j) staged together, their bytes are [sp_row[i], *hi) */
+static void
+iod_slab_window(const struct iod_slab_plan *sp, iod_size_t i, iod_size_t *j,
+		iod_off_t *hi)
+{
+	iod_size_t	span = iod_slab_span(sp);
+	iod_off_t	lo = sp->sp_row[i];
+
+	*hi = lo + span;
+	for (*j = i + 1; *j < sp->sp_nrows; (*j)++) {
+		if (sp->sp_row[*j] + span - lo > IOD_SLAB_WINDOW ||
+		    sp->sp_row[*j] - *hi > (iod_off_t)IOD_SLAB_GAP)
+			break;
+		*hi = sp->sp_row[*j] + span;
+	}
+}
+
+/**
+ * Read the bytes selected by \a sp as seen at \a tid into the cursor. Caller
+ * holds io_lock.
+ */
+int
+iod_slab_read(struct iod_obj *obj, iod_trans_id_t tid,
+	      const struct iod_slab_plan *sp, struct iod_memcur *mc)
+{
+	struct iod_memcur	smc;
+	iod_mem_desc_t		*smd = NULL;
+	iod_pack_fn_t		fn;
+	char			*buf = NULL;
+	iod_size_t		span = iod_slab_span(sp);
+	iod_size_t		bufsz = 0;
+	iod_size_t		r;
+	iod_size_t		i;
+	iod_size_t		j;
+	iod_off_t		hi;
+	int			rc = 0;
+
+	if (sp->sp_bytes == 0)
+		return 0;
+
+	/* long runs, or rows too wide to stage, are read in place */
+	if (sp->sp_run_len >= IOD_SLAB_DIRECT || span > IOD_SLAB_WINDOW) {
+		for (r = 0; r < sp->sp_nrows && rc == 0; r++)
+			for (i = 0; i < sp->sp_runs && rc == 0; i++)
+				rc = iod_obj_read_range(obj, tid,
+						sp->sp_row[r] + i * sp->sp_stride,
+						sp->sp_run_len, mc);
+		return rc;
+	}
+
+	for (i = 0; i < sp->sp_nrows; i = j) {
+		iod_slab_window(sp, i, &j, &hi);
+		if (j > i + 1 || sp->sp_runs > 1)
+			bufsz = iod_max(bufsz, hi - sp->sp_row[i]);
+	}
+	if (bufsz > 0) {
+		buf = malloc(bufsz);
+		smd = malloc(sizeof(*smd) + sizeof(smd->frag[0]));
+		if (buf == NULL || smd == NULL) {
+			rc = -ENOMEM;
+			goto out;
+		}
+		smd->nfrag = 1;
+		smd->frag[0].addr = buf;
+	}
+	fn = iod_pack_fn(sp->sp_run_len, sp->sp_stride);
+
+	for (i = 0; i < sp->sp_nrows && rc == 0; i = j) {
+		iod_slab_window(sp, i, &j, &hi);
+		/* a lone single-run row goes straight to the cursor */
+		if (j == i + 1 && sp->sp_runs == 1) {
+			rc = iod_obj_read_range(obj, tid, sp->sp_row[i],
+						sp->sp_run_len, mc);
+			continue;
+		}
+		smd->frag[0].len = hi - sp->sp_row[i];
+		iod_memcur_init(&smc, smd);
+		rc = iod_obj_read_range(obj, tid, sp->sp_row[i],
+					smd->frag[0].len, &smc);
+		for (r = i; r < j && rc == 0; r++)
+			rc = iod_slab_pack(sp, fn,
+					   buf + (sp->sp_row[r] - sp->sp_row[i]),
+					   mc);
+	}
+out:
+	free(smd);
+	free(buf);
+	return rc;
+}
@@ -0,0 +1,1569 @@
+/*
+ * IOD transactions.
+ *
+ * Each container keeps its TIDs in a table sorted by TID. A write TID moves
+ * STARTED -> FINISHED once all of its participants finished it, and FINISHED
+ * -> READABLE once every lower write TID is readable or aborted, or right
+ * away if it was started independent. Becoming readable commits the TID's
+ * versions in every object it touched; aborting drops them again. Becoming
+ * readable is also recorded in the container's write-ahead log, and finish
+ * events complete once that record is durable. With "iod.trans_lease" set,
+ * a write TID nobody started, finished or wrote for that long is aborted, so
+ * a dead participant cannot hold back the TIDs above it for good.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "iod_internal.h"
+
+/** finish events to complete once the container lock is dropped */
+struct iod_done {
+	iod_event_t	**d_ev;
+	int		*d_rc;
+	unsigned long	d_nr;
+	unsigned long	d_max;
+	struct iod_wal	*d_wal;
+	uint64_t	d_group;	/* WAL group of the latest commit */
+};
+
+static void
+iod_done_add(struct iod_done *done, iod_event_t *ev, int rc)
+{
+	unsigned long	max;
+	iod_event_t	**evs;
+	int		*rcs;
+
+	if (done->d_nr == done->d_max) {
+		max = iod_max(done->d_max * 2, 8UL);
+		evs = realloc(done->d_ev, max * sizeof(*evs));
+		if (evs != NULL)
+			done->d_ev = evs;
+		rcs = realloc(done->d_rc, max * sizeof(*rcs));
+		if (rcs != NULL)
+			done->d_rc = rcs;
+		if (evs == NULL || rcs == NULL) {
+			/* cannot defer it, complete it right away */
+			iod_ev_complete(ev, rc);
+			return;
+		}
+		done->d_max = max;
+	}
+	done->d_ev[done->d_nr] = ev;
+	done->d_rc[done->d_nr] = rc;
+	done->d_nr++;
+}
+
+/** complete the deferred events once the commits they saw are durable */
+static int
+iod_done_flush(struct iod_done *done)
+{
+	unsigned long	i;
+	int		rc;
+
+	rc = iod_wal_wait(done->d_wal, done->d_group);
+	for (i = 0; i < done->d_nr; i++)
+		iod_ev_complete(done->d_ev[i],
+				done->d_rc[i] == 0 ? rc : done->d_rc[i]);
+	free(done->d_ev);
+	free(done->d_rc);
+	return rc;
+}
+
+static void
+iod_trans_wake(struct iod_trans *trans, struct iod_done *done, int rc)
+{
+	unsigned long	i;
+
+	for (i = 0; i < trans->it_nwaiters; i++)
+		iod_done_add(done, trans->it_waiters[i], rc);
+	trans->it_nwaiters = 0;
+}
+
+static long
+iod_trans_index(struct iod_cont *cont, iod_trans_id_t tid)
+{
+	unsigned long	lo = 0;
+	unsigned long	hi = cont->ic_ntrans;
+	unsigned long	mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (cont->ic_trans[mid]->it_tid < tid)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/** Caller holds ic_lock. */
+struct iod_trans *
+iod_trans_find(struct iod_cont *cont, iod_trans_id_t tid)
+{
+	long	i = iod_trans_index(cont, tid);
+
+	if ((unsigned long)i < cont->ic_ntrans &&
+	    cont->ic_trans[i]->it_tid == tid)
+		return cont->ic_trans[i];
+	return NULL;
+}
+
+/** the monotonic clock, in milliseconds */
+static uint64_t
+iod_msec(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+/** Caller holds ic_lock. */
+static struct iod_trans *
+iod_trans_add(struct iod_cont *cont, iod_trans_id_t tid,
+	      iod_trans_status_t status)
+{
+	struct iod_trans	**tbl;
+	struct iod_trans	*trans;
+	unsigned long		max;
+	long			i;
+
+	if (cont->ic_ntrans == cont->ic_trans_max) {
+		max = iod_max(cont->ic_trans_max * 2, 64UL);
+		tbl = realloc(cont->ic_trans, max * sizeof(*tbl));
+		if (tbl == NULL)
+			return NULL;
+		cont->ic_trans = tbl;
+		cont->ic_trans_max = max;
+	}
+	trans = calloc(1, sizeof(*trans));
+	if (trans == NULL)
+		return NULL;
+	trans->it_tid = tid;
+	trans->it_status = status;
+	if (tid < cont->ic_unsettled)
+		cont->ic_unsettled = tid;
+
+	i = iod_trans_index(cont, tid);
+	memmove(&cont->ic_trans[i + 1], &cont->ic_trans[i],
+		(cont->ic_ntrans - i) * sizeof(*cont->ic_trans));
+	cont->ic_trans[i] = trans;
+	cont->ic_ntrans++;
+	return trans;
+}
+
+/*
+ * Finish trees. The finishes of a multi-leader write TID with more ranks
+ * than the fan-out are counted in a tree of sub-coordinators rather than in
+ * it_nfinished: rank r reports to leaf r / fanout, and whoever completes a
+ * node moves on to report to its parent. Only the finish that completes the
+ * root takes ic_lock, so the other ranks never touch the TID table.
+ *
+ * Each node word holds the low 32 bits of the TID above the count of its
+ * finished children, so a stray finish can never count towards another TID.
+ * A tree is reused by a later TID of the same slot once its root completed,
+ * when nobody can still be climbing it; the tree of an aborted TID may still
+ * have climbers and is retired until the container closes instead.
+ */
+
+/** one sub-coordinator, on a cache line of its own */
+struct iod_agg_node {
+	uint64_t	an_word;	/* TID tag << 32 | children finished */
+	unsigned int	an_target;	/* children to wait for */
+	unsigned int	an_parent;	/* the root is its own parent */
+} __attribute__((aligned(64)));
+
+struct iod_trans_agg {
+	struct iod_trans_agg	*ia_next;	/* on ic_agg_retired */
+	iod_trans_id_t		ia_tid;		/* 0 while the slot is idle */
+	int			ia_aborted;
+	int			ia_used;	/* finished since lease scan */
+	unsigned int		ia_num_ranks;
+	unsigned int		ia_fanout;
+	unsigned int		ia_ticket;	/* ranks that gave no rank */
+	unsigned int		ia_max;		/* nodes allocated */
+	struct iod_agg_node	ia_nodes[];
+};
+
+static unsigned int
+iod_agg_nnodes(unsigned int num_ranks, unsigned int fanout)
+{
+	unsigned int	n = num_ranks;
+	unsigned int	nr = 0;
+
+	do {
+		n = (n + fanout - 1) / fanout;
+		nr += n;
+	} while (n > 1);
+	return nr;
+}
+
+/** lay out the tree of \a tid, leaves first and the root last */
+static void
+iod_agg_build(struct iod_trans_agg *agg, iod_trans_id_t tid,
+	      unsigned int num_ranks, unsigned int fanout)
+{
+	struct iod_agg_node	*node;
+	uint64_t		tag = (uint64_t)(uint32_t)tid << 32;
+	unsigned int		base = 0;
+	unsigned int		n = num_ranks;
+	unsigned int		cnt;
+	unsigned int		i;
+
+	do {
+		cnt = (n + fanout - 1) / fanout;
+		for (i = 0; i < cnt; i++) {
+			node = &agg->ia_nodes[base + i];
+			node->an_word = tag;
+			node->an_target = iod_min(fanout, n - i * fanout);
+			node->an_parent = cnt == 1 ? base + i :
+					  base + cnt + i / fanout;
+		}
+		base += cnt;
+		n = cnt;
+	} while (cnt > 1);
+	agg->ia_num_ranks = num_ranks;
+	agg->ia_fanout = fanout;
+	__atomic_store_n(&agg->ia_ticket, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&agg->ia_used, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&agg->ia_tid, tid, __ATOMIC_RELEASE);
+}
+
+/**
+ * Give the new multi-leader TID \a trans a finish tree if it has more ranks
+ * than \a fanout and its slot is free; it is counted flat otherwise.
+ * Caller holds ic_lock.
+ */
+static void
+iod_agg_get(struct iod_cont *cont, struct iod_trans *trans,
+	    unsigned int fanout)
+{
+	struct iod_trans_agg	**slot;
+	struct iod_trans_agg	*agg;
+	size_t			size;
+	unsigned int		nr;
+
+	if (fanout < 2 || trans->it_num_ranks <= fanout)
+		return;
+	slot = &cont->ic_agg[trans->it_tid % IOD_TRANS_AGG_SLOTS];
+	agg = *slot;
+	if (agg != NULL && agg->ia_tid != 0)
+		return;
+
+	nr = iod_agg_nnodes(trans->it_num_ranks, fanout);
+	if (agg == NULL || agg->ia_max < nr) {
+		size = sizeof(*agg) + nr * sizeof(agg->ia_nodes[0]);
+		if (posix_memalign((void **)&agg, sizeof(agg->ia_nodes[0]),
+				   size) != 0)
+			return;
+		memset(agg, 0, sizeof(*agg));
+		agg->ia_max = nr;
+		/* lock-free lookups may still hold the old one */
+		if (*slot != NULL) {
+			(*slot)->ia_next = cont->ic_agg_retired;
+			cont->ic_agg_retired = *slot;
+		}
+	}
+	iod_agg_build(agg, trans->it_tid, trans->it_num_ranks, fanout);
+	__atomic_store_n(slot, agg, __ATOMIC_RELEASE);
+	trans->it_agg = agg;
+}
+
+/**
+ * \a trans stops counting finishes in its tree, because its root completed
+ * or, with \a abort set, because the TID is aborted. Caller holds ic_lock.
+ */
+static void
+iod_agg_put(struct iod_cont *cont, struct iod_trans *trans, int abort)
+{
+	struct iod_trans_agg	*agg = trans->it_agg;
+	struct iod_trans_agg	**slot;
+
+	if (agg == NULL)
+		return;
+	trans->it_agg = NULL;
+	if (abort) {
+		slot = &cont->ic_agg[trans->it_tid % IOD_TRANS_AGG_SLOTS];
+		__atomic_store_n(slot, NULL, __ATOMIC_RELEASE);
+		__atomic_store_n(&agg->ia_aborted, 1, __ATOMIC_RELEASE);
+		agg->ia_next = cont->ic_agg_retired;
+		cont->ic_agg_retired = agg;
+	}
+	__atomic_store_n(&agg->ia_tid, 0, __ATOMIC_RELEASE);
+}
+
+static void
+iod_agg_free_all(struct iod_cont *cont)
+{
+	struct iod_trans_agg	*agg;
+	unsigned long		i;
+
+	for (i = 0; i < IOD_TRANS_AGG_SLOTS; i++) {
+		free(cont->ic_agg[i]);
+		cont->ic_agg[i] = NULL;
+	}
+	while ((agg = cont->ic_agg_retired) != NULL) {
+		cont->ic_agg_retired = agg->ia_next;
+		free(agg);
+	}
+}
+
+/** the finish tree counting \a tid, found without ic_lock */
+static struct iod_trans_agg *
+iod_agg_lookup(struct iod_cont *cont, iod_trans_id_t tid)
+{
+	struct iod_trans_agg	*agg;
+	iod_trans_id_t		agg_tid;
+
+	agg = __atomic_load_n(&cont->ic_agg[tid % IOD_TRANS_AGG_SLOTS],
+			      __ATOMIC_ACQUIRE);
+	if (agg == NULL)
+		return NULL;
+	agg_tid = __atomic_load_n(&agg->ia_tid, __ATOMIC_ACQUIRE);
+	if (agg_tid != tid)
+		return NULL;
+	return agg;
+}
+
+/**
+ * Count one finish of \a tid in its tree \a agg, for the rank in the "rank"
+ * hint or else the next one not given out yet. Returns 1 if it completed
+ * the root, 0 if other ranks are still to finish, or -EINVAL if the rank has
+ * already finished or the TID is no longer counted in \a agg.
+ */
+static int
+iod_agg_finish(struct iod_trans_agg *agg, iod_trans_id_t tid,
+	       iod_hint_list_t *hints)
+{
+	const struct iod_policy	*pol;
+	struct iod_policy	buf;
+	struct iod_agg_node	*node;
+	uint32_t		tag = (uint32_t)tid;
+	unsigned long		rank;
+	unsigned int		target;
+	unsigned int		parent;
+	unsigned int		idx;
+	uint64_t		old;
+	int			rc;
+
+	rc = iod_policy_resolve(NULL, hints, &buf, &pol);
+	if (rc != 0)
+		return rc;
+	if (pol->ip_set & IOD_POL_RANK)
+		rank = pol->ip_rank;
+	else
+		rank = __atomic_fetch_add(&agg->ia_ticket, 1, __ATOMIC_RELAXED);
+	if (rank >= agg->ia_num_ranks)
+		return -EINVAL;
+
+	idx = rank / agg->ia_fanout;
+	for (;;) {
+		/* nothing of the node is read once it is counted */
+		node = &agg->ia_nodes[idx];
+		target = node->an_target;
+		parent = node->an_parent;
+		old = __atomic_load_n(&node->an_word, __ATOMIC_RELAXED);
+		do {
+			if ((uint32_t)(old >> 32) != tag ||
+			    (uint32_t)old >= target)
+				return -EINVAL;
+		} while (!__atomic_compare_exchange_n(&node->an_word, &old,
+						      old + 1, 0,
+						      __ATOMIC_ACQ_REL,
+						      __ATOMIC_RELAXED));
+		if ((uint32_t)old + 1 < target)
+			return 0;
+		if (parent == idx)
+			return 1;
+		idx = parent;
+	}
+}
+
+static void
+iod_trans_free(struct iod_trans *trans)
+{
+	free(trans->it_waiters);
+	free(trans->it_dirty);
+	free(trans);
+}
+
+void
+iod_trans_free_all(struct iod_cont *cont)
+{
+	struct iod_trans	*trans;
+	unsigned long		i;
+	unsigned long		j;
+
+	for (i = 0; i < cont->ic_ntrans; i++) {
+		trans = cont->ic_trans[i];
+		for (j = 0; j < trans->it_nwaiters; j++)
+			iod_ev_complete(trans->it_waiters[j], -ESHUTDOWN);
+		iod_trans_free(trans);
+	}
+	free(cont->ic_trans);
+	cont->ic_trans = NULL;
+	cont->ic_ntrans = 0;
+	cont->ic_trans_max = 0;
+	iod_agg_free_all(cont);
+}
+
+/**
+ * Add the TID 0 that every container starts from: empty, readable and
+ * durable. Caller holds ic_lock.
+ */
+int
+iod_trans_init(struct iod_cont *cont)
+{
+	if (iod_trans_find(cont, 0) != NULL)
+		return 0;
+	return iod_trans_add(cont, 0, IOD_TRANS_DURABLE) == NULL ? -ENOMEM : 0;
+}
+
+/** Restore a readable TID from the catalog checkpoint. */
+int
+iod_trans_restore(struct iod_cont *cont, iod_trans_id_t tid,
+		  iod_trans_status_t status)
+{
+	return iod_trans_add(cont, tid, status) == NULL ? -ENOMEM : 0;
+}
+
+/** 0 if \a trans takes writes, -ECANCELED once aborted, -EINVAL otherwise */
+static int
+iod_trans_open_rc(const struct iod_trans *trans)
+{
+	if (trans == NULL)
+		return -EINVAL;
+	if (trans->it_status == IOD_TRANS_ABORTED)
+		return -ECANCELED;
+	return trans->it_status == IOD_TRANS_STARTED ? 0 : -EINVAL;
+}
+
+/**
+ * Whether write TID \a tid still takes changes, see iod_trans_open_rc.
+ * Caller holds ic_lock.
+ */
+int
+iod_trans_writable(struct iod_cont *cont, iod_trans_id_t tid)
+{
+	return iod_trans_open_rc(iod_trans_find(cont, tid));
+}
+
+static int
+iod_trans_mark(struct iod_cont *cont, iod_trans_id_t tid,
+	       struct iod_obj *obj, int logged)
+{
+	struct iod_trans	*trans = iod_trans_find(cont, tid);
+	struct iod_trans	*prev;
+	struct iod_obj		**dirty;
+	unsigned long		max;
+	int			rc;
+
+	rc = iod_trans_open_rc(trans);
+	if (rc != 0)
+		return rc;
+	trans->it_used = 1;
+	if (!logged)
+		trans->it_unlogged = 1;
+	if (obj->io_last_dirty == tid)
+		return 0;
+	/* the lease mark of the TID that wrote it last is not to be lost */
+	if (obj->io_last_dirty != IOD_TID_UNKNOWN &&
+	    __atomic_load_n(&obj->io_lease_tid, __ATOMIC_RELAXED) ==
+	    obj->io_last_dirty) {
+		prev = iod_trans_find(cont, obj->io_last_dirty);
+		if (prev != NULL)
+			prev->it_used = 1;
+	}
+
+	if (trans->it_ndirty == trans->it_dirty_max) {
+		max = iod_max(trans->it_dirty_max * 2, 16UL);
+		dirty = realloc(trans->it_dirty, max * sizeof(*dirty));
+		if (dirty == NULL)
+			return -ENOMEM;
+		trans->it_dirty = dirty;
+		trans->it_dirty_max = max;
+	}
+	rc = iod_cat_reserve(cont, obj);
+	if (rc != 0)
+		return rc;
+	trans->it_dirty[trans->it_ndirty++] = obj;
+	/* the state of the TID is settled before writes skip ic_lock */
+	__atomic_store_n(&obj->io_last_dirty, tid, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/**
+ * Record that write TID \a tid touched \a obj, so it can be committed or
+ * rolled back later. The change is not in the write-ahead log, so a replay
+ * of the TID would be partial. Caller holds ic_lock.
+ */
+int
+iod_trans_dirty(struct iod_cont *cont, iod_trans_id_t tid,
+		struct iod_obj *obj)
+{
+	return iod_trans_mark(cont, tid, obj, 0);
+}
+
+/**
+ * \a trans takes no more changes: writes to its objects go back through
+ * ic_lock, where they are refused. Caller holds ic_lock.
+ */
+static void
+iod_trans_seal(struct iod_trans *trans)
+{
+	iod_trans_id_t	tid;
+	unsigned long	i;
+
+	for (i = 0; i < trans->it_ndirty; i++) {
+		tid = trans->it_tid;
+		__atomic_compare_exchange_n(&trans->it_dirty[i]->io_last_dirty,
+					    &tid, IOD_TID_UNKNOWN, 0,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+	}
+}
+
+/** iod_trans_dirty for a change the caller logs. Caller holds ic_lock. */
+int
+iod_trans_dirty_logged(struct iod_cont *cont, iod_trans_id_t tid,
+		       struct iod_obj *obj)
+{
+	return iod_trans_mark(cont, tid, obj, 1);
+}
+
+/**
+ * A log record of \a tid could not be written: the TID can no longer be
+ * replayed whole. Caller holds ic_lock.
+ */
+void
+iod_trans_unlogged(struct iod_cont *cont, iod_trans_id_t tid)
+{
+	struct iod_trans	*trans = iod_trans_find(cont, tid);
+
+	if (trans != NULL && trans->it_status == IOD_TRANS_STARTED)
+		trans->it_unlogged = 1;
+}
+
+static int
+iod_ptr_cmp(const void *a, const void *b)
+{
+	uintptr_t	pa = (uintptr_t)*(void * const *)a;
+	uintptr_t	pb = (uintptr_t)*(void * const *)b;
+
+	return pa < pb ? -1 : pa > pb;
+}
+
+/**
+ * Sort and de-duplicate the dirty list of \a trans, which is committed or
+ * rolled back, and give back the catalog slots its entries reserved.
+ */
+static void
+iod_trans_dirty_settle(struct iod_trans *trans)
+{
+	unsigned long	i;
+	unsigned long	n = 0;
+
+	for (i = 0; i < trans->it_ndirty; i++)
+		iod_cat_unreserve(trans->it_dirty[i]);
+	if (trans->it_ndirty < 2)
+		return;
+	qsort(trans->it_dirty, trans->it_ndirty, sizeof(*trans->it_dirty),
+	      iod_ptr_cmp);
+	for (i = 0; i < trans->it_ndirty; i++) {
+		if (n == 0 || trans->it_dirty[n - 1] != trans->it_dirty[i])
+			trans->it_dirty[n++] = trans->it_dirty[i];
+	}
+	trans->it_ndirty = n;
+}
+
+static void
+iod_trans_commit(struct iod_cont *cont, struct iod_trans *trans)
+{
+	struct iod_layer	*layer;
+	struct iod_list		*pos;
+	struct iod_obj		*obj;
+	iod_trans_id_t		tid = trans->it_tid;
+	unsigned long		i;
+
+	(void)cont;
+	iod_trans_dirty_settle(trans);
+	for (i = 0; i < trans->it_ndirty; i++) {
+		obj = trans->it_dirty[i];
+		pthread_rwlock_wrlock(&obj->io_lock);
+		if (obj->io_create_tid == tid)
+			obj->io_create_committed = 1;
+		if (obj->io_unlink_tid == tid)
+			obj->io_unlink_committed = 1;
+		if (obj->io_create_tid != tid && obj->io_unlink_tid != tid)
+			iod_cat_mod(obj, tid);
+		iod_cat_sync(obj);
+		iod_list_for_each(pos, &obj->io_layers) {
+			layer = iod_list_entry(pos, struct iod_layer, il_link);
+			if (layer->il_tid == tid)
+				iod_layer_commit(obj, layer);
+		}
+		iod_vattr_commit(obj->io_dim0, tid);
+		iod_vattr_commit(obj->io_scratch, tid);
+		if (obj->io_kv != NULL)
+			iod_kv_commit(obj, tid);
+		pthread_rwlock_unlock(&obj->io_lock);
+	}
+}
+
+/** undo what \a tid did to \a obj. Caller holds ic_lock. */
+static void
+iod_trans_rollback_obj(struct iod_cont *cont, iod_trans_id_t tid,
+		       struct iod_obj *obj)
+{
+	struct iod_layer	*layer;
+	struct iod_list		*pos;
+	struct iod_list		*n;
+	unsigned long		j;
+	char			path[PATH_MAX];
+
+	pthread_rwlock_wrlock(&obj->io_lock);
+	iod_list_for_each_safe(pos, n, &obj->io_layers) {
+		layer = iod_list_entry(pos, struct iod_layer, il_link);
+		if (layer->il_tid != tid)
+			continue;
+		/* give the rolled back data log space back */
+		for (j = 0; obj->io_fd >= 0 && j < layer->il_nr; j++)
+			iod_cache_punch(obj, layer->il_ext[j].ie_addr,
+					layer->il_ext[j].ie_len);
+		iod_layer_free(layer);
+	}
+	iod_vattr_drop(&obj->io_dim0, tid);
+	iod_vattr_drop(&obj->io_scratch, tid);
+	if (obj->io_kv != NULL)
+		iod_kv_drop(obj, tid);
+	if (obj->io_unlink_tid == tid)
+		__atomic_store_n(&obj->io_unlink_tid, IOD_TID_UNKNOWN,
+				 __ATOMIC_RELAXED);
+	if (obj->io_last_dirty == tid)
+		__atomic_store_n(&obj->io_last_dirty, IOD_TID_UNKNOWN,
+				 __ATOMIC_RELAXED);
+	pthread_rwlock_unlock(&obj->io_lock);
+
+	if (obj->io_create_tid != tid) {
+		iod_cat_sync(obj);
+		return;
+	}
+	obj->io_create_tid = IOD_TID_UNKNOWN;
+	iod_cat_sync(obj);
+	/* still referenced by a handle: just never show it */
+	if (obj->io_nopen > 0)
+		return;
+	iod_obj_remove(cont, obj);
+	iod_cache_release(obj);
+	if (iod_obj_log_path(obj, path, sizeof(path)) == 0)
+		unlink(path);
+	iod_obj_free(obj);
+}
+
+static void
+iod_trans_rollback(struct iod_cont *cont, struct iod_trans *trans)
+{
+	unsigned long	i;
+
+	iod_trans_dirty_settle(trans);
+	for (i = 0; i < trans->it_ndirty; i++)
+		iod_trans_rollback_obj(cont, trans->it_tid, trans->it_dirty[i]);
+	trans->it_ndirty = 0;
+}
+
+/**
+ * Roll back the TIDs on ic_reclaim, in the order they were aborted, and free
+ * their dirty lists. With \a yield, ic_lock is let go after each object.
+ * Caller holds ic_lock.
+ */
+static void
+iod_trans_reclaim(struct iod_cont *cont, int yield)
+{
+	struct iod_trans	*trans;
+	struct iod_obj		*obj;
+
+	while (!iod_list_empty(&cont->ic_reclaim)) {
+		trans = iod_list_entry(cont->ic_reclaim.next, struct iod_trans,
+				       it_reclaim);
+		iod_list_del_init(&trans->it_reclaim);
+		iod_trans_dirty_settle(trans);
+		while (trans->it_ndirty > 0) {
+			obj = trans->it_dirty[--trans->it_ndirty];
+			iod_trans_rollback_obj(cont, trans->it_tid, obj);
+			if (yield) {
+				pthread_mutex_unlock(&cont->ic_lock);
+				pthread_mutex_lock(&cont->ic_lock);
+			}
+		}
+		free(trans->it_dirty);
+		trans->it_dirty = NULL;
+		trans->it_dirty_max = 0;
+	}
+}
+
+static int
+iod_trans_reclaim_op(struct iod_op *op)
+{
+	struct iod_cont	*cont = op->op_u.cont;
+
+	pthread_mutex_lock(&cont->ic_lock);
+	iod_trans_reclaim(cont, 1);
+	cont->ic_reclaim_bg = 0;
+	pthread_cond_broadcast(&cont->ic_persist_cond);
+	pthread_mutex_unlock(&cont->ic_lock);
+	return 0;
+}
+
+/**
+ * Hand the rollback of aborted \a trans to a worker, so that an abort costs
+ * the same however many objects the TID touched. Until the worker gets to
+ * them, its layers, versions and creations stay, uncommitted, where no read
+ * of another TID sees them. Without workers it is rolled back here. Caller
+ * holds ic_lock.
+ */
+static void
+iod_trans_reclaim_queue(struct iod_cont *cont, struct iod_trans *trans)
+{
+	struct iod_op	*op;
+
+	if (trans->it_ndirty == 0)
+		return;
+	iod_list_add_tail(&trans->it_reclaim, &cont->ic_reclaim);
+	if (cont->ic_reclaim_bg > 0)
+		return;
+	op = iod_op_alloc(NULL, IOD_EV_TRANS_FINISH, iod_trans_reclaim_op,
+			  trans->it_tid);
+	if (op != NULL) {
+		op->op_u.cont = cont;
+		/* the close waits for it */
+		cont->ic_reclaim_bg = 1;
+		if (iod_sched_defer(op) == 0)
+			return;
+		cont->ic_reclaim_bg = 0;
+		free(op);
+	}
+	iod_trans_reclaim(cont, 0);
+}
+
+/**
+ * Make every finished TID readable that is independent or whose lower write
+ * TIDs are all readable or aborted. Only the TIDs from the lowest one still
+ * open are looked at. Caller holds ic_lock.
+ */
+static void
+iod_trans_advance(struct iod_cont *cont, struct iod_done *done)
+{
+	struct iod_wal_rec	rec = { 0 };
+	struct iod_trans	*trans;
+	iod_trans_id_t		open = IOD_TID_UNKNOWN;
+	unsigned long		i;
+	uint64_t		group;
+	int			rc;
+
+	for (i = iod_trans_index(cont, cont->ic_unsettled);
+	     i < cont->ic_ntrans; i++) {
+		trans = cont->ic_trans[i];
+		if (trans->it_status == IOD_TRANS_STARTED ||
+		    (trans->it_status == IOD_TRANS_FINISHED &&
+		     open != IOD_TID_UNKNOWN && !trans->it_indep)) {
+			open = iod_min(open, trans->it_tid);
+			continue;
+		}
+		if (trans->it_status != IOD_TRANS_FINISHED)
+			continue;
+		iod_trans_commit(cont, trans);
+		trans->it_status = IOD_TRANS_READABLE;
+		/* listings read it without the lock */
+		if (trans->it_tid > cont->ic_tids.latest_rdable)
+			__atomic_store_n(&cont->ic_tids.latest_rdable,
+					 trans->it_tid, __ATOMIC_RELEASE);
+
+		rec.wr_type = IOD_WAL_COMMIT;
+		rec.wr_flags = trans->it_unlogged ? IOD_WAL_PARTIAL : 0;
+		rec.wr_tid = trans->it_tid;
+		rc = iod_wal_log(cont->ic_wal, &rec, NULL, 0, NULL, 0, &group);
+		done->d_wal = cont->ic_wal;
+		done->d_group = iod_max(done->d_group, group);
+		trans->it_group = group;
+		iod_trans_wake(trans, done, rc);
+	}
+	cont->ic_unsettled = open != IOD_TID_UNKNOWN ? open :
+			     cont->ic_tids.latest_wrting + 1;
+}
+
+static int
+iod_trans_wait(struct iod_trans *trans, iod_event_t *ev)
+{
+	iod_event_t	**evs;
+	unsigned long	max;
+
+	if (trans->it_nwaiters == trans->it_waiters_max) {
+		max = iod_max(trans->it_waiters_max * 2, 4UL);
+		evs = realloc(trans->it_waiters, max * sizeof(*evs));
+		if (evs == NULL)
+			return -ENOMEM;
+		trans->it_waiters = evs;
+		trans->it_waiters_max = max;
+	}
+	trans->it_waiters[trans->it_nwaiters++] = ev;
+	return 0;
+}
+
+static void
+iod_trans_abort(struct iod_cont *cont, struct iod_trans *trans,
+		struct iod_done *done)
+{
+	struct iod_wal_rec	rec = { 0 };
+	uint64_t		group;
+
+	/* replay drops it at the same point, nothing needs to wait for it */
+	rec.wr_type = IOD_WAL_ABORT;
+	rec.wr_tid = trans->it_tid;
+	iod_wal_log(cont->ic_wal, &rec, NULL, 0, NULL, 0, &group);
+	trans->it_status = IOD_TRANS_ABORTED;
+	/* writes skipping ic_lock must see it before the rollback starts */
+	iod_trans_seal(trans);
+	iod_agg_put(cont, trans, 1);
+	iod_trans_wake(trans, done, -ECANCELED);
+	iod_trans_reclaim_queue(cont, trans);
+}
+
+static int
+iod_trans_is_readable(struct iod_trans *trans)
+{
+	return trans->it_status == IOD_TRANS_READABLE ||
+	       trans->it_status == IOD_TRANS_DURABLE;
+}
+
+/**
+ * Forget the TIDs no reader can get at any more: those below both the
+ * persisted TID and the oldest TID a reader holds, once durable, or once
+ * aborted and rolled back. Caller holds ic_lock.
+ */
+static void
+iod_trans_prune(struct iod_cont *cont)
+{
+	struct iod_trans	*trans;
+	iod_trans_id_t		floor = cont->ic_persisted;
+	unsigned long		i;
+	unsigned long		n = 0;
+
+	for (i = 0; i < cont->ic_ntrans; i++) {
+		trans = cont->ic_trans[i];
+		if (trans->it_tid >= floor)
+			break;
+		if (trans->it_rdref > 0)
+			floor = trans->it_tid;
+	}
+	for (i = 0; i < cont->ic_ntrans; i++) {
+		trans = cont->ic_trans[i];
+		if (trans->it_tid < floor &&
+		    (trans->it_status == IOD_TRANS_DURABLE ||
+		     (trans->it_status == IOD_TRANS_ABORTED &&
+		      trans->it_ndirty == 0))) {
+			iod_trans_free(trans);
+			continue;
+		}
+		cont->ic_trans[n++] = trans;
+	}
+	cont->ic_ntrans = n;
+	if (floor > cont->ic_trans_floor)
+		cont->ic_trans_floor = floor;
+}
+
+/**
+ * Hold readable TID \a tid as a read of it does, so it is not forgotten.
+ * Caller holds ic_lock.
+ */
+int
+iod_trans_get(struct iod_cont *cont, iod_trans_id_t tid)
+{
+	struct iod_trans	*trans = iod_trans_find(cont, tid);
+
+	if (trans == NULL || !iod_trans_is_readable(trans))
+		return -EINVAL;
+	trans->it_rdref++;
+	return 0;
+}
+
+/** Let go of a TID iod_trans_get held. Caller holds ic_lock. */
+void
+iod_trans_put(struct iod_cont *cont, iod_trans_id_t tid)
+{
+	struct iod_trans	*trans = iod_trans_find(cont, tid);
+
+	if (trans == NULL || trans->it_rdref == 0)
+		return;
+	if (--trans->it_rdref == 0 && tid < cont->ic_persisted)
+		iod_trans_prune(cont);
+}
+
+/**
+ * The readable TIDs above \a lo up to \a hi are on central storage: they
+ * turn durable, and their dirty lists, which were kept for the persist, go.
+ * Caller holds ic_lock.
+ */
+void
+iod_trans_persisted(struct iod_cont *cont, iod_trans_id_t lo,
+		    iod_trans_id_t hi)
+{
+	struct iod_trans	*trans;
+	unsigned long		i;
+
+	for (i = iod_trans_index(cont, lo + 1); i < cont->ic_ntrans; i++) {
+		trans = cont->ic_trans[i];
+		if (trans->it_tid > hi)
+			break;
+		if (trans->it_status != IOD_TRANS_READABLE)
+			continue;
+		trans->it_status = IOD_TRANS_DURABLE;
+		free(trans->it_dirty);
+		trans->it_dirty = NULL;
+		trans->it_ndirty = 0;
+		trans->it_dirty_max = 0;
+	}
+	if (hi > lo) {
+		cont->ic_persisted = hi;
+		cont->ic_tids.lowest_durable = hi;
+	}
+	iod_trans_prune(cont);
+}
+
+iod_ret_t
+iod_container_query_tids(iod_handle_t coh, iod_container_tids_t *tids,
+			 iod_event_t *event)
+{
+	struct iod_cont	*cont = iod_cont_lookup(coh);
+
+	if (cont == NULL || tids == NULL)
+		return iod_ev_return(event, IOD_EV_CONT_QUERY_TIDS, -EINVAL);
+	pthread_mutex_lock(&cont->ic_lock);
+	*tids = cont->ic_tids;
+	pthread_mutex_unlock(&cont->ic_lock);
+	return iod_ev_return(event, IOD_EV_CONT_QUERY_TIDS, 0);
+}
+
+iod_ret_t
+iod_container_query_stats(iod_handle_t coh, iod_container_stats_t *stats,
+			  iod_event_t *event)
+{
+	struct iod_cont	*cont = iod_cont_lookup(coh);
+
+	if (cont == NULL || stats == NULL)
+		return iod_ev_return(event, IOD_EV_CONT_QUERY_STATS, -EINVAL);
+	pthread_mutex_lock(&cont->ic_lock);
+	*stats = cont->ic_stats;
+	stats->bb_bytes = iod_cache_used(cont);
+	pthread_mutex_unlock(&cont->ic_lock);
+	return iod_ev_return(event, IOD_EV_CONT_QUERY_STATS, 0);
+}
+
+iod_ret_t
+iod_trans_query(iod_handle_t coh, iod_trans_id_t tid,
+		iod_trans_status_t *status, iod_event_t *event)
+{
+	struct iod_cont		*cont = iod_cont_lookup(coh);
+	struct iod_trans	*trans;
+
+	if (cont == NULL || status == NULL)
+		return iod_ev_return(event, IOD_EV_TRANS_QUERY, -EINVAL);
+	pthread_mutex_lock(&cont->ic_lock);
+	trans = iod_trans_find(cont, tid);
+	*status = trans != NULL ? trans->it_status : IOD_TRANS_INVALID;
+	pthread_mutex_unlock(&cont->ic_lock);
+	return iod_ev_return(event, IOD_EV_TRANS_QUERY, 0);
+}
+
+/** Caller holds ic_lock. */
+static int
+iod_trans_start_write(struct iod_cont *cont, iod_trans_id_t *tid,
+		      unsigned int num_ranks, int indep, iod_hint_list_t *hints)
+{
+	const struct iod_policy	*pol;
+	struct iod_policy	buf;
+	struct iod_trans	*trans;
+	int			rc;
+
+	if (!(cont->ic_mode & (IOD_CONT_WO | IOD_CONT_RW)))
+		return -EPERM;
+	rc = iod_policy_resolve(NULL, hints, &buf, &pol);
+	if (rc != 0)
+		return rc;
+	if (*tid == IOD_TID_UNKNOWN) {
+		if (num_ranks != 0)
+			return -EINVAL;
+		*tid = cont->ic_tids.latest_wrting + 1;
+	}
+
+	trans = iod_trans_find(cont, *tid);
+	if (trans != NULL) {
+		/* another participant of a multi-leader TID */
+		if (trans->it_status != IOD_TRANS_STARTED ||
+		    num_ranks == 0 || trans->it_num_ranks != num_ranks ||
+		    trans->it_nstarted >= num_ranks ||
+		    trans->it_indep != indep)
+			return -EINVAL;
+		trans->it_nstarted++;
+		trans->it_used = 1;
+		return 0;
+	}
+	if (*tid <= cont->ic_tids.latest_wrting ||
+	    *tid <= cont->ic_tids.latest_rdable)
+		return -EINVAL;
+
+	trans = iod_trans_add(cont, *tid, IOD_TRANS_STARTED);
+	if (trans == NULL)
+		return -ENOMEM;
+	trans->it_num_ranks = num_ranks;
+	trans->it_nstarted = 1;
+	trans->it_indep = indep;
+	trans->it_renewed = iod_msec();
+	cont->ic_tids.latest_wrting = *tid;
+
+	iod_agg_get(cont, trans, pol->ip_set & IOD_POL_FANOUT ?
+				 pol->ip_fanout : iod_env.ie_fanout);
+	return 0;
+}
+
+/** Caller holds ic_lock. */
+static struct iod_trans *
+iod_trans_lowest_readable(struct iod_cont *cont)
+{
+	unsigned long	i;
+
+	for (i = 0; i < cont->ic_ntrans; i++) {
+		if (cont->ic_trans[i]->it_tid >= cont->ic_tids.lowest_durable &&
+		    iod_trans_is_readable(cont->ic_trans[i]))
+			return cont->ic_trans[i];
+	}
+	return NULL;
+}
+
+/** Caller holds ic_lock. */
+static int
+iod_trans_start_read(struct iod_cont *cont, iod_trans_id_t *tid,
+		     iod_hint_list_t *hints)
+{
+	const struct iod_policy	*pol;
+	struct iod_policy	buf;
+	struct iod_trans	*trans;
+	int			rc;
+
+	rc = iod_policy_resolve(NULL, hints, &buf, &pol);
+	if (rc != 0)
+		return rc;
+	if (*tid == IOD_TID_UNKNOWN) {
+		if (pol->ip_flags & IOD_POL_LOWEST_READABLE)
+			trans = iod_trans_lowest_readable(cont);
+		else
+			trans = iod_trans_find(cont,
+					       cont->ic_tids.latest_rdable);
+	} else {
+		trans = iod_trans_find(cont, *tid);
+	}
+	if (trans == NULL || !iod_trans_is_readable(trans))
+		return -EINVAL;
+	trans->it_rdref++;
+	*tid = trans->it_tid;
+	return 0;
+}
+
+iod_ret_t
+iod_trans_start(iod_handle_t coh, iod_trans_id_t *tid, iod_hint_list_t *hints,
+		unsigned int num_ranks, unsigned int mode,
+		iod_event_t *event)
+{
+	struct iod_cont	*cont = iod_cont_lookup(coh);
+	int		indep = (mode & IOD_TRANS_INDEPENDENT) != 0;
+	int		rc;
+
+	mode &= ~IOD_TRANS_INDEPENDENT;
+	if (cont == NULL || tid == NULL ||
+	    (mode != IOD_TRANS_RD && mode != IOD_TRANS_WR) ||
+	    (indep && mode != IOD_TRANS_WR))
+		return iod_ev_return(event, IOD_EV_TRANS_START, -EINVAL);
+
+	pthread_mutex_lock(&cont->ic_lock);
+	if (mode == IOD_TRANS_WR)
+		rc = iod_trans_start_write(cont, tid, num_ranks, indep, hints);
+	else
+		rc = iod_trans_start_read(cont, tid, hints);
+	pthread_mutex_unlock(&cont->ic_lock);
+	return iod_ev_return(event, IOD_EV_TRANS_START, rc);
+}
+
+/**
+ * Queue the \a event of a finish counted in the finish tree of \a trans
+ * until the TID is readable or aborted. Other ranks may have settled it
+ * since, the event completes right away then. Caller holds ic_lock.
+ */
+static int
+iod_trans_finish_event(struct iod_cont *cont, struct iod_trans *trans,
+		       iod_event_t *event, struct iod_done *done)
+{
+	int	rc;
+
+	if (event == NULL)
+		return 0;
+	switch (trans->it_status) {
+	case IOD_TRANS_STARTED:
+	case IOD_TRANS_FINISHED:
+		rc = iod_trans_wait(trans, event);
+		if (rc != 0)
+			return rc;
+		iod_ev_launch(event, IOD_EV_TRANS_FINISH);
+		break;
+	case IOD_TRANS_ABORTED:
+		iod_ev_launch(event, IOD_EV_TRANS_FINISH);
+		iod_done_add(done, event, -ECANCELED);
+		break;
+	default:
+		iod_ev_launch(event, IOD_EV_TRANS_FINISH);
+		done->d_wal = cont->ic_wal;
+		done->d_group = iod_max(done->d_group, trans->it_group);
+		iod_done_add(done, event, 0);
+		break;
+	}
+	return 0;
+}
+
+/** the root of the finish tree of \a trans completed. Caller holds ic_lock. */
+static void
+iod_trans_agg_done(struct iod_cont *cont, struct iod_trans *trans)
+{
+	trans->it_nfinished = trans->it_num_ranks;
+	trans->it_status = IOD_TRANS_FINISHED;
+	iod_trans_seal(trans);
+	iod_agg_put(cont, trans, 0);
+}
+
+/**
+ * Finish one participant's part of a TID. Caller holds ic_lock. For a write
+ * TID the event, if any, completes once the TID is readable or aborted.
+ */
+static int
+iod_trans_finish_locked(struct iod_cont *cont, iod_trans_id_t tid, int abort,
+			iod_hint_list_t *hints, iod_event_t *event,
+			struct iod_done *done)
+{
+	struct iod_trans	*trans = iod_trans_find(cont, tid);
+	unsigned long		i;
+	int			rc = 0;
+
+	if (trans == NULL)
+		return -EINVAL;
+	if (iod_trans_is_readable(trans)) {
+		/* read side: drop the reference taken by start/slip */
+		if (abort != 0 || trans->it_rdref == 0)
+			return -EINVAL;
+		iod_trans_put(cont, tid);
+		return 0;
+	}
+	if (trans->it_status != IOD_TRANS_STARTED)
+		return -EINVAL;
+	trans->it_used = 1;
+
+	switch (abort) {
+	case 0:
+		if (trans->it_agg != NULL) {
+			rc = iod_agg_finish(trans->it_agg, tid, hints);
+			if (rc < 0)
+				return rc;
+			if (rc == 1)
+				iod_trans_agg_done(cont, trans);
+			rc = iod_trans_finish_event(cont, trans, event, done);
+			break;
+		}
+		if (trans->it_num_ranks != 0 &&
+		    trans->it_nfinished >= trans->it_num_ranks)
+			return -EINVAL;
+		if (event != NULL) {
+			rc = iod_trans_wait(trans, event);
+			if (rc != 0)
+				return rc;
+			iod_ev_launch(event, IOD_EV_TRANS_FINISH);
+		}
+		trans->it_nfinished++;
+		if (trans->it_num_ranks == 0 ||
+		    trans->it_nfinished == trans->it_num_ranks) {
+			trans->it_status = IOD_TRANS_FINISHED;
+			iod_trans_seal(trans);
+		}
+		break;
+	case IOD_TRANS_ABORT_SINGLE:
+		iod_trans_abort(cont, trans, done);
+		break;
+	case IOD_TRANS_ABORT_ALL:
+		for (i = iod_trans_index(cont, tid); i < cont->ic_ntrans; i++) {
+			trans = cont->ic_trans[i];
+			if (trans->it_status == IOD_TRANS_STARTED ||
+			    trans->it_status == IOD_TRANS_FINISHED)
+				iod_trans_abort(cont, trans, done);
+		}
+		break;
+	default:
+		return -EINVAL;
+	}
+	iod_trans_advance(cont, done);
+	return rc;
+}
+
+/**
+ * Finish of a TID counted in the finish tree \a agg. Unless it completes the
+ * root or has an event to queue, it is done without ic_lock.
+ */
+static int
+iod_trans_finish_agg(struct iod_cont *cont, struct iod_trans_agg *agg,
+		     iod_trans_id_t tid, iod_hint_list_t *hints,
+		     iod_event_t *event)
+{
+	struct iod_done		done = { 0 };
+	struct iod_trans	*trans;
+	int			rc;
+	int			rc2;
+
+	rc = iod_agg_finish(agg, tid, hints);
+	if (rc < 0)
+		return iod_ev_return(event, IOD_EV_TRANS_FINISH, rc);
+	if (rc == 0)
+		__atomic_store_n(&agg->ia_used, 1, __ATOMIC_RELAXED);
+	if (rc == 0 && event == NULL)
+		return __atomic_load_n(&agg->ia_aborted, __ATOMIC_ACQUIRE) ?
+		       -EINVAL : 0;
+
+	pthread_mutex_lock(&cont->ic_lock);
+	trans = iod_trans_find(cont, tid);
+	if (rc == 1) {
+		/* unless it was aborted since, the TID is ours to finish */
+		if (trans->it_agg == agg)
+			iod_trans_agg_done(cont, trans);
+		else if (event == NULL)
+			rc = -EINVAL;
+	}
+	if (rc >= 0)
+		rc = iod_trans_finish_event(cont, trans, event, &done);
+	iod_trans_advance(cont, &done);
+	pthread_mutex_unlock(&cont->ic_lock);
+	rc2 = iod_done_flush(&done);
+	if (rc == 0 && event == NULL)
+		rc = rc2;
+	if (rc != 0)
+		return iod_ev_return(event, IOD_EV_TRANS_FINISH, rc);
+	return 0;
+}
+
+iod_ret_t
+iod_trans_finish(iod_handle_t coh, iod_trans_id_t tid, iod_hint_list_t *hints,
+		 int abort, iod_event_t *event)
+{
+	struct iod_cont	*cont = iod_cont_lookup(coh);
+	struct iod_done	done = { 0 };
+	struct iod_trans *trans;
+	struct iod_trans_agg *agg;
+	int		rc;
+	int		rc2;
+
+	if (cont == NULL)
+		return iod_ev_return(event, IOD_EV_TRANS_FINISH, -EINVAL);
+	if (abort == 0) {
+		agg = iod_agg_lookup(cont, tid);
+		if (agg != NULL)
+			return iod_trans_finish_agg(cont, agg, tid, hints,
+						    event);
+	}
+
+	pthread_mutex_lock(&cont->ic_lock);
+	trans = iod_trans_find(cont, tid);
+	if (trans != NULL && trans->it_status == IOD_TRANS_STARTED &&
+	    abort == 0) {
+		/* the event is queued on the TID, completed by readability */
+		rc = iod_trans_finish_locked(cont, tid, 0, hints, event,
+					     &done);
+		pthread_mutex_unlock(&cont->ic_lock);
+		rc2 = iod_done_flush(&done);
+		if (rc == 0 && event == NULL)
+			rc = rc2;
+		if (rc != 0)
+			return iod_ev_return(event, IOD_EV_TRANS_FINISH, rc);
+		return 0;
+	}
+	rc = iod_trans_finish_locked(cont, tid, abort, hints, NULL, &done);
+	pthread_mutex_unlock(&cont->ic_lock);
+	rc2 = iod_done_flush(&done);
+	return iod_ev_return(event, IOD_EV_TRANS_FINISH, rc != 0 ? rc : rc2);
+}
+
+iod_ret_t
+iod_trans_slip(iod_handle_t coh, iod_trans_id_t *tid, iod_hint_list_t *hints,
+	       iod_event_t *event)
+{
+	struct iod_cont		*cont = iod_cont_lookup(coh);
+	struct iod_trans	*trans;
+	struct iod_trans	*next;
+	struct iod_done		done = { 0 };
+	const struct iod_policy	*pol;
+	struct iod_policy	buf;
+	iod_trans_id_t		new_tid;
+	unsigned int		num_ranks;
+	int			indep;
+	unsigned long		i;
+	int			rc;
+	int			rc2;
+
+	if (cont == NULL || tid == NULL || *tid == IOD_TID_UNKNOWN)
+		return iod_ev_return(event, IOD_EV_TRANS_SLIP, -EINVAL);
+
+	pthread_mutex_lock(&cont->ic_lock);
+	trans = iod_trans_find(cont, *tid);
+	if (trans == NULL) {
+		rc = -EINVAL;
+		goto out;
+	}
+
+	if (trans->it_status == IOD_TRANS_STARTED) {
+		num_ranks = trans->it_num_ranks;
+		indep = trans->it_indep;
+		rc = iod_trans_finish_locked(cont, *tid, 0, hints, NULL,
+					     &done);
+		if (rc != 0)
+			goto out;
+		/* every participant of the old TID lands on the same one */
+		new_tid = *tid + 1;
+		next = iod_trans_find(cont, new_tid);
+		if (next != NULL && (next->it_status != IOD_TRANS_STARTED ||
+				     next->it_num_ranks != num_ranks ||
+				     next->it_indep != indep ||
+				     num_ranks == 0))
+			new_tid = cont->ic_tids.latest_wrting + 1;
+		rc = iod_trans_start_write(cont, &new_tid, num_ranks, indep,
+					   hints);
+	} else if (iod_trans_is_readable(trans)) {
+		rc = iod_trans_finish_locked(cont, *tid, 0, hints, NULL,
+					     &done);
+		if (rc != 0)
+			goto out;
+		next = NULL;
+		rc = iod_policy_resolve(NULL, hints, &buf, &pol);
+		if (rc != 0)
+			goto out;
+		if (pol->ip_flags & IOD_POL_ADJACENT_READABLE) {
+			for (i = iod_trans_index(cont, *tid + 1);
+			     i < cont->ic_ntrans; i++) {
+				if (iod_trans_is_readable(cont->ic_trans[i])) {
+					next = cont->ic_trans[i];
+					break;
+				}
+			}
+		}
+		if (next == NULL)
+			next = iod_trans_find(cont,
+					      cont->ic_tids.latest_rdable);
+		new_tid = next->it_tid;
+		next->it_rdref++;
+	} else {
+		rc = -EINVAL;
+		goto out;
+	}
+	if (rc == 0)
+		*tid = new_tid;
+out:
+	pthread_mutex_unlock(&cont->ic_lock);
+	rc2 = iod_done_flush(&done);
+	return iod_ev_return(event, IOD_EV_TRANS_SLIP, rc != 0 ? rc : rc2);
+}
+
+/**
+ * Replay: write TID \a tid touched \a obj in a logged record. Returns -EINVAL
+ * when the TID is already settled and the record is to be skipped. Caller
+ * holds ic_lock.
+ */
+int
+iod_trans_replay_dirty(struct iod_cont *cont, iod_trans_id_t tid,
+		       struct iod_obj *obj)
+{
+	struct iod_trans	*trans = iod_trans_find(cont, tid);
+
+	if (trans == NULL) {
+		if (tid <= cont->ic_tids.latest_rdable)
+			return -EINVAL;
+		trans = iod_trans_add(cont, tid, IOD_TRANS_STARTED);
+		if (trans == NULL)
+			return -ENOMEM;
+		if (tid > cont->ic_tids.latest_wrting)
+			cont->ic_tids.latest_wrting = tid;
+	}
+	if (trans->it_status != IOD_TRANS_STARTED)
+		return -EINVAL;
+	return obj == NULL ? 0 : iod_trans_dirty_logged(cont, tid, obj);
+}
+
+/**
+ * Replay: the log says \a tid became readable; \a commit is 0 when the TID
+ * also made changes the log does not hold, so it is aborted instead. Caller
+ * holds ic_lock.
+ */
+int
+iod_trans_replay_end(struct iod_cont *cont, iod_trans_id_t tid, int commit)
+{
+	struct iod_trans	*trans;
+	int			rc;
+
+	rc = iod_trans_replay_dirty(cont, tid, NULL);
+	if (rc != 0)
+		return rc == -EINVAL ? 0 : rc;
+	trans = iod_trans_find(cont, tid);
+	if (commit) {
+		iod_trans_commit(cont, trans);
+		trans->it_status = IOD_TRANS_READABLE;
+		iod_trans_seal(trans);
+		if (tid > cont->ic_tids.latest_rdable)
+			cont->ic_tids.latest_rdable = tid;
+	} else {
+		iod_trans_rollback(cont, trans);
+		trans->it_status = IOD_TRANS_ABORTED;
+	}
+	return 0;
+}
+
+/** Replay: abort every TID the log never saw become readable. */
+void
+iod_trans_replay_fini(struct iod_cont *cont)
+{
+	struct iod_trans	*trans;
+	unsigned long		i;
+
+	for (i = 0; i < cont->ic_ntrans; i++) {
+		trans = cont->ic_trans[i];
+		if (trans->it_status != IOD_TRANS_STARTED)
+			continue;
+		iod_trans_rollback(cont, trans);
+		trans->it_status = IOD_TRANS_ABORTED;
+	}
+}
+
+/**
+ * Whether open write TID \a trans was used since the last lease scan, and
+ * take the marks of its use. Caller holds ic_lock.
+ */
+static int
+iod_trans_used(struct iod_trans *trans)
+{
+	iod_trans_id_t	*mark;
+	iod_trans_id_t	tid;
+	unsigned long	i;
+	int		used = trans->it_used;
+
+	trans->it_used = 0;
+	if (trans->it_agg != NULL &&
+	    __atomic_exchange_n(&trans->it_agg->ia_used, 0, __ATOMIC_RELAXED))
+		used = 1;
+	/* only an object it wrote last takes its writes without ic_lock */
+	for (i = 0; i < trans->it_ndirty; i++) {
+		mark = &trans->it_dirty[i]->io_lease_tid;
+		tid = trans->it_tid;
+		if (__atomic_compare_exchange_n(mark, &tid, IOD_TID_UNKNOWN, 0,
+						__ATOMIC_RELAXED,
+						__ATOMIC_RELAXED))
+			used = 1;
+	}
+	return used;
+}
+
+/**
+ * Renew the leases of the open write TIDs used since the last scan, and
+ * abort those whose lease ran out: whoever had yet to finish them is taken
+ * for dead. Caller holds ic_lock.
+ */
+static void
+iod_trans_reap(struct iod_cont *cont, struct iod_done *done)
+{
+	struct iod_trans	*trans;
+	uint64_t		now = iod_msec();
+	unsigned long		i;
+	unsigned long		n = 0;
+
+	for (i = iod_trans_index(cont, cont->ic_unsettled);
+	     i < cont->ic_ntrans; i++) {
+		trans = cont->ic_trans[i];
+		if (trans->it_status != IOD_TRANS_STARTED)
+			continue;
+		if (iod_trans_used(trans)) {
+			trans->it_renewed = now;
+		} else if (now - trans->it_renewed >= iod_env.ie_trans_lease) {
+			iod_trans_abort(cont, trans, done);
+			n++;
+		}
+	}
+	cont->ic_stats.trans_expired += n;
+	if (n > 0)
+		iod_trans_advance(cont, done);
+}
+
+/* scans the leases of a container four times per lease */
+static void *
+iod_trans_reaper(void *arg)
+{
+	struct iod_cont	*cont = arg;
+	struct iod_done	done;
+	struct timespec	ts;
+	uint64_t	period = iod_max(iod_env.ie_trans_lease / 4, 1ULL);
+	uint64_t	nsec;
+
+	pthread_mutex_lock(&cont->ic_lock);
+	while (!cont->ic_reaper_stop) {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		nsec = ts.tv_nsec + period % 1000 * 1000000;
+		ts.tv_sec += period / 1000 + nsec / 1000000000;
+		ts.tv_nsec = nsec % 1000000000;
+		pthread_cond_timedwait(&cont->ic_reaper_cond, &cont->ic_lock,
+				       &ts);
+		if (cont->ic_reaper_stop)
+			break;
+		memset(&done, 0, sizeof(done));
+		iod_trans_reap(cont, &done);
+		pthread_mutex_unlock(&cont->ic_lock);
+		iod_done_flush(&done);
+		pthread_mutex_lock(&cont->ic_lock);
+	}
+	pthread_mutex_unlock(&cont->ic_lock);
+	return NULL;
+}
+
+/** Start expiring the write TID leases of \a cont, if "iod.trans_lease". */
+int
+iod_trans_lease_start(struct iod_cont *cont)
+{
+	pthread_condattr_t	attr;
+	int			rc;
+
+	if (iod_env.ie_trans_lease == 0)
+		return 0;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&cont->ic_reaper_cond, &attr);
+	pthread_condattr_destroy(&attr);
+	rc = -pthread_create(&cont->ic_reaper, NULL, iod_trans_reaper, cont);
+	if (rc != 0) {
+		pthread_cond_destroy(&cont->ic_reaper_cond);
+		return rc;
+	}
+	cont->ic_reaper_on = 1;
+	return 0;
+}
+
+/** Stop the lease reaper of \a cont, before it is closed. */
+void
+iod_trans_lease_stop(struct iod_cont *cont)
+{
+	if (!cont->ic_reaper_on)
+		return;
+	pthread_mutex_lock(&cont->ic_lock);
+	cont->ic_reaper_stop = 1;
+	pthread_cond_signal(&cont->ic_reaper_cond);
+	pthread_mutex_unlock(&cont->ic_lock);
+	pthread_join(cont->ic_reaper, NULL);
+	pthread_cond_destroy(&cont->ic_reaper_cond);
+	cont->ic_reaper_on = 0;
+}
@@ -0,0 +1,388 @@
+/*
+ * Streaming transposition of arrays into their dims_seq order.
+ *
+ * An array whose dims_seq is not the identity is stored on central storage
+ * in the physical dimension order it names. Migration cuts the array into
+ * tiles, boxes of at most IOD_TILE_BYTES chosen so that both the runs read
+ * from the burst buffer (logical order) and the runs written to central
+ * storage (physical order) are long. Each tile is read as a hyperslab,
+ * transposed in memory by a recursive cache-oblivious copy and written out,
+ * so memory stays at two tiles per worker whatever the array size and the
+ * data is touched once. Tiles are claimed in physical order by the worker
+ * threads, which keeps the writes streaming through the central files.
+ */
+
+#include <unistd.h>
+
+#include "iod_internal.h"
+
+#define IOD_TILE_BYTES		(16UL << 20)	/* one tile, staged twice */
+#define IOD_TILE_L1		(32UL << 10)	/* base case of the copy */
+
+/** one transposition shared by its workers */
+struct iod_tpose {
+	struct iod_obj		*tp_obj;
+	iod_trans_id_t		tp_tid;
+	uint32_t		tp_nd;
+	uint32_t		tp_cell;
+	const uint32_t		*tp_seq;
+	iod_size_t		tp_dims[IOD_MAX_DIMS];	/* logical */
+	iod_size_t		tp_box[IOD_MAX_DIMS];	/* tile, logical */
+	iod_size_t		tp_ntiles[IOD_MAX_DIMS];
+	iod_size_t		tp_total;
+	pthread_mutex_t		tp_lock;
+	iod_size_t		tp_next;		/* next tile to claim */
+	int			tp_rc;
+};
+
+static iod_size_t
+iod_isqrt(iod_size_t n)
+{
+	iod_size_t	r = 1;
+
+	while ((r + 1) * (r + 1) <= n)
+		r++;
+	return r;
+}
+
+/** a box being copied from logical to physical order, dims physical */
+struct iod_tcopy {
+	uint32_t		tc_nd;
+	uint32_t		tc_cell;
+	iod_size_t		tc_ip[IOD_MAX_DIMS];	/* input byte pitch */
+	iod_size_t		tc_op[IOD_MAX_DIMS];	/* output byte pitch */
+	const char		*tc_in;
+	char			*tc_out;
+};
+
+/**
+ * Grow \a box along \a order, innermost first, until it holds \a target
+ * cells or a dimension is only partly covered.
+ */
+static void
+iod_tile_grow(const struct iod_tpose *tp, const uint32_t *order,
+	      iod_size_t target, iod_size_t *box)
+{
+	iod_size_t	cells = 1;
+	iod_size_t	room;
+	uint32_t	d;
+	int		k;
+
+	for (d = 0; d < tp->tp_nd; d++)
+		cells *= box[d];
+	for (k = tp->tp_nd - 1; k >= 0; k--) {
+		d = order[k];
+		room = iod_min(target / (cells / box[d]), tp->tp_dims[d]);
+		if (room > box[d]) {
+			cells = cells / box[d] * room;
+			box[d] = room;
+		}
+		if (box[d] < tp->tp_dims[d])
+			break;
+	}
+}
+
+static void
+iod_tcopy_base(const struct iod_tcopy *tc, const iod_size_t *lo,
+	       const iod_size_t *hi)
+{
+	iod_size_t	idx[IOD_MAX_DIMS];
+	uint32_t	last = tc->tc_nd - 1;
+	iod_size_t	ip = tc->tc_ip[last];
+	iod_size_t	op = tc->tc_op[last];
+	iod_size_t	n = hi[last] - lo[last];
+	iod_size_t	i;
+	const char	*src;
+	char		*dst;
+	int		k;
+
+	memcpy(idx, lo, tc->tc_nd * sizeof(idx[0]));
+	for (;;) {
+		src = tc->tc_in;
+		dst = tc->tc_out;
+		for (k = 0; k <= (int)last; k++) {
+			src += idx[k] * tc->tc_ip[k];
+			dst += idx[k] * tc->tc_op[k];
+		}
+		if (ip == tc->tc_cell && op == tc->tc_cell) {
+			memcpy(dst, src, n * tc->tc_cell);
+		} else {
+			switch (tc->tc_cell) {
+			case 4:
+				for (i = 0; i < n; i++)
+					memcpy(dst + i * op, src + i * ip, 4);
+				break;
+			case 8:
+				for (i = 0; i < n; i++)
+					memcpy(dst + i * op, src + i * ip, 8);
+				break;
+			case 16:
+				for (i = 0; i < n; i++)
+					memcpy(dst + i * op, src + i * ip, 16);
+				break;
+			default:
+				for (i = 0; i < n; i++)
+					memcpy(dst + i * op, src + i * ip,
+					       tc->tc_cell);
+			}
+		}
+		for (k = (int)last - 1; k >= 0; k--) {
+			if (++idx[k] < hi[k])
+				break;
+			idx[k] = lo[k];
+		}
+		if (k < 0)
+			return;
+	}
+}
+
+/** copy the box [lo, hi), halving its longest side until it fits in L1 */
+static void
+iod_tcopy_rec(const struct iod_tcopy *tc, const iod_size_t *lo,
+	      const iod_size_t *hi)
+{
+	iod_size_t	mid[IOD_MAX_DIMS];
+	iod_size_t	bytes = tc->tc_cell;
+	iod_size_t	len;
+	iod_size_t	best = 0;
+	uint32_t	k;
+	uint32_t	split = 0;
+
+	for (k = 0; k < tc->tc_nd; k++) {
+		len = hi[k] - lo[k];
+		bytes *= len;
+		if (len > best) {
+			best = len;
+			split = k;
+		}
+	}
+	if (bytes <= IOD_TILE_L1 || best < 2) {
+		iod_tcopy_base(tc, lo, hi);
+		return;
+	}
+	memcpy(mid, hi, tc->tc_nd * sizeof(mid[0]));
+	mid[split] = lo[split] + best / 2;
+	iod_tcopy_rec(tc, lo, mid);
+	memcpy(mid, lo, tc->tc_nd * sizeof(mid[0]));
+	mid[split] = lo[split] + best / 2;
+	iod_tcopy_rec(tc, mid, hi);
+}
+
+/**
+ * Read, transpose and write tile \a t. \a img and \a out hold a tile each,
+ * \a fds caches the central shards this worker opened.
+ */
+static int
+iod_tile_move(struct iod_tpose *tp, iod_size_t t, char *img, char *out,
+	      iod_mem_desc_t *md, int *fds)
+{
+	struct iod_slab_plan	sp;
+	struct iod_tcopy	tc;
+	struct iod_memcur	mc;
+	iod_hyperslab_t		slab;
+	iod_size_t		org[IOD_MAX_DIMS];	/* logical */
+	iod_size_t		ext[IOD_MAX_DIMS];	/* logical */
+	iod_size_t		lo[IOD_MAX_DIMS];	/* physical */
+	iod_size_t		hi[IOD_MAX_DIMS];	/* physical */
+	iod_size_t		ppitch[IOD_MAX_DIMS];	/* physical, cells */
+	iod_size_t		idx[IOD_MAX_DIMS];
+	iod_size_t		cells = 1;
+	iod_size_t		run;
+	iod_size_t		pitch;
+	iod_off_t		phys;
+	uint32_t		nd = tp->tp_nd;
+	uint32_t		d;
+	int			first;
+	int			k;
+	int			rc;
+
+	/* tile t, counted in physical order */
+	for (k = nd - 1; k >= 0; k--) {
+		d = tp->tp_seq[k];
+		org[d] = t % tp->tp_ntiles[d] * tp->tp_box[d];
+		ext[d] = iod_min(tp->tp_box[d], tp->tp_dims[d] - org[d]);
+		t /= tp->tp_ntiles[d];
+		cells *= ext[d];
+	}
+
+	slab.start = org;
+	slab.count = ext;
+	slab.stride = NULL;
+	slab.block = NULL;
+	rc = iod_slab_compile(tp->tp_obj, tp->tp_dims, &slab, &sp);
+	if (rc != 0)
+		return rc;
+	md->frag[0].addr = img;
+	md->frag[0].len = cells * tp->tp_cell;
+	iod_memcur_init(&mc, md);
+	rc = iod_slab_read(tp->tp_obj, tp->tp_tid, &sp, &mc);
+	iod_slab_plan_free(&sp);
+	if (rc != 0)
+		return rc;
+
+	tc.tc_nd = nd;
+	tc.tc_cell = tp->tp_cell;
+	tc.tc_in = img;
+	tc.tc_out = out;
+	/* the image is in logical box order, the output in physical */
+	for (pitch = tp->tp_cell, d = nd; d-- > 0; pitch *= ext[d])
+		idx[d] = pitch;
+	for (pitch = tp->tp_cell, k = nd - 1; k >= 0; k--) {
+		lo[k] = 0;
+		hi[k] = ext[tp->tp_seq[k]];
+		tc.tc_ip[k] = idx[tp->tp_seq[k]];
+		tc.tc_op[k] = pitch;
+		pitch *= hi[k];
+	}
+	iod_tcopy_rec(&tc, lo, hi);
+
+	/* physical dims covered whole, innermost up, form one output run */
+	for (pitch = 1, k = nd - 1; k >= 0; k--) {
+		ppitch[k] = pitch;
+		pitch *= tp->tp_dims[tp->tp_seq[k]];
+	}
+	run = 1;
+	for (k = nd - 1; k >= 0; k--) {
+		d = tp->tp_seq[k];
+		run *= ext[d];
+		if (ext[d] < tp->tp_dims[d])
+			break;
+	}
+	first = iod_max(k, 0);
+	for (k = 0; k < first; k++)
+		idx[k] = 0;
+	for (;;) {
+		phys = 0;
+		for (k = 0; k < (int)nd; k++) {
+			d = tp->tp_seq[k];
+			phys += (org[d] + (k < first ? idx[k] : 0)) * ppitch[k];
+		}
+		rc = iod_central_io(tp->tp_obj, fds, phys * tp->tp_cell,
+				    run * tp->tp_cell, out, 1);
+		if (rc != 0)
+			return rc;
+		out += run * tp->tp_cell;
+		for (k = first - 1; k >= 0; k--) {
+			if (++idx[k] < ext[tp->tp_seq[k]])
+				break;
+			idx[k] = 0;
+		}
+		if (k < 0)
+			return 0;
+	}
+}
+
+static void *
+iod_tpose_worker(void *arg)
+{
+	struct iod_tpose	*tp = arg;
+	iod_size_t		bytes = tp->tp_cell;
+	iod_mem_desc_t		*md;
+	iod_size_t		t;
+	uint32_t		ntgt = tp->tp_obj->io_layout.target_num;
+	uint32_t		d;
+	char			*img;
+	char			*out;
+	int			*fds;
+	int			rc = 0;
+
+	for (d = 0; d < tp->tp_nd; d++)
+		bytes *= tp->tp_box[d];
+	img = malloc(bytes);
+	out = malloc(bytes);
+	md = malloc(sizeof(*md) + sizeof(md->frag[0]));
+	fds = malloc(iod_max(ntgt, 1U) * sizeof(*fds));
+	if (img == NULL || out == NULL || md == NULL || fds == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+	md->nfrag = 1;
+	for (d = 0; d < iod_max(ntgt, 1U); d++)
+		fds[d] = -1;
+
+	for (;;) {
+		pthread_mutex_lock(&tp->tp_lock);
+		if (tp->tp_rc != 0 || tp->tp_next == tp->tp_total) {
+			pthread_mutex_unlock(&tp->tp_lock);
+			break;
+		}
+		t = tp->tp_next++;
+		pthread_mutex_unlock(&tp->tp_lock);
+
+		rc = iod_tile_move(tp, t, img, out, md, fds);
+		if (rc != 0)
+			break;
+	}
+	for (d = 0; d < iod_max(ntgt, 1U); d++)
+		if (fds[d] >= 0)
+			close(fds[d]);
+out:
+	if (rc != 0) {
+		pthread_mutex_lock(&tp->tp_lock);
+		if (tp->tp_rc == 0)
+			tp->tp_rc = rc;
+		pthread_mutex_unlock(&tp->tp_lock);
+	}
+	free(fds);
+	free(md);
+	free(out);
+	free(img);
+	return NULL;
+}
+
+/**
+ * Ship a whole array as seen at \a tid in the physical order of its
+ * dims_seq, a tile at a time on up to iod.threads workers. Caller holds
+ * io_lock.
+ */
+int
+iod_migrate_transpose(struct iod_obj *obj, iod_trans_id_t tid)
+{
+	struct iod_tpose	tp;
+	pthread_t		th[64];
+	uint32_t		ident[IOD_MAX_DIMS];
+	iod_size_t		target;
+	unsigned int		nth;
+	unsigned int		i;
+	uint32_t		d;
+
+	memset(&tp, 0, sizeof(tp));
+	tp.tp_obj = obj;
+	tp.tp_tid = tid;
+	tp.tp_nd = obj->io_ndims;
+	tp.tp_cell = obj->io_cell_size;
+	tp.tp_seq = obj->io_seq;
+	tp.tp_total = 1;
+	for (d = 0; d < tp.tp_nd; d++) {
+		tp.tp_dims[d] = d == 0 ? iod_array_dim0(obj, tid) :
+					 obj->io_dims[d];
+		if (tp.tp_dims[d] == 0)
+			return 0;
+		tp.tp_box[d] = 1;
+		ident[d] = d;
+	}
+
+	/* long runs on both sides: about sqrt of the tile each way */
+	target = iod_max(IOD_TILE_BYTES / tp.tp_cell, 1UL);
+	iod_tile_grow(&tp, ident, iod_isqrt(target), tp.tp_box);
+	iod_tile_grow(&tp, tp.tp_seq, target, tp.tp_box);
+	for (d = 0; d < tp.tp_nd; d++) {
+		tp.tp_ntiles[d] = (tp.tp_dims[d] + tp.tp_box[d] - 1) /
+				  tp.tp_box[d];
+		tp.tp_total *= tp.tp_ntiles[d];
+	}
+
+	pthread_mutex_init(&tp.tp_lock, NULL);
+	nth = iod_min(iod_max(iod_env.ie_nthreads, 1U),
+		      sizeof(th) / sizeof(th[0]));
+	nth = iod_min((iod_size_t)nth, tp.tp_total);
+	for (i = 1; i < nth; i++)
+		if (pthread_create(&th[i], NULL, iod_tpose_worker, &tp) != 0)
+			break;
+	nth = i;
+	iod_tpose_worker(&tp);
+	for (i = 1; i < nth; i++)
+		pthread_join(th[i], NULL);
+	pthread_mutex_destroy(&tp.tp_lock);
+	return tp.tp_rc;
+}
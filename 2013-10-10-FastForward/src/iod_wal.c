@@ -0,0 +1,798 @@
+/*
+ * Write-ahead log of small updates.
+ *
+ * KV sets and unlinks, blob writes, blob and KV creations and TID commits
+ * and aborts append a record to <bb_dir>/wal so that they survive a crash
+ * between two catalog checkpoints. Records are gathered in the open group
+ * while one flusher thread writes and syncs the previous group, so
+ * concurrent updates from many threads share one fdatasync. An update
+ * returns, or its event completes, once its group is durable.
+ *
+ * Small blob writes and KV values travel in the record itself, so the data
+ * log need not be synced for them; larger blob writes sync the data log
+ * first and log only where the bytes went. The bytes of a blob write are
+ * gathered into the group straight from the caller's memory descriptor,
+ * with no copy of their own. The records of one list call are logged
+ * together as one IOD_WAL_BATCH record. Array writes, attributes and
+ * unlinks are not logged: a TID that made any of them commits with
+ * IOD_WAL_PARTIAL and is replayed as aborted, as in-flight TIDs are.
+ *
+ * The log file is extended with zeroes ahead of the records, so that most
+ * group syncs only flush data and not the file size as well; replay stops
+ * at the zeroes as at any record that fails its checksum.
+ *
+ * The next open replays the log over the checkpoint, writes a new checkpoint
+ * and empties the log, which a clean close does as well.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "iod_internal.h"
+
+/** the records of one group */
+struct iod_wal_buf {
+	char			*wb_data;
+	size_t			wb_len;
+	size_t			wb_max;
+};
+
+/** events to complete once one group is durable */
+struct iod_wal_evs {
+	iod_event_t		**we_ev;
+	int			*we_rc;
+	unsigned long		we_nr;
+	unsigned long		we_max;
+};
+
+struct iod_wal {
+	pthread_mutex_t		wl_lock;
+	pthread_cond_t		wl_cond;	/* flusher: records to write */
+	pthread_cond_t		wl_done;	/* a group became durable */
+	pthread_t		wl_thread;
+	int			wl_fd;
+	int			wl_stop;
+	uint64_t		wl_off;		/* end of the records */
+	uint64_t		wl_alloc;	/* end of the zeroes past it */
+	uint64_t		wl_open;	/* group taking records */
+	uint64_t		wl_synced;	/* newest durable group */
+	uint64_t		wl_bad;		/* first failed group, or 0 */
+	int			wl_err;
+	struct iod_wal_buf	wl_buf;		/* the open group */
+	struct iod_wal_buf	wl_spare;
+	struct iod_wal_evs	wl_evs[2];	/* by group parity */
+};
+
+static int
+iod_wal_path(struct iod_cont *cont, char *buf)
+{
+	if (snprintf(buf, PATH_MAX, "%s/wal", cont->ic_bb_dir) >= PATH_MAX)
+		return -ENAMETOOLONG;
+	return 0;
+}
+
+/**
+ * The payload of a record: pl_p1, then pl_p2 or, unless that is NULL, the
+ * fragments of pl_md, pl_l2 bytes in all
+ */
+struct iod_wal_pl {
+	const void	*pl_p1;
+	size_t		pl_l1;
+	const void	*pl_p2;
+	iod_mem_desc_t	*pl_md;
+	size_t		pl_l2;
+};
+
+static void
+iod_wal_cksum(struct iod_wal_rec *rec, const struct iod_wal_pl *pl,
+	      iod_checksum_t *cs)
+{
+	iod_checksum_t	saved = rec->wr_cs;
+	unsigned long	i;
+
+	memset(&rec->wr_cs, 0, sizeof(rec->wr_cs));
+	iod_cksum_init(cs);
+	iod_cksum_update(cs, rec, sizeof(*rec));
+	iod_cksum_update(cs, pl->pl_p1, pl->pl_l1);
+	if (pl->pl_md == NULL)
+		iod_cksum_update(cs, pl->pl_p2, pl->pl_l2);
+	for (i = 0; pl->pl_md != NULL && i < pl->pl_md->nfrag; i++)
+		iod_cksum_update(cs, pl->pl_md->frag[i].addr,
+				 pl->pl_md->frag[i].len);
+	rec->wr_cs = saved;
+}
+
+/** copy \a rec and its payload \a pl to \a dst */
+static void
+iod_wal_copy(char *dst, const struct iod_wal_rec *rec,
+	     const struct iod_wal_pl *pl)
+{
+	iod_mem_frag_t	*frag;
+	unsigned long	i;
+
+	memcpy(dst, rec, sizeof(*rec));
+	dst += sizeof(*rec);
+	if (pl->pl_l1 > 0)
+		memcpy(dst, pl->pl_p1, pl->pl_l1);
+	dst += pl->pl_l1;
+	if (pl->pl_md == NULL && pl->pl_l2 > 0)
+		memcpy(dst, pl->pl_p2, pl->pl_l2);
+	for (i = 0; pl->pl_md != NULL && i < pl->pl_md->nfrag; i++) {
+		frag = &pl->pl_md->frag[i];
+		memcpy(dst, frag->addr, frag->len);
+		dst += frag->len;
+	}
+}
+
+/* ------------------------------- logging -------------------------------- */
+
+/** the log grows by this much zeroed space at a time */
+#define IOD_WAL_EXTEND		(4UL << 20)
+
+/** make the log file hold zeroes up to at least \a end. Flusher only. */
+static int
+iod_wal_extend(struct iod_wal *wal, uint64_t end)
+{
+	static const char	zero[65536];
+	uint64_t		new_alloc;
+	int			rc = 0;
+
+	if (end <= wal->wl_alloc)
+		return 0;
+	new_alloc = (end + IOD_WAL_EXTEND - 1) / IOD_WAL_EXTEND *
+		    IOD_WAL_EXTEND;
+	while (rc == 0 && wal->wl_alloc < new_alloc) {
+		rc = iod_pwrite_full(wal->wl_fd, zero, sizeof(zero),
+				     wal->wl_alloc);
+		if (rc == 0)
+			wal->wl_alloc += sizeof(zero);
+	}
+	return rc;
+}
+
+/** the result of durable group \a group. Caller holds wl_lock. */
+static int
+iod_wal_result(struct iod_wal *wal, uint64_t group)
+{
+	return wal->wl_bad != 0 && group >= wal->wl_bad ? wal->wl_err : 0;
+}
+
+static void *
+iod_wal_flusher(void *arg)
+{
+	struct iod_wal		*wal = arg;
+	struct iod_wal_buf	buf;
+	struct iod_wal_evs	evs;
+	uint64_t		group;
+	unsigned long		i;
+	int			rc;
+
+	pthread_mutex_lock(&wal->wl_lock);
+	for (;;) {
+		while (wal->wl_buf.wb_len == 0 && !wal->wl_stop)
+			pthread_cond_wait(&wal->wl_cond, &wal->wl_lock);
+		if (wal->wl_buf.wb_len == 0)
+			break;
+		/* close the group; the next one fills while this one syncs */
+		buf = wal->wl_buf;
+		wal->wl_buf = wal->wl_spare;
+		wal->wl_buf.wb_len = 0;
+		group = wal->wl_open++;
+		rc = wal->wl_err;
+		pthread_mutex_unlock(&wal->wl_lock);
+
+		if (rc == 0)
+			rc = iod_wal_extend(wal, wal->wl_off + buf.wb_len);
+		if (rc == 0)
+			rc = iod_pwrite_full(wal->wl_fd, buf.wb_data,
+					     buf.wb_len, wal->wl_off);
+		if (rc == 0 && fdatasync(wal->wl_fd) != 0)
+			rc = -errno;
+
+		pthread_mutex_lock(&wal->wl_lock);
+		if (rc == 0) {
+			wal->wl_off += buf.wb_len;
+		} else if (wal->wl_bad == 0) {
+			wal->wl_bad = group;
+			wal->wl_err = rc;
+		}
+		wal->wl_spare = buf;
+		wal->wl_synced = group;
+		evs = wal->wl_evs[group & 1];
+		memset(&wal->wl_evs[group & 1], 0, sizeof(evs));
+		pthread_cond_broadcast(&wal->wl_done);
+		pthread_mutex_unlock(&wal->wl_lock);
+
+		for (i = 0; i < evs.we_nr; i++)
+			iod_ev_complete(evs.we_ev[i], evs.we_rc[i] != 0 ?
+					evs.we_rc[i] : rc);
+		free(evs.we_ev);
+		free(evs.we_rc);
+		pthread_mutex_lock(&wal->wl_lock);
+	}
+	pthread_mutex_unlock(&wal->wl_lock);
+	return NULL;
+}
+
+/**
+ * Append record \a rec with the payload \a pl to the open group and return
+ * the group in \a group. Without a log this does nothing and returns group
+ * 0, which is always durable.
+ */
+static int
+iod_wal_append(struct iod_wal *wal, struct iod_wal_rec *rec,
+	       const struct iod_wal_pl *pl, uint64_t *group)
+{
+	struct iod_wal_buf	*wb;
+	iod_checksum_t		cs;
+	size_t			len = sizeof(*rec) + pl->pl_l1 + pl->pl_l2;
+	size_t			max;
+	char			*data;
+
+	*group = 0;
+	if (wal == NULL)
+		return 0;
+	rec->wr_len = pl->pl_l1 + pl->pl_l2;
+	/* checksum outside the lock, only the copy is serialized */
+	iod_wal_cksum(rec, pl, &cs);
+	rec->wr_cs = cs;
+
+	pthread_mutex_lock(&wal->wl_lock);
+	if (wal->wl_err != 0) {
+		pthread_mutex_unlock(&wal->wl_lock);
+		return wal->wl_err;
+	}
+	wb = &wal->wl_buf;
+	if (wb->wb_len + len > wb->wb_max) {
+		max = iod_max(wb->wb_max * 2, iod_max(wb->wb_len + len,
+						      (size_t)65536));
+		data = realloc(wb->wb_data, max);
+		if (data == NULL) {
+			pthread_mutex_unlock(&wal->wl_lock);
+			return -ENOMEM;
+		}
+		wb->wb_data = data;
+		wb->wb_max = max;
+	}
+	iod_wal_copy(wb->wb_data + wb->wb_len, rec, pl);
+	if (wb->wb_len == 0)
+		pthread_cond_signal(&wal->wl_cond);
+	wb->wb_len += len;
+	*group = wal->wl_open;
+	pthread_mutex_unlock(&wal->wl_lock);
+	return 0;
+}
+
+/** log record \a rec with the payload \a p1, \a p2; see iod_wal_append */
+int
+iod_wal_log(struct iod_wal *wal, struct iod_wal_rec *rec,
+	    const void *p1, size_t l1, const void *p2, size_t l2,
+	    uint64_t *group)
+{
+	struct iod_wal_pl	pl = { p1, l1, p2, NULL, l2 };
+
+	return iod_wal_append(wal, rec, &pl, group);
+}
+
+/**
+ * log record \a rec with the payload \a p1 and the bytes \a md, if not NULL,
+ * points at; they are copied into the group from where they are
+ */
+int
+iod_wal_log_mem(struct iod_wal *wal, struct iod_wal_rec *rec,
+		const void *p1, size_t l1, iod_mem_desc_t *md,
+		uint64_t *group)
+{
+	struct iod_wal_pl	pl = { p1, l1, NULL, md,
+				       md != NULL ? iod_mem_len(md) : 0 };
+
+	return iod_wal_append(wal, rec, &pl, group);
+}
+
+/** records in a batch start 8-byte aligned, for the ranges of blob ones */
+#define IOD_WAL_ALIGN(len)	(((len) + 7) & ~(size_t)7)
+
+/**
+ * Add record \a rec with the payload \a pl to \a wt, to be logged with the
+ * rest of a list by iod_wal_batch_log.
+ */
+static int
+iod_wal_batch_put(struct iod_wal_batch *wt, struct iod_wal_rec *rec,
+		  const struct iod_wal_pl *pl)
+{
+	size_t	used = sizeof(*rec) + pl->pl_l1 + pl->pl_l2;
+	size_t	len = IOD_WAL_ALIGN(used);
+	size_t	max;
+	char	*data;
+
+	if (wt->wt_len + len > wt->wt_max) {
+		max = iod_max(wt->wt_max * 2, iod_max(wt->wt_len + len,
+						      (size_t)4096));
+		data = realloc(wt->wt_data, max);
+		if (data == NULL)
+			return -ENOMEM;
+		wt->wt_data = data;
+		wt->wt_max = max;
+	}
+	rec->wr_len = pl->pl_l1 + pl->pl_l2;
+	memset(&rec->wr_cs, 0, sizeof(rec->wr_cs));
+	iod_wal_copy(wt->wt_data + wt->wt_len, rec, pl);
+	memset(wt->wt_data + wt->wt_len + used, 0, len - used);
+	wt->wt_len += len;
+	wt->wt_nr++;
+	return 0;
+}
+
+int
+iod_wal_batch_add(struct iod_wal_batch *wt, struct iod_wal_rec *rec,
+		  const void *p1, size_t l1, const void *p2, size_t l2)
+{
+	struct iod_wal_pl	pl = { p1, l1, p2, NULL, l2 };
+
+	return iod_wal_batch_put(wt, rec, &pl);
+}
+
+/** add record \a rec with the payload \a p1 and the bytes \a md points at */
+int
+iod_wal_batch_add_mem(struct iod_wal_batch *wt, struct iod_wal_rec *rec,
+		      const void *p1, size_t l1, iod_mem_desc_t *md)
+{
+	struct iod_wal_pl	pl = { p1, l1, NULL, md,
+				       md != NULL ? iod_mem_len(md) : 0 };
+
+	return iod_wal_batch_put(wt, rec, &pl);
+}
+
+/**
+ * Log the records of \a wt, all of \a tid, as one record: a replay applies
+ * all of them or none. Frees the batch and returns its group in \a group.
+ */
+int
+iod_wal_batch_log(struct iod_wal *wal, struct iod_wal_batch *wt,
+		  iod_trans_id_t tid, uint64_t *group)
+{
+	struct iod_wal_rec	rec = { 0 };
+	int			rc;
+
+	*group = 0;
+	rec.wr_type = IOD_WAL_BATCH;
+	rec.wr_tid = tid;
+	rec.wr_arg = wt->wt_nr;
+	rc = wt->wt_nr == 0 ? 0 : iod_wal_log(wal, &rec, wt->wt_data,
+					      wt->wt_len, NULL, 0, group);
+	free(wt->wt_data);
+	memset(wt, 0, sizeof(*wt));
+	return rc;
+}
+
+/** wait until \a group is durable and return its result */
+int
+iod_wal_wait(struct iod_wal *wal, uint64_t group)
+{
+	int	rc;
+
+	if (wal == NULL || group == 0)
+		return 0;
+	pthread_mutex_lock(&wal->wl_lock);
+	while (wal->wl_synced < group)
+		pthread_cond_wait(&wal->wl_done, &wal->wl_lock);
+	rc = iod_wal_result(wal, group);
+	pthread_mutex_unlock(&wal->wl_lock);
+	return rc;
+}
+
+/**
+ * Report \a rc of an update logged in \a group, like iod_ev_return: a
+ * blocking call waits for the group, an event completes when the flusher
+ * synced it.
+ */
+iod_ret_t
+iod_wal_return(struct iod_wal *wal, uint64_t group, iod_event_t *ev,
+	       iod_ev_type_t type, int rc)
+{
+	struct iod_wal_evs	*evs;
+	unsigned long		max;
+	iod_event_t		**evp;
+	int			*rcp;
+
+	if (wal == NULL || group == 0)
+		return iod_ev_return(ev, type, rc);
+	if (ev == NULL) {
+		if (rc == 0)
+			rc = iod_wal_wait(wal, group);
+		return rc;
+	}
+	iod_ev_launch(ev, type);
+	pthread_mutex_lock(&wal->wl_lock);
+	if (wal->wl_synced >= group) {
+		if (rc == 0)
+			rc = iod_wal_result(wal, group);
+		pthread_mutex_unlock(&wal->wl_lock);
+		iod_ev_complete(ev, rc);
+		return 0;
+	}
+	evs = &wal->wl_evs[group & 1];
+	if (evs->we_nr == evs->we_max) {
+		max = iod_max(evs->we_max * 2, 16UL);
+		evp = realloc(evs->we_ev, max * sizeof(*evp));
+		if (evp != NULL)
+			evs->we_ev = evp;
+		rcp = realloc(evs->we_rc, max * sizeof(*rcp));
+		if (rcp != NULL)
+			evs->we_rc = rcp;
+		if (evp == NULL || rcp == NULL) {
+			/* cannot defer it, wait for the group right here */
+			pthread_mutex_unlock(&wal->wl_lock);
+			if (rc == 0)
+				rc = iod_wal_wait(wal, group);
+			iod_ev_complete(ev, rc);
+			return 0;
+		}
+		evs->we_max = max;
+	}
+	evs->we_ev[evs->we_nr] = ev;
+	evs->we_rc[evs->we_nr++] = rc;
+	pthread_mutex_unlock(&wal->wl_lock);
+	return 0;
+}
+
+/* ------------------------------- replay --------------------------------- */
+
+static int
+iod_wal_replay_create(struct iod_cont *cont, struct iod_wal_rec *rec,
+		      const char *payload)
+{
+	struct iod_obj	*obj;
+	int		rc;
+
+	if (rec->wr_arg != IOD_OBJ_BLOB && rec->wr_arg != IOD_OBJ_KV)
+		return -EIO;
+	if (iod_obj_find(cont, rec->wr_oid) != NULL)
+		return 0;
+	rc = iod_trans_replay_dirty(cont, rec->wr_tid, NULL);
+	if (rc != 0)
+		return rc == -EINVAL ? 0 : rc;
+	obj = iod_obj_alloc(cont, rec->wr_oid, rec->wr_arg);
+	if (obj == NULL)
+		return -ENOMEM;
+	obj->io_create_tid = rec->wr_tid;
+	if (rec->wr_len > 0) {
+		obj->io_name = strndup(payload, rec->wr_len);
+		if (obj->io_name == NULL) {
+			iod_obj_free(obj);
+			return -ENOMEM;
+		}
+	}
+	rc = iod_obj_insert(cont, obj);
+	if (rc == 0)
+		rc = iod_trans_replay_dirty(cont, rec->wr_tid, obj);
+	else
+		iod_obj_free(obj);
+	return rc;
+}
+
+/**
+ * put the inline bytes of a record back into the data log of \a obj; bytes
+ * that were not inline were synced to the log before the record was written
+ */
+static int
+iod_wal_replay_data(struct iod_obj *obj, const void *buf, iod_size_t len,
+		    uint64_t addr, int write)
+{
+	int	rc;
+
+	rc = iod_pack_fit(obj, iod_max(addr + len, obj->io_tail));
+	if (rc != 0)
+		return rc;
+	if (addr + len > obj->io_tail) {
+		iod_cache_charge(obj, addr + len - obj->io_tail);
+		obj->io_tail = addr + len;
+	}
+	if (!write || len == 0)
+		return 0;
+	return iod_pwrite_full(obj->io_fd, buf, len,
+			       iod_obj_log_pos(obj, addr));
+}
+
+static int
+iod_wal_replay_kv(struct iod_obj *obj, struct iod_wal_rec *rec,
+		  const char *payload)
+{
+	char		key[IOD_KV_KEY_MAXLEN];
+	iod_size_t	vlen = rec->wr_len - rec->wr_arg;
+	int		deleted = rec->wr_type == IOD_WAL_KV_UNLINK;
+	int		rc;
+
+	if (obj->io_type != IOD_OBJ_KV || rec->wr_arg >= sizeof(key) ||
+	    rec->wr_arg > rec->wr_len)
+		return -EIO;
+	memcpy(key, payload, rec->wr_arg);
+	key[rec->wr_arg] = '\0';
+	rc = iod_wal_replay_data(obj, payload + rec->wr_arg, vlen,
+				 rec->wr_addr, !deleted);
+	if (rc == 0)
+		rc = iod_kv_replay(obj, rec->wr_tid, key, deleted,
+				   rec->wr_addr, deleted ? 0 : vlen,
+				   &rec->wr_vcs);
+	return rc;
+}
+
+static int
+iod_wal_replay_blob(struct iod_obj *obj, struct iod_wal_rec *rec,
+		    const char *payload)
+{
+	const struct iod_extent	*ext = (const void *)payload;
+	struct iod_layer	*layer;
+	iod_checksum_t		cs;
+	iod_size_t		total = 0;
+	uint64_t		addr = rec->wr_addr;
+	uint64_t		i;
+	int			rc;
+
+	if (obj->io_type != IOD_OBJ_BLOB ||
+	    rec->wr_arg > rec->wr_len / sizeof(*ext))
+		return -EIO;
+	for (i = 0; i < rec->wr_arg; i++)
+		total += ext[i].ie_len;
+	if ((rec->wr_flags & IOD_WAL_INLINE) &&
+	    total != rec->wr_len - rec->wr_arg * sizeof(*ext))
+		return -EIO;
+	rc = iod_wal_replay_data(obj, ext + rec->wr_arg, total, addr,
+				 rec->wr_flags & IOD_WAL_INLINE);
+	if (rc == 0 && (rec->wr_flags & IOD_WAL_INLINE)) {
+		iod_cksum_init(&cs);
+		iod_cksum_update(&cs, ext + rec->wr_arg, total);
+		rc = iod_cks_add(obj, rec->wr_tid, addr, total, &cs);
+	}
+	if (rc != 0)
+		return rc;
+	layer = iod_layer_get(obj, rec->wr_tid);
+	if (layer == NULL)
+		return -ENOMEM;
+	for (i = 0; i < rec->wr_arg && rc == 0; i++) {
+		rc = iod_layer_insert(layer, ext[i].ie_off, ext[i].ie_len,
+				      addr);
+		addr += ext[i].ie_len;
+		if (ext[i].ie_off + ext[i].ie_len > obj->io_size)
+			obj->io_size = ext[i].ie_off + ext[i].ie_len;
+	}
+	return rc;
+}
+
+static int iod_wal_replay_one(struct iod_cont *cont, struct iod_wal_rec *rec,
+			      const char *payload);
+
+/** apply the records of one list, in the order it logged them */
+static int
+iod_wal_replay_batch(struct iod_cont *cont, struct iod_wal_rec *rec,
+		     const char *payload)
+{
+	struct iod_wal_rec	sub;
+	uint64_t		off = 0;
+	uint64_t		i;
+	int			rc;
+
+	for (i = 0; i < rec->wr_arg; i++) {
+		if (rec->wr_len - off < sizeof(sub))
+			return -EIO;
+		memcpy(&sub, payload + off, sizeof(sub));
+		off += sizeof(sub);
+		if (sub.wr_type == IOD_WAL_BATCH ||
+		    sub.wr_len > rec->wr_len - off)
+			return -EIO;
+		rc = iod_wal_replay_one(cont, &sub, payload + off);
+		if (rc != 0)
+			return rc;
+		off = IOD_WAL_ALIGN(off + sub.wr_len);
+	}
+	return off == rec->wr_len ? 0 : -EIO;
+}
+
+static int
+iod_wal_replay_one(struct iod_cont *cont, struct iod_wal_rec *rec,
+		   const char *payload)
+{
+	struct iod_obj	*obj;
+	int		rc;
+
+	switch (rec->wr_type) {
+	case IOD_WAL_CREATE:
+		return iod_wal_replay_create(cont, rec, payload);
+	case IOD_WAL_COMMIT:
+		return iod_trans_replay_end(cont, rec->wr_tid,
+					    !(rec->wr_flags &
+					      IOD_WAL_PARTIAL));
+	case IOD_WAL_ABORT:
+		return iod_trans_replay_end(cont, rec->wr_tid, 0);
+	case IOD_WAL_BATCH:
+		return iod_wal_replay_batch(cont, rec, payload);
+	case IOD_WAL_KV_SET:
+	case IOD_WAL_KV_UNLINK:
+	case IOD_WAL_BLOB:
+	case IOD_WAL_UNLINK:
+		break;
+	default:
+		return -EIO;
+	}
+	obj = iod_obj_find(cont, rec->wr_oid);
+	if (obj == NULL)
+		return 0;
+	rc = iod_trans_replay_dirty(cont, rec->wr_tid, obj);
+	if (rc != 0)
+		return rc == -EINVAL ? 0 : rc;
+	if (rec->wr_type == IOD_WAL_UNLINK) {
+		obj->io_unlink_tid = rec->wr_tid;
+		obj->io_unlink_committed = 0;
+		return 0;
+	}
+	if (rec->wr_type == IOD_WAL_BLOB)
+		return iod_wal_replay_blob(obj, rec, payload);
+	return iod_wal_replay_kv(obj, rec, payload);
+}
+
+/**
+ * Apply the log over the checkpoint just loaded. The log ends at the first
+ * record that is torn or fails its checksum. Returns the number of records
+ * applied.
+ */
+static int
+iod_wal_replay(struct iod_cont *cont, int fd, uint64_t size, uint64_t *nr)
+{
+	struct iod_wal_rec	rec;
+	struct iod_wal_pl	pl = { 0 };
+	iod_checksum_t		cs;
+	uint64_t		off = 0;
+	char			*payload = NULL;
+	char			*p;
+	size_t			max = 0;
+	int			rc = 0;
+
+	*nr = 0;
+	while (rc == 0 && off + sizeof(rec) <= size) {
+		rc = iod_pread_full(fd, &rec, sizeof(rec), off);
+		/* type 0 is the zeroed space past the last record */
+		if (rc != 0 || rec.wr_type == 0 ||
+		    rec.wr_len > size - off - sizeof(rec))
+			break;
+		if (rec.wr_len + 1 > max) {
+			p = realloc(payload, rec.wr_len + 1);
+			if (p == NULL) {
+				rc = -ENOMEM;
+				break;
+			}
+			payload = p;
+			max = rec.wr_len + 1;
+		}
+		rc = iod_pread_full(fd, payload, rec.wr_len,
+				    off + sizeof(rec));
+		if (rc != 0)
+			break;
+		pl.pl_p1 = payload;
+		pl.pl_l1 = rec.wr_len;
+		iod_wal_cksum(&rec, &pl, &cs);
+		if (memcmp(&cs, &rec.wr_cs, sizeof(cs)) != 0)
+			break;
+		rc = iod_wal_replay_one(cont, &rec, payload);
+		off += sizeof(rec) + rec.wr_len;
+		(*nr)++;
+	}
+	free(payload);
+	/* TIDs the log does not commit did not survive the crash */
+	iod_trans_replay_fini(cont);
+	return rc;
+}
+
+/* ---------------------------- open and close ---------------------------- */
+
+/** sync the data log of every object, so that the log can be emptied */
+static int
+iod_wal_sync_objs(struct iod_cont *cont)
+{
+	struct iod_obj	*obj;
+	unsigned long	i;
+	int		rc;
+
+	/* packed logs are synced with their segments */
+	rc = iod_pack_sync(cont);
+	for (i = 0; i < cont->ic_hash_size; i++) {
+		for (obj = cont->ic_hash[i]; obj != NULL;
+		     obj = obj->io_hnext) {
+			if (obj->io_seg == NULL && obj->io_fd >= 0 &&
+			    fdatasync(obj->io_fd) != 0 && rc == 0)
+				rc = -errno;
+		}
+	}
+	return rc;
+}
+
+/**
+ * Open the log of \a cont, after its checkpoint was loaded: replay what the
+ * log holds, checkpoint the result and start the flusher.
+ */
+int
+iod_wal_open(struct iod_cont *cont)
+{
+	struct iod_wal	*wal;
+	struct stat	st;
+	char		path[PATH_MAX];
+	uint64_t	nr = 0;
+	int		rc;
+	int		fd;
+
+	if (!iod_env.ie_wal)
+		return 0;
+	rc = iod_wal_path(cont, path);
+	if (rc != 0)
+		return rc;
+	fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+		return -errno;
+	rc = fstat(fd, &st) == 0 ? 0 : -errno;
+	if (rc == 0 && st.st_size > 0)
+		rc = iod_wal_replay(cont, fd, st.st_size, &nr);
+	if (rc == 0 && nr > 0)
+		rc = iod_wal_sync_objs(cont);
+	if (rc == 0 && nr > 0)
+		rc = iod_meta_save(cont);
+	if (rc == 0 && st.st_size > 0 &&
+	    (ftruncate(fd, 0) != 0 || fdatasync(fd) != 0))
+		rc = -errno;
+	if (rc != 0) {
+		close(fd);
+		return rc;
+	}
+
+	wal = calloc(1, sizeof(*wal));
+	if (wal == NULL) {
+		close(fd);
+		return -ENOMEM;
+	}
+	pthread_mutex_init(&wal->wl_lock, NULL);
+	pthread_cond_init(&wal->wl_cond, NULL);
+	pthread_cond_init(&wal->wl_done, NULL);
+	wal->wl_fd = fd;
+	wal->wl_open = 1;
+	rc = -pthread_create(&wal->wl_thread, NULL, iod_wal_flusher, wal);
+	if (rc != 0) {
+		pthread_cond_destroy(&wal->wl_done);
+		pthread_cond_destroy(&wal->wl_cond);
+		pthread_mutex_destroy(&wal->wl_lock);
+		close(fd);
+		free(wal);
+		return rc;
+	}
+	cont->ic_wal = wal;
+	return 0;
+}
+
+/**
+ * Flush and stop the log of \a cont. Once the container was \a checkpointed
+ * the log holds nothing the checkpoint lacks and is emptied.
+ */
+void
+iod_wal_close(struct iod_cont *cont, int checkpointed)
+{
+	struct iod_wal	*wal = cont->ic_wal;
+
+	if (wal == NULL)
+		return;
+	pthread_mutex_lock(&wal->wl_lock);
+	wal->wl_stop = 1;
+	pthread_cond_signal(&wal->wl_cond);
+	pthread_mutex_unlock(&wal->wl_lock);
+	pthread_join(wal->wl_thread, NULL);
+
+	if (checkpointed && iod_wal_sync_objs(cont) == 0 &&
+	    ftruncate(wal->wl_fd, 0) == 0)
+		fdatasync(wal->wl_fd);
+	close(wal->wl_fd);
+	free(wal->wl_buf.wb_data);
+	free(wal->wl_spare.wb_data);
+	pthread_cond_destroy(&wal->wl_done);
+	pthread_cond_destroy(&wal->wl_cond);
+	pthread_mutex_destroy(&wal->wl_lock);
+	free(wal);
+	cont->ic_wal = NULL;
+}